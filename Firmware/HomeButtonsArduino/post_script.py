@@ -1,4 +1,5 @@
 import os
+import re
 import zipfile
 
 Import("env")
@@ -26,9 +27,79 @@ def create_partitions_csv():
     print(f"{part_csv_path} created successfully.")
 
 
+MEMORY_SECTIONS = {
+    ".dram0.data": "DRAM",
+    ".dram0.bss": "DRAM",
+    ".noinit": "DRAM",
+    ".rtc.data": "RTC",
+    ".rtc.bss": "RTC",
+    ".rtc_noinit": "RTC",
+}
+MEMORY_REPORT_ROWS = 20
+
+
+def _module_name(path):
+    # libfoo.a(bar.o) -> libfoo.a, .../src/display.cpp.o -> display.cpp
+    if "(" in path:
+        return os.path.basename(path[:path.index("(")])
+    name = os.path.basename(path)
+    return name[:-2] if name.endswith(".o") else name
+
+
+def memory_report():
+    """Prints static RAM use by module and the task stack budget."""
+    map_path = os.path.join(env.subst("$BUILD_DIR"), "firmware.map")
+    if not os.path.isfile(map_path):
+        print("No linker map, skipping memory report")
+        return
+    usage = {}  # (region, module) -> bytes
+    section = None
+    pending = None  # input section name wrapped to the next line
+    with open(map_path, errors="replace") as f:
+        for line in f:
+            if line.startswith("."):
+                section = line.split()[0]
+                pending = None
+                continue
+            if section not in MEMORY_SECTIONS or not line.startswith(" "):
+                continue
+            fields = line.split()
+            if pending is not None:
+                fields = [pending] + fields
+                pending = None
+            if len(fields) == 1 and fields[0].startswith("."):
+                pending = fields[0]
+                continue
+            if len(fields) < 4 or not fields[1].startswith("0x"):
+                continue
+            size = int(fields[2], 16)
+            if size == 0:
+                continue
+            key = (MEMORY_SECTIONS[section], _module_name(" ".join(fields[3:])))
+            usage[key] = usage.get(key, 0) + size
+
+    print("Static RAM by module:")
+    for region in sorted({region for region, _ in usage}):
+        rows = sorted(((size, module) for (r, module), size in usage.items()
+                       if r == region), reverse=True)
+        print(f"  {region}: {sum(size for size, _ in rows)} bytes")
+        for size, module in rows[:MEMORY_REPORT_ROWS]:
+            print(f"    {size:8d}  {module}")
+
+    # peak use is logged at runtime ("stack used/size") and published in
+    # the diagnostics topic
+    with open(os.path.join("src", "config.h")) as f:
+        stacks = re.findall(
+            r"constexpr uint32_t (\w+)_TASK_STACK = (\d+);", f.read())
+    print("Task stacks (static): " + ", ".join(
+        f"{name} {size}" for name, size in stacks) +
+        f", total {sum(int(size) for _, size in stacks)} bytes")
+
+
 def post_build(source, target, env):
     print("#### POST BUILD ####")
     create_partitions_csv()
+    memory_report()
     files = [os.path.join(env.subst("$BUILD_DIR"), file) for file in files_to_zip]
     create_zip(files, os.path.join(env.subst("$BUILD_DIR"), zip_filename))
 
@@ -1,6 +1,8 @@
 #!/usr/bin/env python
 
 import os
+import subprocess
+import sys
 
 sdkconfig_files = ["sdkconfig.release", "sdkconfig.debug", "sdkconfig.mini_release", "sdkconfig.mini_debug"]
 
@@ -17,6 +19,16 @@ def delete_sdkconfig_files():
                 print("Deleted {}".format(file))
 
 
+def generate_builtin_icons():
+    print("Generating built-in icons...")
+    try:
+        subprocess.run([sys.executable, os.path.join("tools", "gen_builtin_icons.py")], check=True)
+    except Exception as e:
+        # not fatal, icons are downloaded at runtime instead
+        print("Failed to generate built-in icons: {}".format(e))
+
+
 print("#### PRE SCRIPT ####")
 delete_sdkconfig_files()
+generate_builtin_icons()
 print("#### PRE SCRIPT DONE ####")
@@ -1,34 +1,84 @@
 #include "app.h"
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
 #include <esp_task_wdt.h>
 #include <SPIFFS.h>
 #include "esp_ota_ops.h"
+#include "esp_system.h"
 
 #include "config.h"
 #include "factory.h"
 #include "setup.h"
 #include "hardware.h"
 
+#include "log_ring.h"
 #include "mdi_helper.h"
+#include "metrics.h"
+#include "net_timeouts.h"
+#include "power.h"
+#include "press_outbox.h"
+#include "sensor_log.h"
+#include "state_cache.h"
+#include "timesync.h"
+#include "trace.h"
+#include "wake_schedule.h"
 
 extern "C" bool verifyRollbackLater() { return true; }
 
+namespace {
+
+// Publishes lines of text packed into as few messages as possible.
+class LinePublisher {
+ public:
+  LinePublisher(Network& network, const TopicType& topic)
+      : network_(network), topic_(topic) {}
+
+  void add(const char* line) {
+    if (payload_.length() + strlen(line) + 1 > MQTT_PYLD_SIZE) {
+      flush();
+    }
+    if (!payload_.empty()) {
+      payload_ += '\n';
+    }
+    payload_ += line;
+  }
+
+  void flush() {
+    if (!payload_.empty()) {
+      network_.publish(topic_, payload_);
+      payload_ = "";
+    }
+  }
+
+ private:
+  Network& network_;
+  TopicType topic_;
+  PayloadType payload_;
+};
+
+}  // namespace
+
 App::App()
     : AppStateMachine("AppSM", *this),
       Logger("APP"),
       network_(device_state_),
       display_(device_state_, mdi_),
-      mqtt_(device_state_, network_) {}
+      mqtt_(device_state_, network_),
+      icon_receiver_(mdi_) {}
 
 void App::setup() {
   info("starting...");
-  xTaskCreate(_main_task_helper,  // Function that should be called
-              "MAIN",             // Name of the task (for debugging)
-              10000,              // Stack size (bytes)
-              this,               // Parameter to pass
-              tskIDLE_PRIORITY,   // Task priority
-              &main_task_h_       // Task handle
+  power::begin();
+  log_ring::start_printer();
+  metrics::wakeup();
+  state_cache::wakeup();
+  wake_schedule::wakeup();
+  net_timeouts::wakeup();
+  main_task_.start(_main_task_helper,  // Function that should be called
+                   "MAIN",             // Name of the task (for debugging)
+                   this,               // Parameter to pass
+                   tskIDLE_PRIORITY    // Task priority
   );
   debug("main task started.");
 
@@ -39,19 +89,24 @@ void App::_start_esp_sleep() {
   esp_sleep_enable_ext1_wakeup(hw_.WAKE_BITMASK, ESP_EXT1_WAKEUP_ANY_HIGH);
   if (device_state_.persisted().wifi_done &&
       device_state_.persisted().setup_done &&
-      !device_state_.persisted().low_batt_mode &&
-      !device_state_.persisted().check_connection) {
+      !device_state_.persisted().low_batt_mode) {
     if (device_state_.persisted().info_screen_showing) {
-      esp_sleep_enable_timer_wakeup(INFO_SCREEN_DISP_TIME * 1000UL);
-    } else if (device_state_.flags().schedule_wakeup_time > 0) {
-      esp_sleep_enable_timer_wakeup(device_state_.flags().schedule_wakeup_time *
-                                    1000000UL);
+      wake_schedule::set(wake_schedule::Source::INFO_SCREEN,
+                         INFO_SCREEN_DISP_TIME / 1000);
     } else {
-      esp_sleep_enable_timer_wakeup(device_state_.sensor_interval() *
-                                    60000000UL);
+      wake_schedule::clear(wake_schedule::Source::INFO_SCREEN);
     }
+    wake_schedule::every(wake_schedule::Source::SENSOR,
+                         device_state_.sensor_interval() * 60);
+    uint64_t sleep_time = wake_schedule::sleep_time_us();
+    if (sleep_time > 0) esp_sleep_enable_timer_wakeup(sleep_time);
   }
+  mdi_.end();
+  metrics::observe(metrics::Histogram::WAKE_TIME_MS, millis());
+  power::record_cpu_stats();
   info("deep sleep... z z z");
+  log_ring::flush();
+  trace::dump();
   esp_deep_sleep_start();
 }
 
@@ -89,27 +144,42 @@ std::pair<BootCause, int16_t> App::_determine_boot_cause() {
 }
 
 void App::_log_stack_status() const {
-  uint32_t btns_free = uxTaskGetStackHighWaterMark(button_task_h_);
-  uint32_t disp_free = uxTaskGetStackHighWaterMark(display_task_h_);
-  uint32_t net_free = uxTaskGetStackHighWaterMark(network_task_h_);
-  uint32_t leds_free = uxTaskGetStackHighWaterMark(leds_task_h_);
-  uint32_t main_free = uxTaskGetStackHighWaterMark(main_task_h_);
-  uint32_t num_tasks = uxTaskGetNumberOfTasks();
+  // stack budget: peak use vs. statically allocated size
+  auto used = [](const auto& task) {
+    return task.started() ? task.stack_size() - task.stack_free() : 0;
+  };
   info(
-      "free stack: btns %d, disp %d, net %d, leds %d, main "
-      "%d, num tasks %d",
-      btns_free, disp_free, net_free, leds_free, main_free, num_tasks);
+      "stack used/size: btns %u/%u, disp %u/%u, net %u/%u, leds %u/%u, main "
+      "%u/%u, num tasks %u",
+      used(button_task_), button_task_.stack_size(), used(display_task_),
+      display_task_.stack_size(), used(network_task_),
+      network_task_.stack_size(), used(leds_task_), leds_task_.stack_size(),
+      used(main_task_), main_task_.stack_size(), uxTaskGetNumberOfTasks());
   uint32_t esp_free_heap = ESP.getFreeHeap();
   uint32_t esp_min_free_heap = ESP.getMinFreeHeap();
   uint32_t rtos_free_heap = xPortGetFreeHeapSize();
   info("free heap: esp %d, esp min %d, rtos %d", esp_free_heap,
        esp_min_free_heap, rtos_free_heap);
+  metrics::set(metrics::Gauge::FREE_HEAP, esp_free_heap);
+  metrics::set(metrics::Gauge::MIN_FREE_HEAP, esp_min_free_heap);
 }
 
 void App::_button_task(void* param) {
   App* app = static_cast<App*>(param);
+  bool press_in_progress = false;
+  bool press_locked = false;
   while (true) {
     app->button_handler_.update();
+    bool in_progress = app->button_handler_.is_press_in_progress();
+    if (in_progress && !press_in_progress) {
+      app->post(AppEvent::BUTTON_PRESS);
+      // multi-presses need the edge interrupts
+      press_locked = power::acquire(power::Lock::BUTTONS);
+    } else if (!in_progress && press_in_progress && press_locked) {
+      power::release(power::Lock::BUTTONS);
+      press_locked = false;
+    }
+    press_in_progress = in_progress;
     delay(20);
   }
 }
@@ -118,7 +188,7 @@ void App::_leds_task(void* param) {
   App* app = static_cast<App*>(param);
   while (true) {
     app->leds_.update(app->hw_);
-    delay(100);
+    app->leds_.wait();
   }
 }
 
@@ -126,7 +196,7 @@ void App::_display_task(void* param) {
   App* app = static_cast<App*>(param);
   while (true) {
     app->display_.update();
-    delay(50);
+    app->display_.wait();
   }
 }
 
@@ -135,59 +205,50 @@ void App::_network_task(void* param) {
   app->network_.setup();
   while (true) {
     app->network_.update();
-    delay(10);
   }
 }
 
 void App::_start_button_task() {
-  if (button_task_h_ != nullptr) return;
+  if (button_task_.started()) return;
   debug("button task started.");
-  xTaskCreate(
+  button_task_.start(
       _button_task,  // Function that should be called
       "BUTTON",      // Name of the task (for debugging)
-      2000,          // Stack size (bytes)
       this,          // Parameter to pass
-      23,            // Task priority, using same as wifi driver:
-           // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-guides/performance/speed.html
-      &button_task_h_  // Task handle
+      23  // Task priority, using same as wifi driver:
+          // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-guides/performance/speed.html
   );
 }
 
 void App::_start_display_task() {
-  if (display_task_h_ != nullptr) return;
+  if (display_task_.started()) return;
   debug("m_display task started.");
-  xTaskCreate(_display_task,    // Function that should be called
-              "DISPLAY",        // Name of the task (for debugging)
-              5000,             // Stack size (bytes)
-              this,             // Parameter to pass
-              1,                // Task priority
-              &display_task_h_  // Task handle
+  display_task_.start(_display_task,  // Function that should be called
+                      "DISPLAY",      // Name of the task (for debugging)
+                      this,           // Parameter to pass
+                      1               // Task priority
   );
 }
 
 void App::_start_network_task() {
-  if (network_task_h_ != nullptr) return;
+  if (network_task_.started()) return;
   debug("network task started.");
-  xTaskCreate(_network_task,    // Function that should be called
-              "NETWORK",        // Name of the task (for debugging)
-              15000,            // Stack size (bytes)
-              this,             // Parameter to pass
-              1,                // Task priority
-              &network_task_h_  // Task handle
+  network_task_.start(_network_task,  // Function that should be called
+                      "NETWORK",      // Name of the task (for debugging)
+                      this,           // Parameter to pass
+                      1               // Task priority
   );
 }
 
 void App::_start_leds_task() {
-  if (leds_task_h_ != nullptr) return;
+  if (leds_task_.started()) return;
   debug("leds task started.");
-  xTaskCreate(
+  leds_task_.start(
       &_leds_task,  // Function that should be called
       "LEDS",       // Name of the task (for debugging)
-      2000,         // Stack size (bytes)
       this,         // Parameter to pass
-      23,           // Task priority, using same as wifi driver:
-           // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-guides/performance/speed.html
-      &leds_task_h_  // Task handle
+      23  // Task priority, using same as wifi driver:
+          // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-guides/performance/speed.html
   );
 }
 
@@ -398,14 +459,13 @@ void App::_main_task() {
         display_.update();
       }
 
-      // format SPIFFS if needed
-      if (!SPIFFS.begin()) {
+      // format SPIFFS if needed, stays mounted for the rest of the wakeup
+      if (!mdi_.begin()) {
         info("Formatting icon storage...");
         display_.disp_message("Formatting\nIcon\nStorage...", 0);
         display_.update();
-        SPIFFS.format();
+        mdi_.format();
       } else {
-        SPIFFS.end();
         debug("SPIFFS test mount OK");
       }
 
@@ -456,6 +516,21 @@ void App::_main_task() {
     case BootCause::TIMER: {
       if (device_state_.flags().awake_mode) {
         // proceed with awake mode
+      } else if (!wake_schedule::due(wake_schedule::Source::SENSOR) &&
+                 !wake_schedule::due(wake_schedule::Source::SCHEDULED) &&
+                 !wake_schedule::due(wake_schedule::Source::RETRY)) {
+        // only the info screen timed out
+        device_state_.persisted().info_screen_showing = false;
+        display_.disp_main();
+        display_.update();
+        display_.end();
+        display_.update();
+        _go_to_sleep();
+      } else if (_sample_only_wake()) {
+        // nothing to upload or show, back to sleep without the radio
+        display_.end();
+        display_.update();
+        _start_esp_sleep();
       } else {
         if (device_state_.persisted().info_screen_showing) {
           device_state_.persisted().info_screen_showing = false;
@@ -516,42 +591,179 @@ void App::_main_task() {
   network_.set_mqtt_callback(std::bind(&App::_mqtt_callback, this,
                                        std::placeholders::_1,
                                        std::placeholders::_2));
+  network_.set_mqtt_raw_callback(
+      std::bind(&App::_mqtt_raw_callback, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3,
+                std::placeholders::_4));
   network_.set_on_connect(std::bind(&App::_net_on_connect, this));
+  network_.set_topic_id_lookup(
+      std::bind(&App::_mqttsn_topic_id, this, std::placeholders::_1));
 
   debug("Starting main loop");
   while (true) {
-    loop();
+    // polled states run every 10 ms, event driven ones sleep until an event
+    // or timer, at the latest for the watchdog
+    run(10, WDT_TIMEOUT_AWAKE * 1000 / 2);
     esp_task_wdt_reset();
-    delay(10);
   }
 }
 
 void App::_publish_sensors() {
-  network_.publish(mqtt_.t_temperature(),
-                   PayloadType("%.2f", device_state_.sensors().temperature));
-  network_.publish(mqtt_.t_humidity(),
-                   PayloadType("%.2f", device_state_.sensors().humidity));
-  network_.publish(mqtt_.t_battery(),
-                   PayloadType("%u", device_state_.sensors().battery_pct));
+  if (device_state_.combined_sensors()) {
+    // keys as in the sensor history
+    network_.publish(
+        mqtt_.t_sensors(),
+        PayloadType(R"({"temp":%.2f,"hum":%.2f,"batt":%u})",
+                    device_state_.sensors().temperature,
+                    device_state_.sensors().humidity,
+                    device_state_.sensors().battery_pct));
+  } else {
+    network_.publish(mqtt_.t_temperature(),
+                     PayloadType("%.2f", device_state_.sensors().temperature));
+    network_.publish(mqtt_.t_humidity(),
+                     PayloadType("%.2f", device_state_.sensors().humidity));
+    network_.publish(mqtt_.t_battery(),
+                     PayloadType("%u", device_state_.sensors().battery_pct));
+  }
+  // samples stay in the log until delivered, the ones already sent during
+  // this wake aren't sent again
+  static_assert(sensor_log::MAX_JSON_LEN < MQTT_PYLD_SIZE,
+                "sensor history message doesn't fit");
+  uint8_t count = sensor_log::count();
+  uint8_t sent = sensor_log::sent_count();
+  time_t now = time(nullptr);
+  while (sent < count) {
+    char buffer[MQTT_PYLD_SIZE];
+    if (sensor_log::to_json(sent, now, buffer, sizeof(buffer)) == 0 ||
+        !network_.publish(mqtt_.t_sensor_history(), buffer)) {
+      warning("sensor history not queued, %u samples kept", count - sent);
+      break;
+    }
+    sent = std::min<uint8_t>(count, sent + sensor_log::JSON_SAMPLES);
+    sensor_log::sent(sent);
+  }
+}
+
+// Publishes the presses that didn't go out on earlier wakes, see
+// press_outbox.h. They stay in the outbox until delivered, a reconnect
+// during the same wake doesn't send them again.
+void App::_replay_presses() {
+  if (presses_replayed_) return;
+  presses_replayed_ = true;
+  press_outbox::Press presses[PRESS_OUTBOX_ENTRIES];
+  uint8_t n = press_outbox::peek(presses);
+  if (n == 0) return;
+  // {"t":[unix s],"btn":[..],"act":[..]}, presses without a valid time are
+  // left out
+  StaticJsonDocument<512> doc;
+  JsonArray times = doc.createNestedArray("t");
+  JsonArray buttons = doc.createNestedArray("btn");
+  JsonArray actions = doc.createNestedArray("act");
+  for (uint8_t i = 0; i < n; i++) {
+    auto action = static_cast<Button::ButtonAction>(presses[i].action);
+    ButtonEvent event{presses[i].button, action};
+    network_.publish(mqtt_.get_button_topic(event), BTN_PRESS_PAYLOAD);
+    metrics::inc(metrics::Counter::BUTTON_PRESSES);
+    if (!presses[i].time_valid) continue;
+    times.add(presses[i].time);
+    buttons.add(presses[i].button);
+    actions.add(Button::get_action_name(action));
+  }
+  char buffer[MQTT_PYLD_SIZE];
+  if (times.size() > 0 && measureJson(doc) < sizeof(buffer)) {
+    serializeJson(doc, buffer, sizeof(buffer));
+    network_.publish(mqtt_.t_button_history(), buffer);
+  }
+  replayed_presses_ = n;
+  info("replayed %u presses", n);
+}
+
+// Removes the replayed presses from the outbox once the broker has them.
+void App::_presses_delivered() {
+  if (replayed_presses_ == 0 || !network_.delivered()) return;
+  uint8_t n = replayed_presses_.exchange(0);
+  press_outbox::remove(n);
+  debug("%u presses delivered", n);
+}
+
+// Removes the sent sensor samples from the log once the broker has them.
+void App::_samples_delivered() {
+  // read first, samples sent after it are not delivered yet
+  uint8_t n = sensor_log::sent_count();
+  if (n == 0 || !network_.delivered()) return;
+  sensor_log::delivered(n);
+  debug("%u sensor samples delivered", n);
+}
+
+// Adds the current readings to the batch, if batching or while connecting
+// fails, so they are uploaded later.
+void App::_record_sample() {
+  if ((device_state_.sensor_batch() <= 1 && net_timeouts::failures() == 0) ||
+      sample_recorded_) {
+    return;
+  }
+  sample_recorded_ = true;
+  sensor_log::add(device_state_.sensors().temperature,
+                  device_state_.sensors().humidity,
+                  device_state_.sensors().battery_pct, time(nullptr));
+}
+
+// Records the sample on a timer wake. Returns true if the batch isn't due or
+// connecting is backed off, and nothing needs to be shown or sent, so the
+// radio can stay off.
+bool App::_sample_only_wake() {
+  if (wake_schedule::due(wake_schedule::Source::SCHEDULED) ||
+      press_outbox::pending() ||
+      device_state_.persisted().info_screen_showing ||
+      (hw_.is_charger_in_standby() &&
+       !device_state_.persisted().charge_complete_showing)) {
+    return false;
+  }
+  if (!net_timeouts::attempt_due()) {
+    _record_sample();
+    info("%u failed connects, not connecting", net_timeouts::failures());
+    return true;
+  }
+  if (wake_schedule::due(wake_schedule::Source::RETRY) ||
+      device_state_.sensor_batch() <= 1) {
+    return false;
+  }
+  _record_sample();
+  if (sensor_log::upload_due(device_state_.sensor_batch())) return false;
+  info("sample %u of %u, not uploading", sensor_log::count(),
+       device_state_.sensor_batch());
+  return true;
 }
 
 void App::_publish_awake_mode_avlb() {
   if (hw_.is_dc_connected()) {
-    network_.publish(mqtt_.t_awake_mode_avlb(), "online", true);
+    network_.publish_state(mqtt_.t_awake_mode_avlb(), "online");
   } else {
-    network_.publish(mqtt_.t_awake_mode_avlb(), "offline", true);
+    network_.publish_state(mqtt_.t_awake_mode_avlb(), "offline");
   }
 }
 
 void App::_mqtt_callback(const char* topic, const char* payload) {
+  if (strcmp(topic, mqtt_.t_sync().c_str()) == 0) {
+    // echoes from earlier connections have another nonce
+    if (sync_pending_ && strtoul(payload, nullptr, 10) == sync_nonce_) {
+      uint32_t latency = millis() - sync_start_time_;
+      debug("commands synced in %lu ms", latency);
+      metrics::observe(metrics::Histogram::SYNC_MS, latency);
+      sync_pending_ = false;
+    }
+    return;
+  }
+
   if (strcmp(topic, mqtt_.t_sensor_interval_cmd().c_str()) == 0) {
     uint16_t mins = atoi(payload);
     if (mins >= SEN_INTERVAL_MIN && mins <= SEN_INTERVAL_MAX) {
       device_state_.set_sensor_interval(mins);
       device_state_.save_all();
-      network_.publish(mqtt_.t_sensor_interval_state(),
-                       PayloadType("%u", device_state_.sensor_interval()),
-                       true);
+      wake_schedule::set(wake_schedule::Source::SENSOR, mins * 60);
+      network_.publish_state(
+          mqtt_.t_sensor_interval_state(),
+          PayloadType("%u", device_state_.sensor_interval()));
       info("Updating discovery config...");
       mqtt_.update_discovery_config();
       debug("sensor interval set to %d minutes", mins);
@@ -561,6 +773,36 @@ void App::_mqtt_callback(const char* topic, const char* payload) {
     return;
   }
 
+  if (strcmp(topic, mqtt_.t_sensor_batch_cmd().c_str()) == 0) {
+    uint16_t batch = atoi(payload);
+    if (batch >= 1 && batch <= SEN_BATCH_MAX) {
+      device_state_.set_sensor_batch(batch);
+      device_state_.save_all();
+      network_.publish_state(mqtt_.t_sensor_batch_state(),
+                             PayloadType("%u", device_state_.sensor_batch()));
+      info("Updating discovery config...");
+      mqtt_.update_discovery_config();
+      debug("sensor batch set to %d samples", batch);
+    }
+    network_.publish(mqtt_.t_sensor_batch_cmd(), "", true);
+    return;
+  }
+
+  if (strcmp(topic, mqtt_.t_combined_sensors_cmd().c_str()) == 0) {
+    if (strcmp(payload, "ON") == 0 || strcmp(payload, "OFF") == 0) {
+      bool combined = strcmp(payload, "ON") == 0;
+      device_state_.set_combined_sensors(combined);
+      device_state_.save_all();
+      network_.publish_state(mqtt_.t_combined_sensors_state(), payload);
+      info("Updating discovery config...");
+      mqtt_.update_discovery_config();
+      _publish_sensors();
+      debug("combined sensor state set to: %s", payload);
+    }
+    network_.publish(mqtt_.t_combined_sensors_cmd(), "", true);
+    return;
+  }
+
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
     if (strcmp(topic, mqtt_.t_btn_label_cmd(i).c_str()) == 0) {
       ButtonLabel new_label(payload);
@@ -568,15 +810,13 @@ void App::_mqtt_callback(const char* topic, const char* payload) {
       debug("button %d label changed to: %s", i + 1, new_label.c_str());
       device_state_.set_btn_label(i, new_label.c_str());
 
-      network_.publish(mqtt_.t_btn_label_state(i),
-                       device_state_.get_btn_label(i), true);
+      network_.publish_state(mqtt_.t_btn_label_state(i),
+                             device_state_.get_btn_label(i));
       network_.publish(mqtt_.t_btn_label_cmd(i), "", true);
       device_state_.flags().display_redraw = true;
       device_state_.save_all();
 
-      ButtonLabel label(device_state_.get_btn_label(i).c_str());
-
-      if (label.substring(0, 4) == "mdi:") {
+      if (device_state_.get_btn_label_desc(i).has_icon()) {
         device_state_.persisted().download_mdi_icons = true;
       }
       return;
@@ -588,13 +828,13 @@ void App::_mqtt_callback(const char* topic, const char* payload) {
       device_state_.persisted().user_awake_mode = true;
       device_state_.flags().awake_mode = true;
       device_state_.save_all();
-      network_.publish(mqtt_.t_awake_mode_state(), "ON", true);
+      network_.publish_state(mqtt_.t_awake_mode_state(), "ON");
       debug("user awake mode set to: ON");
       debug("resetting to awake mode...");
     } else if (strcmp(payload, "OFF") == 0) {
       device_state_.persisted().user_awake_mode = false;
       device_state_.save_all();
-      network_.publish(mqtt_.t_awake_mode_state(), "OFF", true);
+      network_.publish_state(mqtt_.t_awake_mode_state(), "OFF");
       debug("user awake mode set to: OFF");
     }
     network_.publish(mqtt_.t_awake_mode_cmd(), "", true);
@@ -610,14 +850,51 @@ void App::_mqtt_callback(const char* topic, const char* payload) {
       display_.disp_message_large(msg.c_str());
     }
     network_.publish(mqtt_.t_disp_msg_cmd(), "", true);
-    network_.publish(mqtt_.t_disp_msg_state(), "-", false);
+    network_.publish_state(mqtt_.t_disp_msg_state(), "-");
+  }
+
+  if (strcmp(topic, mqtt_.t_icon_source_cmd().c_str()) == 0) {
+    IconSource url(payload);
+    url = url.trim();
+    if (url.empty() || url.substring(0, 7) == "http://" ||
+        url.substring(0, 8) == "https://") {
+      device_state_.set_icon_source(url.c_str());
+      device_state_.save_all();
+      mdi_.set_source(url.c_str());
+      info("icon source set to: %s",
+           url.empty() ? "default" : url.c_str());
+    } else {
+      warning("invalid icon source: %s", url.c_str());
+    }
+    network_.publish_state(mqtt_.t_icon_source_state(),
+                           device_state_.icon_source());
+    network_.publish(mqtt_.t_icon_source_cmd(), "", true);
+    return;
+  }
+
+  if (strcmp(topic, mqtt_.t_log_cmd().c_str()) == 0) {
+    if (strlen(payload) > 0) {
+      _publish_log(strcmp(payload, "raw") == 0);
+      network_.publish(mqtt_.t_log_cmd(), "", true);
+    }
+    return;
+  }
+
+  if (strcmp(topic, mqtt_.t_trace_cmd().c_str()) == 0) {
+    if (strlen(payload) > 0) {
+      _publish_trace();
+      network_.publish(mqtt_.t_trace_cmd(), "", true);
+    }
+    return;
   }
 
   // schedule wakeup cmd
   if (strcmp(topic, mqtt_.t_schedule_wakeup_cmd().c_str()) == 0) {
     uint32_t secs = atoi(payload);
     if (secs >= SCHEDULE_WAKEUP_MIN && secs <= SCHEDULE_WAKEUP_MAX) {
-      device_state_.flags().schedule_wakeup_time = secs;
+      wake_schedule::set(wake_schedule::Source::SCHEDULED, secs);
+      // the scheduled wake connects even if the batch isn't full
+      sensor_log::force_upload();
       network_.publish(mqtt_.t_schedule_wakeup_cmd(), "", true);
       network_.publish(mqtt_.t_schedule_wakeup_state(), "None", true);
       debug("schedule wakeup set to %d seconds", secs);
@@ -625,43 +902,149 @@ void App::_mqtt_callback(const char* topic, const char* payload) {
   }
 }
 
+bool App::_mqtt_raw_callback(const char* topic, const uint8_t* payload,
+                             uint32_t length, uint32_t offset) {
+  if (strcmp(topic, mqtt_.t_icon_cmd().c_str()) != 0) {
+    return false;
+  }
+  switch (icon_receiver_.handle_chunk(payload, length, offset)) {
+    case IconReceiver::Result::IN_PROGRESS:
+      break;
+    case IconReceiver::Result::DONE:
+      network_.publish(mqtt_.t_icon_state(),
+                       PayloadType("%s %u OK", icon_receiver_.name().c_str(),
+                                   icon_receiver_.size()));
+      device_state_.flags().display_redraw = true;
+      break;
+    case IconReceiver::Result::ERROR:
+      network_.publish(mqtt_.t_icon_state(),
+                       PayloadType("%s %u ERROR", icon_receiver_.name().c_str(),
+                                   icon_receiver_.size()));
+      break;
+  }
+  return true;
+}
+
+// Button topics have predefined MQTT-SN topic ids, 4 per button in the order
+// single, double, triple, quad, starting at MQTTSN_BTN_TOPIC_ID.
+uint16_t App::_mqttsn_topic_id(const char* topic) {
+  TopicType common = mqtt_.t_common();
+  if (strncmp(topic, common.c_str(), common.length()) != 0) return 0;
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    for (uint8_t action = Button::SINGLE; action <= Button::QUAD; action++) {
+      ButtonEvent event{static_cast<uint16_t>(i + 1),
+                        static_cast<Button::ButtonAction>(action)};
+      if (strcmp(topic, mqtt_.get_button_topic(event).c_str()) == 0) {
+        return MQTTSN_BTN_TOPIC_ID + i * 4 + action - Button::SINGLE;
+      }
+    }
+  }
+  return 0;
+}
+
 void App::_net_on_connect() {
-  network_.subscribe(mqtt_.t_cmd() + "#");
+  // every time, subscribing is what makes the broker deliver the retained
+  // commands. The nonce goes out after the SUBSCRIBE on the same connection,
+  // so its echo comes after them.
+  if (network_.subscribe(mqtt_.t_cmd() + "#")) {
+    _start_sync();
+  } else {
+    warning("not subscribed, no commands this time");
+    sync_pending_ = false;
+  }
+  _replay_presses();
+  // only the states that changed since the last wake are sent
   _publish_awake_mode_avlb();
-  network_.publish(mqtt_.t_sensor_interval_state(),
-                   PayloadType("%u", device_state_.sensor_interval()), true);
+  network_.publish_state(mqtt_.t_sensor_interval_state(),
+                         PayloadType("%u", device_state_.sensor_interval()));
+  network_.publish_state(mqtt_.t_sensor_batch_state(),
+                         PayloadType("%u", device_state_.sensor_batch()));
+  network_.publish_state(mqtt_.t_combined_sensors_state(),
+                         device_state_.combined_sensors() ? "ON" : "OFF");
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
     auto t = mqtt_.t_btn_label_state(i);
-    network_.publish(t, device_state_.get_btn_label(i), true);
+    network_.publish_state(t, device_state_.get_btn_label(i));
   }
-  network_.publish(mqtt_.t_awake_mode_state(),
-                   (device_state_.persisted().user_awake_mode) ? "ON" : "OFF",
-                   true);
-  network_.publish(mqtt_.t_disp_msg_state(), "-", false);
+  network_.publish_state(
+      mqtt_.t_awake_mode_state(),
+      (device_state_.persisted().user_awake_mode) ? "ON" : "OFF");
+  network_.publish_state(mqtt_.t_disp_msg_state(), "-");
+  network_.publish_state(mqtt_.t_icon_source_state(),
+                         device_state_.icon_source());
 
   if (device_state_.persisted().send_discovery_config) {
     device_state_.persisted().send_discovery_config = false;
     info("Sending discovery config...");
     mqtt_.send_discovery_config();
   }
+
+  if (metrics::publish_due()) {
+    _publish_diagnostics();
+  }
+}
+
+// The broker delivers the retained and queued commands before the echo of a
+// publish sent after subscribing, on the same connection. So once the nonce
+// comes back on cmd/sync there is nothing left to wait for. Only meaningful
+// right after a SUBSCRIBE on the current connection.
+void App::_start_sync() {
+  sync_nonce_ = esp_random();
+  sync_start_time_ = millis();
+  sync_pending_ = true;
+  network_.publish(mqtt_.t_sync(),
+                   PayloadType("%lu", static_cast<unsigned long>(sync_nonce_)),
+                   false);
+}
+
+// True once the commands are in, or if the echo doesn't come back within
+// SYNC_TIMEOUT of the sync start.
+bool App::_synced() {
+  if (!sync_pending_) return true;
+  if (millis() - sync_start_time_ > SYNC_TIMEOUT) {
+    warning("no sync echo after %lu ms", SYNC_TIMEOUT);
+    sync_pending_ = false;
+    return true;
+  }
+  return false;
+}
+
+// The radio goes off as soon as the last publish is acknowledged, the panel
+// and the LEDs finish meanwhile.
+void App::_begin_shutdown() {
+  shutdown_.begin();
+  button_handler_.end();
+  leds_.end();
+  network_.disconnect();
+  shutdown_.add("net", [this] {
+    if (network_.get_state() != Network::State::DISCONNECTED) return false;
+    _presses_delivered();
+    _samples_delivered();
+    return true;
+  });
+  shutdown_.add("display", [this] {
+    // commands may ask for a redraw until the radio is off
+    if (device_state_.flags().display_redraw) {
+      device_state_.flags().display_redraw = false;
+      display_.disp_main();
+    }
+    if (!shutdown_.finished("net") || display_.busy()) return false;
+    display_.end();
+    return display_.get_state() == Display::State::IDLE;
+  });
+  shutdown_.add("leds",
+                [this] { return leds_.get_state() == LEDs::State::IDLE; });
+  shutdown_.add("buttons", [this] { return !hw_.any_button_pressed(); });
 }
 
 void App::_download_mdi_icons() {
   bool download_required = false;
-  mdi_.begin();
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    ButtonLabel label(device_state_.get_btn_label(i).c_str());
-    if (label.substring(0, 4) == "mdi:") {
-      MDIName icon;
-      if(label.index_of(';') > 0)
-      {
-        icon = label.substring(label.index_of(';') + 1, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
+    const LabelDescriptor& label = device_state_.get_btn_label_desc(i);
+    if (label.has_icon()) {
+      if (mdi_.builtin_all_sizes(label.icon.c_str())) {
+        continue;
       }
-      else
-      {
-        icon = label.substring(4, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
-      }
-      if (!mdi_.exists_all_sizes(icon.c_str())) {
+      if (!mdi_.exists_all_sizes(label.icon.c_str())) {
         download_required = true;
         break;
       }
@@ -669,7 +1052,6 @@ void App::_download_mdi_icons() {
   }
   if (!download_required) {
     info("no icons to download");
-    mdi_.end();
     return;
   }
 
@@ -680,7 +1062,6 @@ void App::_download_mdi_icons() {
     info("icon server reachable");
   } else {
     warning("icon server NOT reachable");
-    mdi_.end();
     display_.disp_error("Icon\nserver\nNOT\nreachable");
     device_state_.flags().display_redraw = true;
     return;
@@ -693,34 +1074,109 @@ void App::_download_mdi_icons() {
     info("making space...");
     if (!mdi_.make_space(2 * MDI_FREE_SPACE_THRESHOLD)) {
       error("failed to make space");
-      mdi_.end();
       return;
     }
   }
 
   info("Downloading icons...");
+  MDIName missing[NUM_BUTTONS];
+  uint8_t num_missing = 0;
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    ButtonLabel label(device_state_.get_btn_label(i).c_str());
-    if (label.substring(0, 4) == "mdi:") {
-      MDIName icon;
-      if(label.index_of(';') > 0)
-      {
-        icon = label.substring(label.index_of(';') + 1, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
-      }
-      else
-      {
-        icon = label.substring(4, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
-      }
-      if (!mdi_.exists_all_sizes(icon.c_str())) {
-        mdi_.download(icon.c_str());
+    const LabelDescriptor& label = device_state_.get_btn_label_desc(i);
+    if (label.has_icon()) {
+      if (!mdi_.exists_all_sizes(label.icon.c_str())) {
+        missing[num_missing++] = label.icon;
       }
     }
   }
-  mdi_.end();
+  // a mirror serves all icons in one request
+  if (mdi_.has_custom_source()) {
+    mdi_.download_bundle(missing, num_missing);
+  }
+  for (uint8_t i = 0; i < num_missing; i++) {
+    if (!mdi_.exists_all_sizes(missing[i].c_str())) {
+      mdi_.download(missing[i].c_str());
+    }
+  }
   device_state_.flags().display_redraw = true;
 }
 
+// Publishes the log history kept in RTC memory, several lines per message.
+// raw: binary entries as hex for tools/decode_log.py, first line is
+// "HBL1 <firmware id> <boot>", followed by "T <id> <tag>" and
+// "E <entry>" lines.
+void App::_publish_log(bool raw) {
+  LinePublisher publisher(network_, mqtt_.t_log());
+  auto to_hex = [](StaticString<128>& out, const uint8_t* data, size_t len) {
+    static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+      out += HEX_DIGITS[data[i] >> 4];
+      out += HEX_DIGITS[data[i] & 0x0F];
+    }
+  };
+
+  if (raw) {
+    StaticString<128> line("HBL1 ");
+    to_hex(line, log_ring::firmware_id(), log_ring::FIRMWARE_ID_LEN);
+    line += ' ';
+    line += static_cast<int>(log_ring::boot());
+    publisher.add(line.c_str());
+    for (uint8_t i = 0; i < log_ring::num_tags(); i++) {
+      publisher.add(
+          StaticString<16>("T %u %s", i, log_ring::tag_name(i)).c_str());
+    }
+  }
+  size_t count = log_ring::for_each([&](const log_ring::Entry& entry) {
+    StaticString<128> line;
+    if (raw) {
+      line = "E ";
+      to_hex(line, reinterpret_cast<const uint8_t*>(&entry),
+             offsetof(log_ring::Entry, args) + entry.args_len);
+    } else {
+      char text[Logger::MAX_LOG_LINE_SIZE];
+      log_ring::format(entry, text, sizeof(text));
+      line.set("[#%u %6u][%c][%s] %s", entry.boot, entry.timestamp,
+               log_ring::level_to_char(entry.level),
+               log_ring::tag_name(entry.tag), text);
+    }
+    publisher.add(line.c_str());
+  });
+  publisher.flush();
+  info("published %u log entries", count);
+}
+
+void App::_publish_diagnostics() {
+  _log_stack_status();  // updates the heap gauges
+  static_assert(metrics::MAX_JSON_LEN < MQTT_PYLD_SIZE,
+                "diagnostics part doesn't fit");
+  bool ok = true;
+  for (uint8_t part = 0; part < metrics::NUM_PARTS; part++) {
+    char buffer[MQTT_PYLD_SIZE];
+    ok = metrics::to_json(part, buffer, sizeof(buffer)) > 0 &&
+         network_.publish(mqtt_.t_diagnostics(metrics::part_name(part)),
+                          buffer, true) &&
+         ok;
+  }
+  if (!ok) {
+    error("diagnostics not published");
+    return;
+  }
+  metrics::published();
+  debug("diagnostics published");
+}
+
+// Publishes the trace events recorded so far, see trace.h.
+void App::_publish_trace() {
+  LinePublisher publisher(network_, mqtt_.t_trace());
+  size_t count = trace::for_each_line(
+      [&publisher](const char* line) { publisher.add(line); });
+  publisher.flush();
+  info("published %u trace events", count);
+}
+
 void AppSMStates::InitState::entry() {
+  // presses that don't go out wait in the outbox
+  net_timeouts::use_learned(sm().boot_cause_ != BootCause::RESET);
   sm().network_.connect();
 
   sm()._start_button_task();
@@ -734,6 +1190,7 @@ void AppSMStates::InitState::entry() {
 #else
   sm().mdi_.add_size(100);
 #endif
+  sm().mdi_.set_source(sm().device_state_.icon_source().c_str());
 
   if (!sm().device_state_.flags().awake_mode) {
     esp_task_wdt_init(WDT_TIMEOUT_SLEEP, true);
@@ -755,10 +1212,36 @@ void AppSMStates::InitState::entry() {
   }
 }
 
-void AppSMStates::AwakeModeIdleState::entry() { sm().button_handler_.clear(); }
+void AppSMStates::AwakeModeIdleState::entry() {
+  sm().button_handler_.clear();
+  if (!power::light_sleep_enabled() &&
+      power::enable_light_sleep(sm().hw_.WAKE_BITMASK)) {
+    sm().network_.set_light_sleep(true);
+  }
+  // everything except button presses is checked once per redraw interval
+  start_timer(AppEvent::IDLE_TICK, AWAKE_REDRAW_INTERVAL, true);
+}
+
+bool AppSMStates::AwakeModeIdleState::on_event(AppEvent event, uint32_t arg) {
+  switch (event) {
+    case AppEvent::BUTTON_PRESS:
+      // may be stale, the press was already handled
+      if (sm().button_handler_.is_press_in_progress()) {
+        transition_to<UserInputFinishState>();
+      }
+      return true;
+    case AppEvent::IDLE_TICK:
+      _tick();
+      return true;
+  }
+  return false;
+}
 
-void AppSMStates::AwakeModeIdleState::loop() {
+void AppSMStates::AwakeModeIdleState::_tick() {
+  sm()._presses_delivered();
+  sm()._samples_delivered();
   if (sm().button_handler_.is_press_in_progress()) {
+    // the event got lost
     return transition_to<UserInputFinishState>();
   } else if (millis() - sm().last_sensor_publish_ >= AWAKE_SENSOR_INTERVAL) {
     sm().hw_.read_temp_hmd(sm().device_state_.sensors().temperature,
@@ -770,20 +1253,21 @@ void AppSMStates::AwakeModeIdleState::loop() {
     sm()._publish_sensors();
     sm().last_sensor_publish_ = millis();
     sm()._log_stack_status();
-  } else if (millis() - sm().last_m_display_redraw_ >= AWAKE_REDRAW_INTERVAL) {
-    if (sm().device_state_.flags().display_redraw) {
-      sm().device_state_.flags().display_redraw = false;
-      if (sm().device_state_.persisted().download_mdi_icons) {
-        sm()._download_mdi_icons();
-        sm().device_state_.persisted().download_mdi_icons = false;
-      }
-      if (sm().device_state_.persisted().info_screen_showing) {
-        sm().display_.disp_info();
-      } else {
-        sm().display_.disp_main();
-      }
+    int32_t idle_pct = power::idle_pct();
+    sm().info("idle: %d %%", idle_pct);
+    metrics::set(metrics::Gauge::IDLE_PCT, idle_pct);
+    power::record_cpu_stats();
+  } else if (sm().device_state_.flags().display_redraw) {
+    sm().device_state_.flags().display_redraw = false;
+    if (sm().device_state_.persisted().download_mdi_icons) {
+      sm()._download_mdi_icons();
+      sm().device_state_.persisted().download_mdi_icons = false;
+    }
+    if (sm().device_state_.persisted().info_screen_showing) {
+      sm().display_.disp_info();
+    } else {
+      sm().display_.disp_main();
     }
-    sm().last_m_display_redraw_ = millis();
   } else if (sm().device_state_.persisted().info_screen_showing &&
              millis() - sm().info_screen_start_time_ >= INFO_SCREEN_DISP_TIME) {
     sm().display_.disp_main();
@@ -847,6 +1331,7 @@ void AppSMStates::UserInputFinishState::loop() {
                            sm().hw_.LED_BRIGHT_DFLT, false);
           sm().network_.publish(sm().mqtt_.get_button_topic(btn_event),
                                 BTN_PRESS_PAYLOAD);
+          metrics::inc(metrics::Counter::BUTTON_PRESSES);
           return transition_to<AwakeModeIdleState>();
         } else {
           sm().leds_.blink(btn_event.id,
@@ -904,18 +1389,52 @@ void AppSMStates::UserInputFinishState::loop() {
   }
 }
 
+void AppSMStates::NetConnectingState::entry() {
+  press_queued_early_ = false;
+  timeout_ = net_timeouts::timeout(net_timeouts::Phase::CONNECT);
+  if (sm().btn_event_.action == Button::IDLE) return;
+  press_time_ = time(nullptr);
+  timeout_ = std::min(timeout_, PRESS_CONNECT_TIMEOUT);
+  // queued now, it's sent as soon as Wi-Fi is up
+  TopicType topic = sm().mqtt_.get_button_topic(sm().btn_event_);
+  if (sm().network_.publishes_early(topic)) {
+    sm().network_.publish(topic, BTN_PRESS_PAYLOAD);
+    metrics::inc(metrics::Counter::BUTTON_PRESSES);
+    press_queued_early_ = true;
+  }
+}
+
+// Queued early, the press is sent only once the network has sent it, not if
+// Wi-Fi never came up or the early publish failed.
+bool AppSMStates::NetConnectingState::_press_sent() {
+  return press_queued_early_ && sm().network_.early_published() > 0;
+}
+
 void AppSMStates::NetConnectingState::loop() {
-  if (sm().network_.get_state() == Network::State::M_CONNECTED) {
-    if (sm().btn_event_.action != Button::IDLE) {
+  // batched samples need the clock, SNTP gets a moment to set it
+  if (sm().network_.get_state() == Network::State::M_CONNECTED &&
+      (sm().device_state_.sensor_batch() <= 1 || timesync::settled())) {
+    if (sm().btn_event_.action != Button::IDLE && !_press_sent()) {
       sm().network_.publish(sm().mqtt_.get_button_topic(sm().btn_event_),
                             BTN_PRESS_PAYLOAD);
+      if (!press_queued_early_) {
+        metrics::inc(metrics::Counter::BUTTON_PRESSES);
+      }
     }
     sm().hw_.read_temp_hmd(sm().device_state_.sensors().temperature,
                            sm().device_state_.sensors().humidity,
                            sm().device_state_.get_use_fahrenheit());
     sm().device_state_.sensors().battery_pct = sm().hw_.read_battery_percent();
+    sm()._record_sample();
     sm()._publish_sensors();
+    net_timeouts::succeeded(net_timeouts::Phase::CONNECT, millis());
+    net_timeouts::connected();
     sm().device_state_.persisted().failed_connections = 0;
+    if (sm().device_state_.persisted().check_connection) {
+      sm().device_state_.persisted().check_connection = false;
+      sm().display_.disp_main();
+    }
+    wake_schedule::clear(wake_schedule::Source::RETRY);
     return transition_to<CmdShutdownState>();
   } else if (sm().button_handler_.is_press_finished()) {
     // abort on button press
@@ -926,8 +1445,14 @@ void AppSMStates::NetConnectingState::loop() {
       sm().button_handler_.clear();
     }
 
-  } else if (millis() >= NET_CONNECT_TIMEOUT) {
+  } else if (millis() >= timeout_) {
     sm().warning("network connect timeout.");
+    net_timeouts::failed();
+    if (sm().btn_event_.action != Button::IDLE && !_press_sent()) {
+      press_outbox::add(sm().btn_event_.id, sm().btn_event_.action,
+                        press_time_);
+      wake_schedule::set(wake_schedule::Source::RETRY, NET_RETRY_DELAY);
+    }
     if (sm().boot_cause_ == BootCause::BUTTON) {
       sm().display_.disp_error("Network\nconnection\nnot\nsuccessful", 3000);
     } else if (sm().boot_cause_ == BootCause::TIMER) {
@@ -937,14 +1462,41 @@ void AppSMStates::NetConnectingState::loop() {
         sm().device_state_.persisted().failed_connections = 0;
         sm().device_state_.persisted().check_connection = true;
         sm().display_.disp_error("Check\nconnection!");
+      } else if (net_timeouts::failures() == 1) {
+        // later failures back off instead
+        wake_schedule::set(wake_schedule::Source::RETRY, NET_RETRY_DELAY);
       }
     }
     return transition_to<CmdShutdownState>();
   }
 }
 
+bool AppSMStates::MenuState::on_event(AppEvent event, uint32_t arg) {
+  bool awake_mode = sm().device_state_.flags().awake_mode;
+  switch (event) {
+    case AppEvent::MENU_TIMEOUT:
+      // restarted by the menu once the press is finished
+      if (awake_mode || sm().button_handler_.is_press_in_progress()) {
+        return true;
+      }
+      sm().debug("menu timeout");
+      break;
+    case AppEvent::MENU_CLOSE:
+      break;
+    default:
+      return false;
+  }
+  sm().display_.disp_main();
+  if (awake_mode) {
+    transition_to<AwakeModeIdleState>(this);
+  } else {
+    transition_to<CmdShutdownState>(this);
+  }
+  return true;
+}
+
 void AppSMStates::SettingsMenuState::entry() {
-  sm().settings_menu_start_time_ = millis();
+  start_timer(AppEvent::MENU_TIMEOUT, SETTINGS_MENU_TIMEOUT);
   sm().device_state_.persisted().info_screen_showing = false;
   sm().display_.disp_settings();
   // wait until button released. TODO: should be improved
@@ -955,7 +1507,6 @@ void AppSMStates::SettingsMenuState::entry() {
 }
 
 void AppSMStates::SettingsMenuState::loop() {
-  bool awake_mode = sm().device_state_.flags().awake_mode;
   ButtonEvent btn_event = sm().button_handler_.get_event();
   if (sm().button_handler_.is_press_in_progress()) {
     if (sm().button_handler_.is_press_finished()) {
@@ -981,18 +1532,14 @@ void AppSMStates::SettingsMenuState::loop() {
             break;
           case 4:
             // cancel
-            sm().display_.disp_main();
-            if (awake_mode) {
-              return transition_to<AwakeModeIdleState>();
-            } else {
-              return transition_to<CmdShutdownState>();
-            }
-            break;
+            sm().dispatch(AppEvent::MENU_CLOSE, 0);
+            return;
           default:
             break;
         }
       }
       sm().button_handler_.clear();
+      start_timer(AppEvent::MENU_TIMEOUT, SETTINGS_MENU_TIMEOUT);
     } else if (btn_event.action == Button::LONG_3 && btn_event.id == 3) {
       // factory reset
       return transition_to<FactoryResetState>();
@@ -1001,17 +1548,10 @@ void AppSMStates::SettingsMenuState::loop() {
       return transition_to<DeviceInfoState>();
     }
   }
-  if (!awake_mode &&
-      millis() - sm().settings_menu_start_time_ > SETTINGS_MENU_TIMEOUT &&
-      !sm().button_handler_.is_press_in_progress()) {
-    sm().debug("settings menu timeout");
-    sm().display_.disp_main();
-    return transition_to<CmdShutdownState>();
-  }
 }
 
 void AppSMStates::DeviceInfoState::entry() {
-  sm().device_info_start_time_ = millis();
+  start_timer(AppEvent::MENU_TIMEOUT, DEVICE_INFO_TIMEOUT);
   sm().display_.disp_device_info();
   // wait until button released. TODO: should be improved
   while (sm().hw_.any_button_pressed()) {
@@ -1021,29 +1561,18 @@ void AppSMStates::DeviceInfoState::entry() {
 }
 
 void AppSMStates::DeviceInfoState::loop() {
-  bool awake_mode = sm().device_state_.flags().awake_mode;
   ButtonEvent btn_event = sm().button_handler_.get_event();
   if (sm().button_handler_.is_press_in_progress()) {
     if (sm().button_handler_.is_press_finished()) {
+      sm().button_handler_.clear();
       if (btn_event.action == Button::SINGLE) {
         // cancel
-        sm().display_.disp_main();
-        sm().button_handler_.clear();
-        if (awake_mode) {
-          return transition_to<AwakeModeIdleState>();
-        } else {
-          return transition_to<CmdShutdownState>();
-        }
+        sm().dispatch(AppEvent::MENU_CLOSE, 0);
+        return;
       }
-      sm().button_handler_.clear();
+      start_timer(AppEvent::MENU_TIMEOUT, DEVICE_INFO_TIMEOUT);
     }
   }
-  if (!awake_mode &&
-      millis() - sm().device_info_start_time_ > DEVICE_INFO_TIMEOUT) {
-    sm().debug("device info timeout");
-    sm().display_.disp_main();
-    return transition_to<CmdShutdownState>();
-  }
 }
 
 void AppSMStates::CmdShutdownState::entry() {
@@ -1058,35 +1587,19 @@ void AppSMStates::CmdShutdownState::entry() {
     sm().device_state_.persisted().info_screen_showing = false;
     sm().display_.disp_main();
   }
-  sm().shutdown_cmd_time_ = millis();
 }
 
 void AppSMStates::CmdShutdownState::loop() {
-  // wait for timeout
-  if (millis() - sm().shutdown_cmd_time_ > SHUTDOWN_DELAY) {
-    sm().button_handler_.end();
-    sm().leds_.end();
-    sm().network_.disconnect();
-    return transition_to<NetDisconnectingState>();
+  // wait for the commands sent while asleep
+  if (sm()._synced() && !sm().icon_receiver_.busy()) {
+    return transition_to<ShuttingDownState>(this);
   }
 }
 
-void AppSMStates::NetDisconnectingState::loop() {
-  if (sm().network_.get_state() == Network::State::DISCONNECTED &&
-      !sm().display_.busy()) {
-    if (sm().device_state_.flags().display_redraw) {
-      sm().device_state_.flags().display_redraw = false;
-      sm().display_.disp_main();
-    }
-    sm().display_.end();
-    return transition_to<ShuttingDownState>();
-  }
-}
+void AppSMStates::ShuttingDownState::entry() { sm()._begin_shutdown(); }
 
 void AppSMStates::ShuttingDownState::loop() {
-  if (sm().display_.get_state() == Display::State::IDLE &&
-      sm().leds_.get_state() == LEDs::State::IDLE &&
-      !sm().hw_.any_button_pressed()) {
+  if (sm().shutdown_.done()) {
     sm()._log_stack_status();
     if (sm().device_state_.flags().awake_mode) {
       sm().device_state_.persisted().silent_restart = true;
@@ -2,6 +2,8 @@
 #define HOMEBUTTONS_APP_H
 
 #include <array>
+#include <atomic>
+#include <ctime>
 #include "state.h"
 #include "buttons.h"
 #include "leds.h"
@@ -11,13 +13,33 @@
 #include "logger.h"
 #include "hardware.h"
 #include "mdi_helper.h"
+#include "icon_receiver.h"
+#include "shutdown.h"
+#include "static_task.h"
 
 class App;
 
 enum class BootCause { RESET, TIMER, BUTTON };
 
+enum class AppEvent : uint8_t {
+  BUTTON_PRESS,  // a press started, from the button task
+  IDLE_TICK,
+  MENU_CLOSE,
+  MENU_TIMEOUT,
+};
+
+template <>
+struct StateMachineTraits<App> {
+  using Event = AppEvent;
+  static constexpr UBaseType_t EVENT_QUEUE_SIZE = 4;
+  static constexpr uint8_t MAX_TIMERS = 2;
+};
+
 namespace AppSMStates {
 
+class CmdShutdownState;
+class ShuttingDownState;
+
 class InitState : public State<App> {
  public:
   using State<App>::State;
@@ -32,9 +54,13 @@ class AwakeModeIdleState : public State<App> {
   using State<App>::State;
 
   void entry() override;
-  void loop() override;
+  bool on_event(AppEvent event, uint32_t arg) override;
+  bool polled() const override { return false; }
 
   const char* get_name() override { return "AwakeModeIdleState"; }
+
+ private:
+  void _tick();
 };
 
 class UserInputFinishState : public State<App> {
@@ -50,13 +76,35 @@ class NetConnectingState : public State<App> {
  public:
   using State<App>::State;
 
+  void entry() override;
   void loop() override;
 
   const char* get_name() override { return "NetConnectingState"; }
+
+ private:
+  bool _press_sent();
+
+  // queued to go out as soon as Wi-Fi is up
+  bool press_queued_early_ = false;
+  time_t press_time_ = 0;
+  uint32_t timeout_ = 0;
+};
+
+// Parent of the menu screens, closes them on MENU_CLOSE and, unless in awake
+// mode, on MENU_TIMEOUT.
+class MenuState : public State<App> {
+ public:
+  using Transitions = ::Transitions<AwakeModeIdleState, CmdShutdownState>;
+  using State<App>::State;
+
+  bool on_event(AppEvent event, uint32_t arg) override;
+
+  const char* get_name() override { return "MenuState"; }
 };
 
 class SettingsMenuState : public State<App> {
  public:
+  using Parent = MenuState;
   using State<App>::State;
 
   void entry() override;
@@ -67,6 +115,7 @@ class SettingsMenuState : public State<App> {
 
 class DeviceInfoState : public State<App> {
  public:
+  using Parent = MenuState;
   using State<App>::State;
 
   void entry() override;
@@ -77,6 +126,7 @@ class DeviceInfoState : public State<App> {
 
 class CmdShutdownState : public State<App> {
  public:
+  using Transitions = ::Transitions<ShuttingDownState>;
   using State<App>::State;
 
   void entry() override;
@@ -85,19 +135,12 @@ class CmdShutdownState : public State<App> {
   const char* get_name() override { return "CmdShutdownState"; }
 };
 
-class NetDisconnectingState : public State<App> {
- public:
-  using State<App>::State;
-
-  void loop() override;
-
-  const char* get_name() override { return "NetDisconnectingState"; }
-};
-
 class ShuttingDownState : public State<App> {
  public:
+  using Transitions = ::Transitions<>;
   using State<App>::State;
 
+  void entry() override;
   void loop() override;
 
   const char* get_name() override { return "ShuttingDownState"; }
@@ -118,9 +161,10 @@ class FactoryResetState : public State<App> {
 using AppStateMachine = StateMachine<
     App, AppSMStates::InitState, AppSMStates::AwakeModeIdleState,
     AppSMStates::UserInputFinishState, AppSMStates::NetConnectingState,
-    AppSMStates::SettingsMenuState, AppSMStates::DeviceInfoState,
-    AppSMStates::CmdShutdownState, AppSMStates::NetDisconnectingState,
-    AppSMStates::ShuttingDownState, AppSMStates::FactoryResetState>;
+    AppSMStates::MenuState, AppSMStates::SettingsMenuState,
+    AppSMStates::DeviceInfoState,
+    AppSMStates::CmdShutdownState, AppSMStates::ShuttingDownState,
+    AppSMStates::FactoryResetState>;
 
 class App : public AppStateMachine, public Logger {
  public:
@@ -153,17 +197,31 @@ class App : public AppStateMachine, public Logger {
   }
 
   void _publish_sensors();
+  void _replay_presses();
+  void _presses_delivered();
+  void _samples_delivered();
+  void _record_sample();
+  bool _sample_only_wake();
   void _publish_awake_mode_avlb();
   void _mqtt_callback(const char* topic, const char* payload);
+  bool _mqtt_raw_callback(const char* topic, const uint8_t* payload,
+                          uint32_t length, uint32_t offset);
   void _net_on_connect();
+  void _start_sync();
+  bool _synced();
+  void _begin_shutdown();
+  uint16_t _mqttsn_topic_id(const char* topic);
   void _download_mdi_icons();
+  void _publish_log(bool raw);
+  void _publish_trace();
+  void _publish_diagnostics();
 
   DeviceState device_state_;
-  TaskHandle_t button_task_h_ = nullptr;
-  TaskHandle_t display_task_h_ = nullptr;
-  TaskHandle_t network_task_h_ = nullptr;
-  TaskHandle_t leds_task_h_ = nullptr;
-  TaskHandle_t main_task_h_ = nullptr;
+  StaticTask<BUTTON_TASK_STACK> button_task_;
+  StaticTask<DISPLAY_TASK_STACK> display_task_;
+  StaticTask<NETWORK_TASK_STACK> network_task_;
+  StaticTask<LEDS_TASK_STACK> leds_task_;
+  StaticTask<MAIN_TASK_STACK> main_task_;
 
   LEDs leds_;
   Network network_;
@@ -171,25 +229,30 @@ class App : public AppStateMachine, public Logger {
   MQTTHelper mqtt_;
   HardwareDefinition hw_;
   MDIHelper mdi_;
+  IconReceiver icon_receiver_;
   ButtonHandler<NUM_BUTTONS> button_handler_;
+  ShutdownSequencer shutdown_;
   ButtonEvent btn_event_;
   BootCause boot_cause_;
 
   uint32_t last_sensor_publish_ = 0;
-  uint32_t last_m_display_redraw_ = 0;
+  bool sample_recorded_ = false;  // one batched sample per wake
   uint32_t info_screen_start_time_ = 0;
-  uint32_t settings_menu_start_time_ = 0;
-  uint32_t device_info_start_time_ = 0;
-  uint32_t shutdown_cmd_time_ = 0;
+  uint32_t sync_nonce_ = 0;
+  uint32_t sync_start_time_ = 0;
+  std::atomic<bool> sync_pending_{false};
+  // sent from the outbox, removed from it once delivered
+  std::atomic<uint8_t> replayed_presses_{0};
+  bool presses_replayed_ = false;  // network task only
 
   friend class AppSMStates::InitState;
   friend class AppSMStates::AwakeModeIdleState;
   friend class AppSMStates::UserInputFinishState;
   friend class AppSMStates::NetConnectingState;
+  friend class AppSMStates::MenuState;
   friend class AppSMStates::SettingsMenuState;
   friend class AppSMStates::DeviceInfoState;
   friend class AppSMStates::CmdShutdownState;
-  friend class AppSMStates::NetDisconnectingState;
   friend class AppSMStates::ShuttingDownState;
   friend class AppSMStates::FactoryResetState;
 };
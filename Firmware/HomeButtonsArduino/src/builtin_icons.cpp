@@ -0,0 +1,69 @@
+#include "builtin_icons.h"
+
+#if __has_include("builtin_icons_data.h")
+#include "builtin_icons_data.h"  // generated, defines HAS_BUILTIN_ICONS
+#endif
+
+namespace builtin_icons {
+
+#ifdef HAS_BUILTIN_ICONS
+static constexpr size_t NUM_ICONS = sizeof(BUILTIN_ICONS) / sizeof(BuiltinIcon);
+#else
+static constexpr BuiltinIcon* BUILTIN_ICONS = nullptr;
+static constexpr size_t NUM_ICONS = 0;
+#endif
+
+// table is sorted by name, then size
+const BuiltinIcon* find(const char* name, uint16_t size) {
+  size_t lo = 0;
+  size_t hi = NUM_ICONS;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    const BuiltinIcon& icon = BUILTIN_ICONS[mid];
+    int cmp = strcmp(icon.name, name);
+    if (cmp == 0) {
+      cmp = static_cast<int>(icon.size) - static_cast<int>(size);
+    }
+    if (cmp == 0) {
+      return &icon;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return nullptr;
+}
+
+size_t count() { return NUM_ICONS; }
+
+bool decode(const BuiltinIcon& icon, uint8_t* buf, size_t buf_len) {
+  size_t out_len = (icon.width + 7) / 8 * icon.height;
+  if (out_len > buf_len) {
+    return false;
+  }
+  size_t in = 0;
+  size_t out = 0;
+  while (in < icon.len && out < out_len) {
+    int8_t n = static_cast<int8_t>(icon.data[in++]);
+    if (n >= 0) {
+      size_t run = n + 1;
+      if (in + run > icon.len || out + run > out_len) {
+        return false;
+      }
+      memcpy(buf + out, icon.data + in, run);
+      in += run;
+      out += run;
+    } else if (n != -128) {
+      size_t run = 1 - n;
+      if (in >= icon.len || out + run > out_len) {
+        return false;
+      }
+      memset(buf + out, icon.data[in++], run);
+      out += run;
+    }
+  }
+  return out == out_len;
+}
+
+}  // namespace builtin_icons
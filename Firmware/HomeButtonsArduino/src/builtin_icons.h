@@ -0,0 +1,32 @@
+#ifndef HOMEBUTTONS_BUILTIN_ICONS_H
+#define HOMEBUTTONS_BUILTIN_ICONS_H
+
+#include <Arduino.h>
+
+// Icon compiled into the firmware by tools/gen_builtin_icons.py.
+// Bitmap is stored in XBM format (1 bpp, LSB first, rows padded to full
+// bytes) and compressed with PackBits.
+struct BuiltinIcon {
+  const char* name;
+  uint16_t size;
+  uint16_t width;
+  uint16_t height;
+  const uint8_t* data;
+  size_t len;
+};
+
+namespace builtin_icons {
+
+// largest supported icon (100x100) in XBM format
+static constexpr size_t MAX_DECODED_SIZE = (100 + 7) / 8 * 100;
+
+const BuiltinIcon* find(const char* name, uint16_t size);
+size_t count();
+
+// Decompresses icon into XBM bitmap. Returns false if buf is too small or
+// data is corrupted.
+bool decode(const BuiltinIcon& icon, uint8_t* buf, size_t buf_len);
+
+}  // namespace builtin_icons
+
+#endif  // HOMEBUTTONS_BUILTIN_ICONS_H
@@ -12,6 +12,7 @@ void Button::begin(uint8_t pin, uint16_t id, bool active_high) {
   this->pin = pin;
   this->id = id;
   this->active_high = active_high;
+  idle_level = _read_pin();
   attachInterrupt(pin, std::bind(&Button::_isr, this), CHANGE);
   begun = true;
   debug("id %d begun", id);
@@ -40,13 +41,19 @@ void Button::update() {
   uint32_t since_release_start = millis() - release_start_time;
 
   switch (state_machine_state) {
-    case 0:  // idle
-      if (rising_flag) {
+    case 0: {  // idle
+      // the interrupt misses edges while the CPU is in light sleep, the
+      // level is sampled as well
+      bool level = _read_pin();
+      bool missed_rise = level && !idle_level;
+      idle_level = level;
+      if (rising_flag || missed_rise) {
         rising_flag = false;
         press_start_time = millis();
         state_machine_state = 1;
       }
       break;
+    }
     case 1:  // debounce
       if (since_press_start >= DEBOUNCE_TIMEOUT) {
         if (_read_pin()) {
@@ -225,4 +232,6 @@ void Button::_reset() {
   press_finished = false;
   state_machine_state = 0;
   action = IDLE;
+  // a button still held down is not a new press
+  idle_level = begun && _read_pin();
 }
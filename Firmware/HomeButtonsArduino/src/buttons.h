@@ -55,6 +55,7 @@ class Button : public Logger {
 
   bool rising_flag = false;
   bool falling_flag = false;
+  bool idle_level = false;  // pin level at the last update in idle
 
   void IRAM_ATTR _isr();
   bool _read_pin() const;
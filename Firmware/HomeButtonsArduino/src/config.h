@@ -34,6 +34,7 @@ static constexpr uint8_t NUM_BUTTONS = 6;
 static constexpr char BTN_PRESS_PAYLOAD[] = "PRESS";
 static constexpr uint8_t BTN_LABEL_MAXLEN = 56;
 static constexpr uint8_t USER_MSG_MAXLEN = 64;
+static constexpr uint8_t ICON_SOURCE_MAXLEN = 96;
 
 // ------ defaults ------
 static constexpr char DEVICE_NAME_DFLT[] = "Home Buttons";
@@ -52,6 +53,18 @@ static constexpr uint16_t SEN_INTERVAL_DFLT = 30;  // min
 static constexpr uint16_t SEN_INTERVAL_MIN = 5;    // min
 static constexpr uint16_t SEN_INTERVAL_MAX = 60;   // min
 #endif
+// batching: samples per upload, 1 uploads on every wake
+static constexpr uint8_t SEN_BATCH_DFLT = 1;
+static constexpr uint8_t SEN_BATCH_MAX = 12;
+static constexpr float SEN_BATCH_TEMP_DELTA = 1.0;  // uploads early
+static constexpr float SEN_BATCH_HMD_DELTA = 5.0;   // uploads early, %
+static constexpr uint8_t SENSOR_LOG_ENTRIES = 16;   // kept in RTC memory
+
+// undelivered button presses, see press_outbox.h
+static constexpr uint8_t PRESS_OUTBOX_ENTRIES = 8;     // kept in RTC memory
+static constexpr uint32_t PRESS_OUTBOX_MAX_AGE = 600;  // s
+// a button wake gives up connecting after, the press waits in the outbox
+static constexpr uint32_t PRESS_CONNECT_TIMEOUT = 10000L;  // ms
 
 // ----- timing ------
 static constexpr uint32_t SETUP_TIMEOUT = 600;             // s
@@ -62,7 +75,8 @@ static constexpr uint32_t WDT_TIMEOUT_SLEEP = 60;          // s
 static constexpr uint32_t AWAKE_REDRAW_INTERVAL = 1000L;   // ms
 static constexpr uint32_t SETTINGS_MENU_TIMEOUT = 30000L;  // ms
 static constexpr uint32_t DEVICE_INFO_TIMEOUT = 30000L;    // ms
-static constexpr uint32_t SHUTDOWN_DELAY = 500L;           // ms
+static constexpr uint32_t SYNC_TIMEOUT = 2000L;            // ms, cmd/sync echo
+static constexpr uint32_t ICON_UPLOAD_TIMEOUT = 5000L;     // ms
 
 // ------ network ------
 static constexpr uint32_t QUICK_WIFI_TIMEOUT = 5000L;
@@ -72,7 +86,65 @@ static constexpr uint32_t MQTT_TIMEOUT = 5000L;
 static constexpr uint32_t NET_CONN_CHECK_INTERVAL = 1000L;
 static constexpr uint32_t NET_CONNECT_TIMEOUT = 30000L;
 static constexpr uint8_t MAX_FAILED_CONNECTIONS = 5;
+// learned timeouts, see net_timeouts.h
+static constexpr uint8_t NET_TIMEOUT_MIN_SAMPLES = 8;   // before learning
+static constexpr uint16_t NET_TIMEOUT_HISTORY = 64;     // connects, then aged
+static constexpr uint8_t NET_TIMEOUT_PERCENTILE = 95;
+static constexpr uint32_t NET_TIMEOUT_MARGIN_PCT = 200;  // of the percentile
+static constexpr uint32_t NET_TIMEOUT_MIN = 1000L;       // ms
+static constexpr uint8_t NET_BACKOFF_MAX_SKIP = 15;      // timer wakes
+static constexpr uint32_t NET_POLL_INTERVAL = 10L;              // ms
+static constexpr uint32_t NET_POLL_INTERVAL_LIGHT_SLEEP = 50L;  // ms
+static constexpr uint16_t MQTT_KEEPALIVE = 15;         // s
+static constexpr uint8_t MQTT_INFLIGHT = 4;            // QoS 1 publishes
+static constexpr uint32_t MQTT_WRITE_TIMEOUT = 1000L;  // ms
+static constexpr uint32_t MQTT_ACK_TIMEOUT = 1000L;    // ms, before disconnect
+// MQTT over TLS, used if the server is given as mqtts://host
+static constexpr char MQTTS_SCHEME[] = "mqtts://";
+static constexpr size_t TLS_SESSION_SIZE = 512;  // kept in RTC memory
 static const IPAddress DEFAULT_DNS2 = IPAddress(1, 1, 1, 1);
+static constexpr char NTP_SERVER[] = "pool.ntp.org";
+// MQTT-SN over UDP, used if the server is given as mqttsn://host
+static constexpr char MQTTSN_SCHEME[] = "mqttsn://";
+static constexpr uint16_t MQTTSN_KEEPALIVE = 60;        // s
+static constexpr uint32_t MQTTSN_RETRY_TIMEOUT = 500L;  // ms
+static constexpr uint8_t MQTTSN_RETRIES = 3;
+static constexpr uint8_t MQTTSN_MAX_TOPICS = 12;  // registered per session
+// predefined topic ids of the button topics, 4 per button (single..quad)
+static constexpr uint16_t MQTTSN_BTN_TOPIC_ID = 1;
+static constexpr uint32_t SNTP_TIMEOUT = 2000L;  // ms
+
+// ------ power ------
+// CPU profiles: COMPUTE runs at max, WAIT at min. Min keeps APB (LEDC, SPI,
+// UART) at 80 MHz.
+static constexpr int CPU_FREQ_MAX = 240;  // MHz
+static constexpr int CPU_FREQ_MIN = 80;   // MHz
+
+// ------ tasks ------
+// stack sizes in bytes, statically allocated
+static constexpr uint32_t MAIN_TASK_STACK = 10000;
+static constexpr uint32_t NETWORK_TASK_STACK = 15000;
+static constexpr uint32_t DISPLAY_TASK_STACK = 5000;
+static constexpr uint32_t BUTTON_TASK_STACK = 2000;
+static constexpr uint32_t LEDS_TASK_STACK = 2000;
+static constexpr uint32_t LOG_TASK_STACK = 3000;
+
+// ------ diagnostics ------
+static constexpr uint8_t LOG_RING_ENTRIES = 64;  // kept in RTC memory
+static constexpr uint8_t TRACE_MAX_TASKS = 8;      // only with TRACE_ENABLED
+static constexpr uint16_t TRACE_TASK_EVENTS = 128;  // per task
+static constexpr uint16_t METRICS_PUBLISH_WAKES = 24;
+
+// ------ state cache ------
+static constexpr uint8_t STATE_CACHE_ENTRIES = 16;   // kept in RTC memory
+static constexpr uint16_t STATE_REFRESH_WAKES = 24;  // republish everything
+
+// ------ wake schedule ------
+// deadlines this close to a wake are handled in the same boot
+static constexpr uint32_t WAKE_COALESCE_WINDOW = 30;               // s
+static constexpr uint32_t WAKE_MAX_SLEEP = SEN_INTERVAL_MAX * 60;  // s
+// a timer wake that couldn't connect tries again after, s
+static constexpr uint32_t NET_RETRY_DELAY = 120;
 
 // ------ other ------
 static constexpr uint32_t MIN_FREE_HEAP = 10000UL;
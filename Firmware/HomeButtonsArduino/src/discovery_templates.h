@@ -0,0 +1,39 @@
+#ifndef HOMEBUTTONS_DISCOVERY_TEMPLATES_H
+#define HOMEBUTTONS_DISCOVERY_TEMPLATES_H
+
+// Discovery payloads of MQTTHelper, see json_template.h. Split where a member
+// is optional, rendered one after the other into the payload. The native
+// tests render them next to the ArduinoJson documents they replace.
+static constexpr char DEVICE_FULL[] =
+    R"({"ids":["$"],"mdl":"$","name":"$","sw":"$","hw":"$","mf":"$"})";
+static constexpr char DEVICE_SHORT[] = R"({"ids":["$"]})";
+static constexpr char DEVICE_END[] = R"(,"dev":#})";
+
+static constexpr char TRIGGER_CONF[] =
+    R"({"atype":"trigger","t":"$$","pl":"$","type":"$","stype":"button_#")";
+static constexpr char SENSOR_CONF[] =
+    R"({"name":"$","uniq_id":"$_$","stat_t":"$","dev_cla":"$",)"
+    R"("unit_of_meas":"$","exp_aft":#)";
+static constexpr char VALUE_TEMPLATE[] = R"(,"val_tpl":"{{ value_json.$ }}")";
+static constexpr char HISTORY_ATTRIBUTES[] =
+    R"(,"json_attr_t":"$",)"
+    R"("json_attr_tpl":"{{ {'time': value_json.t, '$': value_json.$} | tojson }}")";
+static constexpr char NUMBER_CONF[] =
+    R"({"name":"$","uniq_id":"$_$","cmd_t":"$","stat_t":"$")";
+static constexpr char UNIT[] = R"(,"unit_of_meas":"$")";
+static constexpr char NUMBER_RANGE[] =
+    R"(,"min":#,"max":#,"mode":"$","ic":"$","ret":"true")";
+static constexpr char TEXT_CONF[] =
+    R"({"name":"$","uniq_id":"$_$","cmd_t":"$","stat_t":"$","max":#,)"
+    R"("ic":"$","ret":"true")";
+static constexpr char DIAGNOSTIC_CONF[] =
+    R"({"name":"$","uniq_id":"$_$","stat_t":"$","val_tpl":"$")";
+static constexpr char DIAGNOSTIC_CLASS[] =
+    R"(,"stat_cla":"$","ent_cat":"diagnostic")";
+static constexpr char SWITCH_CONF[] =
+    R"({"name":"$","uniq_id":"$_$","cmd_t":"$","stat_t":"$","ic":"$",)"
+    R"("ret":"true")";
+static constexpr char AVAILABILITY[] = R"(,"avty_t":"$")";
+static constexpr char CONFIG_CATEGORY[] = R"(,"ent_cat":"config")";
+
+#endif  // HOMEBUTTONS_DISCOVERY_TEMPLATES_H
@@ -1,13 +1,16 @@
 #include "display.h"
 
 #include <GxEPD2_BW.h>
-#include <SPIFFS.h>
 #include <U8g2_for_Adafruit_GFX.h>
 #include <qrcode.h>
 
+#include <new>
+
 #include "bitmaps.h"
 #include "config.h"
 #include "hardware.h"
+#include "metrics.h"
+#include "trace.h"
 
 #ifndef HOME_BUTTONS_MINI
 static constexpr uint16_t WIDTH = 128;
@@ -17,24 +20,6 @@ static constexpr int WIDTH = 200;
 constexpr int HEIGHT = 200;
 #endif
 
-uint16_t read16(File &f) {
-  // BMP data is stored little-endian, same as Arduino.
-  uint16_t result;
-  ((uint8_t *)&result)[0] = f.read();  // LSB
-  ((uint8_t *)&result)[1] = f.read();  // MSB
-  return result;
-}
-
-uint32_t read32(File &f) {
-  // BMP data is stored little-endian, same as Arduino.
-  uint32_t result;
-  ((uint8_t *)&result)[0] = f.read();  // LSB
-  ((uint8_t *)&result)[1] = f.read();
-  ((uint8_t *)&result)[2] = f.read();
-  ((uint8_t *)&result)[3] = f.read();  // MSB
-  return result;
-}
-
 #define GxEPD2_DISPLAY_CLASS GxEPD2_BW
 
 #ifndef HOME_BUTTONS_MINI
@@ -49,17 +34,22 @@ uint32_t read32(File &f) {
        ? EPD::HEIGHT                                         \
        : MAX_DISPLAY_BUFFER_SIZE / (EPD::WIDTH / 8))
 
-static GxEPD2_DISPLAY_CLASS<GxEPD2_DRIVER_CLASS,
-                            MAX_HEIGHT(GxEPD2_DRIVER_CLASS)> *disp;
+using DisplayDriver =
+    GxEPD2_DISPLAY_CLASS<GxEPD2_DRIVER_CLASS, MAX_HEIGHT(GxEPD2_DRIVER_CLASS)>;
+
+// constructed once in Display::begin(), the frame buffer is part of the driver
+alignas(DisplayDriver) static uint8_t disp_storage[sizeof(DisplayDriver)];
+static DisplayDriver *disp = nullptr;
 
 static U8G2_FOR_ADAFRUIT_GFX u8g2;
 
 void Display::begin(HardwareDefinition &HW) {
   if (state != State::IDLE) return;
-  disp = new GxEPD2_DISPLAY_CLASS<GxEPD2_DRIVER_CLASS,
-                                  MAX_HEIGHT(GxEPD2_DRIVER_CLASS)>(
-      GxEPD2_DRIVER_CLASS(/*CS=*/HW.EINK_CS, /*DC=*/HW.EINK_DC,
-                          /*RST=*/HW.EINK_RST, /*BUSY=*/HW.EINK_BUSY));
+  if (disp == nullptr) {
+    disp = new (disp_storage) DisplayDriver(
+        GxEPD2_DRIVER_CLASS(/*CS=*/HW.EINK_CS, /*DC=*/HW.EINK_DC,
+                            /*RST=*/HW.EINK_RST, /*BUSY=*/HW.EINK_BUSY));
+  }
   disp->init();
   u8g2.begin(*disp);
   current_ui_state = {};
@@ -68,12 +58,42 @@ void Display::begin(HardwareDefinition &HW) {
   pre_disappear_ui_state = {};
   state = State::ACTIVE;
   info("begin");
+  _notify();
 }
 
 void Display::end() {
   if (state != State::ACTIVE) return;
   state = State::CMD_END;
   debug("cmd end");
+  _notify();
+}
+
+void Display::wait() {
+  task_ = xTaskGetCurrentTaskHandle();
+  // a command sent before the handle was set is already pending
+  TickType_t ticks = _until_update();
+  if (ticks > 0) ulTaskNotifyTake(pdTRUE, ticks);
+}
+
+void Display::_notify() {
+  if (task_ != nullptr) xTaskNotifyGive(task_);
+}
+
+// as the checks at the start of update()
+TickType_t Display::_until_update() const {
+  if (state == State::IDLE) return portMAX_DELAY;
+  if (state == State::CMD_END && !new_ui_cmd) return 0;
+  if (current_ui_state.disappearing) {
+    uint32_t shown = millis() - current_ui_state.appear_time;
+    if (shown >= current_ui_state.disappear_timeout) return 0;
+    return pdMS_TO_TICKS(current_ui_state.disappear_timeout - shown) + 1;
+  }
+  return new_ui_cmd ? 0 : portMAX_DELAY;
+}
+
+void Display::_refresh() {
+  render_cpu_.end();
+  disp->display();
 }
 
 void Display::update() {
@@ -118,6 +138,11 @@ void Display::update() {
         static_cast<int>(draw_ui_state.page), draw_ui_state.disappearing,
         draw_ui_state.message.c_str());
 
+  TRACE_SCOPE("Display::update");
+  power::Hold pm_hold(power::Lock::DISPLAY);
+  // drawing into the buffer, _refresh() drops back to WAIT for the panel
+  render_cpu_.start(power::CpuProfile::COMPUTE);
+  uint32_t start = millis();
   redraw_in_progress = true;
   switch (draw_ui_state.page) {
     case DisplayPage::EMPTY:
@@ -158,10 +183,13 @@ void Display::update() {
                 draw_ui_state.mdi_size);
       break;
   }
+  render_cpu_.end();
   current_ui_state = draw_ui_state;
   current_ui_state.appear_time = millis();
   draw_ui_state = {};
   redraw_in_progress = false;
+  metrics::inc(metrics::Counter::DISPLAY_REFRESHES);
+  metrics::observe(metrics::Histogram::DISPLAY_UPDATE_MS, millis() - start);
 
   if (state == State::ENDING) {
     disp->hibernate();
@@ -249,18 +277,23 @@ void Display::disp_test(const char *text, const char *mdi_name,
 
 UIState Display::get_ui_state() { return current_ui_state; }
 
-void Display::init_ui_state(UIState ui_state) { current_ui_state = ui_state; }
+void Display::init_ui_state(UIState ui_state) {
+  current_ui_state = ui_state;
+  _notify();
+}
 
 Display::State Display::get_state() { return state; }
 
 void Display::set_cmd_state(UIState cmd) {
   cmd_ui_state = cmd;
   new_ui_cmd = true;
+  _notify();
 }
 
 #ifndef HOME_BUTTONS_MINI
 void Display::draw_message(const UIState::MessageType &message, bool error,
                            bool large) {
+  TRACE_SCOPE("Display::draw_message");
   disp->setRotation(0);
   disp->setFullWindow();
 
@@ -281,30 +314,26 @@ void Display::draw_message(const UIState::MessageType &message, bool error,
     }
 
     UIState::MessageType part;
-    UIState::MessageType remain = message;
+    StaticStringView remain = message.view();
     uint16_t lines = 0;
     uint16_t linecounter = 0;
 
     do {
-      if (remain.index_of('\n') < 0) {
-        part = remain;
-        remain = "";
-      } else {
-        part = remain.substring(0, remain.index_of('\n'));
-        remain = remain.substring(remain.index_of('\n') + 1);
-      }
+      int end = remain.index_of('\n');
+      remain = end < 0 ? StaticStringView() : remain.substring(end + 1);
       lines += 1;
-    } while (strcmp(remain.c_str(), "") != 0);
+    } while (!remain.empty());
 
-    remain = message;
+    remain = message.view();
 
     do {
-      if (remain.index_of('\n') < 0) {
+      int end = remain.index_of('\n');
+      if (end < 0) {
         part = remain;
-        remain = "";
+        remain = StaticStringView();
       } else {
-        part = remain.substring(0, remain.index_of('\n'));
-        remain = remain.substring(remain.index_of('\n') + 1);
+        part = remain.substring(0, end);
+        remain = remain.substring(end + 1);
       }
       switch (global_rotation) {
         case 90:
@@ -337,7 +366,7 @@ void Display::draw_message(const UIState::MessageType &message, bool error,
       }
       u8g2.print(part.c_str());
       linecounter += 1;
-    } while (strcmp(remain.c_str(), "") != 0);
+    } while (!remain.empty());
 
   } else {
     u8g2.setFont(u8g2_font_helvB12_tr);
@@ -350,10 +379,12 @@ void Display::draw_message(const UIState::MessageType &message, bool error,
     u8g2.print(message.c_str());
   }
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_main() {
+  TRACE_SCOPE("Display::draw_main");
+  uint32_t start = micros();
   const uint16_t min_btn_clearance = 14;
   const uint16_t h_padding = 5;
 
@@ -371,71 +402,18 @@ void Display::draw_main() {
     disp->fillRect(12, HEIGHT - 3, WIDTH - 24, 3, text_color);
   }
 
-  mdi_.begin();
-  LabelType label_type[NUM_BUTTONS] = {};
-  for (uint16_t i = 0; i < NUM_BUTTONS; i++) {
-    ButtonLabel label = device_state_.get_btn_label(i);
-    if (label.substring(0, 4) == "mdi:") {
-      if (label.index_of(' ') > 0) {
-        label_type[i] = LabelType::Mixed;
-      } else {
-        label_type[i] = LabelType::Icon;
-      }
-    } else {
-      label_type[i] = LabelType::Text;
-      if (label == "") {
-        label_type[i] = LabelType::Icon;
-      }
-    }
-  }
-
   // Loop through buttons
   for (uint16_t i = 0; i < NUM_BUTTONS; i++) {
-    ButtonLabel label = device_state_.get_btn_label(i);
-    uint16_t rotation = 0;
-    if (label_type[i] == LabelType::Icon && label.substring(0, 4) == "mdi:") {
-      MDIName icon;
-
-      if (label.index_of(';') > 0) {
-        icon = label.substring(
-            label.index_of(';') + 1,
-            label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
-        rotation = atoi(label.substring(4, label.index_of(';')).c_str());
-        if (i == 0) {
-          global_rotation = rotation;
-        }
-      } else {
-        icon = label.substring(
-            4, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
-        if (i == 0) {
-          global_rotation = rotation;
-        }
-      }
-
-      // make smaller if opposite is text or mixed
-      uint16_t size = 64;
-      bool small = false;
-      if (rotation == 0 || rotation == 180) {
-        if (i % 2 == 0) {
-          if (label_type[i + 1] == LabelType::Text ||
-              label_type[i + 1] == LabelType::Mixed) {
-            size = 48;
-            small = true;
-          } else {
-            size = 64;
-            small = false;
-          }
-        } else {
-          if (label_type[i - 1] == LabelType::Text ||
-              label_type[i - 1] == LabelType::Mixed) {
-            size = 48;
-            small = true;
-          } else {
-            size = 64;
-            small = false;
-          }
-        }
-      }
+    const ButtonLabel &label = device_state_.get_btn_label(i);
+    const LabelDescriptor &desc = device_state_.get_btn_label_desc(i);
+    uint16_t rotation = desc.rotation;
+    if (i == 0) {
+      global_rotation = rotation;
+    }
+    if (desc.type == LabelDescriptor::Type::Icon) {
+      // smaller if opposite is text or mixed
+      uint16_t size = desc.icon_size;
+      bool small = size < 64;
 
       // calculate icon position on display
       uint16_t x = i % 2 == 0 ? 0 : WIDTH - size;
@@ -463,21 +441,12 @@ void Display::draw_main() {
         }
       }
 
-      draw_mdi(icon.c_str(), size, x, y, rotation);
+      draw_mdi(desc.icon.c_str(), size, x, y, rotation);
 
-    } else if (label_type[i] == LabelType::Mixed) {
-      MDIName icon;
-      if (label.index_of(';') > 0) {
-        icon = label.substring(label.index_of(';') + 1, label.index_of(' '));
-        rotation = atoi(label.substring(4, label.index_of(';')).c_str());
-      } else {
-        icon = label.substring(4, label.index_of(' '));
-      }
-      if (i == 0) {
-        global_rotation = rotation;
-      }
-      StaticString<56> text = label.substring(label.index_of(' ') + 1);
-      uint16_t icon_size = 48;
+    } else if (desc.type == LabelDescriptor::Type::Mixed) {
+      const char *text = desc.text(label);
+      ButtonLabel truncated;
+      uint16_t icon_size = desc.icon_size;
       uint16_t y = 0;
       uint16_t x = 0;
       if (rotation == 0 || rotation == 180) {
@@ -490,7 +459,7 @@ void Display::draw_main() {
         x = i % 2 == 0 ? WIDTH / 2 - icon_size : WIDTH / 2;
       }
 
-      draw_mdi(icon.c_str(), icon_size, x, y, rotation);
+      draw_mdi(desc.icon.c_str(), icon_size, x, y, rotation);
       // draw text
       uint16_t max_text_width = 0;
       bool smaller_for_rotation = 1;
@@ -502,56 +471,44 @@ void Display::draw_main() {
         smaller_for_rotation = 1;
       }
 
-      if (text.index_of('_') == 0) {
-        // force small font
-        text = text.substring(1);
-        u8g2.setFont(u8g2_font_helvB18_te);
-        if (text.index_of('_') == 0) {
-          text = text.substring(1);
-          u8g2.setFont(u8g2_font_helvB12_te);
-          smaller_for_rotation = 0;
-          if (text.index_of('_') == 0) {
-            text = text.substring(1);
-            u8g2.setFont(u8g2_font_helvB10_te);
-            if (text.index_of('_') == 0) {
-              text = text.substring(1);
-              u8g2.setFont(u8g2_font_helvB08_te);
-            }
-          }
-        }
-      } else {
-        u8g2.setFont(u8g2_font_helvB24_te);
+      // forced small font
+      set_label_font(desc.font_level);
+      if (desc.font_level >= 2) {
+        smaller_for_rotation = 0;
       }
       uint16_t w, h;
-      w = u8g2.getUTF8Width(text.c_str());
+      w = u8g2.getUTF8Width(text);
       h = u8g2.getFontAscent();
       if (w >= max_text_width || smaller_for_rotation == 1) {
         u8g2.setFont(u8g2_font_helvB18_te);
-        w = u8g2.getUTF8Width(text.c_str());
+        w = u8g2.getUTF8Width(text);
         h = u8g2.getFontAscent();
         if (w >= max_text_width || smaller_for_rotation == 1) {
           u8g2.setFont(u8g2_font_helvB12_te);
-          w = u8g2.getUTF8Width(text.c_str());
+          w = u8g2.getUTF8Width(text);
           h = u8g2.getFontAscent();
           if (w >= max_text_width) {
             u8g2.setFont(u8g2_font_helvB10_te);
-            w = u8g2.getUTF8Width(text.c_str());
+            w = u8g2.getUTF8Width(text);
             h = u8g2.getFontAscent();
             if (w >= max_text_width) {
               u8g2.setFont(u8g2_font_helvB08_te);
-              w = u8g2.getUTF8Width(text.c_str());
+              w = u8g2.getUTF8Width(text);
               h = u8g2.getFontAscent();
               if (w >= max_text_width) {
-                text = text.substring(0, text.length() - 1) + ".";
+                truncated.set("%s", text);
+                truncated = truncated.substring(0, truncated.length() - 1) + ".";
                 while (1) {
-                  w = u8g2.getUTF8Width(text.c_str());
+                  w = u8g2.getUTF8Width(truncated.c_str());
                   h = u8g2.getFontAscent();
                   if (w >= max_text_width) {
-                    text = text.substring(0, text.length() - 2) + ".";
+                    truncated =
+                        truncated.substring(0, truncated.length() - 2) + ".";
                   } else {
                     break;
                   }
                 }
+                text = truncated.c_str();
               }
             }
           }
@@ -568,7 +525,7 @@ void Display::draw_main() {
         x = i % 2 == 0 ? h_padding / 2 : WIDTH - 12 - h_padding / 2;
         y = static_cast<uint16_t>(round((HEIGHT / 6.) +
                                         ((HEIGHT / 3.) * (i / 2)) -
-                                        (u8g2.getUTF8Width(text.c_str()) / 2)));
+                                        (u8g2.getUTF8Width(text) / 2)));
         u8g2.setCursor(x, y);
       } else if (rotation == 180) {
         u8g2.setFontDirection(2);
@@ -582,19 +539,14 @@ void Display::draw_main() {
         x = i % 2 == 0 ? h_padding / 2 + 12 : WIDTH - h_padding / 2;
         y = static_cast<uint16_t>(round((HEIGHT / 6.) +
                                         ((HEIGHT / 3.) * (i / 2)) +
-                                        (u8g2.getUTF8Width(text.c_str()) / 2)));
+                                        (u8g2.getUTF8Width(text) / 2)));
         u8g2.setCursor(x, y);
       }
-      u8g2.print(text.c_str());
+      u8g2.print(text);
     } else {
+      const char *text = desc.text(label);
+      ButtonLabel truncated;
       uint16_t max_label_width;
-      if (label.index_of(';') > 0) {
-        rotation = atoi(label.substring(0, label.index_of(';')).c_str());
-        label = label.substring(label.index_of(';') + 1).c_str();
-      }
-      if (i == 0) {
-        global_rotation = rotation;
-      }
       bool smaller_for_rotation = 1;
       if (rotation == 0 || rotation == 180) {
         max_label_width = WIDTH - min_btn_clearance;
@@ -604,56 +556,44 @@ void Display::draw_main() {
         smaller_for_rotation = 1;
       }
 
-      if (label.index_of('_') == 0) {
-        // force small font
-        label = label.substring(1);
-        u8g2.setFont(u8g2_font_helvB18_te);
-        if (label.index_of('_') == 0) {
-          label = label.substring(1);
-          u8g2.setFont(u8g2_font_helvB12_te);
-          smaller_for_rotation = 0;
-          if (label.index_of('_') == 0) {
-            label = label.substring(1);
-            u8g2.setFont(u8g2_font_helvB10_te);
-            if (label.index_of('_') == 0) {
-              label = label.substring(1);
-              u8g2.setFont(u8g2_font_helvB08_te);
-            }
-          }
-        }
-      } else {
-        u8g2.setFont(u8g2_font_helvB24_te);
+      // forced small font
+      set_label_font(desc.font_level);
+      if (desc.font_level >= 2) {
+        smaller_for_rotation = 0;
       }
       uint16_t w, h;
-      w = u8g2.getUTF8Width(label.c_str());
+      w = u8g2.getUTF8Width(text);
       h = u8g2.getFontAscent();
       if (w >= max_label_width || smaller_for_rotation == 1) {
         u8g2.setFont(u8g2_font_helvB18_te);
-        w = u8g2.getUTF8Width(label.c_str());
+        w = u8g2.getUTF8Width(text);
         h = u8g2.getFontAscent();
         if (w >= max_label_width || smaller_for_rotation == 1) {
           u8g2.setFont(u8g2_font_helvB12_te);
-          w = u8g2.getUTF8Width(label.c_str());
+          w = u8g2.getUTF8Width(text);
           h = u8g2.getFontAscent();
           if (w >= max_label_width) {
             u8g2.setFont(u8g2_font_helvB10_te);
-            w = u8g2.getUTF8Width(label.c_str());
+            w = u8g2.getUTF8Width(text);
             h = u8g2.getFontAscent();
             if (w >= max_label_width) {
               u8g2.setFont(u8g2_font_helvB08_te);
-              w = u8g2.getUTF8Width(label.c_str());
+              w = u8g2.getUTF8Width(text);
               h = u8g2.getFontAscent();
               if (w >= max_label_width) {
-                label = label.substring(0, label.length() - 1) + ".";
+                truncated.set("%s", text);
+                truncated = truncated.substring(0, truncated.length() - 1) + ".";
                 while (1) {
-                  w = u8g2.getUTF8Width(label.c_str());
+                  w = u8g2.getUTF8Width(truncated.c_str());
                   h = u8g2.getFontAscent();
                   if (w >= max_label_width) {
-                    label = label.substring(0, label.length() - 2) + ".";
+                    truncated =
+                        truncated.substring(0, truncated.length() - 2) + ".";
                   } else {
                     break;
                   }
                 }
+                text = truncated.c_str();
               }
             }
           }
@@ -679,40 +619,40 @@ void Display::draw_main() {
           if (i == 0) {
             disp->fillRect(0, (HEIGHT / 6) - 1, 5, 2, text_color);
             disp->fillRect(3, (HEIGHT / 6), 2,
-                           (u8g2.getUTF8Width(label.c_str()) / 2) + h_padding -
+                           (u8g2.getUTF8Width(text) / 2) + h_padding -
                                (HEIGHT / 6),
                            text_color);
             disp->fillRect(3,
                            (HEIGHT / 6) +
-                               (u8g2.getUTF8Width(label.c_str()) / 2) +
+                               (u8g2.getUTF8Width(text) / 2) +
                                h_padding - (HEIGHT / 6) - 1,
                            5, 2, text_color);
           } else if (i == 1) {
             disp->fillRect(WIDTH - 5, (HEIGHT / 6) - 1, 5, 2, text_color);
             disp->fillRect(WIDTH - 5, (HEIGHT / 6), 2,
-                           (u8g2.getUTF8Width(label.c_str()) / 2) + h_padding -
+                           (u8g2.getUTF8Width(text) / 2) + h_padding -
                                (HEIGHT / 6),
                            text_color);
             disp->fillRect(WIDTH - 8,
                            (HEIGHT / 6) +
-                               (u8g2.getUTF8Width(label.c_str()) / 2) +
+                               (u8g2.getUTF8Width(text) / 2) +
                                h_padding - (HEIGHT / 6) - 1,
                            5, 2, text_color);
           }
         } else if (i > 3) {
           x = i % 2 == 0 ? 6 + ((24 - u8g2.getFontAscent()) / 2)
                          : WIDTH - 6 - 24 + ((24 - u8g2.getFontAscent()) / 2);
-          y = HEIGHT - h_padding - u8g2.getUTF8Width(label.c_str());
+          y = HEIGHT - h_padding - u8g2.getUTF8Width(text);
           if (i == 4) {
             disp->fillRect(0, HEIGHT - (HEIGHT / 6) - 1, 5, 2,
                            text_color);  // Quadrat von x=0 bis x=5 und y= 5/6
                                          // HEIGHT -1 bis y= 5/6 HEIGHT +1
             disp->fillRect(3, HEIGHT - (HEIGHT / 6), 2,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - (HEIGHT - (HEIGHT / 6)),
                            text_color);
             disp->fillRect(3,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - 1,
                            5, 2, text_color);
           } else if (i == 5) {
@@ -720,11 +660,11 @@ void Display::draw_main() {
                            text_color);  // Quadrat von x=0 bis x=5 und y= 5/6
                                          // HEIGHT -1 bis y= 5/6 HEIGHT +1
             disp->fillRect(WIDTH - 5, HEIGHT - (HEIGHT / 6), 2,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - (HEIGHT - (HEIGHT / 6)),
                            text_color);
             disp->fillRect(WIDTH - 8,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - 1,
                            5, 2, text_color);
           }
@@ -733,7 +673,7 @@ void Display::draw_main() {
                   ? (h_padding) + 32 + ((24 - u8g2.getFontAscent()) / 2)
                   : WIDTH - 56 - h_padding + ((24 - u8g2.getFontAscent()) / 2);
           y = static_cast<uint16_t>(
-              round((HEIGHT / 2.) - (u8g2.getUTF8Width(label.c_str()) / 2)));
+              round((HEIGHT / 2.) - (u8g2.getUTF8Width(text) / 2)));
           if (i == 2) {
             disp->fillRect(0, (HEIGHT / 2) - 1, 32, 2, text_color);
           } else if (i == 3) {
@@ -754,27 +694,27 @@ void Display::draw_main() {
         if (i < 2) {
           x = i % 2 == 0 ? 6 + 24 - ((24 - u8g2.getFontAscent()) / 2)
                          : WIDTH - 6 - ((24 - u8g2.getFontAscent()) / 2);
-          y = h_padding + u8g2.getUTF8Width(label.c_str());
+          y = h_padding + u8g2.getUTF8Width(text);
           if (i == 0) {
             disp->fillRect(0, (HEIGHT / 6) - 1, 5, 2, text_color);
             disp->fillRect(3, (HEIGHT / 6), 2,
-                           (u8g2.getUTF8Width(label.c_str()) / 2) + h_padding -
+                           (u8g2.getUTF8Width(text) / 2) + h_padding -
                                (HEIGHT / 6),
                            text_color);
             disp->fillRect(3,
                            (HEIGHT / 6) +
-                               (u8g2.getUTF8Width(label.c_str()) / 2) +
+                               (u8g2.getUTF8Width(text) / 2) +
                                h_padding - (HEIGHT / 6) - 1,
                            5, 2, text_color);
           } else if (i == 1) {
             disp->fillRect(WIDTH - 5, (HEIGHT / 6) - 1, 5, 2, text_color);
             disp->fillRect(WIDTH - 5, (HEIGHT / 6), 2,
-                           (u8g2.getUTF8Width(label.c_str()) / 2) + h_padding -
+                           (u8g2.getUTF8Width(text) / 2) + h_padding -
                                (HEIGHT / 6),
                            text_color);
             disp->fillRect(WIDTH - 8,
                            (HEIGHT / 6) +
-                               (u8g2.getUTF8Width(label.c_str()) / 2) +
+                               (u8g2.getUTF8Width(text) / 2) +
                                h_padding - (HEIGHT / 6) - 1,
                            5, 2, text_color);
           }
@@ -787,11 +727,11 @@ void Display::draw_main() {
                            text_color);  // Quadrat von x=0 bis x=5 und y= 5/6
                                          // HEIGHT -1 bis y= 5/6 HEIGHT +1
             disp->fillRect(3, HEIGHT - (HEIGHT / 6), 2,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - (HEIGHT - (HEIGHT / 6)),
                            text_color);
             disp->fillRect(3,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - 1,
                            5, 2, text_color);
           } else if (i == 5) {
@@ -799,11 +739,11 @@ void Display::draw_main() {
                            text_color);  // Quadrat von x=0 bis x=5 und y= 5/6
                                          // HEIGHT -1 bis y= 5/6 HEIGHT +1
             disp->fillRect(WIDTH - 5, HEIGHT - (HEIGHT / 6), 2,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - (HEIGHT - (HEIGHT / 6)),
                            text_color);
             disp->fillRect(WIDTH - 8,
-                           (HEIGHT - (u8g2.getUTF8Width(label.c_str())) / 2) -
+                           (HEIGHT - (u8g2.getUTF8Width(text)) / 2) -
                                h_padding - 1,
                            5, 2, text_color);
           }
@@ -812,7 +752,7 @@ void Display::draw_main() {
                   ? h_padding + 56 - ((24 - u8g2.getFontAscent()) / 2)
                   : WIDTH - h_padding - 32 - ((24 - u8g2.getFontAscent()) / 2);
           y = static_cast<uint16_t>(
-              round((HEIGHT / 2.) + (u8g2.getUTF8Width(label.c_str()) / 2)));
+              round((HEIGHT / 2.) + (u8g2.getUTF8Width(text) / 2)));
           if (i == 2) {
             disp->fillRect(0, (HEIGHT / 2) - 1, 32, 2, text_color);
           } else if (i == 3) {
@@ -820,22 +760,24 @@ void Display::draw_main() {
           }
         }
       }
-      if (label == "<format_spiffs>" && just_formatted == 0) {
+      if (strcmp(text, "<format_spiffs>") == 0 && just_formatted == 0) {
         info("Formatting icon storage...");
         disp_message("Formatting\nIcon\nStorage...", 0);
         update();
-        SPIFFS.format();
+        mdi_.format();
         just_formatted = 1;
       }
       u8g2.setCursor(x, y);
-      u8g2.print(label.c_str());
+      u8g2.print(text);
     }
   }
-  mdi_.end();
-  disp->display();
+  debug("main screen drawn in %u us", micros() - start);
+  mdi_.log_stats();
+  _refresh();
 }
 
 void Display::draw_info() {
+  TRACE_SCOPE("Display::draw_info");
   disp->setRotation(0);
   disp->setFullWindow();
 
@@ -1012,10 +954,11 @@ void Display::draw_info() {
   }
   u8g2.print(text.c_str());
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_device_info() {
+  TRACE_SCOPE("Display::draw_device_info");
   disp->setRotation(0);
   disp->setFullWindow();
   u8g2.setFontDirection(0);
@@ -1060,10 +1003,11 @@ void Display::draw_device_info() {
   }
   u8g2.setCursor(0, 152);
   u8g2.print(batt_volt.c_str());
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_welcome() {
+  TRACE_SCOPE("Display::draw_welcome");
   disp->setRotation(0);
   disp->setFullWindow();
   u8g2.setFontDirection(0);
@@ -1127,10 +1071,11 @@ void Display::draw_welcome() {
   u8g2.setCursor(0, 294);
   u8g2.print(device_state_.factory().unique_id.c_str());
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_settings() {
+  TRACE_SCOPE("Display::draw_settings");
   disp->setRotation(0);
   disp->setFullWindow();
   u8g2.setFontDirection(0);
@@ -1167,10 +1112,11 @@ void Display::draw_settings() {
   u8g2.setCursor(0, 294);
   u8g2.print(device_state_.factory().unique_id.c_str());
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_ap_config() {
+  TRACE_SCOPE("Display::draw_ap_config");
   UIState::MessageType contents = UIState::MessageType("WIFI:T:WPA;S:") +
                                   device_state_.get_ap_ssid().c_str() +
                                   ";P:" + device_state_.get_ap_password() +
@@ -1234,10 +1180,11 @@ void Display::draw_ap_config() {
   u8g2.setCursor(0, 275);
   u8g2.print(device_state_.get_ap_password());
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_web_config() {
+  TRACE_SCOPE("Display::draw_web_config");
   UIState::MessageType contents =
       UIState::MessageType("http://") + device_state_.ip();
 
@@ -1293,11 +1240,12 @@ void Display::draw_web_config() {
   u8g2.setCursor(0, 260);
   u8g2.print(device_state_.ip());
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_test(const char *text, const char *mdi_name,
                         uint16_t mdi_size) {
+  TRACE_SCOPE("Display::draw_test");
   uint16_t fg, bg;
   fg = GxEPD_BLACK;
   bg = GxEPD_WHITE;
@@ -1312,20 +1260,19 @@ void Display::draw_test(const char *text, const char *mdi_name,
 
   disp->fillScreen(bg);
 
-  mdi_.begin();
   draw_mdi(mdi_name, mdi_size, WIDTH / 2 - mdi_size / 2, 50);
-  mdi_.end();
 
   u8g2.setFont(u8g2_font_helvB24_te);
   uint16_t w = u8g2.getUTF8Width(text);
   u8g2.setCursor(WIDTH / 2 - w / 2, 250);
   u8g2.print(text);
 
-  disp->display();
+  _refresh();
 }
 #else
 void Display::draw_message(const UIState::MessageType &message, bool error,
                            bool large) {
+  TRACE_SCOPE("Display::draw_message");
   disp->setRotation(0);
   disp->setFullWindow();
 
@@ -1354,38 +1301,38 @@ void Display::draw_message(const UIState::MessageType &message, bool error,
     u8g2.setCursor(0, 70);
     u8g2.print(message.c_str());
   }
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_main() {
+  TRACE_SCOPE("Display::draw_main");
+  uint32_t start = micros();
   disp->setRotation(0);
   disp->setFullWindow();
 
   disp->fillScreen(bg_color);
 
-  mdi_.begin();
-
   // Loop through buttons
   for (uint16_t i = 0; i < NUM_BUTTONS; i++) {
-    ButtonLabel label = device_state_.get_btn_label(i);
-    uint16_t size = 100;
+    const LabelDescriptor &desc = device_state_.get_btn_label_desc(i);
+    uint16_t size = desc.icon_size;
     uint16_t x = i % 2 == 0 ? 0 : WIDTH - size;
     uint16_t y = i < 2 ? 0 : HEIGHT - size;
-    if (label.substring(0, 4) == "mdi:") {
-      MDIName icon = label.substring(
-          4, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
-      draw_mdi(icon.c_str(), size, x, y);
+    if (desc.has_icon()) {
+      draw_mdi(desc.icon.c_str(), size, x, y);
     } else {
       draw_mdi("x", size, x, y);
     }
   }
   // disp->drawRect(WIDTH / 2 - 1, 0, 2, HEIGHT, GxEPD_BLACK);
   // disp->drawRect(0, HEIGHT / 2 - 1, WIDTH, 2, GxEPD_BLACK);
-  mdi_.end();
-  disp->display();
+  debug("main screen drawn in %u us", micros() - start);
+  mdi_.log_stats();
+  _refresh();
 }
 
 void Display::draw_info() {
+  TRACE_SCOPE("Display::draw_info");
   disp->setRotation(0);
   disp->setFullWindow();
 
@@ -1414,10 +1361,11 @@ void Display::draw_info() {
   u8g2.setCursor(85, 180);
   u8g2.print(text.c_str());
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_device_info() {
+  TRACE_SCOPE("Display::draw_device_info");
   disp->setRotation(0);
   disp->setFullWindow();
 
@@ -1457,10 +1405,11 @@ void Display::draw_device_info() {
       "Battery: %.2f V", device_state_.sensors().battery_voltage);
   u8g2.setCursor(0, 180);
   u8g2.print(batt_volt.c_str());
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_welcome() {
+  TRACE_SCOPE("Display::draw_welcome");
   disp->setRotation(0);
   disp->setFullWindow();
   u8g2.setBackgroundColor(bg_color);
@@ -1492,10 +1441,11 @@ void Display::draw_welcome() {
   u8g2.setCursor(WIDTH / 2 - w / 2, 198);
   u8g2.print(text);
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_settings() {
+  TRACE_SCOPE("Display::draw_settings");
   disp->setRotation(0);
   disp->setFullWindow();
 
@@ -1512,10 +1462,11 @@ void Display::draw_settings() {
 
   // disp->drawRect(WIDTH / 2 - 1, 0, 2, HEIGHT, GxEPD_BLACK);
   // disp->drawRect(0, HEIGHT / 2 - 1, WIDTH, 2, GxEPD_BLACK);
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_ap_config() {
+  TRACE_SCOPE("Display::draw_ap_config");
   disp->setRotation(0);
   disp->setFullWindow();
   u8g2.setBackgroundColor(bg_color);
@@ -1552,10 +1503,11 @@ void Display::draw_ap_config() {
   u8g2.setCursor(WIDTH / 2 - w / 2, 198);
   u8g2.print(text);
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_web_config() {
+  TRACE_SCOPE("Display::draw_web_config");
   disp->setRotation(0);
   disp->setFullWindow();
   u8g2.setBackgroundColor(bg_color);
@@ -1590,11 +1542,12 @@ void Display::draw_web_config() {
   u8g2.setCursor(WIDTH / 2 - w / 2, 198);
   u8g2.print(text);
 
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_test(const char *text, const char *mdi_name,
                         uint16_t mdi_size) {
+  TRACE_SCOPE("Display::draw_test");
   uint16_t fg, bg;
   fg = GxEPD_BLACK;
   bg = GxEPD_WHITE;
@@ -1608,236 +1561,104 @@ void Display::draw_test(const char *text, const char *mdi_name,
 
   disp->fillScreen(bg);
 
-  mdi_.begin();
   draw_mdi(mdi_name, mdi_size, WIDTH / 2 - mdi_size / 2, 20);
-  mdi_.end();
 
   u8g2.setFont(u8g2_font_helvB24_te);
   uint16_t w = u8g2.getUTF8Width(text);
   u8g2.setCursor(WIDTH / 2 - w / 2, 175);
   u8g2.print(text);
 
-  disp->display();
+  _refresh();
 }
 #endif
 
 void Display::draw_white() {
+  TRACE_SCOPE("Display::draw_white");
   disp->setFullWindow();
   disp->fillScreen(GxEPD_WHITE);
-  disp->display();
+  _refresh();
 }
 
 void Display::draw_black() {
+  TRACE_SCOPE("Display::draw_black");
   disp->setFullWindow();
   disp->fillScreen(GxEPD_BLACK);
-  disp->display();
+  _refresh();
 }
 
 // based on GxEPD2_Spiffs_Example.ino - drawBitmapFromSpiffs_Buffered()
-// Warning - SPIFFS.begin() must be called before this function
-bool Display::draw_bmp(File &file, int16_t x, int16_t y, int16_t rotation) {
-  uint32_t startTime = millis();
-  if (!file) {
-    error("error opening file");
-    return false;
+void Display::draw_mdi(const char *name, uint16_t size, int16_t x, int16_t y,
+                       int16_t rotation) {
+  TRACE_SCOPE("Display::draw_mdi");
+  const IconBitmap *bitmap = mdi_.get_bitmap(name, size);
+  if (bitmap != nullptr) {
+    draw_icon_bitmap(*bitmap, x, y, rotation);
+    return;
+  }
+  error("Could not draw icon: %s", name);
+  if (size == 64) {
+    disp->drawXBitmap(x, y, file_question_outline_64x64, 64, 64, text_color);
+  } else if (size == 48) {
+    disp->drawXBitmap(x, y, file_question_outline_48x48, 48, 48, text_color);
+  } else if (size == 100) {
+    disp->drawXBitmap(x, y, file_question_outline_100x100, 100, 100,
+                      text_color);
+  }
+}
+
+void Display::draw_icon_bitmap(const IconBitmap &bitmap, int16_t x, int16_t y,
+                               int16_t rotation) {
+  if (rotation == 0) {
+    disp->drawXBitmap(x, y, bitmap.data, bitmap.width, bitmap.height,
+                      text_color);
+    return;
   }
-  bool valid = false;  // valid format to be handled
-  bool flip = true;    // bitmap is stored bottom-to-top
-  if ((x >= disp->width()) || (y >= disp->height())) return false;
-
-  // Parse BMP header
-  if (read16(file) == 0x4D42) {
-    debug("BMP signature detected");
-    uint32_t fileSize = read32(file);
-    uint32_t creatorBytes = read32(file);
-    (void)creatorBytes;                   // unused
-    uint32_t imageOffset = read32(file);  // Start of image data
-    uint32_t headerSize = read32(file);
-    uint32_t width = read32(file);
-    int32_t height = (int32_t)read32(file);
-    uint16_t planes = read16(file);
-    uint16_t depth = read16(file);  // bits per pixel
-    uint32_t format = read32(file);
-    if ((planes == 1) && ((format == 0) || (format == 3))) {
-      debug("BMP Image Offset: %d", imageOffset);
-      debug("BMP Header size: %d", headerSize);
-      debug("BMP File size: %d", fileSize);
-      debug("BMP Bit Depth: %d", depth);
-      debug("BMP Image size: %d x %d", width, height);
-      // BMP rows are padded (if needed) to 4-byte boundary
-      uint32_t rowSize = (width * depth / 8 + 3) & ~3;
-      if (depth < 8) rowSize = ((width * depth + 8 - depth) / 8 + 3) & ~3;
-      if (height < 0) {
-        height = -height;
-        flip = false;
+  uint16_t w = bitmap.width;
+  uint16_t h = bitmap.height;
+  uint16_t stride = (w + 7) / 8;
+  for (uint16_t row = 0; row < h; row++) {
+    for (uint16_t col = 0; col < w; col++) {
+      if (!(bitmap.data[row * stride + col / 8] & (1 << (col % 8)))) {
+        continue;
       }
-      uint16_t w = width;
-      uint16_t h = height;
-      if ((x + w - 1) >= disp->width()) w = disp->width() - x;
-      if ((y + h - 1) >= disp->height()) h = disp->height() - y;
-      valid = true;
-      uint8_t bitmask = 0xFF;
-      uint8_t bitshift = 8 - depth;
-      uint16_t red, green, blue;
-      bool whitish = false;
-      bool colored = false;
-      if (depth <= 8) {
-        if (depth < 8) bitmask >>= depth;
-        file.seek(imageOffset - (4 << depth));
-        for (uint16_t pn = 0; pn < (1 << depth); pn++) {
-          blue = file.read();
-          green = file.read();
-          red = file.read();
-          file.read();
-          whitish = (red + green + blue) > 3 * 0x80;
-          // reddish or yellowish?
-          colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-          if (0 == pn % 8) mono_palette_buffer[pn / 8] = 0;
-          mono_palette_buffer[pn / 8] |= whitish << pn % 8;
-          if (0 == pn % 8) color_palette_buffer[pn / 8] = 0;
-          color_palette_buffer[pn / 8] |= colored << pn % 8;
-          rgb_palette_buffer[pn] = ((red & 0xF8) << 8) | ((green & 0xFC) << 3) |
-                                   ((blue & 0xF8) >> 3);
-        }
+      uint16_t xadd = col;
+      uint16_t yadd = row;
+      // 90 degree ccw
+      if (rotation == 90) {
+        xadd = h - row;
+        yadd = col;
       }
-      uint32_t rowPosition =
-          flip ? imageOffset + (height - h) * rowSize : imageOffset;
-
-      for (uint16_t row = 0; row < h;
-           row++, rowPosition += rowSize)  // for each line
-      {
-        uint32_t in_remain = rowSize;
-        uint32_t in_idx = 0;
-        uint32_t in_bytes = 0;
-        uint8_t in_byte = 0;  // for depth <= 8
-        uint8_t in_bits = 0;  // for depth <= 8
-        uint16_t color = GxEPD_WHITE;
-        file.seek(rowPosition);
-        for (uint16_t col = 0; col < w; col++)  // for each pixel
-        {
-          // Time to read more pixel data?
-          if (in_idx >= in_bytes)  // ok, exact match for 24bit also (size
-                                   // IS multiple of 3)
-          {
-            in_bytes = file.read(input_buffer, in_remain > sizeof(input_buffer)
-                                                   ? sizeof(input_buffer)
-                                                   : in_remain);
-            in_remain -= in_bytes;
-            in_idx = 0;
-          }
-          switch (depth) {
-            case 24:
-              blue = input_buffer[in_idx++];
-              green = input_buffer[in_idx++];
-              red = input_buffer[in_idx++];
-              whitish = (red + green + blue) > 3 * 0x80;
-              // reddish or yellowish?
-              colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-              color = ((red & 0xF8) << 8) | ((green & 0xFC) << 3) |
-                      ((blue & 0xF8) >> 3);
-              break;
-            case 16: {
-              uint8_t lsb = input_buffer[in_idx++];
-              uint8_t msb = input_buffer[in_idx++];
-              if (format == 0)  // 555
-              {
-                blue = (lsb & 0x1F) << 3;
-                green = ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2);
-                red = (msb & 0x7C) << 1;
-                color = ((red & 0xF8) << 8) | ((green & 0xFC) << 3) |
-                        ((blue & 0xF8) >> 3);
-              } else  // 565
-              {
-                blue = (lsb & 0x1F) << 3;
-                green = ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3);
-                red = (msb & 0xF8);
-                color = (msb << 8) | lsb;
-              }
-              whitish = (red + green + blue) > 3 * 0x80;
-              // reddish or yellowish?
-              colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-            } break;
-            case 1:
-            case 4:
-            case 8: {
-              if (0 == in_bits) {
-                in_byte = input_buffer[in_idx++];
-                in_bits = 8;
-              }
-              uint16_t pn = (in_byte >> bitshift) & bitmask;
-              whitish = mono_palette_buffer[pn / 8] & (0x1 << pn % 8);
-              colored = color_palette_buffer[pn / 8] & (0x1 << pn % 8);
-              in_byte <<= depth;
-              in_bits -= depth;
-              color = rgb_palette_buffer[pn];
-            } break;
-          }
-          if (whitish) {
-            color = GxEPD_WHITE;
-          } else if (colored) {
-            color = GxEPD_COLORED;
-          } else {
-            color = GxEPD_BLACK;
-          }
-
-          uint16_t yadd = (flip ? h - row - 1 : row);
-          uint16_t xadd = col;
-
-          // 90 degree ccw
-          if (rotation == 90) {
-            xadd = h - yadd;
-            yadd = col;
-          }
-
-          // 180 degree ccw
-          if (rotation == 180) {
-            xadd = w - col;
-            yadd = h - yadd;
-          }
-
-          // 270 degree ccw = 90 degree cw
-          if (rotation == 270) {
-            xadd = yadd;
-            yadd = w - col;
-          }
-
-          disp->drawPixel(x + xadd, y + yadd, color);
-        }  // end pixel
-      }  // end line
+      // 180 degree ccw
+      if (rotation == 180) {
+        xadd = w - col;
+        yadd = h - row;
+      }
+      // 270 degree ccw = 90 degree cw
+      if (rotation == 270) {
+        xadd = row;
+        yadd = w - col;
+      }
+      disp->drawPixel(x + xadd, y + yadd, text_color);
     }
   }
-  file.close();
-  if (!valid) {
-    error("BMP format not valid.");
-  }
-  debug("BMP loaded in %lu ms", millis() - startTime);
-  return valid;
 }
 
-void Display::draw_mdi(const char *name, uint16_t size, int16_t x, int16_t y,
-                       int16_t rotation) {
-  bool draw_placeholder = false;
-  File file;
-  if (mdi_.exists(name, size)) {
-    File file = mdi_.get_file(name, size);
-    if (!draw_bmp(file, x, y, rotation)) {
-      error("Could not draw icon: %s", name);
-      // file might be corrupted - remove so it will be downloaded again
-      mdi_.remove(name, size);
-      draw_placeholder = true;
-    }
-  } else {
-    error("Icon not found: %s", name);
-    draw_placeholder = true;
-  }
-  if (draw_placeholder) {
-    if (size == 64) {
-      disp->drawXBitmap(x, y, file_question_outline_64x64, 64, 64, text_color);
-    } else if (size == 48) {
-      disp->drawXBitmap(x, y, file_question_outline_48x48, 48, 48, text_color);
-    } else if (size == 100) {
-      disp->drawXBitmap(x, y, file_question_outline_100x100, 100, 100,
-                        text_color);
-    }
+void Display::set_label_font(uint8_t font_level) {
+  switch (font_level) {
+    case 0:
+      u8g2.setFont(u8g2_font_helvB24_te);
+      break;
+    case 1:
+      u8g2.setFont(u8g2_font_helvB18_te);
+      break;
+    case 2:
+      u8g2.setFont(u8g2_font_helvB12_te);
+      break;
+    case 3:
+      u8g2.setFont(u8g2_font_helvB10_te);
+      break;
+    default:
+      u8g2.setFont(u8g2_font_helvB08_te);
+      break;
   }
 }
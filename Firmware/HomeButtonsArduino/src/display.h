@@ -6,12 +6,9 @@
 #include "state.h"
 #include "logger.h"
 #include "mdi_helper.h"
+#include "power.h"
 #include "types.h"
 
-// parameters for draw_bmp()
-static constexpr uint16_t input_buffer_pixels = 800;
-static constexpr uint16_t max_palette_pixels = 256;
-
 struct HardwareDefinition;
 
 class DeviceState;
@@ -51,6 +48,9 @@ class Display : public Logger {
   void begin(HardwareDefinition& HW);
   void end();
   void update();
+  // Blocks the calling task until update() has something to do: a new
+  // command, end() or the timeout of a disappearing message.
+  void wait();
 
   void disp_message(const char* message, uint32_t duration = 0);
   void disp_message_large(const char* message, uint32_t duration = 0);
@@ -75,8 +75,6 @@ class Display : public Logger {
   bool busy() { return redraw_in_progress; }
 
  private:
-  enum class LabelType : uint8_t { Text, Icon, Mixed };
-
   State state = State::IDLE;
 
   UIState current_ui_state = {};
@@ -86,6 +84,7 @@ class Display : public Logger {
 
   bool new_ui_cmd = false;
   bool redraw_in_progress = false;
+  TaskHandle_t task_ = nullptr;  // notified by the commands, set by wait()
 
   uint16_t text_color = GxEPD_BLACK;
   uint16_t bg_color = GxEPD_WHITE;
@@ -94,19 +93,13 @@ class Display : public Logger {
 
   const DeviceState& device_state_;
   MDIHelper& mdi_;
-
-  // ### buffers for draw_bmp()
-  // up to depth 24
-  uint8_t input_buffer[3 * input_buffer_pixels];
-  // palette buffer for depth <= 8 b/w
-  uint8_t mono_palette_buffer[max_palette_pixels / 8];
-  // palette buffer for depth <= 8 c/w
-  uint8_t color_palette_buffer[max_palette_pixels / 8];
-  // palette buffer for depth <= 8 for buffered graphics, needed for 7-color
-  // display
-  uint16_t rgb_palette_buffer[max_palette_pixels];
+  power::CpuRequest render_cpu_;
 
   void set_cmd_state(UIState cmd);
+  void _notify();
+  TickType_t _until_update() const;
+  // sends the buffer and waits for the panel
+  void _refresh();
 
   void draw_message(const UIState::MessageType& message, bool error = false,
                     bool large = false);
@@ -120,7 +113,10 @@ class Display : public Logger {
   void draw_test(const char* text, const char* mdi_name, uint16_t mdi_size);
   void draw_white();
   void draw_black();
-  bool draw_bmp(File& file, int16_t x, int16_t y, int16_t rotation = 0);
+  void draw_icon_bitmap(const IconBitmap& bitmap, int16_t x, int16_t y,
+                        int16_t rotation = 0);
+  // font for a label forced smaller with leading underscores
+  void set_label_font(uint8_t font_level);
   void draw_mdi(const char* name, uint16_t size, int16_t x, int16_t y, int16_t rotation = 0);
 };
 
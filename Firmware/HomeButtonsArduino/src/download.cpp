@@ -1,12 +1,14 @@
 #include "download.h"
 
 #include <stdint.h>
+#include <WiFi.h>
 #include <WiFiClientSecure.h>
 
 #include <HTTPClient.h>
 
 #include "config.h"
 #include "logger.h"
+#include "power.h"
 #include "static_string.h"
 
 static constexpr uint32_t DOWNLOAD_TIMEOUT = 5000;
@@ -16,7 +18,25 @@ bool download::download_file_https(const char* host, const char* url,
                                    File& file, const char* certificate) {
   static Logger logger("Download");
 
-  // Send a GET request for the BMP file
+  int totalBytes = 0;
+  bool ret = download_stream(url, [&file, &totalBytes](const uint8_t* data,
+                                                       size_t len) {
+    totalBytes += len;
+    return file.write(data, len) == len;
+  });
+  file.close();
+  if (ret) {
+    logger.debug("Wrote %d bytes", totalBytes);
+  }
+  return ret;
+}
+
+bool download::download_stream(
+    const char* url, std::function<bool(const uint8_t*, size_t)> on_data) {
+  static Logger logger("Download");
+  power::CpuRequest compute(power::CpuProfile::COMPUTE);
+
+  // Send a GET request
   HTTPClient https;
   https.setConnectTimeout(DOWNLOAD_TIMEOUT);
   https.setTimeout(DOWNLOAD_TIMEOUT);
@@ -28,39 +48,45 @@ bool download::download_file_https(const char* host, const char* url,
     return false;
   }
 
-  // Write the BMP data to the file
+  // Pass the data on as it arrives, size is -1 if not sent by server
   WiFiClient* stream = https.getStreamPtr();
+  int size = https.getSize();
   int totalBytes = 0;
   uint32_t start_time = millis();
-  while (https.connected() && (totalBytes < https.getSize())) {
+  while (https.connected() && (size < 0 || totalBytes < size)) {
     if (stream->available()) {
       uint8_t buffer[DOWNLOAD_BUFFER_SIZE];
       int bytesRead = stream->readBytes(buffer, sizeof(buffer));
       if (bytesRead == 0) {
         break;
       }
-      file.write(buffer, bytesRead);
+      if (!on_data(buffer, bytesRead)) {
+        logger.error("Failed to process data");
+        https.end();
+        return false;
+      }
       totalBytes += bytesRead;
     }
     if (millis() - start_time > DOWNLOAD_TIMEOUT) {
       logger.error("Download timed out");
       https.end();
-      file.close();
       return false;
     }
     delay(1);
   }
-  file.close();
-  logger.debug("Wrote %d bytes", totalBytes);
-
   https.end();
-  logger.debug("Disconnected from server");
+  logger.debug("Received %d bytes, disconnected from server", totalBytes);
+  if (size >= 0 && totalBytes < size) {
+    logger.error("Connection closed after %d of %d bytes", totalBytes, size);
+    return false;
+  }
   return true;
 }
 
 bool download::check_connection(const char* host, const char* url,
                                 const char* certificate) {
   static Logger logger("Download");
+  power::CpuRequest compute(power::CpuProfile::COMPUTE);
 
   // Send a GET request for the BMP file
   HTTPClient https;
@@ -75,4 +101,18 @@ bool download::check_connection(const char* host, const char* url,
     return true;
   }
   https.end();
-}
\ No newline at end of file
+}
+
+bool download::is_on_local_subnet(const char* host) {
+  static Logger logger("Download");
+
+  IPAddress ip;
+  if (!ip.fromString(host) && !WiFi.hostByName(host, ip)) {
+    logger.warning("Failed to resolve '%s'", host);
+    return false;
+  }
+  uint32_t mask = WiFi.subnetMask();
+  bool local = (uint32_t(ip) & mask) == (uint32_t(WiFi.localIP()) & mask);
+  logger.debug("'%s' is %son local subnet", host, local ? "" : "not ");
+  return local;
+}
@@ -3,11 +3,20 @@
 
 #include <FS.h>
 
+#include <functional>
+
 namespace download {
 bool download_file_https(const char* host, const char* url, File& file,
                          const char* certificate);
 
+// Streams the response body to on_data, stops if it returns false.
+bool download_stream(const char* url,
+                     std::function<bool(const uint8_t*, size_t)> on_data);
+
 bool check_connection(const char* host, const char* url,
                       const char* certificate);
+
+// True if host (IP or name) is on the subnet of the Wi-Fi interface.
+bool is_on_local_subnet(const char* host);
 }  // namespace download
 #endif
@@ -6,11 +6,11 @@
 #include <Preferences.h>
 #include <ArduinoJson.h>
 
-#include <PubSubClient.h>
 #include <WiFi.h>
 
 #include "display.h"
 #include "hardware.h"
+#include "mqtt_transport.h"
 
 static constexpr char FAC_TEST_BASE_TOPIC[] = "homebuttons-factory/devices";
 static constexpr uint16_t TEST_ICON_SIZE = 100;
@@ -96,12 +96,10 @@ bool FactoryTest::run_test(HardwareDefinition& HW, Display& display) {
   display.disp_message_large("FACTORY");
   display.update();
 
-  WiFiClient wifi_client;
-  PubSubClient mqtt_client(wifi_client);
-  mqtt_client.setCallback(
+  static MQTTTransport mqtt_client;  // too large for the stack
+  mqtt_client.set_callback(
       std::bind(&FactoryTest::_mqtt_callback, this, std::placeholders::_1,
                 std::placeholders::_2, std::placeholders::_3));
-  mqtt_client.setBufferSize(1024);
 
   WiFi.mode(WIFI_STA);
   WiFi.persistent(false);
@@ -118,11 +116,16 @@ bool FactoryTest::run_test(HardwareDefinition& HW, Display& display) {
   info("Connecting to MQTT...");
   info("mqtt_server %s, port %d", params.mqtt_server.toString().c_str(),
        params.mqtt_port);
-  mqtt_client.setServer(params.mqtt_server, params.mqtt_port);
+  mqtt_client.set_server(params.mqtt_server.toString().c_str(),
+                         params.mqtt_port);
   while (!mqtt_client.connected()) {
     mqtt_client.connect(HW.get_unique_id(), params.mqtt_user.c_str(),
-                        params.mqtt_password.c_str());
-    delay(100);
+                        params.mqtt_password.c_str(), true);
+    uint32_t start_time = millis();
+    while (!mqtt_client.connected() && millis() - start_time < MQTT_TIMEOUT) {
+      mqtt_client.loop();
+      delay(10);
+    }
   }
   info("MQTT connected");
 
@@ -142,7 +145,7 @@ bool FactoryTest::run_test(HardwareDefinition& HW, Display& display) {
   serializeJson(device_doc, buffer, sizeof(buffer));
 
   StaticString<256> topic("%s/%s", FAC_TEST_BASE_TOPIC, HW.get_serial_number());
-  mqtt_client.publish(topic.c_str(), buffer);
+  mqtt_client.publish(topic.c_str(), buffer, false);
 
   // wait for test start message
   while (!test_spec_.received) {
@@ -252,7 +255,7 @@ bool FactoryTest::run_test(HardwareDefinition& HW, Display& display) {
 
   StaticString<256> result_topic("%s/%s/test_result", FAC_TEST_BASE_TOPIC,
                                  HW.get_serial_number());
-  mqtt_client.publish(result_topic.c_str(), buffer);
+  mqtt_client.publish(result_topic.c_str(), buffer, false);
 
   if (passed) {
     info("factory test passed");
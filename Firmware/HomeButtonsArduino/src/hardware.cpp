@@ -1,5 +1,6 @@
 #include "hardware.h"
 #include "logger.h"
+#include "trace.h"
 #include "esp_efuse.h"
 #include "esp_efuse_custom_table.h"
 
@@ -334,6 +335,7 @@ uint8_t HardwareDefinition::read_battery_percent() {
 
 void HardwareDefinition::read_temp_hmd(float &temp, float &hmd,
                                        const bool fahrenheit) {
+  TRACE_SCOPE("HardwareDefinition::read_temp_hmd");
   shtc3_wire.begin(
       (int)SDA,
       (int)SCL);  // must be cast to int otherwise wrong begin() is called
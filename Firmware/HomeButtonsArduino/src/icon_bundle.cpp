@@ -0,0 +1,92 @@
+#include "icon_bundle.h"
+
+#include <algorithm>
+#include <cstring>
+
+constexpr char IconBundleHeader::MAGIC[4];
+
+bool IconBundleParser::feed(const uint8_t* data, size_t len) {
+  while (len > 0 || state_ == State::DATA) {
+    switch (state_) {
+      case State::HEADER:
+        if (!_read_fixed(data, len, &header_, sizeof(header_))) {
+          return true;
+        }
+        if (memcmp(header_.magic, IconBundleHeader::MAGIC,
+                   sizeof(header_.magic)) != 0 ||
+            header_.count > MAX_ENTRIES) {
+          return _error();
+        }
+        state_ = header_.count > 0 ? State::TABLE : State::DONE;
+        break;
+      case State::TABLE: {
+        if (!_read_fixed(data, len, entries_,
+                         sizeof(IconBundleEntry) * header_.count)) {
+          return true;
+        }
+        for (uint16_t i = 0; i < header_.count; i++) {
+          entries_[i].name[sizeof(entries_[i].name) - 1] = '\0';
+        }
+        current_ = 0;
+        state_ = State::DATA;
+        if (!_start_icon()) {
+          return _error();
+        }
+      } break;
+      case State::DATA: {
+        const IconBundleEntry& entry = entries_[current_];
+        size_t n = std::min<size_t>(len, entry.length - fill_);
+        if (n > 0) {
+          if (!on_data_(data, n)) {
+            return _error();
+          }
+          data += n;
+          len -= n;
+          fill_ += n;
+        }
+        if (fill_ < entry.length) {
+          return true;
+        }
+        if (!on_end_(entry)) {
+          return _error();
+        }
+        current_++;
+        if (current_ >= header_.count) {
+          state_ = State::DONE;
+        } else if (!_start_icon()) {
+          return _error();
+        }
+      } break;
+      case State::DONE:
+        // trailing data
+        return _error();
+      case State::ERROR:
+        return false;
+    }
+  }
+  return state_ != State::ERROR;
+}
+
+bool IconBundleParser::_read_fixed(const uint8_t*& data, size_t& len,
+                                   void* dst, size_t dst_len) {
+  size_t n = std::min(len, dst_len - fill_);
+  memcpy(static_cast<uint8_t*>(dst) + fill_, data, n);
+  data += n;
+  len -= n;
+  fill_ += n;
+  if (fill_ < dst_len) {
+    return false;
+  }
+  fill_ = 0;
+  return true;
+}
+
+bool IconBundleParser::_start_icon() {
+  fill_ = 0;
+  return on_begin_(entries_[current_]);
+}
+
+bool IconBundleParser::_error() {
+  state_ = State::ERROR;
+  return false;
+}
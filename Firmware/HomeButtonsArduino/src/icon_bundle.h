@@ -0,0 +1,69 @@
+#ifndef HOMEBUTTONS_ICON_BUNDLE_H
+#define HOMEBUTTONS_ICON_BUNDLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Icon bundle served by an icon mirror (see tools/icon_mirror.py).
+// All values little endian:
+//
+//   header:  magic "HBB1", uint16 count, uint16 reserved
+//   table:   count x {char name[48], uint16 size, uint16 reserved,
+//                     uint32 length}
+//   data:    BMP files concatenated in table order
+//
+// Icons the mirror doesn't have are left out of the table.
+struct __attribute__((packed)) IconBundleHeader {
+  static constexpr char MAGIC[4] = {'H', 'B', 'B', '1'};
+
+  char magic[4];
+  uint16_t count;
+  uint16_t reserved;
+};
+
+struct __attribute__((packed)) IconBundleEntry {
+  char name[48];  // null terminated
+  uint16_t size;
+  uint16_t reserved;
+  uint32_t length;
+};
+
+// Incremental parser, data can be fed in chunks of any size.
+class IconBundleParser {
+ public:
+  static constexpr uint8_t MAX_ENTRIES = 24;
+
+  using BeginCallback = std::function<bool(const IconBundleEntry& entry)>;
+  using DataCallback = std::function<bool(const uint8_t* data, size_t len)>;
+  using EndCallback = std::function<bool(const IconBundleEntry& entry)>;
+
+  IconBundleParser(BeginCallback on_begin, DataCallback on_data,
+                   EndCallback on_end)
+      : on_begin_(on_begin), on_data_(on_data), on_end_(on_end) {}
+
+  // Returns false on malformed data or if a callback returned false.
+  bool feed(const uint8_t* data, size_t len);
+  bool done() const { return state_ == State::DONE; }
+  uint16_t count() const { return header_.count; }
+
+ private:
+  enum class State { HEADER, TABLE, DATA, DONE, ERROR };
+
+  BeginCallback on_begin_;
+  DataCallback on_data_;
+  EndCallback on_end_;
+
+  State state_ = State::HEADER;
+  IconBundleHeader header_ = {};
+  IconBundleEntry entries_[MAX_ENTRIES] = {};
+  size_t fill_ = 0;  // bytes of current header/table/icon consumed
+  uint16_t current_ = 0;
+
+  bool _read_fixed(const uint8_t*& data, size_t& len, void* dst,
+                   size_t dst_len);
+  bool _start_icon();
+  bool _error();
+};
+
+#endif  // HOMEBUTTONS_ICON_BUNDLE_H
@@ -0,0 +1,231 @@
+#include "icon_receiver.h"
+
+#include <esp_rom_crc.h>
+
+#include "config.h"
+
+static constexpr uint32_t BMP_HEADER_SIZE = 14 + 40 + 2 * 4;
+
+constexpr char IconChunkHeader::MAGIC[4];
+
+static uint32_t bmp_row_size(uint16_t width) {
+  return (((width + 7) / 8) + 3) & ~3;
+}
+
+IconReceiver::IconReceiver(MDIHelper& mdi) : Logger("ICON"), mdi_(mdi) {
+  mutex_ = xSemaphoreCreateMutex();
+}
+
+IconReceiver::Result IconReceiver::handle_chunk(const uint8_t* data,
+                                                uint32_t length,
+                                                uint32_t offset) {
+  xSemaphoreTake(mutex_, portMAX_DELAY);
+  Result ret = _handle_chunk(data, length, offset);
+  xSemaphoreGive(mutex_);
+  return ret;
+}
+
+void IconReceiver::abort() {
+  xSemaphoreTake(mutex_, portMAX_DELAY);
+  if (active_) {
+    warning("aborting upload of '%s'", name_.c_str());
+    _fail();
+  }
+  xSemaphoreGive(mutex_);
+}
+
+bool IconReceiver::busy() {
+  xSemaphoreTake(mutex_, portMAX_DELAY);
+  if (active_ && millis() - last_chunk_time_ > ICON_UPLOAD_TIMEOUT) {
+    error("upload timed out");
+    _fail();
+  }
+  bool ret = active_;
+  xSemaphoreGive(mutex_);
+  return ret;
+}
+
+IconReceiver::Result IconReceiver::_handle_chunk(const uint8_t* data,
+                                                 uint32_t length,
+                                                 uint32_t offset) {
+  if (offset > 0) {
+    // rest of a chunk too large for one MQTT receive buffer
+    if (offset != message_pos_) {
+      error("unexpected piece at offset %u", offset);
+      return _fail();
+    }
+    message_pos_ += length;
+    if (!active_) {
+      return Result::IN_PROGRESS;  // the chunk failed already, ignore the rest
+    }
+    return _handle_bitmap(data, length);
+  }
+  message_pos_ = length;
+  if (length < sizeof(IconChunkHeader)) {
+    error("chunk too short: %u", length);
+    return _fail();
+  }
+  IconChunkHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, IconChunkHeader::MAGIC, sizeof(header.magic)) !=
+      0) {
+    error("invalid chunk magic");
+    return _fail();
+  }
+  header.name[sizeof(header.name) - 1] = '\0';
+
+  if (header.offset == 0) {
+    Result ret = _start(header);
+    if (ret != Result::IN_PROGRESS) {
+      return ret;
+    }
+  } else if (!active_ || !(name_ == header.name) || size_ != header.size ||
+             header.offset != received_) {
+    error("unexpected chunk '%s' size %d offset %u", header.name, header.size,
+          header.offset);
+    return _fail();
+  }
+
+  return _handle_bitmap(data + sizeof(IconChunkHeader),
+                        length - sizeof(IconChunkHeader));
+}
+
+IconReceiver::Result IconReceiver::_handle_bitmap(const uint8_t* bitmap,
+                                                  uint32_t bitmap_len) {
+  if (received_ + bitmap_len > total_len_) {
+    error("chunk exceeds icon length");
+    return _fail();
+  }
+  if (!_write_bitmap(bitmap, bitmap_len)) {
+    error("failed to write icon");
+    return _fail();
+  }
+  crc_ = esp_rom_crc32_le(crc_, bitmap, bitmap_len);
+  received_ += bitmap_len;
+  last_chunk_time_ = millis();
+  debug("received %u/%u bytes", received_, total_len_);
+
+  if (received_ < total_len_) {
+    return Result::IN_PROGRESS;
+  }
+
+  file_.close();
+  active_ = false;
+  if (crc_ != crc_expected_) {
+    error("CRC mismatch: 0x%08x != 0x%08x", crc_, crc_expected_);
+    mdi_.abort_upload();
+    return Result::ERROR;
+  }
+  if (!mdi_.finish_upload(name_.c_str(), size_)) {
+    return Result::ERROR;
+  }
+  info("received '%s' size %d", name_.c_str(), size_);
+  return Result::DONE;
+}
+
+IconReceiver::Result IconReceiver::_start(const IconChunkHeader& header) {
+  if (active_) {
+    warning("restarting upload, '%s' incomplete", name_.c_str());
+    _fail();
+  }
+  if (!mdi_.has_size(header.size)) {
+    error("size %d not supported", header.size);
+    return _fail();
+  }
+  if (header.width == 0 || header.height == 0 || header.width > header.size ||
+      header.height > header.size ||
+      header.total_len != (header.width + 7) / 8 * uint32_t{header.height}) {
+    error("invalid dimensions %dx%d, length %u", header.width, header.height,
+          header.total_len);
+    return _fail();
+  }
+  if (mdi_.get_builtin(header.name, header.size) != nullptr) {
+    warning("'%s' size %d is built in, pushed icon will not be used",
+            header.name, header.size);
+  }
+
+  name_ = header.name;
+  size_ = header.size;
+  width_ = header.width;
+  height_ = header.height;
+  total_len_ = header.total_len;
+  crc_expected_ = header.crc32;
+  received_ = 0;
+  crc_ = 0;
+
+  file_ = mdi_.begin_upload(BMP_HEADER_SIZE + bmp_row_size(width_) * height_);
+  if (!file_) {
+    return _fail();
+  }
+  active_ = true;
+  if (!_write_bmp_header()) {
+    error("failed to write BMP header");
+    return _fail();
+  }
+  info("receiving '%s' size %d (%ux%u)", name_.c_str(), size_, width_,
+       height_);
+  return Result::IN_PROGRESS;
+}
+
+bool IconReceiver::_write_bmp_header() {
+  uint32_t image_size = bmp_row_size(width_) * height_;
+  uint8_t header[BMP_HEADER_SIZE] = {};
+  auto put16 = [&header](size_t pos, uint16_t v) {
+    header[pos] = v & 0xFF;
+    header[pos + 1] = v >> 8;
+  };
+  auto put32 = [&header](size_t pos, uint32_t v) {
+    for (size_t i = 0; i < 4; i++) {
+      header[pos + i] = (v >> (8 * i)) & 0xFF;
+    }
+  };
+  // file header
+  put16(0, 0x4D42);
+  put32(2, BMP_HEADER_SIZE + image_size);
+  put32(10, BMP_HEADER_SIZE);
+  // info header, negative height = stored top to bottom
+  put32(14, 40);
+  put32(18, width_);
+  put32(22, static_cast<uint32_t>(-static_cast<int32_t>(height_)));
+  put16(26, 1);
+  put16(28, 1);
+  put32(34, image_size);
+  put32(46, 2);
+  // palette: 0 = white, 1 = black
+  put32(54, 0x00FFFFFF);
+  put32(58, 0x00000000);
+  return file_.write(header, sizeof(header)) == sizeof(header);
+}
+
+bool IconReceiver::_write_bitmap(const uint8_t* data, uint32_t length) {
+  static constexpr uint8_t PADDING[3] = {};
+  uint32_t stride = (width_ + 7) / 8;
+  uint32_t padding = bmp_row_size(width_) - stride;
+  uint32_t pos = received_;
+  while (length > 0) {
+    uint32_t row_pos = pos % stride;
+    uint32_t n = std::min(length, stride - row_pos);
+    if (file_.write(data, n) != n) {
+      return false;
+    }
+    if (row_pos + n == stride && padding > 0 &&
+        file_.write(PADDING, padding) != padding) {
+      return false;
+    }
+    data += n;
+    length -= n;
+    pos += n;
+  }
+  return true;
+}
+
+IconReceiver::Result IconReceiver::_fail() {
+  if (file_) {
+    file_.close();
+  }
+  if (active_) {
+    mdi_.abort_upload();
+  }
+  active_ = false;
+  return Result::ERROR;
+}
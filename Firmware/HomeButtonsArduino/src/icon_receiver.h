@@ -0,0 +1,74 @@
+#ifndef HOMEBUTTONS_ICON_RECEIVER_H
+#define HOMEBUTTONS_ICON_RECEIVER_H
+
+#include <SPIFFS.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "logger.h"
+#include "mdi_helper.h"
+#include "types.h"
+
+// Header of a single icon chunk published to cmd/icon (little endian).
+// The bitmap is 1 bpp, rows top to bottom, MSB first, each row padded to a
+// full byte, set bit = black. Icons larger than one MQTT message are either
+// split into chunks, which must be published in order, or sent as a single
+// chunk which the transport streams in pieces.
+struct __attribute__((packed)) IconChunkHeader {
+  static constexpr char MAGIC[4] = {'H', 'B', 'I', '1'};
+
+  char magic[4];
+  char name[48];  // null terminated
+  uint16_t size;
+  uint16_t width;
+  uint16_t height;
+  uint32_t total_len;  // bitmap length of the whole icon
+  uint32_t offset;     // offset of this chunk within the bitmap
+  uint32_t crc32;      // CRC-32 (IEEE 802.3) of the whole bitmap
+};
+
+// Writes pushed icons directly into the icon store, one chunk at a time.
+// Chunks arrive on the network task, busy() and abort() are called from the
+// main task.
+class IconReceiver : public Logger {
+ public:
+  enum class Result { IN_PROGRESS, DONE, ERROR };
+
+  explicit IconReceiver(MDIHelper& mdi);
+
+  // offset of data within the MQTT message, > 0 for the following pieces of
+  // a streamed message
+  Result handle_chunk(const uint8_t* data, uint32_t length,
+                      uint32_t offset = 0);
+  void abort();
+  bool busy();
+
+  const MDIName& name() const { return name_; }
+  uint16_t size() const { return size_; }
+
+ private:
+  MDIHelper& mdi_;
+  SemaphoreHandle_t mutex_ = nullptr;
+  File file_;
+  bool active_ = false;
+  uint32_t message_pos_ = 0;  // expected offset of the next piece
+  uint32_t last_chunk_time_ = 0;
+
+  MDIName name_{};
+  uint16_t size_ = 0;
+  uint16_t width_ = 0;
+  uint16_t height_ = 0;
+  uint32_t total_len_ = 0;
+  uint32_t received_ = 0;
+  uint32_t crc_expected_ = 0;
+  uint32_t crc_ = 0;
+
+  Result _handle_chunk(const uint8_t* data, uint32_t length, uint32_t offset);
+  Result _handle_bitmap(const uint8_t* bitmap, uint32_t length);
+  Result _start(const IconChunkHeader& header);
+  bool _write_bmp_header();
+  bool _write_bitmap(const uint8_t* data, uint32_t length);
+  Result _fail();
+};
+
+#endif  // HOMEBUTTONS_ICON_RECEIVER_H
@@ -0,0 +1,27 @@
+#include "icon_source.h"
+
+namespace icon_source {
+
+static constexpr char HTTPS[] = "https://";
+static constexpr size_t HTTPS_LEN = sizeof(HTTPS) - 1;
+
+bool to_plain_http(const IconSource& source, IconSource& host,
+                   IconSource& http_url) {
+  if (!(source.substring(0, HTTPS_LEN) == HTTPS)) {
+    return false;
+  }
+  IconSource rest = source.substring(HTTPS_LEN);
+  int end = rest.index_of('/');
+  if (end < 0) {
+    end = rest.length();
+  }
+  int port = rest.index_of(':');
+  if (port >= 0 && port < end) {
+    end = port;
+  }
+  host = rest.substring(0, end);
+  http_url = IconSource("http://") + rest.c_str();
+  return true;
+}
+
+}  // namespace icon_source
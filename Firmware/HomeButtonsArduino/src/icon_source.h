@@ -0,0 +1,15 @@
+#ifndef HOMEBUTTONS_ICON_SOURCE_H
+#define HOMEBUTTONS_ICON_SOURCE_H
+
+#include "types.h"
+
+namespace icon_source {
+
+// Splits an https:// icon source into its host and the same URL over plain
+// HTTP, port and path kept as they are. False if the source isn't HTTPS.
+bool to_plain_http(const IconSource& source, IconSource& host,
+                   IconSource& http_url);
+
+}  // namespace icon_source
+
+#endif  // HOMEBUTTONS_ICON_SOURCE_H
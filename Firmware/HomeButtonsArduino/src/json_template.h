@@ -0,0 +1,91 @@
+#ifndef HOMEBUTTONS_JSON_TEMPLATE_H
+#define HOMEBUTTONS_JSON_TEMPLATE_H
+
+#include <initializer_list>
+
+#include "static_string.h"
+
+// Fills a constant JSON skeleton, for payloads whose keys never change. Each
+// '$' in the template takes the next value escaped (the template has the
+// quotes), each '#' takes it as is (a number or already rendered JSON).
+// Escapes like ArduinoJson, so the output is the same as serializeJson() of
+// a document with the members in the same order.
+namespace json_template {
+
+class Value {
+ public:
+  Value(const char* str) : str_(str) {}
+  template <size_t SIZE>
+  Value(const StaticString<SIZE>& str) : str_(str.c_str()) {}
+  Value(int number) : number_(number) {}
+
+  const char* str() const { return str_; }
+  int number() const { return number_; }
+
+ private:
+  const char* str_ = nullptr;  // nullptr = number
+  int number_ = 0;
+};
+
+inline char escaped(char c) {
+  switch (c) {
+    case '"':
+      return '"';
+    case '\\':
+      return '\\';
+    case '\b':
+      return 'b';
+    case '\f':
+      return 'f';
+    case '\n':
+      return 'n';
+    case '\r':
+      return 'r';
+    case '\t':
+      return 't';
+    default:
+      return '\0';
+  }
+}
+
+template <size_t SIZE>
+void append_escaped(StaticString<SIZE>& out, const char* str) {
+  const char* run = str;  // not yet appended, needs no escaping
+  for (; *str != '\0'; str++) {
+    char e = escaped(*str);
+    if (e == '\0') continue;
+    out += StaticStringView(run, str - run);
+    out += '\\';
+    out += e;
+    run = str + 1;
+  }
+  out += StaticStringView(run, str - run);
+}
+
+// Appends to out, which is truncated (and logs) if too small. Slots without
+// a value are left empty.
+template <size_t SIZE>
+void render(StaticString<SIZE>& out, const char* tpl,
+            std::initializer_list<Value> values = {}) {
+  auto value = values.begin();
+  const char* run = tpl;
+  for (; *tpl != '\0'; tpl++) {
+    if (*tpl != '$' && *tpl != '#') continue;
+    out += StaticStringView(run, tpl - run);
+    run = tpl + 1;
+    if (value == values.end()) continue;
+    if (value->str() == nullptr) {
+      out += value->number();
+    } else if (*tpl == '$') {
+      append_escaped(out, value->str());
+    } else {
+      out += value->str();
+    }
+    value++;
+  }
+  out += StaticStringView(run, tpl - run);
+}
+
+}  // namespace json_template
+
+#endif  // HOMEBUTTONS_JSON_TEMPLATE_H
@@ -0,0 +1,73 @@
+#include "label.h"
+
+#include <string.h>
+
+static constexpr char MDI_PREFIX[] = "mdi:";
+static constexpr size_t MDI_PREFIX_LEN = sizeof(MDI_PREFIX) - 1;
+
+// "<digits>;" at the start of str, returns the length of the prefix. A
+// semicolon without digits is text, as before labels were parsed.
+static size_t parse_rotation(const char* str, uint16_t& rotation) {
+  size_t i = 0;
+  uint16_t value = 0;
+  while (i < 3 && str[i] >= '0' && str[i] <= '9') {
+    value = value * 10 + (str[i] - '0');
+    i++;
+  }
+  if (i == 0 || str[i] != ';') {
+    return 0;
+  }
+  rotation = value;
+  return i + 1;
+}
+
+LabelDescriptor parse_label(const char* label) {
+  LabelDescriptor desc;
+  size_t pos = 0;
+  if (strncmp(label, MDI_PREFIX, MDI_PREFIX_LEN) == 0) {
+    pos = MDI_PREFIX_LEN;
+    pos += parse_rotation(label + pos, desc.rotation);
+    const char* space = strchr(label + pos, ' ');
+    size_t icon_end = space != nullptr ? space - label : strlen(label);
+    desc.icon.set("%.*s", static_cast<int>(icon_end - pos), label + pos);
+    if (space != nullptr) {
+      desc.type = LabelDescriptor::Type::Mixed;
+      pos = icon_end + 1;
+    } else {
+      desc.type = LabelDescriptor::Type::Icon;
+      pos = icon_end;
+    }
+  } else if (label[0] != '\0') {
+    desc.type = LabelDescriptor::Type::Text;
+    pos = parse_rotation(label, desc.rotation);
+  }
+  if (desc.has_text()) {
+    while (label[pos] == '_' &&
+           desc.font_level < LabelDescriptor::MAX_FONT_LEVEL) {
+      desc.font_level++;
+      pos++;
+    }
+  }
+  desc.text_start = pos;
+  return desc;
+}
+
+void update_label_layout(LabelDescriptor (&labels)[NUM_BUTTONS]) {
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    LabelDescriptor& label = labels[i];
+#ifndef HOME_BUTTONS_MINI
+    if (label.type == LabelDescriptor::Type::Mixed) {
+      label.icon_size = 48;
+    } else if (label.type == LabelDescriptor::Type::Icon) {
+      // make smaller if opposite is text or mixed
+      bool small = (label.rotation == 0 || label.rotation == 180) &&
+                   labels[i ^ 1].has_text();
+      label.icon_size = small ? 48 : 64;
+    } else {
+      label.icon_size = 0;
+    }
+#else
+    label.icon_size = 100;
+#endif
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef HOMEBUTTONS_LABEL_H
+#define HOMEBUTTONS_LABEL_H
+
+#include "config.h"
+#include "types.h"
+
+// Button label, parsed once when it is loaded or changed.
+//
+// Label forms:
+//   "<text>"                   text
+//   "<rotation>;<text>"        rotated text
+//   "mdi:<icon>"               icon
+//   "mdi:<rotation>;<icon>"    rotated icon
+//   "mdi:<icon> <text>"        icon and text (mixed)
+// Up to four leading underscores in the text force a smaller font.
+struct LabelDescriptor {
+  enum class Type : uint8_t { Empty, Text, Icon, Mixed };
+
+  // forced font sizes, 0 = automatic
+  static constexpr uint8_t MAX_FONT_LEVEL = 4;
+
+  Type type = Type::Empty;
+  uint16_t rotation = 0;
+  MDIName icon;
+  uint8_t text_start = 0;  // offset into the label, text runs to its end
+  uint8_t font_level = 0;  // number of leading underscores
+  uint16_t icon_size = 0;  // set by update_label_layout()
+
+  bool has_icon() const { return type == Type::Icon || type == Type::Mixed; }
+  bool has_text() const { return type == Type::Text || type == Type::Mixed; }
+  const char* text(const ButtonLabel& label) const {
+    return label.c_str() + text_start;
+  }
+};
+
+LabelDescriptor parse_label(const char* label);
+
+// Icon size of each button depends on the label of the opposite button.
+void update_label_layout(LabelDescriptor (&labels)[NUM_BUTTONS]);
+
+#endif  // HOMEBUTTONS_LABEL_H
@@ -1,15 +1,18 @@
 #include "leds.h"
 
 #include "hardware.h"
+#include "power.h"
 
 void LEDs::begin() {
   state = State::ACTIVE;
   info("begin");
+  _notify();
 }
 
 void LEDs::end() {
   cmd_state = CMDState::CMD_END;
   debug("cmd end");
+  _notify();
 }
 
 void LEDs::blink(uint8_t led_num, uint8_t num_blinks, uint8_t brightness,
@@ -26,6 +29,7 @@ void LEDs::blink(uint8_t led_num, uint8_t num_blinks, uint8_t brightness,
   new_cmd_blink = true;
   debug("blink - led: %d, blinks: %d, bri: %d, hold: %d", led_num, num_blinks,
         brightness, hold);
+  _notify();
 }
 
 LEDs::State LEDs::get_state() const { return state; }
@@ -62,6 +66,8 @@ void LEDs::update(HardwareDefinition& HW) {
         off = 150;
         break;
     }
+    // a held LED is only used right before deep sleep
+    power::Hold pm_hold(power::Lock::LEDS);
     for (uint8_t i = 0; i < current_blink.num_blinks; i++) {
       HW.set_led_num(current_blink.led_num, current_blink.brightness);
       delay(on);
@@ -78,3 +84,17 @@ void LEDs::update(HardwareDefinition& HW) {
     info("ended");
   }
 }
+
+void LEDs::wait() {
+  task_ = xTaskGetCurrentTaskHandle();
+  // a command sent before the handle was set is already pending
+  if (state == State::ACTIVE &&
+      (new_cmd_blink || cmd_state == CMDState::CMD_END)) {
+    return;
+  }
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+void LEDs::_notify() {
+  if (task_ != nullptr) xTaskNotifyGive(task_);
+}
@@ -2,6 +2,9 @@
 #define HOMEBUTTONS_LEDS_H
 
 #include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include "config.h"
 #include "logger.h"
 
@@ -20,6 +23,8 @@ class LEDs : public Logger {
   State get_state() const;
 
   void update(HardwareDefinition& HW);
+  // Blocks the calling task until update() has a blink or end() to handle.
+  void wait();
 
  private:
   enum class CMDState { NONE, CMD_END };
@@ -36,6 +41,9 @@ class LEDs : public Logger {
   Blink cmd_blink = {};
   bool new_cmd_blink = false;
   Blink current_blink = {};
+  TaskHandle_t task_ = nullptr;  // notified by the commands, set by wait()
+
+  void _notify();
 };
 
 #endif  // HOMEBUTTONS_LEDS_H
@@ -0,0 +1,426 @@
+#include "log_ring.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "soc/soc_memory_layout.h"
+
+#include "config.h"
+#include "static_task.h"
+
+namespace log_ring {
+
+#ifdef LOGGER_DEFERRED
+static constexpr bool DEFERRED = true;
+#else
+static constexpr bool DEFERRED = false;
+#endif
+
+static constexpr uint32_t MAGIC = 0x484C5231;  // "HLR1"
+static constexpr size_t LINE_SIZE = 128;
+
+struct Ring {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint32_t head;     // number of entries ever written
+  uint32_t printed;  // number of entries printed to the UART
+  uint16_t boot;
+  uint8_t num_tags;
+  char tags[MAX_TAGS][TAG_LEN + 1];
+  Entry entries[LOG_RING_ENTRIES];
+};
+
+RTC_NOINIT_ATTR static Ring ring;
+static bool initialized = false;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t printer_task = nullptr;
+
+// One printf conversion, e.g. "%-8.*s"
+struct Spec {
+  size_t len = 0;
+  char conv = '\0';
+  bool width_arg = false;      // '*'
+  bool precision_arg = false;  // '.*'
+  uint8_t int_size = 4;        // long long and intmax_t are 8 B
+};
+
+static bool _parse_spec(const char* p, Spec& spec) {
+  const char* start = p++;
+  spec = Spec();
+  while (*p != '\0' && strchr("-+ #0", *p)) p++;
+  if (*p == '*') {
+    spec.width_arg = true;
+    p++;
+  }
+  while (isdigit(static_cast<unsigned char>(*p))) p++;
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      spec.precision_arg = true;
+      p++;
+    }
+    while (isdigit(static_cast<unsigned char>(*p))) p++;
+  }
+  uint8_t longs = 0;
+  while (*p != '\0' && strchr("hlLqjzt", *p)) {
+    if (*p == 'l') longs++;
+    if (*p == 'q' || *p == 'j' || *p == 'L') longs = 2;
+    p++;
+  }
+  if (*p == '\0') {
+    return false;
+  }
+  spec.int_size = longs >= 2 ? 8 : 4;
+  spec.conv = *p;
+  spec.len = p - start + 1;
+  return true;
+}
+
+static bool _is_int(char conv) { return strchr("diouxXc", conv) != nullptr; }
+static bool _is_float(char conv) { return strchr("fFeEgGaA", conv) != nullptr; }
+
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) {
+    // RTC memory is random after power-on, keep entries only if they belong
+    // to this firmware
+    if (ring.magic != MAGIC ||
+        memcmp(ring.firmware_id, id, FIRMWARE_ID_LEN) != 0 ||
+        ring.num_tags > MAX_TAGS || ring.printed > ring.head) {
+      memset(&ring, 0, sizeof(ring));
+      ring.magic = MAGIC;
+      memcpy(ring.firmware_id, id, FIRMWARE_ID_LEN);
+    }
+    ring.boot++;
+    initialized = true;
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+uint8_t register_tag(const char* tag) {
+  if (!initialized) {
+    _init();
+  }
+  uint8_t id = NO_TAG;
+  taskENTER_CRITICAL(&lock);
+  for (uint8_t i = 0; i < ring.num_tags; i++) {
+    if (strncmp(ring.tags[i], tag, TAG_LEN) == 0) {
+      id = i;
+      break;
+    }
+  }
+  if (id == NO_TAG && ring.num_tags < MAX_TAGS) {
+    id = ring.num_tags++;
+    strncpy(ring.tags[id], tag, TAG_LEN);
+    ring.tags[id][TAG_LEN] = '\0';
+  }
+  taskEXIT_CRITICAL(&lock);
+  return id;
+}
+
+const char* tag_name(uint8_t id) {
+  return id < ring.num_tags ? ring.tags[id] : "?";
+}
+
+uint8_t num_tags() { return ring.num_tags; }
+
+uint16_t boot() { return ring.boot; }
+
+const uint8_t* firmware_id() { return ring.firmware_id; }
+
+void record(esp_log_level_t level, uint8_t tag, const char* fmt,
+            va_list args) {
+  if (!initialized) {
+    _init();
+  }
+  Entry entry;
+  entry.timestamp = esp_log_timestamp();
+  entry.fmt = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(fmt));
+  entry.level = level;
+  entry.tag = tag;
+  entry.args_len = 0;
+  entry.flags = 0;
+
+  va_list ap;
+  va_copy(ap, args);
+  auto put = [&entry](const void* data, size_t n) {
+    if (entry.args_len + n > MAX_ARGS_LEN) {
+      entry.flags |= FLAG_TRUNCATED;
+      return false;
+    }
+    memcpy(&entry.args[entry.args_len], data, n);
+    entry.args_len += n;
+    return true;
+  };
+  Spec spec;
+  bool ok = true;
+  for (const char* p = strchr(fmt, '%'); ok && p != nullptr;
+       p = strchr(p + spec.len, '%')) {
+    if (!_parse_spec(p, spec)) {
+      break;
+    }
+    if (spec.width_arg) {
+      int width = va_arg(ap, int);
+      ok = put(&width, sizeof(width));
+    }
+    if (ok && spec.precision_arg) {
+      int precision = va_arg(ap, int);
+      ok = put(&precision, sizeof(precision));
+    }
+    if (!ok || spec.conv == '%') {
+      continue;
+    }
+    if (_is_int(spec.conv) && spec.int_size == 8) {
+      uint64_t value = va_arg(ap, uint64_t);
+      ok = put(&value, sizeof(value));
+    } else if (_is_int(spec.conv) || spec.conv == 'p') {
+      uint32_t value = va_arg(ap, uint32_t);
+      ok = put(&value, sizeof(value));
+    } else if (_is_float(spec.conv)) {
+      double value = va_arg(ap, double);
+      ok = put(&value, sizeof(value));
+    } else if (spec.conv == 's') {
+      const char* str = va_arg(ap, const char*);
+      if (str == nullptr) {
+        str = "(null)";
+      }
+      // strings are cut to the space that is left
+      size_t room = MAX_ARGS_LEN - entry.args_len;
+      if (room == 0) {
+        entry.flags |= FLAG_TRUNCATED;
+        break;
+      }
+      size_t n = strnlen(str, room - 1);
+      memcpy(&entry.args[entry.args_len], str, n);
+      entry.args[entry.args_len + n] = '\0';
+      entry.args_len += n + 1;
+    }
+  }
+  va_end(ap);
+
+  taskENTER_CRITICAL(&lock);
+  entry.boot = ring.boot;
+  memcpy(&ring.entries[ring.head % LOG_RING_ENTRIES], &entry,
+         offsetof(Entry, args) + entry.args_len);
+  ring.head++;
+  if (!DEFERRED) {
+    ring.printed = ring.head;
+  }
+  taskEXIT_CRITICAL(&lock);
+
+  if (DEFERRED && printer_task != nullptr) {
+    xTaskNotifyGive(printer_task);
+  }
+}
+
+template <typename T>
+static int _format_arg(char* buf, size_t len, const char* spec_str,
+                       const Spec& spec, int width, int precision, T value) {
+  if (spec.width_arg && spec.precision_arg) {
+    return snprintf(buf, len, spec_str, width, precision, value);
+  } else if (spec.width_arg) {
+    return snprintf(buf, len, spec_str, width, value);
+  } else if (spec.precision_arg) {
+    return snprintf(buf, len, spec_str, precision, value);
+  }
+  return snprintf(buf, len, spec_str, value);
+}
+
+size_t format(const Entry& entry, char* buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  const char* fmt =
+      reinterpret_cast<const char*>(static_cast<uintptr_t>(entry.fmt));
+  if (!esp_ptr_in_drom(fmt) && !esp_ptr_in_dram(fmt)) {
+    return snprintf(buf, len, "<bad format 0x%08x>", entry.fmt);
+  }
+  size_t out = 0;
+  size_t pos = 0;
+  auto get = [&entry, &pos](void* value, size_t n) {
+    if (pos + n > entry.args_len) {
+      return false;
+    }
+    memcpy(value, &entry.args[pos], n);
+    pos += n;
+    return true;
+  };
+  const char* p = fmt;
+  while (*p != '\0' && out < len - 1) {
+    if (*p != '%') {
+      buf[out++] = *p++;
+      continue;
+    }
+    Spec spec;
+    char spec_str[16];
+    if (!_parse_spec(p, spec) || spec.len >= sizeof(spec_str)) {
+      break;
+    }
+    memcpy(spec_str, p, spec.len);
+    spec_str[spec.len] = '\0';
+    p += spec.len;
+
+    int width = 0;
+    int precision = 0;
+    bool ok = (!spec.width_arg || get(&width, sizeof(width))) &&
+              (!spec.precision_arg || get(&precision, sizeof(precision)));
+    int n = 0;
+    if (spec.conv == '%') {
+      n = snprintf(&buf[out], len - out, "%%");
+    } else if (!ok) {
+      n = snprintf(&buf[out], len - out, "?");
+    } else if (_is_int(spec.conv) && spec.int_size == 8) {
+      uint64_t value;
+      ok = get(&value, sizeof(value));
+      n = ok ? _format_arg(&buf[out], len - out, spec_str, spec, width,
+                           precision, value)
+             : snprintf(&buf[out], len - out, "?");
+    } else if (_is_int(spec.conv) || spec.conv == 'p') {
+      uint32_t value;
+      ok = get(&value, sizeof(value));
+      n = !ok ? snprintf(&buf[out], len - out, "?")
+          : spec.conv == 'p'
+              ? _format_arg(&buf[out], len - out, spec_str, spec, width,
+                            precision, reinterpret_cast<void*>(value))
+              : _format_arg(&buf[out], len - out, spec_str, spec, width,
+                            precision, value);
+    } else if (_is_float(spec.conv)) {
+      double value;
+      ok = get(&value, sizeof(value));
+      n = ok ? _format_arg(&buf[out], len - out, spec_str, spec, width,
+                           precision, value)
+             : snprintf(&buf[out], len - out, "?");
+    } else if (spec.conv == 's') {
+      const char* str = reinterpret_cast<const char*>(&entry.args[pos]);
+      size_t max = pos < entry.args_len ? entry.args_len - pos : 0;
+      size_t str_len = strnlen(str, max);
+      if (str_len < max) {
+        pos += str_len + 1;
+        n = _format_arg(&buf[out], len - out, spec_str, spec, width,
+                        precision, str);
+      } else {
+        n = snprintf(&buf[out], len - out, "?");
+      }
+    }
+    if (n > 0) {
+      out += std::min(static_cast<size_t>(n), len - 1 - out);
+    }
+  }
+  buf[out] = '\0';
+  return out;
+}
+
+size_t for_each(std::function<void(const Entry&)> fn) {
+  taskENTER_CRITICAL(&lock);
+  uint32_t head = ring.head;
+  taskEXIT_CRITICAL(&lock);
+  uint32_t first = head > LOG_RING_ENTRIES ? head - LOG_RING_ENTRIES : 0;
+  size_t count = 0;
+  for (uint32_t i = first; i < head; i++) {
+    Entry entry;
+    taskENTER_CRITICAL(&lock);
+    // skip entries overwritten in the meantime
+    bool valid = ring.head - i <= LOG_RING_ENTRIES;
+    if (valid) {
+      entry = ring.entries[i % LOG_RING_ENTRIES];
+    }
+    taskEXIT_CRITICAL(&lock);
+    if (valid) {
+      fn(entry);
+      count++;
+    }
+  }
+  return count;
+}
+
+char level_to_char(uint8_t level) {
+  switch (level) {
+    case ESP_LOG_ERROR:
+      return 'E';
+    case ESP_LOG_WARN:
+      return 'W';
+    case ESP_LOG_INFO:
+      return 'I';
+    case ESP_LOG_DEBUG:
+      return 'D';
+    default:
+      return '?';
+  }
+}
+
+static void _print(const Entry& entry) {
+  char line[LINE_SIZE];
+  int rc;
+  if (entry.boot == ring.boot) {
+    rc = snprintf(line, sizeof(line), "[%6u][%c][%-8s] ", entry.timestamp,
+                  level_to_char(entry.level), tag_name(entry.tag));
+  } else {
+    // left over from an earlier wakeup, e.g. before a crash
+    rc = snprintf(line, sizeof(line), "[#%u %6u][%c][%-8s] ", entry.boot,
+                  entry.timestamp, level_to_char(entry.level),
+                  tag_name(entry.tag));
+  }
+  if (rc < 0 || rc >= static_cast<int>(sizeof(line))) {
+    return;
+  }
+  format(entry, &line[rc], sizeof(line) - rc);
+  esp_log_write(static_cast<esp_log_level_t>(entry.level),
+                tag_name(entry.tag), "%s\n", line);
+}
+
+static void _print_pending() {
+  while (true) {
+    Entry entry;
+    bool pending = false;
+    taskENTER_CRITICAL(&lock);
+    if (ring.head - ring.printed > LOG_RING_ENTRIES) {
+      ring.printed = ring.head - LOG_RING_ENTRIES;  // overwritten
+    }
+    if (ring.printed != ring.head) {
+      entry = ring.entries[ring.printed % LOG_RING_ENTRIES];
+      ring.printed++;
+      pending = true;
+    }
+    taskEXIT_CRITICAL(&lock);
+    if (!pending) {
+      return;
+    }
+    _print(entry);
+  }
+}
+
+static void _printer_task(void*) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    _print_pending();
+  }
+}
+
+void start_printer() {
+  if (!DEFERRED) {
+    return;
+  }
+  // local, so the stack is optimized out without LOGGER_DEFERRED
+  static StaticTask<LOG_TASK_STACK> task;
+  if (!task.start(_printer_task, "LOG", nullptr, tskIDLE_PRIORITY)) {
+    return;
+  }
+  printer_task = task.handle();
+  // entries left over from before a crash are printed first
+  xTaskNotifyGive(printer_task);
+}
+
+void flush() {
+  if (DEFERRED) {
+    _print_pending();
+  }
+}
+
+}  // namespace log_ring
@@ -0,0 +1,67 @@
+#ifndef HOMEBUTTONS_LOG_RING_H
+#define HOMEBUTTONS_LOG_RING_H
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "esp_log.h"
+
+// Binary log records kept in RTC memory. They survive deep sleep, crashes and
+// soft resets (not power loss) and are reset when the firmware changes.
+//
+// Only the format string address and the raw arguments are stored, the text
+// is formatted later: by the firmware itself (same image) or on the host by
+// tools/decode_log.py, which looks the format strings up in the ELF file.
+namespace log_ring {
+
+static constexpr uint8_t MAX_TAGS = 32;
+static constexpr uint8_t TAG_LEN = 8;
+static constexpr uint8_t NO_TAG = 0xFF;
+static constexpr uint8_t MAX_ARGS_LEN = 32;
+
+static constexpr uint8_t FLAG_TRUNCATED = 0x01;  // not all args fit
+
+struct Entry {
+  uint32_t timestamp;  // ms since boot
+  uint32_t fmt;        // address of the format string
+  uint16_t boot;       // boot counter, wakeups from deep sleep included
+  uint8_t level;       // esp_log_level_t
+  uint8_t tag;         // index into tag table
+  uint8_t args_len;
+  uint8_t flags;
+  uint8_t reserved[2];
+  uint8_t args[MAX_ARGS_LEN];
+};
+static_assert(sizeof(Entry) == 48, "decode_log.py expects 48 B entries");
+
+// Returns the tag id, NO_TAG if the table is full.
+uint8_t register_tag(const char* tag);
+const char* tag_name(uint8_t id);
+uint8_t num_tags();
+
+void record(esp_log_level_t level, uint8_t tag, const char* fmt,
+            va_list args);
+
+// Formats an entry of the running firmware.
+size_t format(const Entry& entry, char* buf, size_t len);
+char level_to_char(uint8_t level);
+
+uint16_t boot();
+// short id of the firmware the entries belong to (ELF SHA-256 prefix)
+const uint8_t* firmware_id();
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+
+// Calls fn for every stored entry, oldest first. Returns number of entries.
+size_t for_each(std::function<void(const Entry&)> fn);
+
+// Deferred output (LOGGER_DEFERRED): a low priority task prints recorded
+// entries to the UART. flush() prints everything pending right away, call it
+// before deep sleep.
+void start_printer();
+void flush();
+
+}  // namespace log_ring
+
+#endif  // HOMEBUTTONS_LOG_RING_H
@@ -3,11 +3,21 @@
 
 #include "static_string.h"
 #include "esp_log.h"
+#include "log_ring.h"
 
 #ifndef LOGGER_DEFAULT_LOG_LEVEL
 #error "LOGGER_DEFAULT_LOG_LEVEL isn't defined"
 #endif
 
+// Messages above this level are removed at compile time, including their
+// format strings.
+#ifndef LOGGER_COMPILE_LOG_LEVEL
+#define LOGGER_COMPILE_LOG_LEVEL LOGGER_DEFAULT_LOG_LEVEL
+#endif
+
+// Every message is recorded in binary form in log_ring. With LOGGER_DEFERRED
+// the UART output is left to the log_ring printer task.
+
 class Logger {
 #ifdef LOGGER_ENABLE_COLOR
   static constexpr bool ENABLE_COLOR = true;
@@ -23,7 +33,7 @@ class Logger {
   // Therefore, you cannot have any static logger when using arduino framework
 
   Logger(const char* tag, esp_log_level_t level = LOGGER_DEFAULT_LOG_LEVEL)
-      : tag_(tag), log_level_(level) {
+      : tag_(tag), tag_id_(log_ring::register_tag(tag)), log_level_(level) {
     _computed_padded_tag();
     esp_log_level_set(tag_.c_str(), level);
     ESP_LOGD("logger", "Log level for %s: %c", tag, _log_level_to_char(level));
@@ -31,39 +41,35 @@ class Logger {
 
   static constexpr std::size_t MAX_LOG_LINE_SIZE = 128;
 
-  void __attribute__((format(printf, 2, 3))) debug(const char* fmt, ...) const {
-    va_list args;
-    va_start(args, fmt);
-    _log(ESP_LOG_DEBUG, fmt, args);
-    va_end(args);
+  __attribute__((always_inline, format(printf, 2, 3))) void debug(
+      const char* fmt, ...) const {
+    if (ESP_LOG_DEBUG > LOGGER_COMPILE_LOG_LEVEL) return;
+    _logf(ESP_LOG_DEBUG, fmt, __builtin_va_arg_pack());
   }
 
-  void __attribute__((format(printf, 2, 3))) info(const char* fmt, ...) const {
-    va_list args;
-    va_start(args, fmt);
-    _log(ESP_LOG_INFO, fmt, args);
-    va_end(args);
+  __attribute__((always_inline, format(printf, 2, 3))) void info(
+      const char* fmt, ...) const {
+    if (ESP_LOG_INFO > LOGGER_COMPILE_LOG_LEVEL) return;
+    _logf(ESP_LOG_INFO, fmt, __builtin_va_arg_pack());
   }
 
-  void __attribute__((format(printf, 2, 3)))
-  warning(const char* fmt, ...) const {
-    va_list args;
-    va_start(args, fmt);
-    _log(ESP_LOG_WARN, fmt, args);
-    va_end(args);
+  __attribute__((always_inline, format(printf, 2, 3))) void warning(
+      const char* fmt, ...) const {
+    if (ESP_LOG_WARN > LOGGER_COMPILE_LOG_LEVEL) return;
+    _logf(ESP_LOG_WARN, fmt, __builtin_va_arg_pack());
   }
 
-  void __attribute__((format(printf, 2, 3))) error(const char* fmt, ...) const {
-    va_list args;
-    va_start(args, fmt);
-    _log(ESP_LOG_ERROR, fmt, args);
-    va_end(args);
+  __attribute__((always_inline, format(printf, 2, 3))) void error(
+      const char* fmt, ...) const {
+    if (ESP_LOG_ERROR > LOGGER_COMPILE_LOG_LEVEL) return;
+    _logf(ESP_LOG_ERROR, fmt, __builtin_va_arg_pack());
   }
 
  private:
   static constexpr std::size_t MAX_TAG_LENGTH = 8;
   StaticString<MAX_TAG_LENGTH> tag_;
   StaticString<MAX_TAG_LENGTH> padded_tag_;
+  uint8_t tag_id_;
   esp_log_level_t log_level_;
 
   constexpr char _log_level_to_char(esp_log_level_t level) const {
@@ -103,9 +109,21 @@ class Logger {
     }
   }
 
+  void __attribute__((noinline))
+  _logf(esp_log_level_t level, const char* fmt, ...) const {
+    va_list args;
+    va_start(args, fmt);
+    _log(level, fmt, args);
+    va_end(args);
+  }
+
   // va_list args
   void _log(esp_log_level_t level, const char* fmt, va_list args) const {
     if (level > log_level_) return;
+    log_ring::record(level, tag_id_, fmt, args);
+#ifdef LOGGER_DEFERRED
+    return;
+#endif
     char buffer[MAX_LOG_LINE_SIZE];
     int rc;
     if (ENABLE_COLOR) {
@@ -1,9 +1,14 @@
 #include "app.h"
 
+#include <new>
+
+// Statically allocated, but constructed in setup(): loggers must not be
+// created before that, see Logger.
+alignas(App) static uint8_t app_storage[sizeof(App)];
 static App *app;
 
 void setup() {
-  app = new App();
+  app = new (app_storage) App();
   app->setup();
 }
 
@@ -2,6 +2,11 @@
 
 #include "download.h"
 #include "github_raw_cert.h"
+#include "icon_bundle.h"
+#include "icon_source.h"
+#include "metrics.h"
+#include "power.h"
+#include "trace.h"
 
 static constexpr char HOST[] = "raw.githubusercontent.com";
 
@@ -13,18 +18,48 @@ static constexpr char TEST_URL[] =
 
 static constexpr char FOLDER[] = "/mdi";
 
+static constexpr char UPLOAD_PATH[] = "/mdi/upload.tmp";
+
+// largest BMP header: file header, BITMAPV5HEADER and a 256 color palette
+static constexpr size_t MAX_BMP_HEADER = 14 + 124 + 256 * 4;
+
+// MDI names: lowercase letters, digits and dashes
+static bool valid_icon_name(const char* name) {
+  if (*name == '\0') {
+    return false;
+  }
+  for (const char* c = name; *c != '\0'; c++) {
+    if (!(*c >= 'a' && *c <= 'z') && !(*c >= '0' && *c <= '9') && *c != '-') {
+      return false;
+    }
+  }
+  return true;
+}
+
+MDIHelper::MDIHelper() : Logger("MDI") {
+  mutex_ = xSemaphoreCreateMutex();
+  cache_mutex_ = xSemaphoreCreateMutex();
+}
+
 bool MDIHelper::begin() {
   if (spiffs_mounted_) {
     return true;
   }
-  if (!SPIFFS.begin()) {
-    error("Failed to mount SPIFFS file system");
-    return false;
+  // display and main task may both need the file system first
+  xSemaphoreTake(mutex_, portMAX_DELAY);
+  if (!spiffs_mounted_) {
+    TRACE_SCOPE("MDIHelper::mount");
+    uint32_t start = micros();
+    if (SPIFFS.begin()) {
+      spiffs_mounted_ = true;
+      stats_.mount_us = micros() - start;
+      debug("Mounted SPIFFS file system in %u us", stats_.mount_us);
+    } else {
+      error("Failed to mount SPIFFS file system");
+    }
   }
-
-  spiffs_mounted_ = true;
-  debug("Mounted SPIFFS file system");
-  return true;
+  xSemaphoreGive(mutex_);
+  return spiffs_mounted_;
 }
 
 void MDIHelper::add_size(uint16_t size) {
@@ -39,43 +74,109 @@ void MDIHelper::end() {
   if (!spiffs_mounted_) {
     return;
   }
+  if (upload_active_) {
+    warning("Upload in progress, unmounting anyway");
+  }
+  log_stats();
+  TRACE_SCOPE("MDIHelper::unmount");
+  xSemaphoreTake(mutex_, portMAX_DELAY);
   SPIFFS.end();
   spiffs_mounted_ = false;
+  xSemaphoreGive(mutex_);
   debug("Unmounted SPIFFS file system");
 }
 
+bool MDIHelper::format() {
+  TRACE_SCOPE("MDIHelper::format");
+  xSemaphoreTake(cache_mutex_, portMAX_DELAY);
+  xSemaphoreTake(mutex_, portMAX_DELAY);
+  bool ret = SPIFFS.format();
+  for (auto& entry : cache_) {
+    entry.size = 0;
+  }
+  xSemaphoreGive(mutex_);
+  xSemaphoreGive(cache_mutex_);
+  if (!ret) {
+    error("Failed to format SPIFFS file system");
+  }
+  return ret;
+}
+
+void MDIHelper::log_stats() {
+  debug("mount: %u us, lookups: %u (%u us), reads: %u (%u us), cache hits: %u",
+        stats_.mount_us, stats_.lookups, stats_.lookup_us, stats_.reads,
+        stats_.read_us, stats_.cache_hits);
+}
+
+void MDIHelper::set_source(const char* url) {
+  source_ = url;
+  source_ = source_.trim();
+  if (!source_.empty() && source_.c_str()[source_.length() - 1] != '/') {
+    source_ += '/';
+  }
+  base_url_ = "";
+}
+
+const char* MDIHelper::_base_url() {
+  if (source_.empty()) {
+    return MDI_URL;
+  }
+  if (!base_url_.empty()) {
+    return base_url_.c_str();
+  }
+  base_url_ = source_;
+  // no need for TLS on the local network
+  IconSource host;
+  IconSource http_url;
+  if (icon_source::to_plain_http(source_, host, http_url) &&
+      download::is_on_local_subnet(host.c_str())) {
+    base_url_ = http_url;
+  }
+  info("Icon source: %s", base_url_.c_str());
+  return base_url_.c_str();
+}
+
 StaticString<MAX_PATH_LEN> MDIHelper::_get_path(const char* name,
                                                 uint16_t size) {
   return StaticString<MAX_PATH_LEN>("%s/%d/%s.bmp", FOLDER, size, name);
 }
 
 bool MDIHelper::check_connection() {
+  if (has_custom_source()) {
+    // mirror returns an empty bundle
+    StaticString<256> url("%sbundle", _base_url());
+    return download::check_connection(HOST, url.c_str(), nullptr);
+  }
   return download::check_connection(HOST, TEST_URL,
                                     github_raw_cert::DigiCert_Global_Root_G2);
 }
 
 bool MDIHelper::download(const char* name, uint16_t size) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (!begin()) {
     return false;
   }
 
+  if (get_builtin(name, size) != nullptr) {
+    info("'%s' size %d is built in", name, size);
+    return true;
+  }
+
   auto path = _get_path(name, size);
 
-  if (SPIFFS.exists(path.c_str())) {
+  if (_exists(path.c_str())) {
     info("'%s' size %d already exists", name, size);
     return true;
   }
 
   debug("Downloading '%s' size %d to '%s'", name, size, path.c_str());
+  TRACE_SCOPE("MDIHelper::download");
 
-  File file = SPIFFS.open(path.c_str(), FILE_WRITE, true);
+  File file = _create(path.c_str(), 0);
   if (!file) {
-    error("Failed to open '%s' for writing", path.c_str());
     return false;
   }
 
-  StaticString<256> url("%s%dx%d/%s.bmp", MDI_URL, size, size, name);
+  StaticString<256> url("%s%dx%d/%s.bmp", _base_url(), size, size, name);
   bool ret = download::download_file_https(
       HOST, url.c_str(), file,
       github_raw_cert::DigiCert_Global_Root_G2);
@@ -90,8 +191,7 @@ bool MDIHelper::download(const char* name, uint16_t size) {
 }
 
 bool MDIHelper::download(const char* name) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (!begin()) {
     return false;
   }
 
@@ -103,18 +203,102 @@ bool MDIHelper::download(const char* name) {
   return true;
 }
 
+bool MDIHelper::download_bundle(const MDIName* names, uint8_t count) {
+  if (!begin()) {
+    return false;
+  }
+  if (!has_custom_source()) {
+    return false;
+  }
+  TRACE_SCOPE("MDIHelper::download_bundle");
+
+  StaticString<512> url("%sbundle?sizes=", _base_url());
+  for (uint8_t i = 0; i < num_sizes_; ++i) {
+    url += StaticString<8>(i > 0 ? ",%u" : "%u", sizes_[i]);
+  }
+  url += "&icons=";
+  for (uint8_t i = 0; i < count; ++i) {
+    if (i > 0) {
+      url += ',';
+    }
+    url += names[i];
+  }
+  debug("Downloading bundle: %s", url.c_str());
+
+  File file;
+  StaticString<MAX_PATH_LEN> path;
+  uint8_t received = 0;
+  IconBundleParser parser(
+      [this, &file, &path, names, count](const IconBundleEntry& entry) {
+        if (!has_size(entry.size)) {
+          error("Unexpected size %d in bundle", entry.size);
+          return false;
+        }
+        if (!valid_icon_name(entry.name)) {
+          error("Invalid icon name in bundle");
+          return false;
+        }
+        bool requested = false;
+        for (uint8_t i = 0; i < count && !requested; i++) {
+          requested = names[i] == entry.name;
+        }
+        if (!requested) {
+          error("Unexpected icon '%s' in bundle", entry.name);
+          return false;
+        }
+        if (entry.length >
+            MAX_BMP_HEADER + 4 * uint32_t{entry.size} * entry.size) {
+          error("'%s' size %d too large: %u", entry.name, entry.size,
+                entry.length);
+          return false;
+        }
+        path = _get_path(entry.name, entry.size);
+        file = _create(path.c_str(), entry.length);
+        return static_cast<bool>(file);
+      },
+      [&file](const uint8_t* data, size_t len) {
+        return file.write(data, len) == len;
+      },
+      [this, &file, &received](const IconBundleEntry& entry) {
+        file.close();
+        received++;
+        info("Downloaded '%s' size: %d", entry.name, entry.size);
+        return true;
+      });
+
+  bool ret = download::download_stream(
+      url.c_str(), [&parser](const uint8_t* data, size_t len) {
+        return parser.feed(data, len);
+      });
+  if (file) {
+    // incomplete icon
+    file.close();
+    SPIFFS.remove(path.c_str());
+  }
+  if (!ret || !parser.done()) {
+    error("Failed to download bundle");
+    return false;
+  }
+  info("Bundle: %d of %d requested icons", received, count * num_sizes_);
+  return true;
+}
+
 bool MDIHelper::exists(const char* name, uint16_t size) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (get_builtin(name, size) != nullptr) {
+    return true;
+  }
+  if (!begin()) {
     return false;
   }
   auto path = _get_path(name, size);
-  return SPIFFS.exists(path.c_str());
+  return _exists(path.c_str());
 }
 
 bool MDIHelper::exists_all_sizes(const char* name) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (builtin_all_sizes(name)) {
+    return true;
+  }
+  if (!begin()) {
     return false;
   }
   for (uint8_t i = 0; i < num_sizes_; ++i) {
@@ -125,9 +309,21 @@ bool MDIHelper::exists_all_sizes(const char* name) {
   return true;
 }
 
+const BuiltinIcon* MDIHelper::get_builtin(const char* name, uint16_t size) {
+  return builtin_icons::find(name, size);
+}
+
+bool MDIHelper::builtin_all_sizes(const char* name) {
+  for (uint8_t i = 0; i < num_sizes_; ++i) {
+    if (get_builtin(name, sizes_[i]) == nullptr) {
+      return false;
+    }
+  }
+  return num_sizes_ > 0;
+}
+
 File MDIHelper::get_file(const char* name, uint16_t size) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (!begin()) {
     return File();
   }
 
@@ -142,8 +338,7 @@ File MDIHelper::get_file(const char* name, uint16_t size) {
 }
 
 size_t MDIHelper::get_free_space() {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (!begin()) {
     return 0;
   }
   size_t free = SPIFFS.totalBytes() - SPIFFS.usedBytes();
@@ -152,14 +347,14 @@ size_t MDIHelper::get_free_space() {
 }
 
 bool MDIHelper::make_space(size_t size) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (!begin()) {
     return false;
   }
   if (get_free_space() > size) {
     return true;
   }
   info("Freeing space...");
+  TRACE_SCOPE("MDIHelper::make_space");
   File root = SPIFFS.open(FOLDER);
   if (!root) {
     error("Failed to open '%s'", FOLDER);
@@ -191,12 +386,270 @@ bool MDIHelper::make_space(size_t size) {
   return true;
 }
 
+// New icon file, making space first if the length is known.
+File MDIHelper::_create(const char* path, size_t length) {
+  if (length > 0 && !make_space(length)) {
+    error("Not enough space for '%s' (%u bytes)", path, length);
+    return File();
+  }
+  File file = SPIFFS.open(path, FILE_WRITE, true);
+  if (!file) {
+    error("Failed to open '%s' for writing", path);
+  }
+  return file;
+}
+
 bool MDIHelper::remove(const char* name, uint16_t size) {
-  if (!spiffs_mounted_) {
-    error("SPIFFS not mounted");
+  if (!begin()) {
     return false;
   }
   auto path = _get_path(name, size);
   debug("Removing '%s'", path.c_str());
-  return SPIFFS.remove(path.c_str());
+  bool ret = SPIFFS.remove(path.c_str());
+  _invalidate(name, size);
+  return ret;
+}
+
+bool MDIHelper::has_size(uint16_t size) const {
+  for (uint8_t i = 0; i < num_sizes_; ++i) {
+    if (sizes_[i] == size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+File MDIHelper::begin_upload(size_t size) {
+  if (!begin()) {
+    return File();
+  }
+  if (SPIFFS.exists(UPLOAD_PATH)) {
+    SPIFFS.remove(UPLOAD_PATH);
+  }
+  File file = _create(UPLOAD_PATH, size);
+  if (!file) {
+    return File();
+  }
+  upload_active_ = true;
+  return file;
+}
+
+bool MDIHelper::finish_upload(const char* name, uint16_t size) {
+  upload_active_ = false;
+  auto path = _get_path(name, size);
+  if (SPIFFS.exists(path.c_str())) {
+    SPIFFS.remove(path.c_str());
+  }
+  bool renamed = SPIFFS.rename(UPLOAD_PATH, path.c_str());
+  // after the file changed, a redraw in between would cache the old one
+  _invalidate(name, size);
+  if (!renamed) {
+    error("Failed to rename upload to '%s'", path.c_str());
+    SPIFFS.remove(UPLOAD_PATH);
+    return false;
+  }
+  debug("Stored upload as '%s'", path.c_str());
+  return true;
+}
+
+void MDIHelper::abort_upload() {
+  upload_active_ = false;
+  if (spiffs_mounted_) {
+    SPIFFS.remove(UPLOAD_PATH);
+  }
+}
+
+const IconBitmap* MDIHelper::get_bitmap(const char* name, uint16_t size) {
+  xSemaphoreTake(cache_mutex_, portMAX_DELAY);
+  const IconBitmap* bitmap = _get_bitmap(name, size);
+  xSemaphoreGive(cache_mutex_);
+  return bitmap;
+}
+
+const IconBitmap* MDIHelper::_get_bitmap(const char* name, uint16_t size) {
+  CacheEntry& slot = _cache_slot(name, size);
+  if (slot.name == name && slot.size == size) {
+    stats_.cache_hits++;
+    metrics::inc(metrics::Counter::ICON_CACHE_HITS);
+    return &slot.bitmap;
+  }
+  metrics::inc(metrics::Counter::ICON_CACHE_MISSES);
+  slot.size = 0;  // invalid until decoded
+
+  const BuiltinIcon* builtin = get_builtin(name, size);
+  if (builtin != nullptr) {
+    TRACE_SCOPE("MDIHelper::decode_builtin");
+    power::CpuRequest compute(power::CpuProfile::COMPUTE);
+    if (builtin->width > MAX_ICON_SIZE || builtin->height > MAX_ICON_SIZE ||
+        !builtin_icons::decode(*builtin, slot.bitmap.data,
+                               sizeof(slot.bitmap.data))) {
+      error("Failed to decode built-in '%s' size %d", name, size);
+      return nullptr;
+    }
+    slot.bitmap.width = builtin->width;
+    slot.bitmap.height = builtin->height;
+  } else {
+    if (!exists(name, size)) {
+      error("'%s' size %d does not exist", name, size);
+      return nullptr;
+    }
+    auto path = _get_path(name, size);
+    TRACE_SCOPE("MDIHelper::read_bmp");
+    power::CpuRequest compute(power::CpuProfile::COMPUTE);
+    uint32_t start = micros();
+    File file = SPIFFS.open(path.c_str(), FILE_READ);
+    bool ok = _decode_bmp(file, slot.bitmap);
+    file.close();
+    stats_.reads++;
+    stats_.read_us += micros() - start;
+    if (!ok) {
+      error("Failed to decode '%s'", path.c_str());
+      // file might be corrupted - remove so it will be downloaded again
+      SPIFFS.remove(path.c_str());
+      return nullptr;
+    }
+  }
+  slot.name = name;
+  slot.size = size;
+  return &slot.bitmap;
+}
+
+bool MDIHelper::_exists(const char* path) {
+  uint32_t start = micros();
+  bool ret = SPIFFS.exists(path);
+  stats_.lookups++;
+  stats_.lookup_us += micros() - start;
+  return ret;
+}
+
+// matching or least recently used entry
+MDIHelper::CacheEntry& MDIHelper::_cache_slot(const char* name,
+                                              uint16_t size) {
+  CacheEntry* lru = &cache_[0];
+  for (auto& entry : cache_) {
+    if (entry.size == size && entry.name == name) {
+      lru = &entry;
+      break;
+    }
+    if (entry.last_use < lru->last_use) {
+      lru = &entry;
+    }
+  }
+  lru->last_use = ++cache_clock_;
+  return *lru;
+}
+
+void MDIHelper::_invalidate(const char* name, uint16_t size) {
+  xSemaphoreTake(cache_mutex_, portMAX_DELAY);
+  for (auto& entry : cache_) {
+    if (entry.size == size && entry.name == name) {
+      entry.size = 0;
+    }
+  }
+  xSemaphoreGive(cache_mutex_);
+}
+
+// Decodes uncompressed BMP files with depth 1, 4, 8, 16, 24 or 32.
+// Same black/white threshold as the GxEPD2 examples.
+bool MDIHelper::_decode_bmp(File& file, IconBitmap& bitmap) {
+  if (!file) {
+    return false;
+  }
+  uint8_t header[54];
+  if (file.read(header, sizeof(header)) != sizeof(header) ||
+      header[0] != 'B' || header[1] != 'M') {
+    return false;
+  }
+  auto get16 = [&header](size_t pos) {
+    return static_cast<uint16_t>(header[pos] | (header[pos + 1] << 8));
+  };
+  auto get32 = [&header](size_t pos) {
+    return static_cast<uint32_t>(header[pos] | (header[pos + 1] << 8) |
+                                 (header[pos + 2] << 16) |
+                                 (header[pos + 3] << 24));
+  };
+  uint32_t image_offset = get32(10);
+  uint32_t header_size = get32(14);
+  int32_t width = static_cast<int32_t>(get32(18));
+  int32_t height = static_cast<int32_t>(get32(22));
+  uint16_t planes = get16(26);
+  uint16_t depth = get16(28);
+  uint32_t format = get32(30);
+
+  bool flip = true;  // bitmap is stored bottom-to-top
+  if (height < 0) {
+    height = -height;
+    flip = false;
+  }
+  if (planes != 1 || (format != 0 && format != 3) || width <= 0 ||
+      width > MAX_ICON_SIZE || height > MAX_ICON_SIZE ||
+      (depth != 1 && depth != 4 && depth != 8 && depth != 16 && depth != 24 &&
+       depth != 32)) {
+    error("Unsupported BMP: %dx%d, depth %u, format %u", width, height, depth,
+          format);
+    return false;
+  }
+
+  // palette for depth <= 8: bit set = white
+  uint8_t palette[256 / 8] = {};
+  if (depth <= 8) {
+    file.seek(14 + header_size);
+    for (uint16_t pn = 0; pn < (1 << depth); pn++) {
+      uint8_t bgr[4];
+      if (file.read(bgr, sizeof(bgr)) != sizeof(bgr)) {
+        return false;
+      }
+      if (bgr[0] + bgr[1] + bgr[2] > 3 * 0x80) {
+        palette[pn / 8] |= 1 << (pn % 8);
+      }
+    }
+  }
+
+  // BMP rows are padded to 4-byte boundary
+  uint32_t row_size = ((width * depth + 31) / 32) * 4;
+  uint16_t stride = (width + 7) / 8;
+  memset(bitmap.data, 0, stride * height);
+  for (int32_t row = 0; row < height; row++) {
+    int32_t src_row = flip ? height - 1 - row : row;
+    file.seek(image_offset + src_row * row_size);
+    if (file.read(row_buffer_, row_size) != row_size) {
+      return false;
+    }
+    for (int32_t col = 0; col < width; col++) {
+      bool whitish;
+      switch (depth) {
+        case 32:
+        case 24: {
+          const uint8_t* px = &row_buffer_[col * (depth / 8)];
+          whitish = px[0] + px[1] + px[2] > 3 * 0x80;
+        } break;
+        case 16: {
+          uint8_t lsb = row_buffer_[2 * col];
+          uint8_t msb = row_buffer_[2 * col + 1];
+          uint16_t red, green, blue;
+          blue = (lsb & 0x1F) << 3;
+          if (format == 0) {  // 555
+            green = ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2);
+            red = (msb & 0x7C) << 1;
+          } else {  // 565
+            green = ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3);
+            red = (msb & 0xF8);
+          }
+          whitish = red + green + blue > 3 * 0x80;
+        } break;
+        default: {
+          uint32_t bit = col * depth;
+          uint8_t pn = (row_buffer_[bit / 8] >> (8 - depth - bit % 8)) &
+                       ((1 << depth) - 1);
+          whitish = palette[pn / 8] & (1 << (pn % 8));
+        } break;
+      }
+      if (!whitish) {
+        bitmap.data[row * stride + col / 8] |= 1 << (col % 8);
+      }
+    }
+  }
+  bitmap.width = width;
+  bitmap.height = height;
+  return true;
 }
@@ -3,34 +3,112 @@
 
 #include <SPIFFS.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "builtin_icons.h"
 #include "logger.h"
 #include "static_string.h"
+#include "types.h"
 
 static constexpr uint8_t MAX_NUM_SIZES = 3;
 
 static constexpr size_t MAX_PATH_LEN = 56;
 
+#ifndef HOME_BUTTONS_MINI
+static constexpr uint16_t MAX_ICON_SIZE = 64;
+#else
+static constexpr uint16_t MAX_ICON_SIZE = 100;
+#endif
+
+// one decoded icon for each button
+static constexpr uint8_t ICON_CACHE_SIZE = NUM_BUTTONS;
+
+// Decoded icon in XBM format (1 bpp, LSB first, rows padded to full bytes,
+// set bit = black).
+struct IconBitmap {
+  uint16_t width = 0;
+  uint16_t height = 0;
+  uint8_t data[(MAX_ICON_SIZE + 7) / 8 * MAX_ICON_SIZE];
+};
+
+// Icon storage. SPIFFS is mounted on first use and stays mounted until end()
+// is called before deep sleep. Decoded icons are cached for the whole wakeup.
 class MDIHelper : public Logger {
  public:
-  MDIHelper() : Logger("MDI") {}
+  MDIHelper();
   bool begin();
   void add_size(uint16_t size);
+  // base URL of an icon mirror, empty = default source
+  void set_source(const char* url);
+  bool has_custom_source() const { return !source_.empty(); }
   bool download(const char* name, uint16_t size);
   bool download(const char* name);
+  // all sizes of all icons in one request, custom source only
+  bool download_bundle(const MDIName* names, uint8_t count);
   bool check_connection();
   bool exists(const char* name, uint16_t size);
   bool exists_all_sizes(const char* name);
+  const BuiltinIcon* get_builtin(const char* name, uint16_t size);
+  bool builtin_all_sizes(const char* name);
   File get_file(const char* name, uint16_t size);
+  // Built-in or stored icon, decoded. Valid until the next call, must only be
+  // used from a single task (display). Uploads and removals from other tasks
+  // invalidate the cached icon.
+  const IconBitmap* get_bitmap(const char* name, uint16_t size);
   size_t get_free_space();
   bool make_space(size_t size);
   bool remove(const char* name, uint16_t size);
+  bool has_size(uint16_t size) const;
+  // icon upload into temporary file, renamed once complete
+  File begin_upload(size_t size);
+  bool finish_upload(const char* name, uint16_t size);
+  void abort_upload();
+  // removes all stored icons
+  bool format();
+  // unmount, only before deep sleep
   void end();
+  void log_stats();
 
  private:
+  struct CacheEntry {
+    MDIName name;
+    uint16_t size = 0;
+    uint32_t last_use = 0;
+    IconBitmap bitmap;
+  };
+
+  struct Stats {
+    uint32_t mount_us = 0;
+    uint32_t lookups = 0;
+    uint32_t lookup_us = 0;
+    uint32_t reads = 0;
+    uint32_t read_us = 0;
+    uint32_t cache_hits = 0;
+  };
+
+  SemaphoreHandle_t mutex_ = nullptr;
+  // cache entries, taken before mutex_ when both are needed
+  SemaphoreHandle_t cache_mutex_ = nullptr;
   bool spiffs_mounted_ = false;
+  bool upload_active_ = false;
+  CacheEntry cache_[ICON_CACHE_SIZE];
+  uint32_t cache_clock_ = 0;
+  Stats stats_;
+  uint8_t row_buffer_[4 * MAX_ICON_SIZE];  // up to depth 32
+
   uint16_t sizes_[MAX_NUM_SIZES] = {0};
   uint8_t num_sizes_ = 0;
+  IconSource source_{};
+  IconSource base_url_{};  // resolved once per wakeup
+  const char* _base_url();
   StaticString<MAX_PATH_LEN> _get_path(const char* name, uint16_t size);
+  bool _exists(const char* path);
+  const IconBitmap* _get_bitmap(const char* name, uint16_t size);
+  File _create(const char* path, size_t length);
+  CacheEntry& _cache_slot(const char* name, uint16_t size);
+  void _invalidate(const char* name, uint16_t size);
+  bool _decode_bmp(File& file, IconBitmap& bitmap);
 };
 
 #endif
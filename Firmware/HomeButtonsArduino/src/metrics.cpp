@@ -0,0 +1,278 @@
+#include "metrics.h"
+
+#include <ArduinoJson.h>
+
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+namespace metrics {
+
+static constexpr size_t NUM_COUNTERS = static_cast<size_t>(Counter::NUM);
+static constexpr size_t NUM_GAUGES = static_cast<size_t>(Gauge::NUM);
+static constexpr size_t NUM_HISTOGRAMS = static_cast<size_t>(Histogram::NUM);
+
+static constexpr const char* COUNTER_NAMES[] = {
+    "wake",      "wifi_fail", "wifi_rec",  "mqtt_fail", "mqtt_rec", "pub_fail",
+    "q_full",    "icon_hit",  "icon_miss", "disp_upd",  "btn",      "tls_res",
+    "tls_full",  "btn_q",     "btn_drop",
+};
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) ==
+                  NUM_COUNTERS,
+              "a counter has no name");
+
+static constexpr const char* GAUGE_NAMES[] = {
+    "heap",     "heap_min", "rssi",    "idle",    "cpu_max", "cpu_sw_us",
+    "qwifi_to", "wifi_to",  "mqtt_to", "net_to",  "net_fail"};
+static_assert(sizeof(GAUGE_NAMES) / sizeof(GAUGE_NAMES[0]) == NUM_GAUGES,
+              "a gauge has no name");
+
+struct HistogramInfo {
+  const char* name;
+  uint32_t bounds[HISTOGRAM_BOUNDS];  // upper bounds, inclusive
+};
+
+static constexpr HistogramInfo HISTOGRAMS[] = {
+    {"wake_ms", {1000, 2000, 5000, 10000, 30000}},
+    {"wifi_ms", {300, 500, 1000, 2000, 5000}},
+    {"mqtt_ms", {50, 100, 200, 500, 1000}},
+    {"disp_ms", {500, 1000, 2000, 3000, 5000}},
+    {"tls_ms", {100, 200, 500, 1000, 2000}},
+    {"tx_b", {256, 512, 1024, 2048, 4096}},
+    {"pub_ms", {50, 100, 200, 500, 1000}},
+    {"sync_ms", {50, 100, 200, 500, 1000}},
+    {"shdn_ms", {100, 500, 1000, 2000, 5000}},
+};
+static_assert(sizeof(HISTOGRAMS) / sizeof(HISTOGRAMS[0]) == NUM_HISTOGRAMS,
+              "a histogram has no name");
+
+// named by kind, "h<n>" for every histogram part whatever their number
+struct PartNames {
+  char names[NUM_PARTS][4];
+};
+static_assert(NUM_PARTS - PART_HISTOGRAMS <= 10, "histogram part name");
+
+static constexpr PartNames _part_names() {
+  PartNames part_names = {};
+  part_names.names[PART_COUNTERS][0] = 'c';
+  part_names.names[PART_GAUGES][0] = 'g';
+  for (uint8_t part = PART_HISTOGRAMS; part < PART_TASKS; part++) {
+    part_names.names[part][0] = 'h';
+    part_names.names[part][1] = static_cast<char>('0' + part - PART_HISTOGRAMS);
+  }
+  part_names.names[PART_TASKS][0] = 't';
+  return part_names;
+}
+
+static constexpr PartNames PART_NAMES = _part_names();
+
+static constexpr size_t _length(const char* str) {
+  size_t n = 0;
+  while (str[n] != '\0') n++;
+  return n;
+}
+
+// {"name":value,...} with every value value_len long
+template <size_t N>
+static constexpr size_t _max_object_len(const char* const (&names)[N],
+                                        size_t value_len) {
+  size_t n = 1;
+  for (const char* name : names) n += _length(name) + 4 + value_len;
+  return n;
+}
+
+// {"name":[count,sum,buckets..],...}, all uint32
+static constexpr size_t _max_histograms_len(size_t part) {
+  size_t n = 1;
+  for (size_t i = (part - PART_HISTOGRAMS) * HISTOGRAMS_PER_PART;
+       i < NUM_HISTOGRAMS &&
+       i < (part - PART_HISTOGRAMS + 1) * HISTOGRAMS_PER_PART;
+       i++) {
+    n += _length(HISTOGRAMS[i].name) + 4 + 2 + (HISTOGRAM_BOUNDS + 3) * 11 - 1;
+  }
+  return n;
+}
+
+static constexpr bool _histograms_fit() {
+  for (size_t part = PART_HISTOGRAMS; part < PART_TASKS; part++) {
+    if (_max_histograms_len(part) > MAX_JSON_LEN) return false;
+  }
+  return true;
+}
+
+static_assert(_max_object_len(COUNTER_NAMES, 10) <= MAX_JSON_LEN,
+              "counters don't fit into one part");
+static_assert(_max_object_len(GAUGE_NAMES, 11) <= MAX_JSON_LEN,
+              "gauges don't fit into one part");
+static_assert(_histograms_fit(), "histograms don't fit into one part");
+
+static constexpr uint32_t MAGIC = 0x484D5431;  // "HMT1"
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+static constexpr UBaseType_t MAX_TASKS = 16;
+
+struct HistogramData {
+  uint32_t count;
+  uint32_t sum;
+  uint32_t buckets[HISTOGRAM_BOUNDS + 1];
+};
+
+struct Data {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint16_t wakes_since_publish;
+  bool never_published;
+  uint32_t counters[NUM_COUNTERS];
+  int32_t gauges[NUM_GAUGES];
+  HistogramData histograms[NUM_HISTOGRAMS];
+};
+
+RTC_NOINIT_ATTR static Data data;
+static bool initialized = false;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// call with lock held
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  // RTC memory is random after power-on, and the layout may change with the
+  // firmware
+  if (data.magic != MAGIC ||
+      memcmp(data.firmware_id, id, FIRMWARE_ID_LEN) != 0) {
+    memset(&data, 0, sizeof(data));
+    data.magic = MAGIC;
+    memcpy(data.firmware_id, id, FIRMWARE_ID_LEN);
+    data.never_published = true;
+  }
+  initialized = true;
+}
+
+void inc(Counter counter, uint32_t n) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  data.counters[static_cast<size_t>(counter)] += n;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void set(Gauge gauge, int32_t value) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  data.gauges[static_cast<size_t>(gauge)] = value;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void observe(Histogram histogram, uint32_t value) {
+  size_t i = static_cast<size_t>(histogram);
+  uint8_t bucket = 0;
+  while (bucket < HISTOGRAM_BOUNDS && value > HISTOGRAMS[i].bounds[bucket]) {
+    bucket++;
+  }
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  data.histograms[i].count++;
+  data.histograms[i].sum += value;
+  data.histograms[i].buckets[bucket]++;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void wakeup() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  data.counters[static_cast<size_t>(Counter::WAKEUPS)]++;
+  if (data.wakes_since_publish < UINT16_MAX) {
+    data.wakes_since_publish++;
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+bool publish_due() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  bool due = data.never_published ||
+             data.wakes_since_publish >= METRICS_PUBLISH_WAKES;
+  taskEXIT_CRITICAL(&lock);
+  return due;
+}
+
+void published() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  data.wakes_since_publish = 0;
+  data.never_published = false;
+  taskEXIT_CRITICAL(&lock);
+}
+
+static void _add_tasks(JsonDocument& doc, size_t len) {
+#if configUSE_TRACE_FACILITY
+  TaskStatus_t status[MAX_TASKS];
+  uint32_t total_run_time = 0;
+  UBaseType_t count = uxTaskGetSystemState(status, MAX_TASKS, &total_run_time);
+  for (UBaseType_t i = 0; i < count; i++) {
+    // fits with the longest values
+    if (measureJson(doc) + strlen(status[i].pcTaskName) + 4 + 12 >= len) {
+      ESP_LOGW("metrics", "task stats incomplete, %u of %u", i, count);
+      break;
+    }
+    JsonArray task = doc.createNestedArray(status[i].pcTaskName);
+    task.add(status[i].usStackHighWaterMark);
+#if configGENERATE_RUN_TIME_STATS
+    if (total_run_time > 0) {
+      task.add(static_cast<uint32_t>(
+          static_cast<uint64_t>(status[i].ulRunTimeCounter) * 100 /
+          total_run_time));
+    }
+#endif
+  }
+#endif
+}
+
+const char* part_name(uint8_t part) {
+  return part < NUM_PARTS ? PART_NAMES.names[part] : "";
+}
+
+size_t to_json(uint8_t part, char* buf, size_t len) {
+  Data copy;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  copy = data;
+  taskEXIT_CRITICAL(&lock);
+
+  StaticJsonDocument<1536> doc;
+  doc.to<JsonObject>();
+  if (part == PART_COUNTERS) {
+    for (size_t i = 0; i < NUM_COUNTERS; i++) {
+      doc[COUNTER_NAMES[i]] = copy.counters[i];
+    }
+  } else if (part == PART_GAUGES) {
+    for (size_t i = 0; i < NUM_GAUGES; i++) {
+      doc[GAUGE_NAMES[i]] = copy.gauges[i];
+    }
+  } else if (part < PART_TASKS) {
+    size_t first = (part - PART_HISTOGRAMS) * HISTOGRAMS_PER_PART;
+    for (size_t i = first;
+         i < NUM_HISTOGRAMS && i < first + HISTOGRAMS_PER_PART; i++) {
+      JsonArray histogram = doc.createNestedArray(HISTOGRAMS[i].name);
+      histogram.add(copy.histograms[i].count);
+      histogram.add(copy.histograms[i].sum);
+      for (uint32_t bucket : copy.histograms[i].buckets) {
+        histogram.add(bucket);
+      }
+    }
+  } else if (part == PART_TASKS) {
+    _add_tasks(doc, len);
+  } else {
+    return 0;
+  }
+
+  if (measureJson(doc) >= len) {
+    ESP_LOGE("metrics", "part %s too large", PART_NAMES.names[part]);
+    return 0;
+  }
+  return serializeJson(doc, buf, len);
+}
+
+}  // namespace metrics
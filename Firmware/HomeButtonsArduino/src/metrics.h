@@ -0,0 +1,107 @@
+#ifndef HOMEBUTTONS_METRICS_H
+#define HOMEBUTTONS_METRICS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Runtime metrics kept in RTC memory, so they add up over deep sleep. They
+// are reset on power loss and when the firmware changes.
+//
+// All metrics are declared here, a module adds its own by extending the enums
+// and the name tables in metrics.cpp (checked at compile time).
+namespace metrics {
+
+// monotonic, only reset together with the RTC memory
+enum class Counter : uint8_t {
+  WAKEUPS,
+  WIFI_FAILURES,
+  WIFI_RECONNECTS,
+  MQTT_FAILURES,
+  MQTT_RECONNECTS,
+  PUBLISH_FAILURES,
+  QUEUE_FULL,
+  ICON_CACHE_HITS,
+  ICON_CACHE_MISSES,
+  DISPLAY_REFRESHES,
+  BUTTON_PRESSES,
+  TLS_RESUMED,
+  TLS_FULL,
+  PRESSES_QUEUED,   // not delivered, see press_outbox.h
+  PRESSES_DROPPED,  // outbox full or too old
+  NUM
+};
+
+// last value
+enum class Gauge : uint8_t {
+  FREE_HEAP,
+  MIN_FREE_HEAP,
+  WIFI_RSSI,
+  IDLE_PCT,
+  CPU_MAX_PCT,            // share of time at max frequency
+  CPU_SWITCH_US,          // slowest switch to max frequency
+  QUICK_WIFI_TIMEOUT_MS,  // learned, see net_timeouts.h
+  WIFI_TIMEOUT_MS,
+  MQTT_TIMEOUT_MS,
+  NET_TIMEOUT_MS,
+  NET_FAILURES,  // connects failed in a row
+  NUM
+};
+
+// fixed buckets, see metrics.cpp
+enum class Histogram : uint8_t {
+  WAKE_TIME_MS,
+  WIFI_CONNECT_MS,
+  MQTT_CONNECT_MS,
+  DISPLAY_UPDATE_MS,
+  TLS_HANDSHAKE_MS,
+  TX_BYTES,     // MQTT bytes per connection
+  PUBLISH_MS,   // connected until the last publish was acknowledged
+  SYNC_MS,      // cmd/sync echo, see App::_start_sync()
+  SHUTDOWN_MS,  // until ready for deep sleep, see ShutdownSequencer
+  NUM
+};
+
+static constexpr uint8_t HISTOGRAM_BOUNDS = 5;  // +1 bucket for the rest
+
+void inc(Counter counter, uint32_t n = 1);
+void set(Gauge gauge, int32_t value);
+void observe(Histogram histogram, uint32_t value);
+
+// Counts a wakeup, call once per boot.
+void wakeup();
+// True every METRICS_PUBLISH_WAKES wakeups, and on the first one after reset.
+bool publish_due();
+void published();
+
+// The metrics are written in parts, one compact JSON document each, so every
+// part fits into one MQTT message. Parts are named by part_name():
+//   "c"       {<counter>:n}
+//   "g"       {<gauge>:n}
+//   "h0".."hN" {<histogram>:[count,sum,buckets..]}, HISTOGRAMS_PER_PART each
+//   "t"       {<task>:[free stack,cpu %]}
+// "t" needs FreeRTOS trace facility, cpu % needs run time stats, tasks that
+// don't fit are left out.
+static constexpr uint8_t HISTOGRAMS_PER_PART = 4;
+static constexpr uint8_t PART_COUNTERS = 0;
+static constexpr uint8_t PART_GAUGES = 1;
+static constexpr uint8_t PART_HISTOGRAMS = 2;
+static constexpr uint8_t PART_TASKS =
+    PART_HISTOGRAMS + (static_cast<uint8_t>(Histogram::NUM) +
+                       HISTOGRAMS_PER_PART - 1) /
+                          HISTOGRAMS_PER_PART;
+static constexpr uint8_t NUM_PARTS = PART_TASKS + 1;
+// Longest part with every value at its maximum, checked in metrics.cpp.
+static constexpr size_t MAX_JSON_LEN = 480;
+
+const char* part_name(uint8_t part);
+// Part with the histogram in it.
+constexpr uint8_t histogram_part(Histogram histogram) {
+  return PART_HISTOGRAMS +
+         static_cast<uint8_t>(histogram) / HISTOGRAMS_PER_PART;
+}
+// Returns the length, 0 if it doesn't fit.
+size_t to_json(uint8_t part, char* buf, size_t len);
+
+}  // namespace metrics
+
+#endif  // HOMEBUTTONS_METRICS_H
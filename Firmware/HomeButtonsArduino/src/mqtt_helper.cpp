@@ -1,22 +1,33 @@
 #include "mqtt_helper.h"
 
 #include <Arduino.h>
-#include <ArduinoJson.h>
 
 #include "config.h"
+#include "discovery_templates.h"
 #include "network.h"
 #include "state.h"
 #include "hardware.h"
+#include "json_template.h"
+#include "metrics.h"
 #include "static_string.h"
 
-template <size_t SIZE>
-bool convertToJson(const StaticString<SIZE>& src, JsonVariant dst) {
-  return dst.set(
-      const_cast<char*>(src.c_str()));  // Warning: use char*, not const char*
-                                        // to force a copy in ArduinoJson.
+using FormatterType = StaticString<64>;
+using DeviceType = StaticString<256>;
+
+// HA can't backfill sensor history over MQTT, the latest sample is the state
+// and the batch its attributes
+static void _add_history_attributes(PayloadType& conf, const char* series,
+                                    const char* key, const TopicType& topic,
+                                    uint8_t batch) {
+  if (batch <= 1) return;
+  json_template::render(conf, HISTORY_ATTRIBUTES, {topic, series, key});
 }
 
-using FormatterType = StaticString<64>;
+static DeviceType _device_short(const DeviceState& state) {
+  DeviceType device;
+  json_template::render(device, DEVICE_SHORT, {state.factory().unique_id});
+  return device;
+}
 
 MQTTHelper::MQTTHelper(DeviceState& state, Network& network)
     : _device_state(state), _network(network) {}
@@ -34,222 +45,180 @@ void MQTTHelper::send_discovery_config() {
       TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
       "/sensor/" + _device_state.factory().unique_id;
 
-  // device objects
-  StaticJsonDocument<256> device_full;
-  device_full["ids"][0] = _device_state.factory().unique_id;
-  device_full["mdl"] = _device_state.factory().model_name;
-  device_full["name"] = _device_state.device_name();
-  device_full["sw"] = SW_VERSION;
-  device_full["hw"] = _device_state.factory().hw_version;
-  device_full["mf"] = MANUFACTURER;
-
-  StaticJsonDocument<128> device_short;
-  device_short["ids"][0] = _device_state.factory().unique_id;
+  const auto& unique_id = _device_state.factory().unique_id;
 
-  // send mqtt msg
-  char buffer[MQTT_PYLD_SIZE];
-
-  // button single press
-  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    StaticJsonDocument<MQTT_PYLD_SIZE> conf;
-    conf["atype"] = "trigger";
-    conf["t"] = t_btn_press(i);
-    conf["pl"] = BTN_PRESS_PAYLOAD;
-    conf["type"] = "button_short_press";
-    conf["stype"] = FormatterType("button_%d", i + 1);
-    if (i == 0) {
-      conf["dev"] = device_full;
-    } else {
-      conf["dev"] = device_short;
+  // device objects
+  DeviceType device_full;
+  json_template::render(
+      device_full, DEVICE_FULL,
+      {unique_id, _device_state.factory().model_name,
+       _device_state.device_name(), SW_VERSION,
+       _device_state.factory().hw_version, MANUFACTURER});
+  DeviceType device_short = _device_short(_device_state);
+
+  // button presses, the full device only once
+  struct Trigger {
+    const char* suffix;
+    const char* type;
+  };
+  static constexpr Trigger TRIGGERS[] = {
+      {"", "button_short_press"},
+      {"_double", "button_double_press"},
+      {"_triple", "button_triple_press"},
+      {"_quad", "button_quadruple_press"},
+  };
+  for (const auto& trigger : TRIGGERS) {
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      PayloadType conf;
+      json_template::render(conf, TRIGGER_CONF,
+                            {t_btn_press(i), trigger.suffix, BTN_PRESS_PAYLOAD,
+                             trigger.type, i + 1});
+      bool full = i == 0 && trigger.suffix[0] == '\0';
+      json_template::render(conf, DEVICE_END,
+                            {full ? device_full : device_short});
+      TopicType topic_name("%s/button_%d%s/config",
+                           trigger_topic_common.c_str(), i + 1,
+                           trigger.suffix);
+      _network.publish(topic_name, conf, true);
     }
-    serializeJson(conf, buffer, sizeof(buffer));
-    TopicType topic_name("%s/button_%d/config", trigger_topic_common.c_str(),
-                         i + 1);
-    _network.publish(topic_name, buffer, true);
-  }
-
-  // button double press
-  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    StaticJsonDocument<MQTT_PYLD_SIZE> conf;
-    conf["atype"] = "trigger";
-    conf["t"] = t_btn_press(i) + "_double";
-    conf["pl"] = BTN_PRESS_PAYLOAD;
-    conf["type"] = "button_double_press";
-    conf["stype"] = FormatterType("button_%d", i + 1);
-    conf["dev"] = device_short;
-    serializeJson(conf, buffer, sizeof(buffer));
-    TopicType topic_name("%s/button_%d_double/config",
-                         trigger_topic_common.c_str(), i + 1);
-    _network.publish(topic_name, buffer, true);
-  }
-
-  // button triple press
-  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    StaticJsonDocument<MQTT_PYLD_SIZE> conf;
-    conf["atype"] = "trigger";
-    conf["t"] = t_btn_press(i) + "_triple";
-    conf["pl"] = BTN_PRESS_PAYLOAD;
-    conf["type"] = "button_triple_press";
-    conf["stype"] = FormatterType("button_%d", i + 1);
-    conf["dev"] = device_short;
-    serializeJson(conf, buffer, sizeof(buffer));
-    TopicType topic_name("%s/button_%d_triple/config",
-                         trigger_topic_common.c_str(), i + 1);
-    _network.publish(topic_name, buffer, true);
-  }
-
-  // button quad press
-  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    StaticJsonDocument<MQTT_PYLD_SIZE> conf;
-    conf["atype"] = "trigger";
-    conf["t"] = t_btn_press(i) + "_quad";
-    conf["pl"] = BTN_PRESS_PAYLOAD;
-    conf["type"] = "button_quadruple_press";
-    conf["stype"] = FormatterType("button_%d", i + 1);
-    conf["dev"] = device_short;
-    serializeJson(conf, buffer, sizeof(buffer));
-    TopicType topic_name("%s/button_%d_quad/config",
-                         trigger_topic_common.c_str(), i + 1);
-    _network.publish(topic_name, buffer, true);
-  }
-
-  uint16_t expire_after = _device_state.sensor_interval() * 60 + 60;  // seconds
-
-  {
-    // temperature
-    TopicType temperature_config_topic =
-        sensor_topic_common + "/temperature/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> temp_conf;
-    temp_conf["name"] = "Temperature";
-    temp_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_temperature";
-    temp_conf["stat_t"] = t_temperature();
-    temp_conf["dev_cla"] = "temperature";
-    temp_conf["unit_of_meas"] =
-        _device_state.get_use_fahrenheit() ? "°F" : "°C";
-    temp_conf["exp_aft"] = expire_after;
-    temp_conf["dev"] = device_short;
-    serializeJson(temp_conf, buffer, sizeof(buffer));
-    _network.publish(temperature_config_topic, buffer, true);
   }
 
-  {
-    // humidity
-    TopicType humidity_config_topic = sensor_topic_common + "/humidity/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> humidity_conf;
-    humidity_conf["name"] = "Humidity";
-    humidity_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_humidity";
-    humidity_conf["stat_t"] = t_humidity();
-    humidity_conf["dev_cla"] = "humidity";
-    humidity_conf["unit_of_meas"] = "%";
-    humidity_conf["exp_aft"] = expire_after;
-    humidity_conf["dev"] = device_short;
-    serializeJson(humidity_conf, buffer, sizeof(buffer));
-    _network.publish(humidity_config_topic, buffer, true);
-  }
+  _send_sensor_configs(sensor_topic_common, device_short.c_str());
 
   {
-    // battery
-    TopicType battery_config_topic = sensor_topic_common + "/battery/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> battery_conf;
-    battery_conf["name"] = "Battery";
-    battery_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_battery";
-    battery_conf["stat_t"] = t_battery();
-    battery_conf["dev_cla"] = "battery";
-    battery_conf["unit_of_meas"] = "%";
-    battery_conf["exp_aft"] = expire_after;
-    battery_conf["dev"] = device_short;
-    serializeJson(battery_conf, buffer, sizeof(buffer));
-    _network.publish(battery_config_topic, buffer, true);
+    // sensor interval slider
+    TopicType sensor_interval_config_topic =
+        TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
+        "/number/" + unique_id + "/sensor_interval/config";
+    PayloadType conf;
+    json_template::render(conf, NUMBER_CONF,
+                          {"Sensor interval", unique_id, "sensor_interval",
+                           t_sensor_interval_cmd(), t_sensor_interval_state()});
+    json_template::render(conf, UNIT, {"min"});
+    json_template::render(conf, NUMBER_RANGE,
+                          {SEN_INTERVAL_MIN, SEN_INTERVAL_MAX, "slider",
+                           "mdi:timer-sand"});
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(sensor_interval_config_topic, conf, true);
   }
 
   {
-    // sensor interval slider
-    TopicType sensor_interval_config_topic =
+    // sensor batch slider
+    TopicType sensor_batch_config_topic =
         TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
-        "/number/" + _device_state.factory().unique_id +
-        "/sensor_interval/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> sensor_interval_conf;
-    sensor_interval_conf["name"] = "Sensor interval";
-    sensor_interval_conf["uniq_id"] = FormatterType{} +
-                                      _device_state.factory().unique_id +
-                                      "_sensor_interval";
-    sensor_interval_conf["cmd_t"] = t_sensor_interval_cmd();
-    sensor_interval_conf["stat_t"] = t_sensor_interval_state();
-    sensor_interval_conf["unit_of_meas"] = "min";
-    sensor_interval_conf["min"] = SEN_INTERVAL_MIN;
-    sensor_interval_conf["max"] = SEN_INTERVAL_MAX;
-    sensor_interval_conf["mode"] = "slider";
-    sensor_interval_conf["ic"] = "mdi:timer-sand";
-    sensor_interval_conf["ret"] = "true";
-    sensor_interval_conf["dev"] = device_short;
-    serializeJson(sensor_interval_conf, buffer, sizeof(buffer));
-    _network.publish(sensor_interval_config_topic, buffer, true);
+        "/number/" + unique_id + "/sensor_batch/config";
+    PayloadType conf;
+    json_template::render(conf, NUMBER_CONF,
+                          {"Sensor batch", unique_id, "sensor_batch",
+                           t_sensor_batch_cmd(), t_sensor_batch_state()});
+    json_template::render(conf, NUMBER_RANGE,
+                          {1, SEN_BATCH_MAX, "slider", "mdi:tray-full"});
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(sensor_batch_config_topic, conf, true);
   }
 
   // button labels
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
     TopicType button_label_config_topics =
         TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
-        "/text/" + _device_state.factory().unique_id + "/button_" + (i + 1) +
-        "_label/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> conf;
-    conf["name"] = FormatterType{} + "Button " + (i + 1) + " label";
-    conf["uniq_id"] = FormatterType{} + _device_state.factory().unique_id +
-                      "_button_" + (i + 1) + "_label";
-    conf["cmd_t"] = t_btn_label_cmd(i);
-    conf["stat_t"] = t_btn_label_state(i);
-    conf["max"] = BTN_LABEL_MAXLEN;
-    conf["ic"] = FormatterType("mdi:numeric-%d-box", i + 1);
-    conf["ret"] = "true";
-    conf["dev"] = device_short;
-    serializeJson(conf, buffer, sizeof(buffer));
-    _network.publish(button_label_config_topics, buffer, true);
+        "/text/" + unique_id + "/button_" + (i + 1) + "_label/config";
+    PayloadType conf;
+    json_template::render(
+        conf, TEXT_CONF,
+        {FormatterType("Button %d label", i + 1), unique_id,
+         FormatterType("button_%d_label", i + 1), t_btn_label_cmd(i),
+         t_btn_label_state(i), BTN_LABEL_MAXLEN,
+         FormatterType("mdi:numeric-%d-box", i + 1)});
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(button_label_config_topics, conf, true);
   }
 
   {
     // user message
     TopicType user_message_config_topic =
         TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
-        "/text/" + _device_state.factory().unique_id + "/user_message/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> user_message_conf;
-    user_message_conf["name"] = "Show message";
-    user_message_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_user_message";
-    user_message_conf["cmd_t"] = t_disp_msg_cmd();
-    user_message_conf["stat_t"] = t_disp_msg_state();
-    user_message_conf["max"] = USER_MSG_MAXLEN;
-    user_message_conf["ic"] = "mdi:message-text";
-    user_message_conf["ret"] = "true";
-    user_message_conf["dev"] = device_short;
-    serializeJson(user_message_conf, buffer, sizeof(buffer));
-    _network.publish(user_message_config_topic, buffer, true);
+        "/text/" + unique_id + "/user_message/config";
+    PayloadType conf;
+    json_template::render(conf, TEXT_CONF,
+                          {"Show message", unique_id, "user_message",
+                           t_disp_msg_cmd(), t_disp_msg_state(),
+                           USER_MSG_MAXLEN, "mdi:message-text"});
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(user_message_config_topic, conf, true);
   }
 
   {
     // schedule wakeup
     TopicType schedule_wakeup_config_topic =
         TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
-        "/number/" + _device_state.factory().unique_id +
-        "/schedule_wakeup/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> schedule_wakeup_conf;
-    schedule_wakeup_conf["name"] = "Schedule wakeup";
-    schedule_wakeup_conf["uniq_id"] = FormatterType{} +
-                                      _device_state.factory().unique_id +
-                                      "_schedule_wakeup";
-    schedule_wakeup_conf["cmd_t"] = t_schedule_wakeup_cmd();
-    schedule_wakeup_conf["stat_t"] = t_schedule_wakeup_state();
-    schedule_wakeup_conf["unit_of_meas"] = "s";
-    schedule_wakeup_conf["min"] = SCHEDULE_WAKEUP_MIN;
-    schedule_wakeup_conf["max"] = SCHEDULE_WAKEUP_MAX;
-    schedule_wakeup_conf["mode"] = "box";
-    schedule_wakeup_conf["ic"] = "mdi:alarm";
-    schedule_wakeup_conf["ret"] = "true";
-    schedule_wakeup_conf["dev"] = device_short;
-    serializeJson(schedule_wakeup_conf, buffer, sizeof(buffer));
-    _network.publish(schedule_wakeup_config_topic, buffer, true);
+        "/number/" + unique_id + "/schedule_wakeup/config";
+    PayloadType conf;
+    json_template::render(conf, NUMBER_CONF,
+                          {"Schedule wakeup", unique_id, "schedule_wakeup",
+                           t_schedule_wakeup_cmd(),
+                           t_schedule_wakeup_state()});
+    json_template::render(conf, UNIT, {"s"});
+    json_template::render(conf, NUMBER_RANGE,
+                          {SCHEDULE_WAKEUP_MIN, SCHEDULE_WAKEUP_MAX, "box",
+                           "mdi:alarm"});
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(schedule_wakeup_config_topic, conf, true);
+  }
+
+  {
+    // diagnostics, see metrics.h
+    struct DiagnosticSensor {
+      const char* id;
+      const char* name;
+      uint8_t part;
+      const char* value_template;
+      const char* unit;
+      const char* state_class;
+    };
+    static constexpr DiagnosticSensor DIAGNOSTIC_SENSORS[] = {
+        {"wakeups", "Wakeups", metrics::PART_COUNTERS,
+         "{{ value_json.wake }}", nullptr, "total_increasing"},
+        {"conn_failures", "Connection failures", metrics::PART_COUNTERS,
+         "{{ value_json.wifi_fail + value_json.mqtt_fail }}", nullptr,
+         "total_increasing"},
+        {"min_free_heap", "Min free heap", metrics::PART_GAUGES,
+         "{{ value_json.heap_min }}", "B", "measurement"},
+        {"avg_wake_time", "Average wake time",
+         metrics::histogram_part(metrics::Histogram::WAKE_TIME_MS),
+         "{{ (value_json.wake_ms[1] / [value_json.wake_ms[0], 1] | max) "
+         "| round(0) }}",
+         "ms", "measurement"},
+    };
+    for (const auto& sensor : DIAGNOSTIC_SENSORS) {
+      PayloadType conf;
+      json_template::render(
+          conf, DIAGNOSTIC_CONF,
+          {sensor.name, unique_id, sensor.id,
+           t_diagnostics(metrics::part_name(sensor.part)),
+           sensor.value_template});
+      if (sensor.unit != nullptr) {
+        json_template::render(conf, UNIT, {sensor.unit});
+      }
+      json_template::render(conf, DIAGNOSTIC_CLASS, {sensor.state_class});
+      json_template::render(conf, DEVICE_END, {device_short});
+      _network.publish(sensor_topic_common + "/" + sensor.id + "/config",
+                       conf, true);
+    }
+  }
+
+  {
+    // combined sensor state toggle
+    TopicType combined_sensors_config_topic =
+        TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
+        "/switch/" + unique_id + "/combined_sensors/config";
+    PayloadType conf;
+    json_template::render(conf, SWITCH_CONF,
+                          {"Combined sensor state", unique_id,
+                           "combined_sensors", t_combined_sensors_cmd(),
+                           t_combined_sensors_state(), "mdi:code-json"});
+    json_template::render(conf, CONFIG_CATEGORY);
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(combined_sensors_config_topic, conf, true);
   }
 
 #ifndef HOME_BUTTONS_MINI
@@ -257,19 +226,15 @@ void MQTTHelper::send_discovery_config() {
     // awake mode toggle
     TopicType awake_mode_config_topic =
         TopicType{} + _device_state.user_preferences().mqtt.discovery_prefix +
-        "/switch/" + _device_state.factory().unique_id + "/awake_mode/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> awake_mode_conf;
-    awake_mode_conf["name"] = "Awake mode";
-    awake_mode_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_awake_mode";
-    awake_mode_conf["cmd_t"] = t_awake_mode_cmd();
-    awake_mode_conf["stat_t"] = t_awake_mode_state();
-    awake_mode_conf["ic"] = "mdi:coffee";
-    awake_mode_conf["ret"] = "true";
-    awake_mode_conf["avty_t"] = t_awake_mode_avlb();
-    awake_mode_conf["dev"] = device_short;
-    serializeJson(awake_mode_conf, buffer, sizeof(buffer));
-    _network.publish(awake_mode_config_topic, buffer, true);
+        "/switch/" + unique_id + "/awake_mode/config";
+    PayloadType conf;
+    json_template::render(conf, SWITCH_CONF,
+                          {"Awake mode", unique_id, "awake_mode",
+                           t_awake_mode_cmd(), t_awake_mode_state(),
+                           "mdi:coffee"});
+    json_template::render(conf, AVAILABILITY, {t_awake_mode_avlb()});
+    json_template::render(conf, DEVICE_END, {device_short});
+    _network.publish(awake_mode_config_topic, conf, true);
   }
 #endif
 }
@@ -281,58 +246,45 @@ void MQTTHelper::update_discovery_config() {
       _device_state.user_preferences().mqtt.discovery_prefix.c_str(),
       _device_state.factory().unique_id.c_str());
 
-  StaticJsonDocument<128> device_short;
-  device_short["ids"][0] = _device_state.factory().unique_id;
-
-  char buffer[MQTT_PYLD_SIZE];
-
-  uint16_t expire_after = _device_state.sensor_interval() * 60 + 60;  // seconds
-
-  {
-    TopicType temperature_config_topic =
-        sensor_topic_common + "/temperature/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> temp_conf;
-    temp_conf["name"] = "Temperature";
-    temp_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_temperature";
-    temp_conf["stat_t"] = t_temperature();
-    temp_conf["dev_cla"] = "temperature";
-    temp_conf["unit_of_meas"] =
-        _device_state.get_use_fahrenheit() ? "°F" : "°C";
-    temp_conf["exp_aft"] = expire_after;
-    temp_conf["dev"] = device_short;
-    serializeJson(temp_conf, buffer, sizeof(buffer));
-    _network.publish(temperature_config_topic, buffer, true);
-  }
-
-  {
-    TopicType humidity_config_topic = sensor_topic_common + "/humidity/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> humidity_conf;
-    humidity_conf["name"] = "Humidity";
-    humidity_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_humidity";
-    humidity_conf["stat_t"] = t_humidity();
-    humidity_conf["dev_cla"] = "humidity";
-    humidity_conf["unit_of_meas"] = "%";
-    humidity_conf["exp_aft"] = expire_after;
-    humidity_conf["dev"] = device_short;
-    serializeJson(humidity_conf, buffer, sizeof(buffer));
-    _network.publish(humidity_config_topic, buffer, true);
-  }
+  _send_sensor_configs(sensor_topic_common,
+                       _device_short(_device_state).c_str());
+}
 
-  {
-    TopicType battery_config_topic = sensor_topic_common + "/battery/config";
-    StaticJsonDocument<MQTT_PYLD_SIZE> battery_conf;
-    battery_conf["name"] = "Battery";
-    battery_conf["uniq_id"] =
-        FormatterType{} + _device_state.factory().unique_id + "_battery";
-    battery_conf["stat_t"] = t_battery();
-    battery_conf["dev_cla"] = "battery";
-    battery_conf["unit_of_meas"] = "%";
-    battery_conf["exp_aft"] = expire_after;
-    battery_conf["dev"] = device_short;
-    serializeJson(battery_conf, buffer, sizeof(buffer));
-    _network.publish(battery_config_topic, buffer, true);
+void MQTTHelper::_send_sensor_configs(const TopicType& topic_common,
+                                      const char* device) {
+  struct Sensor {
+    const char* id;  // also the device class and the history series
+    const char* name;
+    const char* key;  // in the combined and the history payloads
+    const char* unit;
+    TopicType state_topic;
+  };
+  const Sensor sensors[] = {
+      {"temperature", "Temperature", "temp",
+       _device_state.get_use_fahrenheit() ? "°F" : "°C", t_temperature()},
+      {"humidity", "Humidity", "hum", "%", t_humidity()},
+      {"battery", "Battery", "batt", "%", t_battery()},
+  };
+
+  // seconds, a batch is only uploaded every sensor_batch samples
+  uint16_t expire_after =
+      _device_state.sensor_interval() * 60 * _device_state.sensor_batch() + 60;
+  bool combined = _device_state.combined_sensors();
+
+  for (const auto& sensor : sensors) {
+    PayloadType conf;
+    json_template::render(
+        conf, SENSOR_CONF,
+        {sensor.name, _device_state.factory().unique_id, sensor.id,
+         combined ? t_sensors() : sensor.state_topic, sensor.id, sensor.unit,
+         expire_after});
+    if (combined) {
+      json_template::render(conf, VALUE_TEMPLATE, {sensor.key});
+    }
+    _add_history_attributes(conf, sensor.id, sensor.key, t_sensor_history(),
+                            _device_state.sensor_batch());
+    json_template::render(conf, DEVICE_END, {device});
+    _network.publish(topic_common + "/" + sensor.id + "/config", conf, true);
   }
 }
 
@@ -362,6 +314,7 @@ TopicType MQTTHelper::t_temperature() const {
 }
 TopicType MQTTHelper::t_humidity() const { return t_common() + "humidity"; }
 TopicType MQTTHelper::t_battery() const { return t_common() + "battery"; }
+TopicType MQTTHelper::t_sensors() const { return t_common() + "sensors"; }
 TopicType MQTTHelper::t_btn_press(uint8_t i) const {
   if (i < NUM_BUTTONS)
     return t_common() + "button_" + (i + 1);
@@ -391,6 +344,30 @@ TopicType MQTTHelper::t_sensor_interval_cmd() const {
   return t_cmd() + "sensor_interval";
 }
 
+TopicType MQTTHelper::t_sensor_batch_state() const {
+  return t_common() + "sensor_batch";
+}
+
+TopicType MQTTHelper::t_sensor_batch_cmd() const {
+  return t_cmd() + "sensor_batch";
+}
+
+TopicType MQTTHelper::t_combined_sensors_state() const {
+  return t_common() + "combined_sensors";
+}
+
+TopicType MQTTHelper::t_combined_sensors_cmd() const {
+  return t_cmd() + "combined_sensors";
+}
+
+TopicType MQTTHelper::t_sensor_history() const {
+  return t_common() + "sensor_history";
+}
+
+TopicType MQTTHelper::t_button_history() const {
+  return t_common() + "button_history";
+}
+
 TopicType MQTTHelper::t_awake_mode_state() const {
   return t_common() + "awake_mode";
 }
@@ -416,3 +393,29 @@ TopicType MQTTHelper::t_schedule_wakeup_cmd() const {
 TopicType MQTTHelper::t_schedule_wakeup_state() const {
   return t_common() + "schedule_wakeup";
 }
+
+TopicType MQTTHelper::t_icon_cmd() const { return t_cmd() + "icon"; }
+
+TopicType MQTTHelper::t_icon_state() const { return t_common() + "icon"; }
+
+TopicType MQTTHelper::t_icon_source_cmd() const {
+  return t_cmd() + "icon_source";
+}
+
+TopicType MQTTHelper::t_icon_source_state() const {
+  return t_common() + "icon_source";
+}
+
+TopicType MQTTHelper::t_log_cmd() const { return t_cmd() + "log"; }
+
+TopicType MQTTHelper::t_log() const { return t_common() + "log"; }
+
+TopicType MQTTHelper::t_trace_cmd() const { return t_cmd() + "trace"; }
+
+TopicType MQTTHelper::t_trace() const { return t_common() + "trace"; }
+
+TopicType MQTTHelper::t_diagnostics(const char* part) const {
+  return t_common() + "diagnostics/" + part;
+}
+
+TopicType MQTTHelper::t_sync() const { return t_cmd() + "sync"; }
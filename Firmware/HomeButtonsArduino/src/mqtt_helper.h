@@ -28,11 +28,18 @@ class MQTTHelper {
   TopicType t_temperature() const;
   TopicType t_humidity() const;
   TopicType t_battery() const;
+  TopicType t_sensors() const;  // all of the above, as one JSON object
   TopicType t_btn_press(uint8_t btn_idx) const;
   TopicType t_btn_label_state(uint8_t btn_idx) const;
   TopicType t_btn_label_cmd(uint8_t btn_idx) const;
   TopicType t_sensor_interval_state() const;
   TopicType t_sensor_interval_cmd() const;
+  TopicType t_sensor_batch_state() const;
+  TopicType t_sensor_batch_cmd() const;
+  TopicType t_combined_sensors_state() const;
+  TopicType t_combined_sensors_cmd() const;
+  TopicType t_sensor_history() const;
+  TopicType t_button_history() const;
   TopicType t_awake_mode_state() const;
   TopicType t_awake_mode_cmd() const;
   TopicType t_awake_mode_avlb() const;
@@ -40,10 +47,23 @@ class MQTTHelper {
   TopicType t_disp_msg_state() const;
   TopicType t_schedule_wakeup_cmd() const;
   TopicType t_schedule_wakeup_state() const;
+  TopicType t_icon_cmd() const;
+  TopicType t_icon_source_cmd() const;
+  TopicType t_icon_source_state() const;
+  TopicType t_icon_state() const;
+  TopicType t_log_cmd() const;
+  TopicType t_log() const;
+  TopicType t_trace_cmd() const;
+  TopicType t_trace() const;
+  TopicType t_diagnostics(const char* part) const;  // see metrics.h
+  TopicType t_sync() const;
 
  private:
   DeviceState& _device_state;
   Network& _network;
+
+  // device is the rendered "dev" object
+  void _send_sensor_configs(const TopicType& topic_common, const char* device);
 };
 
 #endif  // HOMEBUTTONS_MQTTHELPER_H
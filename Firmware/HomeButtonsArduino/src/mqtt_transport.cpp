@@ -0,0 +1,551 @@
+#include "mqtt_transport.h"
+
+#include <WiFi.h>
+#include <lwip/sockets.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// packet types, upper nibble of the fixed header
+constexpr uint8_t CONNECT = 0x10;
+constexpr uint8_t CONNACK = 0x20;
+constexpr uint8_t PUBLISH = 0x30;
+constexpr uint8_t PUBACK = 0x40;
+constexpr uint8_t SUBSCRIBE = 0x82;  // with the required reserved bits
+constexpr uint8_t SUBACK = 0x90;
+constexpr uint8_t PINGREQ = 0xC0;
+constexpr uint8_t PINGRESP = 0xD0;
+constexpr uint8_t DISCONNECT = 0xE0;
+
+// publish flags
+constexpr uint8_t FLAG_DUP = 0x08;
+constexpr uint8_t FLAG_QOS1 = 0x02;
+constexpr uint8_t FLAG_RETAIN = 0x01;
+
+// connect flags
+constexpr uint8_t FLAG_USER = 0x80;
+constexpr uint8_t FLAG_PASSWORD = 0x40;
+constexpr uint8_t FLAG_CLEAN_SESSION = 0x02;
+
+constexpr uint8_t PROTOCOL_LEVEL = 0x04;  // 3.1.1
+constexpr uint8_t SUBACK_FAILURE = 0x80;
+
+void put16(uint8_t *buf, uint16_t value) {
+  buf[0] = value >> 8;
+  buf[1] = value & 0xFF;
+}
+
+uint16_t get16(const uint8_t *buf) { return (buf[0] << 8) | buf[1]; }
+
+// remaining length, 1 to 4 bytes
+size_t put_length(uint8_t *buf, uint32_t length) {
+  size_t i = 0;
+  do {
+    uint8_t byte = length & 0x7F;
+    length >>= 7;
+    buf[i++] = length > 0 ? byte | 0x80 : byte;
+  } while (length > 0);
+  return i;
+}
+
+size_t put_string(uint8_t *buf, const char *str) {
+  size_t length = strlen(str);
+  put16(buf, length);
+  memcpy(buf + 2, str, length);
+  return 2 + length;
+}
+
+}  // namespace
+
+MQTTTransport::~MQTTTransport() { _close(); }
+
+void MQTTTransport::set_server(const char *host, uint16_t port) {
+  host_ = host;
+  port_ = port;
+}
+
+void MQTTTransport::set_tls(bool enable, const char *psk, const char *pin) {
+  tls_ = enable;
+  tls_psk_ = psk;
+  tls_pin_ = pin;
+}
+
+bool MQTTTransport::connect(const char *client_id, const char *user,
+                            const char *password, bool clean_session) {
+  _close();
+  bool auth = strlen(user) > 0 && strlen(password) > 0;
+  size_t body_length = 10 + 2 + strlen(client_id) +
+                       (auth ? 4 + strlen(user) + strlen(password) : 0);
+  if (5 + body_length > CONNECT_SIZE) {
+    error("client id or credentials too long");
+    return false;
+  }
+  clean_session_ = clean_session;
+  session_lost_ = false;
+  psk_identity_ = auth ? user : client_id;
+
+  size_t i = 0;
+  connect_[i++] = CONNECT;
+  i += put_length(&connect_[i], body_length);
+  i += put_string(&connect_[i], "MQTT");
+  connect_[i++] = PROTOCOL_LEVEL;
+  connect_[i++] = (clean_session ? FLAG_CLEAN_SESSION : 0) |
+                  (auth ? FLAG_USER | FLAG_PASSWORD : 0);
+  put16(&connect_[i], MQTT_KEEPALIVE);
+  i += 2;
+  i += put_string(&connect_[i], client_id);
+  if (auth) {
+    i += put_string(&connect_[i], user);
+    i += put_string(&connect_[i], password);
+  }
+  connect_length_ = i;
+  return _open();
+}
+
+void MQTTTransport::disconnect() {
+  if (connected()) {
+    uint8_t packet[] = {DISCONNECT, 0};
+    _write(packet, sizeof(packet));
+  }
+  _close();
+}
+
+void MQTTTransport::loop() {
+  if (state_ == State::DISCONNECTED) {
+    return;
+  } else if (state_ == State::TCP_CONNECTING) {
+    if (!_tcp_connected()) return;
+    if (!tls_) {
+      if (!_start_session()) return;
+    } else if (tls_channel_.begin(socket_, host_.c_str(), port_,
+                                  psk_identity_.c_str(), tls_psk_.c_str(),
+                                  tls_pin_.c_str())) {
+      state_ = State::TLS_HANDSHAKE;
+    } else {
+      _close();
+      return;
+    }
+  }
+  if (state_ == State::TLS_HANDSHAKE) {
+    int ret = tls_channel_.handshake();
+    if (ret < 0) {
+      _close();
+      return;
+    } else if (ret == 0 || !_start_session()) {
+      return;
+    }
+  }
+  _receive();
+  if (state_ != State::CONNECTED) return;
+
+  uint32_t now = millis();
+  if (ping_pending_) {
+    if (now - ping_sent_time_ > MQTT_ACK_TIMEOUT) {
+      warning("broker not responding");
+      _close();
+    }
+  } else if (now - last_receive_time_ > MQTT_KEEPALIVE * 1000UL ||
+             now - last_send_time_ > MQTT_KEEPALIVE * 1000UL) {
+    uint8_t packet[] = {PINGREQ, 0};
+    ping_pending_ = _write(packet, sizeof(packet));
+    ping_sent_time_ = now;
+  }
+}
+
+bool MQTTTransport::publish(const char *topic, const char *payload,
+                            bool retained) {
+  if (!connected()) return false;
+  auto free_slot = [this]() {
+    return std::find_if(std::begin(in_flight_), std::end(in_flight_),
+                        [](const InFlight &m) { return m.id == 0; });
+  };
+  auto slot = free_slot();
+  if (slot == std::end(in_flight_)) {
+    _receive();  // the acks may be waiting
+    slot = free_slot();
+  }
+  if (slot == std::end(in_flight_)) {
+    warning("%u publishes not acknowledged", MQTT_INFLIGHT);
+    return false;
+  }
+  slot->id = _next_packet_id();
+  slot->retained = retained;
+  slot->topic = TopicType(topic);
+  slot->payload = PayloadType(payload);
+  // if the connection broke, it's sent again after the reconnect
+  _send_publish(*slot, false);
+  return true;
+}
+
+bool MQTTTransport::subscribe(const char *topic) {
+  if (!connected()) return false;
+  uint8_t head[4];
+  put16(head, _next_packet_id());
+  size_t topic_length = strlen(topic);
+  put16(&head[2], topic_length);
+  // QoS 1 commands sent while asleep are queued in the persistent session,
+  // QoS 0 ones are lost, only retained commands arrive in any case
+  uint8_t qos = 1;
+  return _send_header(SUBSCRIBE, 4 + topic_length + 1, true) &&
+         _write(head, sizeof(head), true) &&
+         _write(reinterpret_cast<const uint8_t *>(topic), topic_length,
+                true) &&
+         _write(&qos, 1);
+}
+
+uint8_t MQTTTransport::in_flight() const {
+  return std::count_if(std::begin(in_flight_), std::end(in_flight_),
+                       [](const InFlight &m) { return m.id != 0; });
+}
+
+uint32_t MQTTTransport::take_bytes_sent() {
+  uint32_t bytes = bytes_sent_;
+  bytes_sent_ = 0;
+  return bytes;
+}
+
+bool MQTTTransport::_open() {
+  IPAddress ip;
+  if (!ip.fromString(host_.c_str()) && !WiFi.hostByName(host_.c_str(), ip)) {
+    warning("can't resolve %s", host_.c_str());
+    return false;
+  }
+  socket_ = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (socket_ < 0) {
+    error("socket failed: %d", errno);
+    return false;
+  }
+  lwip_fcntl(socket_, F_SETFL, lwip_fcntl(socket_, F_GETFL, 0) | O_NONBLOCK);
+  int one = 1;
+  lwip_setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port_);
+  addr.sin_addr.s_addr = static_cast<uint32_t>(ip);
+  if (lwip_connect(socket_, reinterpret_cast<sockaddr *>(&addr),
+                   sizeof(addr)) < 0 &&
+      errno != EINPROGRESS) {
+    warning("connect failed: %d", errno);
+    _close();
+    return false;
+  }
+  state_ = State::TCP_CONNECTING;
+  rx_state_ = RxState::TYPE;
+  ping_pending_ = false;
+  last_send_time_ = millis();
+  return true;
+}
+
+// Unacknowledged publishes are kept for the next connection.
+void MQTTTransport::_close() {
+  tls_channel_.end();
+  if (socket_ >= 0) {
+    lwip_close(socket_);
+    socket_ = -1;
+  }
+  state_ = State::DISCONNECTED;
+}
+
+bool MQTTTransport::_tcp_connected() {
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(socket_, &fds);
+  timeval timeout = {0, 0};
+  if (lwip_select(socket_ + 1, nullptr, &fds, nullptr, &timeout) <= 0) {
+    return false;
+  }
+  int err = 0;
+  socklen_t len = sizeof(err);
+  lwip_getsockopt(socket_, SOL_SOCKET, SO_ERROR, &err, &len);
+  if (err != 0) {
+    warning("TCP connect failed: %d", err);
+    _close();
+    return false;
+  }
+  return true;
+}
+
+bool MQTTTransport::_start_session() {
+  state_ = State::CONNACK_WAIT;
+  last_receive_time_ = millis();
+  return _write(connect_, connect_length_);
+}
+
+// Bytes sent, 0 if the send buffer is full, -1 on error.
+int MQTTTransport::_send_some(const uint8_t *data, size_t length, bool more) {
+  if (tls_) return tls_channel_.send(data, length, more);
+  int sent = lwip_send(socket_, data, length, more ? MSG_MORE : 0);
+  if (sent >= 0) {
+    return sent;
+  } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return 0;
+  }
+  warning("send failed: %d", errno);
+  return -1;
+}
+
+// Bytes read, 0 if nothing has arrived, -1 if closed or on error.
+int MQTTTransport::_receive_some(uint8_t *buf, size_t length) {
+  if (tls_) return tls_channel_.receive(buf, length);
+  int n = lwip_recv(socket_, buf, length, MSG_DONTWAIT);
+  if (n > 0) {
+    return n;
+  } else if (n == 0) {
+    warning("connection closed by broker");
+  } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return 0;
+  } else {
+    warning("receive failed: %d", errno);
+  }
+  return -1;
+}
+
+// Waits up to MQTT_WRITE_TIMEOUT for room in the send buffer. more holds the
+// data back until the rest of the packet is written.
+bool MQTTTransport::_write(const uint8_t *data, size_t length, bool more) {
+  uint32_t start = millis();
+  while (length > 0) {
+    if (socket_ < 0) return false;
+    int sent = _send_some(data, length, more);
+    if (sent > 0) {
+      data += sent;
+      length -= sent;
+      bytes_sent_ += sent;
+      continue;
+    } else if (sent < 0) {
+      _close();
+      return false;
+    }
+    uint32_t elapsed = millis() - start;
+    if (elapsed >= MQTT_WRITE_TIMEOUT) {
+      warning("send timed out");
+      _close();
+      return false;
+    }
+    uint32_t wait = MQTT_WRITE_TIMEOUT - elapsed;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(socket_, &fds);
+    timeval timeout = {static_cast<time_t>(wait / 1000),
+                       static_cast<suseconds_t>((wait % 1000) * 1000)};
+    lwip_select(socket_ + 1, nullptr, &fds, nullptr, &timeout);
+  }
+  last_send_time_ = millis();
+  return true;
+}
+
+bool MQTTTransport::_send_header(uint8_t type, uint32_t length, bool more) {
+  uint8_t header[5] = {type};
+  return _write(header, 1 + put_length(&header[1], length), more);
+}
+
+bool MQTTTransport::_send_packet(uint8_t type, const uint8_t *body,
+                                 size_t length) {
+  return _send_header(type, length, length > 0) &&
+         (length == 0 || _write(body, length));
+}
+
+// Topic and payload are written from the message, without a packet buffer.
+bool MQTTTransport::_send_publish(const InFlight &message, bool dup) {
+  uint8_t type = PUBLISH | FLAG_QOS1 | (dup ? FLAG_DUP : 0) |
+                 (message.retained ? FLAG_RETAIN : 0);
+  size_t topic_length = message.topic.length();
+  size_t payload_length = message.payload.length();
+  uint8_t topic_head[2];
+  put16(topic_head, topic_length);
+  uint8_t id[2];
+  put16(id, message.id);
+  return _send_header(type, 2 + topic_length + 2 + payload_length, true) &&
+         _write(topic_head, sizeof(topic_head), true) &&
+         _write(reinterpret_cast<const uint8_t *>(message.topic.c_str()),
+                topic_length, true) &&
+         _write(id, sizeof(id), payload_length > 0) &&
+         _write(reinterpret_cast<const uint8_t *>(message.payload.c_str()),
+                payload_length);
+}
+
+// Reads what has arrived, a packet may be split across calls.
+void MQTTTransport::_receive() {
+  while (socket_ >= 0) {
+    uint8_t byte;
+    uint8_t *dst = &byte;
+    size_t want = 1;
+    if (rx_state_ == RxState::BODY) {
+      want = rx_length_ - rx_read_;
+      if (rx_large_) {
+        dst = rx_ + rx_fill_;
+        want = std::min(want, sizeof(rx_) - rx_fill_);
+      } else {
+        dst = rx_ + rx_read_;
+      }
+    }
+    int n = _receive_some(dst, want);
+    if (n == 0) {
+      return;
+    } else if (n < 0) {
+      _close();
+      return;
+    }
+    last_receive_time_ = millis();
+
+    switch (rx_state_) {
+      case RxState::TYPE:
+        rx_type_ = byte;
+        rx_length_ = 0;
+        rx_length_shift_ = 0;
+        rx_state_ = RxState::LENGTH;
+        break;
+      case RxState::LENGTH:
+        rx_length_ |= static_cast<uint32_t>(byte & 0x7F) << rx_length_shift_;
+        rx_length_shift_ += 7;
+        if ((byte & 0x80) == 0) {
+          rx_read_ = 0;
+          rx_large_ = rx_length_ > sizeof(rx_);
+          rx_fill_ = 0;
+          rx_state_ = RxState::BODY;
+        } else if (rx_length_shift_ > 21) {
+          error("malformed packet");
+          _close();
+          return;
+        }
+        break;
+      case RxState::BODY:
+        rx_read_ += n;
+        if (rx_large_) {
+          rx_fill_ += n;
+          if (rx_fill_ == sizeof(rx_) || rx_read_ == rx_length_) {
+            _handle_piece();
+            rx_fill_ = 0;
+          }
+        }
+        break;
+    }
+
+    if (rx_state_ == RxState::BODY && rx_read_ == rx_length_) {
+      rx_state_ = RxState::TYPE;
+      if (!rx_large_) {
+        _handle();
+      } else if (rx_id_ != 0) {
+        _send_puback(rx_id_);
+      }
+    }
+  }
+}
+
+void MQTTTransport::_handle() {
+  switch (rx_type_ & 0xF0) {
+    case CONNACK:
+      _handle_connack();
+      break;
+    case PUBLISH:
+      _handle_publish();
+      break;
+    case PUBACK:
+      if (rx_length_ >= 2) {
+        uint16_t id = get16(rx_);
+        for (auto &message : in_flight_) {
+          if (message.id == id) message.id = 0;
+        }
+      }
+      break;
+    case SUBACK:
+      if (rx_length_ >= 3 && rx_[2] == SUBACK_FAILURE) {
+        warning("subscribe rejected");
+      }
+      break;
+    case PINGRESP:
+      ping_pending_ = false;
+      break;
+    default:
+      debug("unexpected packet: 0x%02x", rx_type_);
+      break;
+  }
+}
+
+void MQTTTransport::_handle_connack() {
+  if (state_ != State::CONNACK_WAIT || rx_length_ < 2) return;
+  if (rx_[1] != 0) {
+    warning("connect rejected: %u", rx_[1]);
+    _close();
+    return;
+  }
+  bool session_present = rx_[0] & 0x01;
+  session_lost_ = !clean_session_ && !session_present;
+  state_ = State::CONNECTED;
+  // the last connection's unacknowledged publishes, duplicates if the broker
+  // still has the session
+  for (auto &message : in_flight_) {
+    if (message.id != 0 && !_send_publish(message, session_present)) return;
+  }
+}
+
+void MQTTTransport::_handle_publish() {
+  uint8_t qos = (rx_type_ >> 1) & 0x03;
+  if (rx_length_ < 2) return;
+  size_t topic_length = get16(rx_);
+  size_t pos = 2 + topic_length + (qos > 0 ? 2 : 0);
+  if (pos > rx_length_) {
+    warning("malformed publish");
+    return;
+  }
+  uint16_t id = qos > 0 ? get16(&rx_[2 + topic_length]) : 0;
+  TopicType topic(StaticStringView(reinterpret_cast<const char *>(&rx_[2]),
+                                   topic_length));
+  if (callback_) {
+    callback_(topic.c_str(), &rx_[pos], rx_length_ - pos);
+  }
+  if (qos == 1) _send_puback(id);
+}
+
+// One buffer full of a packet larger than rx_. A PUBLISH is passed on to the
+// stream callback, anything else is skipped. The PUBLISH is acknowledged
+// either way, or the broker sends it again on every connect.
+void MQTTTransport::_handle_piece() {
+  bool first = rx_read_ == rx_fill_;
+  if (first) {
+    rx_streaming_ = false;
+    rx_id_ = 0;
+    rx_offset_ = 0;
+    if ((rx_type_ & 0xF0) != PUBLISH) {
+      warning("packet too large (0x%02x, %u bytes), skipped", rx_type_,
+              rx_length_);
+      return;
+    }
+    uint8_t qos = (rx_type_ >> 1) & 0x03;
+    size_t topic_length = get16(rx_);
+    size_t pos = 2 + topic_length + (qos > 0 ? 2 : 0);
+    if (pos > rx_fill_) {
+      // no packet id either, the broker sends it again
+      warning("topic too long, message skipped");
+      return;
+    }
+    rx_id_ = qos == 1 ? get16(&rx_[2 + topic_length]) : 0;
+    rx_topic_ = TopicType(StaticStringView(
+        reinterpret_cast<const char *>(&rx_[2]), topic_length));
+    rx_streaming_ = static_cast<bool>(stream_callback_);
+    if (!rx_streaming_) {
+      warning("message too large (%u bytes), skipped", rx_length_);
+      return;
+    }
+    debug("streaming %u bytes", rx_length_);
+    stream_callback_(rx_topic_.c_str(), &rx_[pos], rx_fill_ - pos, 0);
+    rx_offset_ = rx_fill_ - pos;
+  } else if (rx_streaming_) {
+    stream_callback_(rx_topic_.c_str(), rx_, rx_fill_, rx_offset_);
+    rx_offset_ += rx_fill_;
+  }
+}
+
+bool MQTTTransport::_send_puback(uint16_t id) {
+  uint8_t body[2];
+  put16(body, id);
+  return _send_packet(PUBACK, body, sizeof(body));
+}
+
+uint16_t MQTTTransport::_next_packet_id() {
+  if (++packet_id_ == 0) packet_id_ = 1;
+  return packet_id_;
+}
@@ -0,0 +1,123 @@
+#ifndef HOMEBUTTONS_MQTT_TRANSPORT_H
+#define HOMEBUTTONS_MQTT_TRANSPORT_H
+
+#include "config.h"
+#include "logger.h"
+#include "mqtt_helper.h"  // TopicType, PayloadType, MQTT_BUFFER_SIZE
+#include "tls.h"
+#include "transport.h"
+#include "types.h"
+
+// MQTT 3.1.1 client on a non-blocking lwIP socket. connect() only starts the
+// TCP connection, loop() advances it through CONNACK and never waits for the
+// network. Publishes with QoS 1, up to MQTT_INFLIGHT unacknowledged, which
+// are sent again after a reconnect, also those the connection broke under. Incoming messages larger than
+// MQTT_BUFFER_SIZE go to the stream callback in pieces, or are skipped
+// without dropping the connection. Optionally over TLS, see TLSChannel.
+class MQTTTransport : public Transport, public Logger {
+ public:
+  MQTTTransport() : Logger("MQTT") {}
+  ~MQTTTransport();
+
+  void set_server(const char *host, uint16_t port) override;
+  void set_callback(Callback callback) override { callback_ = callback; }
+  void set_stream_callback(StreamCallback callback) override {
+    stream_callback_ = callback;
+  }
+  // Applies from the next connect(). The PSK identity is the MQTT user, or
+  // the client id without one.
+  void set_tls(bool enable, const char *psk = "", const char *pin = "");
+  bool connect(const char *client_id, const char *user,
+               const char *password, bool clean_session) override;
+  bool connected() override { return state_ == State::CONNECTED; }
+  void disconnect() override;
+  void loop() override;
+  bool publish(const char *topic, const char *payload, bool retained) override;
+  bool subscribe(const char *topic) override;
+
+  bool session_lost() const override { return session_lost_; }
+  uint8_t in_flight() const override;
+  uint32_t take_bytes_sent() override;
+
+  const char *name() const override { return tls_ ? "MQTTS" : "MQTT"; }
+
+ private:
+  enum class State {
+    DISCONNECTED,
+    TCP_CONNECTING,
+    TLS_HANDSHAKE,
+    CONNACK_WAIT,
+    CONNECTED
+  };
+
+  // incoming packet, read as the bytes arrive
+  enum class RxState { TYPE, LENGTH, BODY };
+
+  struct InFlight {
+    uint16_t id = 0;  // 0 = free
+    bool retained = false;
+    TopicType topic;
+    PayloadType payload;
+  };
+
+  // fixed header (5) + length prefixed client id, user and password
+  static constexpr size_t CONNECT_SIZE = 5 + 10 + 3 * (2 + 64);
+
+  MQTTServer host_;
+  uint16_t port_ = 0;
+  int socket_ = -1;
+  bool tls_ = false;
+  TLSKey tls_psk_;
+  TLSKey tls_pin_;
+  MQTTUser psk_identity_;
+  TLSChannel tls_channel_;
+  State state_ = State::DISCONNECTED;
+  bool clean_session_ = true;
+  bool session_lost_ = false;
+  uint32_t last_send_time_ = 0;
+  uint32_t last_receive_time_ = 0;
+  uint32_t bytes_sent_ = 0;
+  bool ping_pending_ = false;
+  uint32_t ping_sent_time_ = 0;
+  uint16_t packet_id_ = 0;
+  Callback callback_;
+  StreamCallback stream_callback_;
+  InFlight in_flight_[MQTT_INFLIGHT];
+
+  uint8_t connect_[CONNECT_SIZE];
+  size_t connect_length_ = 0;
+
+  RxState rx_state_ = RxState::TYPE;
+  uint8_t rx_type_ = 0;
+  uint32_t rx_length_ = 0;
+  uint8_t rx_length_shift_ = 0;
+  uint32_t rx_read_ = 0;
+  // larger than rx_, read in pieces of up to sizeof(rx_)
+  bool rx_large_ = false;
+  uint32_t rx_fill_ = 0;    // of the current piece
+  bool rx_streaming_ = false;
+  uint32_t rx_offset_ = 0;  // payload passed on so far
+  uint16_t rx_id_ = 0;      // to acknowledge, 0 = none
+  TopicType rx_topic_;
+  uint8_t rx_[MQTT_BUFFER_SIZE];
+
+  bool _open();
+  void _close();
+  bool _tcp_connected();
+  bool _start_session();
+  int _send_some(const uint8_t *data, size_t length, bool more);
+  int _receive_some(uint8_t *buf, size_t length);
+  bool _write(const uint8_t *data, size_t length, bool more = false);
+  bool _send_header(uint8_t type, uint32_t length, bool more);
+  bool _send_packet(uint8_t type, const uint8_t *body, size_t length);
+  bool _send_publish(const InFlight &message, bool dup);
+  void _receive();
+  void _handle();
+  void _handle_connack();
+  void _handle_publish();
+  void _handle_piece();
+  bool _send_puback(uint16_t id);
+  uint16_t _next_packet_id();
+};
+
+#endif  // HOMEBUTTONS_MQTT_TRANSPORT_H
@@ -0,0 +1,447 @@
+#include "mqttsn.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// message types
+constexpr uint8_t CONNECT = 0x04;
+constexpr uint8_t CONNACK = 0x05;
+constexpr uint8_t REGISTER = 0x0A;
+constexpr uint8_t REGACK = 0x0B;
+constexpr uint8_t PUBLISH = 0x0C;
+constexpr uint8_t PUBACK = 0x0D;
+constexpr uint8_t SUBSCRIBE = 0x12;
+constexpr uint8_t SUBACK = 0x13;
+constexpr uint8_t PINGREQ = 0x16;
+constexpr uint8_t PINGRESP = 0x17;
+constexpr uint8_t DISCONNECT = 0x18;
+
+// flags
+constexpr uint8_t FLAG_DUP = 0x80;
+constexpr uint8_t FLAG_RETAIN = 0x10;
+constexpr uint8_t FLAG_CLEAN_SESSION = 0x04;
+constexpr uint8_t TOPIC_NORMAL = 0x00;
+constexpr uint8_t TOPIC_PREDEFINED = 0x01;
+constexpr uint8_t TOPIC_SHORT = 0x02;
+
+constexpr uint8_t PROTOCOL_ID = 0x01;
+
+// return codes
+constexpr uint8_t ACCEPTED = 0x00;
+constexpr uint8_t INVALID_TOPIC_ID = 0x02;
+
+uint8_t qos_flags(int8_t qos) {
+  return qos < 0 ? 0x60 : static_cast<uint8_t>(qos << 5);
+}
+
+int8_t flags_qos(uint8_t flags) {
+  uint8_t qos = (flags >> 5) & 0x03;
+  return qos == 3 ? -1 : qos;
+}
+
+void put16(uint8_t *buf, uint16_t value) {
+  buf[0] = value >> 8;
+  buf[1] = value & 0xFF;
+}
+
+uint16_t get16(const uint8_t *buf) { return (buf[0] << 8) | buf[1]; }
+
+}  // namespace
+
+void MQTTSNTransport::set_server(const char *host, uint16_t port) {
+  if (!(host_ == host)) ip_ = IPAddress();
+  host_ = host;
+  port_ = port;
+}
+
+bool MQTTSNTransport::connect(const char *client_id, const char *user,
+                              const char *password, bool clean_session) {
+  if (strlen(user) > 0) {
+    warning("MQTT-SN has no authentication, user ignored");
+  }
+  if (!_start()) return false;
+
+  size_t id_length = strlen(client_id);
+  size_t i = _header(CONNECT, 4 + id_length);
+  tx_[i++] = clean_session ? FLAG_CLEAN_SESSION : 0;
+  tx_[i++] = PROTOCOL_ID;
+  put16(&tx_[i], MQTTSN_KEEPALIVE);
+  i += 2;
+  memcpy(&tx_[i], client_id, id_length);
+  i += id_length;
+
+  Message reply;
+  if (!_request(i, CONNACK, 0, reply) || reply.length < 1) {
+    return false;
+  }
+  if (reply.body[0] != ACCEPTED) {
+    warning("connect rejected: %u", reply.body[0]);
+    return false;
+  }
+  // registrations don't outlive the session
+  for (auto &topic : topics_) topic.id = 0;
+  connected_ = true;
+  ping_pending_ = false;
+  return true;
+}
+
+void MQTTSNTransport::disconnect() {
+  if (connected_) {
+    _send_empty(DISCONNECT);
+  }
+  connected_ = false;
+  if (udp_started_) {
+    udp_.stop();
+    udp_started_ = false;
+  }
+}
+
+void MQTTSNTransport::loop() {
+  if (!udp_started_) return;
+  Message message;
+  while (_receive(0, message)) {
+    _handle(message);
+  }
+  if (!connected_) return;
+  if (ping_pending_) {
+    if (millis() - ping_time_ > MQTTSN_RETRY_TIMEOUT * MQTTSN_RETRIES) {
+      warning("gateway not responding");
+      connected_ = false;
+    }
+  } else if (millis() - last_send_time_ > MQTTSN_KEEPALIVE * 1000 / 2) {
+    ping_pending_ = _send_empty(PINGREQ);
+    ping_time_ = millis();
+  }
+}
+
+bool MQTTSNTransport::publish(const char *topic, const char *payload,
+                              bool retained) {
+  if (!connected_) return false;
+  uint16_t predefined_id = lookup_ ? lookup_(topic) : 0;
+  if (predefined_id != 0) {
+    return _publish(predefined_id, TOPIC_PREDEFINED, 1, retained, payload,
+                    nullptr);
+  }
+  // the gateway may have dropped a registration, register once more then
+  for (uint8_t attempt = 0; attempt < 2; attempt++) {
+    Topic *known = _find(topic);
+    uint16_t id = known != nullptr ? known->id : _register(topic);
+    if (id == 0) return false;
+    uint8_t return_code = ACCEPTED;
+    if (_publish(id, TOPIC_NORMAL, 1, retained, payload, &return_code)) {
+      return true;
+    } else if (return_code != INVALID_TOPIC_ID) {
+      return false;
+    }
+    _forget(id);
+  }
+  return false;
+}
+
+bool MQTTSNTransport::subscribe(const char *topic) {
+  if (!connected_) return false;
+  size_t topic_length = strlen(topic);
+  uint16_t msg_id = _next_msg_id();
+  size_t i = _header(SUBSCRIBE, 3 + topic_length);
+  if (i == 0) return false;
+  tx_[i++] = qos_flags(1) | TOPIC_NORMAL;
+  put16(&tx_[i], msg_id);
+  i += 2;
+  memcpy(&tx_[i], topic, topic_length);
+  i += topic_length;
+
+  Message reply;
+  if (!_request(i, SUBACK, msg_id, reply) || reply.length < 6 ||
+      reply.body[5] != ACCEPTED) {
+    return false;
+  }
+  // 0 for wildcards, their topics are registered by the gateway
+  uint16_t id = get16(&reply.body[1]);
+  if (id != 0) _remember(id, topic);
+  return true;
+}
+
+bool MQTTSNTransport::publish_early(const char *topic, const char *payload) {
+  uint16_t predefined_id = lookup_ ? lookup_(topic) : 0;
+  if (predefined_id == 0 || !_start()) return false;
+  return _publish(predefined_id, TOPIC_PREDEFINED, -1, false, payload,
+                  nullptr);
+}
+
+bool MQTTSNTransport::publishes_early(const char *topic) const {
+  return lookup_ && lookup_(topic) != 0;
+}
+
+bool MQTTSNTransport::_start() {
+  if (ip_ == IPAddress() && !WiFi.hostByName(host_.c_str(), ip_)) {
+    error("can't resolve %s", host_.c_str());
+    return false;
+  }
+  if (!udp_started_) {
+    udp_started_ = udp_.begin(0);
+  }
+  return udp_started_;
+}
+
+// Writes the header of a message with body_length bytes after the type to
+// tx_. Returns the offset of the body, 0 if it doesn't fit.
+size_t MQTTSNTransport::_header(uint8_t type, size_t body_length) {
+  size_t length = body_length + 2;
+  if (length <= 0xFF) {
+    tx_[0] = length;
+    tx_[1] = type;
+    return 2;
+  }
+  length += 2;
+  if (length > sizeof(tx_)) {
+    error("message too long: %u", length);
+    return 0;
+  }
+  tx_[0] = 0x01;
+  put16(&tx_[1], length);
+  tx_[3] = type;
+  return 4;
+}
+
+bool MQTTSNTransport::_send(const uint8_t *data, size_t length) {
+  if (length == 0) return false;
+  last_send_time_ = millis();
+  if (udp_.beginPacket(ip_, port_) && udp_.write(data, length) == length &&
+      udp_.endPacket()) {
+    bytes_sent_ += length;
+    return true;
+  }
+  return false;
+}
+
+uint32_t MQTTSNTransport::take_bytes_sent() {
+  uint32_t bytes = bytes_sent_;
+  bytes_sent_ = 0;
+  return bytes;
+}
+
+// Control messages don't use tx_, it may hold a request waiting for a reply.
+bool MQTTSNTransport::_send_empty(uint8_t type) {
+  uint8_t message[] = {2, type};
+  return _send(message, sizeof(message));
+}
+
+// REGACK and PUBACK
+bool MQTTSNTransport::_send_ack(uint8_t type, uint16_t topic_id,
+                                uint16_t msg_id, uint8_t return_code) {
+  uint8_t message[7] = {7, type};
+  put16(&message[2], topic_id);
+  put16(&message[4], msg_id);
+  message[6] = return_code;
+  return _send(message, sizeof(message));
+}
+
+bool MQTTSNTransport::_receive(uint32_t timeout_ms, Message &message) {
+  uint32_t start = millis();
+  while (true) {
+    if (udp_.parsePacket() > 0) {
+      int length = udp_.read(rx_, sizeof(rx_));
+      size_t header = rx_[0] == 0x01 ? 3 : 1;
+      size_t total = header == 3 ? get16(&rx_[1]) : rx_[0];
+      if (udp_.remoteIP() == ip_ && length > static_cast<int>(header) &&
+          total == static_cast<size_t>(length)) {
+        message = {rx_[header], &rx_[header + 1], total - header - 1};
+        return true;
+      }
+      warning("malformed message, %d bytes", length);
+    } else if (millis() - start >= timeout_ms) {
+      return false;
+    } else {
+      delay(1);
+    }
+  }
+}
+
+// Sends the message in tx_ and waits for the reply, retrying. Unrelated
+// messages are handled meanwhile.
+bool MQTTSNTransport::_request(size_t length, uint8_t reply_type,
+                               uint16_t msg_id, Message &reply) {
+  if (length == 0) return false;
+  for (uint8_t attempt = 0; attempt < MQTTSN_RETRIES; attempt++) {
+    if (!_send(tx_, length)) return false;
+    uint32_t start = millis();
+    uint32_t elapsed = 0;
+    while (elapsed < MQTTSN_RETRY_TIMEOUT &&
+           _receive(MQTTSN_RETRY_TIMEOUT - elapsed, reply)) {
+      elapsed = millis() - start;
+      if (reply.type != reply_type) {
+        _handle(reply);
+        continue;
+      }
+      // offset of the message id in the reply
+      size_t id_at = reply_type == SUBACK ? 3 : 2;
+      if (msg_id == 0 ||
+          (reply.length >= id_at + 2 && get16(&reply.body[id_at]) == msg_id)) {
+        return true;
+      }
+    }
+    // a retransmitted publish is marked as duplicate
+    size_t type_at = tx_[0] == 0x01 ? 3 : 1;
+    if (tx_[type_at] == PUBLISH) tx_[type_at + 1] |= FLAG_DUP;
+  }
+  warning("no reply from gateway (type 0x%02x)", reply_type);
+  return false;
+}
+
+void MQTTSNTransport::_handle(const Message &message) {
+  switch (message.type) {
+    case PUBLISH:
+      _handle_publish(message);
+      break;
+    case REGISTER: {
+      // topic of a wildcard subscription
+      if (message.length < 5) break;
+      uint16_t id = get16(&message.body[0]);
+      uint16_t msg_id = get16(&message.body[2]);
+      TopicType name(StaticStringView(
+          reinterpret_cast<const char *>(&message.body[4]),
+          message.length - 4));
+      _remember(id, name.c_str());
+      _send_ack(REGACK, id, msg_id, ACCEPTED);
+      break;
+    }
+    case PINGREQ:
+      _send_empty(PINGRESP);
+      break;
+    case PINGRESP:
+      ping_pending_ = false;
+      break;
+    case DISCONNECT:
+      warning("disconnected by gateway");
+      connected_ = false;
+      break;
+    default:
+      debug("ignored message type 0x%02x", message.type);
+      break;
+  }
+}
+
+void MQTTSNTransport::_handle_publish(const Message &message) {
+  if (message.length < 5) return;
+  uint8_t flags = message.body[0];
+  uint16_t id = get16(&message.body[1]);
+  uint16_t msg_id = get16(&message.body[3]);
+  int8_t qos = flags_qos(flags);
+  if (in_callback_) {
+    // sent again by the gateway if QoS 1
+    warning("publish while busy, dropped");
+    return;
+  }
+
+  uint8_t return_code = ACCEPTED;
+  Topic *topic = _find(id);
+  if ((flags & 0x03) == TOPIC_SHORT) {
+    in_topic_ =
+        StaticStringView(reinterpret_cast<const char *>(&message.body[1]), 2);
+  } else if ((flags & 0x03) == TOPIC_NORMAL && topic != nullptr) {
+    in_topic_ = topic->name;
+  } else {
+    return_code = INVALID_TOPIC_ID;
+  }
+  uint32_t length = std::min(message.length - 5, sizeof(in_payload_));
+  memcpy(in_payload_, &message.body[5], length);
+
+  if (qos == 1) {
+    _send_ack(PUBACK, id, msg_id, return_code);
+  }
+  if (return_code != ACCEPTED) {
+    warning("publish to unknown topic id %u", id);
+    return;
+  }
+  if (callback_) {
+    in_callback_ = true;
+    callback_(in_topic_.c_str(), in_payload_, length);
+    in_callback_ = false;
+  }
+}
+
+// qos -1, 0 or 1. return_code is set if the gateway rejected it.
+bool MQTTSNTransport::_publish(uint16_t topic_id, uint8_t id_type, int8_t qos,
+                               bool retained, const char *payload,
+                               uint8_t *return_code) {
+  size_t payload_length = strlen(payload);
+  uint16_t msg_id = qos == 1 ? _next_msg_id() : 0;
+  size_t i = _header(PUBLISH, 5 + payload_length);
+  if (i == 0) return false;
+  tx_[i++] = qos_flags(qos) | (retained ? FLAG_RETAIN : 0) | id_type;
+  put16(&tx_[i], topic_id);
+  put16(&tx_[i + 2], msg_id);
+  i += 4;
+  memcpy(&tx_[i], payload, payload_length);
+  i += payload_length;
+
+  if (qos < 1) return _send(tx_, i);
+  Message reply;
+  if (!_request(i, PUBACK, msg_id, reply) || reply.length < 5) return false;
+  if (reply.body[4] != ACCEPTED) {
+    warning("publish to topic id %u rejected: %u", topic_id, reply.body[4]);
+    if (return_code != nullptr) *return_code = reply.body[4];
+    return false;
+  }
+  return true;
+}
+
+// Returns the topic id, 0 if it failed.
+uint16_t MQTTSNTransport::_register(const char *topic) {
+  size_t topic_length = strlen(topic);
+  uint16_t msg_id = _next_msg_id();
+  size_t i = _header(REGISTER, 4 + topic_length);
+  if (i == 0) return 0;
+  put16(&tx_[i], 0);
+  put16(&tx_[i + 2], msg_id);
+  i += 4;
+  memcpy(&tx_[i], topic, topic_length);
+  i += topic_length;
+
+  Message reply;
+  if (!_request(i, REGACK, msg_id, reply) || reply.length < 5) return 0;
+  if (reply.body[4] != ACCEPTED) {
+    warning("register %s rejected: %u", topic, reply.body[4]);
+    return 0;
+  }
+  uint16_t id = get16(&reply.body[0]);
+  _remember(id, topic);
+  return id;
+}
+
+uint16_t MQTTSNTransport::_next_msg_id() {
+  if (++msg_id_ == 0) msg_id_ = 1;
+  return msg_id_;
+}
+
+MQTTSNTransport::Topic *MQTTSNTransport::_find(const char *name) {
+  for (auto &topic : topics_) {
+    if (topic.id != 0 && strcmp(topic.name.c_str(), name) == 0) return &topic;
+  }
+  return nullptr;
+}
+
+MQTTSNTransport::Topic *MQTTSNTransport::_find(uint16_t id) {
+  for (auto &topic : topics_) {
+    if (topic.id == id && id != 0) return &topic;
+  }
+  return nullptr;
+}
+
+// the oldest registration is replaced if full
+void MQTTSNTransport::_remember(uint16_t id, const char *name) {
+  Topic *topic = _find(id);
+  if (topic == nullptr) {
+    topic = &topics_[next_topic_];
+    next_topic_ = (next_topic_ + 1) % MQTTSN_MAX_TOPICS;
+  }
+  topic->id = id;
+  topic->name = name;
+}
+
+void MQTTSNTransport::_forget(uint16_t id) {
+  Topic *topic = _find(id);
+  if (topic != nullptr) topic->id = 0;
+}
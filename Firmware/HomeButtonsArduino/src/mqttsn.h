@@ -0,0 +1,95 @@
+#ifndef HOMEBUTTONS_MQTTSN_H
+#define HOMEBUTTONS_MQTTSN_H
+
+#include <WiFiUdp.h>
+
+#include "config.h"
+#include "logger.h"
+#include "mqtt_helper.h"  // TopicType, MQTT_BUFFER_SIZE
+#include "transport.h"
+#include "types.h"
+
+// MQTT-SN 1.2 client over UDP, for a gateway that bridges to the broker.
+// Publishes with QoS 1, topics with a predefined id skip REGISTER and can be
+// sent with QoS -1 before the session exists. Subscribes with QoS 1, so the
+// gateway retries messages that arrive while one is being handled. No
+// authentication, will or sleeping clients.
+class MQTTSNTransport : public Transport, public Logger {
+ public:
+  MQTTSNTransport() : Logger("MQTTSN") {}
+
+  void set_server(const char *host, uint16_t port) override;
+  void set_callback(Callback callback) override { callback_ = callback; }
+  void set_topic_id_lookup(TopicIdLookup lookup) { lookup_ = lookup; }
+  bool connect(const char *client_id, const char *user,
+               const char *password, bool clean_session) override;
+  bool connected() override { return connected_; }
+  void disconnect() override;
+  void loop() override;
+  bool publish(const char *topic, const char *payload, bool retained) override;
+  bool subscribe(const char *topic) override;
+
+  bool publish_early(const char *topic, const char *payload) override;
+  bool publishes_early(const char *topic) const override;
+  uint32_t take_bytes_sent() override;
+
+  const char *name() const override { return "MQTT-SN"; }
+
+ private:
+  struct Message {
+    uint8_t type;
+    uint8_t *body;
+    size_t length;  // of the body
+  };
+
+  struct Topic {
+    uint16_t id = 0;  // 0 = free
+    TopicType name;
+  };
+
+  static constexpr size_t MAX_MESSAGE_SIZE = MQTT_BUFFER_SIZE + 8;
+
+  WiFiUDP udp_;
+  bool udp_started_ = false;
+  MQTTServer host_;
+  IPAddress ip_;
+  uint16_t port_ = 0;
+  bool connected_ = false;
+  uint16_t msg_id_ = 0;
+  uint32_t last_send_time_ = 0;
+  uint32_t bytes_sent_ = 0;
+  uint32_t ping_time_ = 0;
+  bool ping_pending_ = false;
+  bool in_callback_ = false;
+  Callback callback_;
+  TopicIdLookup lookup_;
+  Topic topics_[MQTTSN_MAX_TOPICS];
+  uint8_t next_topic_ = 0;
+  uint8_t tx_[MAX_MESSAGE_SIZE];
+  uint8_t rx_[MAX_MESSAGE_SIZE];
+  // incoming publish, the callback may send and receive
+  TopicType in_topic_;
+  uint8_t in_payload_[MQTT_BUFFER_SIZE];
+
+  bool _start();
+  size_t _header(uint8_t type, size_t body_length);
+  bool _send(const uint8_t *data, size_t length);
+  bool _send_empty(uint8_t type);
+  bool _send_ack(uint8_t type, uint16_t topic_id, uint16_t msg_id,
+                 uint8_t return_code);
+  bool _receive(uint32_t timeout_ms, Message &message);
+  bool _request(size_t length, uint8_t reply_type, uint16_t msg_id,
+                Message &reply);
+  void _handle(const Message &message);
+  void _handle_publish(const Message &message);
+  bool _publish(uint16_t topic_id, uint8_t id_type, int8_t qos,
+                bool retained, const char *payload, uint8_t *return_code);
+  uint16_t _register(const char *topic);
+  uint16_t _next_msg_id();
+  Topic *_find(const char *name);
+  Topic *_find(uint16_t id);
+  void _remember(uint16_t id, const char *name);
+  void _forget(uint16_t id);
+};
+
+#endif  // HOMEBUTTONS_MQTTSN_H
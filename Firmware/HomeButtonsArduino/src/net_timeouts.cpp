@@ -0,0 +1,157 @@
+#include "net_timeouts.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "metrics.h"
+
+namespace net_timeouts {
+
+static constexpr uint32_t MAGIC = 0x484E5431;  // "HNT1"
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+static constexpr size_t NUM_PHASES = static_cast<size_t>(Phase::NUM);
+
+// upper bounds in ms, roughly logarithmic, the timeout is taken from these
+static constexpr uint32_t BOUNDS[] = {
+    100,  150,  200,  300,  500,   700,   1000,  1500,
+    2000, 3000, 5000, 7000, 10000, 15000, 20000, 30000};
+static constexpr size_t NUM_BUCKETS = sizeof(BOUNDS) / sizeof(BOUNDS[0]) + 1;
+
+static constexpr uint32_t FIXED[] = {QUICK_WIFI_TIMEOUT, WIFI_TIMEOUT,
+                                     MQTT_TIMEOUT, NET_CONNECT_TIMEOUT};
+static_assert(sizeof(FIXED) / sizeof(FIXED[0]) == NUM_PHASES,
+              "a phase has no fixed timeout");
+
+static constexpr metrics::Gauge GAUGES[] = {
+    metrics::Gauge::QUICK_WIFI_TIMEOUT_MS, metrics::Gauge::WIFI_TIMEOUT_MS,
+    metrics::Gauge::MQTT_TIMEOUT_MS, metrics::Gauge::NET_TIMEOUT_MS};
+static_assert(sizeof(GAUGES) / sizeof(GAUGES[0]) == NUM_PHASES,
+              "a phase has no gauge");
+
+struct History {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint16_t buckets[NUM_PHASES][NUM_BUCKETS];
+  uint8_t failures;  // in a row
+  uint8_t skip;      // timer wakes left to skip
+};
+
+RTC_NOINIT_ATTR static History history;
+static bool initialized = false;
+static bool learned_enabled = false;
+static uint32_t learned[NUM_PHASES];
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// call with lock held
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  if (history.magic != MAGIC ||
+      memcmp(history.firmware_id, id, FIRMWARE_ID_LEN) != 0) {
+    memset(&history, 0, sizeof(history));
+    history.magic = MAGIC;
+    memcpy(history.firmware_id, id, FIRMWARE_ID_LEN);
+  }
+  initialized = true;
+}
+
+// call with lock held
+static uint32_t _learn(size_t phase) {
+  const uint16_t* buckets = history.buckets[phase];
+  uint32_t count = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; i++) count += buckets[i];
+  if (count < NET_TIMEOUT_MIN_SAMPLES) return FIXED[phase];
+  // bucket of the percentile, rounded up
+  uint32_t rank = (count * NET_TIMEOUT_PERCENTILE + 99) / 100;
+  size_t i = 0;
+  uint32_t seen = buckets[0];
+  while (seen < rank) seen += buckets[++i];
+  if (i == NUM_BUCKETS - 1) return FIXED[phase];  // beyond the last bound
+  uint32_t timeout = BOUNDS[i] * NET_TIMEOUT_MARGIN_PCT / 100;
+  return std::min(std::max(timeout, NET_TIMEOUT_MIN), FIXED[phase]);
+}
+
+void wakeup() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (size_t i = 0; i < NUM_PHASES; i++) learned[i] = _learn(i);
+  uint8_t failures = history.failures;
+  uint8_t skip = history.skip;
+  taskEXIT_CRITICAL(&lock);
+  for (size_t i = 0; i < NUM_PHASES; i++) {
+    metrics::set(GAUGES[i], learned[i]);
+  }
+  metrics::set(metrics::Gauge::NET_FAILURES, failures);
+  if (failures > 0) {
+    ESP_LOGI("net_timeouts", "%u failed connects, skipping %u wakes",
+             failures, skip);
+  }
+}
+
+void use_learned(bool enable) { learned_enabled = enable; }
+
+uint32_t timeout(Phase phase) {
+  size_t i = static_cast<size_t>(phase);
+  return learned_enabled ? learned[i] : FIXED[i];
+}
+
+void succeeded(Phase phase, uint32_t duration_ms) {
+  size_t bucket = 0;
+  while (bucket < NUM_BUCKETS - 1 && duration_ms > BOUNDS[bucket]) bucket++;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  uint16_t* buckets = history.buckets[static_cast<size_t>(phase)];
+  uint32_t count = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; i++) count += buckets[i];
+  // halving ages out old connects, so a changed network is learned again
+  if (count >= NET_TIMEOUT_HISTORY) {
+    for (size_t i = 0; i < NUM_BUCKETS; i++) buckets[i] /= 2;
+  }
+  buckets[bucket]++;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void connected() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  history.failures = 0;
+  history.skip = 0;
+  taskEXIT_CRITICAL(&lock);
+  metrics::set(metrics::Gauge::NET_FAILURES, 0);
+}
+
+void failed() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  if (history.failures < UINT8_MAX) history.failures++;
+  uint8_t shift = std::min<uint8_t>(history.failures - 1, 7);
+  history.skip = std::min<uint32_t>((1u << shift) - 1, NET_BACKOFF_MAX_SKIP);
+  uint8_t failures = history.failures;
+  taskEXIT_CRITICAL(&lock);
+  metrics::set(metrics::Gauge::NET_FAILURES, failures);
+}
+
+uint8_t failures() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  uint8_t failures = history.failures;
+  taskEXIT_CRITICAL(&lock);
+  return failures;
+}
+
+bool attempt_due() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  bool due = history.skip == 0;
+  if (!due) history.skip--;
+  taskEXIT_CRITICAL(&lock);
+  return due;
+}
+
+}  // namespace net_timeouts
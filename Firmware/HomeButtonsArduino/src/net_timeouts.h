@@ -0,0 +1,38 @@
+#ifndef HOMEBUTTONS_NET_TIMEOUTS_H
+#define HOMEBUTTONS_NET_TIMEOUTS_H
+
+#include <cstdint>
+
+// Connect timeouts learned from how long successful connects took, and
+// backoff of timer wake connects while they keep failing. Kept in RTC memory,
+// reset on power loss and when the firmware changes, which falls back to the
+// fixed timeouts in config.h.
+namespace net_timeouts {
+
+enum class Phase : uint8_t {
+  QUICK_WIFI,  // Wi-Fi with the saved BSSID and channel
+  WIFI,        // Wi-Fi with a scan
+  MQTT,
+  CONNECT,  // from boot until ready to publish
+  NUM
+};
+
+// Computes the learned timeouts, call once per boot.
+void wakeup();
+// Learned timeouts if enabled, otherwise the fixed ones, e.g. after a reset.
+void use_learned(bool enable);
+uint32_t timeout(Phase phase);  // ms
+
+void succeeded(Phase phase, uint32_t duration_ms);
+
+// Whole connect attempts. After n failures in a row the next 2^(n-1) - 1
+// timer wakes skip connecting, up to NET_BACKOFF_MAX_SKIP.
+void connected();
+void failed();
+uint8_t failures();
+// Call once per timer wake that would connect, false to skip it.
+bool attempt_due();
+
+}  // namespace net_timeouts
+
+#endif  // HOMEBUTTONS_NET_TIMEOUTS_H
@@ -1,10 +1,13 @@
 #include "network.h"
 #include <esp_wifi.h>
 #include "config.h"
+#include "metrics.h"
+#include "net_timeouts.h"
 #include "state.h"
+#include "state_cache.h"
+#include "timesync.h"
 #include "utils.h"
 
-static constexpr uint8_t MQTT_QUEUE_SIZE = 4;
 static constexpr uint8_t MQTT_QUEUE_ITEMS_PER_LOOP = 5;
 
 String mac2String(uint8_t ar[]) {
@@ -44,12 +47,18 @@ void NetworkSMStates::QuickConnectState::loop() {
   } else if (WiFi.status() == WL_CONNECTED) {
     sm().info("Wi-Fi connected (quick mode) in %lu ms.",
               millis() - start_time_);
+    metrics::observe(metrics::Histogram::WIFI_CONNECT_MS,
+                     millis() - start_time_);
+    net_timeouts::succeeded(net_timeouts::Phase::QUICK_WIFI,
+                            millis() - start_time_);
     return transition_to<WifiConnectedState>();
-  } else if (millis() - start_time_ > QUICK_WIFI_TIMEOUT) {
+  } else if (millis() - start_time_ >
+             net_timeouts::timeout(net_timeouts::Phase::QUICK_WIFI)) {
     // try again with normal mode
     sm().info(
         "Wi-Fi connect failed (quick mode). Retrying with normal "
         "mode...");
+    metrics::inc(metrics::Counter::WIFI_FAILURES);
     sm().device_state_.persisted().wifi_quick_connect = false;
     return transition_to<DisconnectState>();
   }
@@ -89,6 +98,10 @@ void NetworkSMStates::NormalConnectState::loop() {
           "Wi-Fi connected (normal mode) in %lu ms. Saving settings for quick "
           "mode...",
           millis() - start_time_);
+      metrics::observe(metrics::Histogram::WIFI_CONNECT_MS,
+                       millis() - start_time_);
+      net_timeouts::succeeded(net_timeouts::Phase::WIFI,
+                              millis() - start_time_);
 
       String ssid = WiFi.SSID();
       String psk = WiFi.psk();
@@ -102,35 +115,48 @@ void NetworkSMStates::NormalConnectState::loop() {
       start_time_ = millis();
       await_confirm_quick_wifi_settings_ = true;
     }
-  } else if (millis() - start_time_ >= WIFI_TIMEOUT) {
+  } else if (millis() - start_time_ >=
+             net_timeouts::timeout(net_timeouts::Phase::WIFI)) {
     sm().warning("Wi-Fi connect failed (normal mode). Retrying...");
+    metrics::inc(metrics::Counter::WIFI_FAILURES);
     return transition_to<DisconnectState>();
   }
 }
 
 void NetworkSMStates::MQTTConnectState::entry() {
-  sm().mqtt_client_.setServer(
-      sm().device_state_.user_preferences().mqtt.server.c_str(),
-      sm().device_state_.user_preferences().mqtt.port);
-  sm().mqtt_client_.setBufferSize(MQTT_BUFFER_SIZE);
-  sm().mqtt_client_.setCallback(
+  const auto &mqtt = sm().device_state_.user_preferences().mqtt;
+  const char *host;
+  TransportType type = parse_server(mqtt.server.c_str(), &host);
+  sm().mqtt_transport_.set_tls(type == TransportType::MQTT_TLS,
+                               mqtt.tls_psk.c_str(), mqtt.tls_pin.c_str());
+  sm().transport_->set_server(host, mqtt.port);
+  sm().transport_->set_callback(
       std::bind(&Network::_mqtt_callback, &sm(), std::placeholders::_1,
                 std::placeholders::_2, std::placeholders::_3));
+  sm().transport_->set_stream_callback(std::bind(
+      &Network::_mqtt_stream_callback, &sm(), std::placeholders::_1,
+      std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
   // proceed with MQTT connection
   start_time_ = millis();
-  sm().info("connecting MQTT....");
+  sm().info("connecting %s....", sm().transport_->name());
   sm()._connect_mqtt();
 }
 
 void NetworkSMStates::MQTTConnectState::loop() {
   if (sm().command_ == Network::Command::DISCONNECT) {
     return transition_to<DisconnectState>();
-  } else if (sm().mqtt_client_.connected()) {
-    sm().info("MQTT connected in %lu ms.", millis() - start_time_);
+  } else if (sm().transport_->connected()) {
+    sm().info("%s connected in %lu ms.", sm().transport_->name(),
+              millis() - start_time_);
+    metrics::observe(metrics::Histogram::MQTT_CONNECT_MS,
+                     millis() - start_time_);
+    net_timeouts::succeeded(net_timeouts::Phase::MQTT, millis() - start_time_);
     sm().info("Network connected in %lu ms.",
               millis() - sm().cmd_connect_time_);
     return transition_to<FullyConnectedState>();
-  } else if (millis() - start_time_ > MQTT_TIMEOUT) {
+  } else if (millis() - start_time_ >
+             net_timeouts::timeout(net_timeouts::Phase::MQTT)) {
+    metrics::inc(metrics::Counter::MQTT_FAILURES);
     if (WiFi.status() == WL_CONNECTED) {
       sm().state_ = Network::State::W_CONNECTED;
       sm().warning("MQTT connect failed. Retrying...");
@@ -150,19 +176,26 @@ void NetworkSMStates::WifiConnectedState::loop() {
   sm().device_state_.set_ip(WiFi.localIP());
   sm().info("Wi-Fi connected.");
   sm().info("IP: %s", ip_address_to_static_string(WiFi.localIP()).c_str());
+  metrics::set(metrics::Gauge::WIFI_RSSI, WiFi.RSSI());
   String ssid = WiFi.SSID();
   sm().device_state_.save_all();
   uint8_t *bssid = WiFi.BSSID();
   int32_t ch = WiFi.channel();
   sm().info("SSID: %s, BSSID: %s, CH: %d", ssid.c_str(),
             mac2String(bssid).c_str(), ch);
+  timesync::start();
+  sm()._publish_early();
   return transition_to<MQTTConnectState>();
 }
 
 void NetworkSMStates::DisconnectState::entry() {
   sm().info("disconnecting...");
-  sm().mqtt_client_.disconnect();
-  sm().wifi_client_.flush();
+  sm().transport_->disconnect();
+  uint32_t bytes_sent = sm().transport_->take_bytes_sent();
+  if (bytes_sent > 0) {
+    sm().info("%s sent %lu bytes.", sm().transport_->name(), bytes_sent);
+    metrics::observe(metrics::Histogram::TX_BYTES, bytes_sent);
+  }
   WiFi.disconnect(true, sm().erase_);
   WiFi.mode(WIFI_OFF);
   sm().state_ = Network::State::DISCONNECTED;
@@ -175,6 +208,12 @@ void NetworkSMStates::DisconnectState::loop() {
 
 void NetworkSMStates::FullyConnectedState::entry() {
   last_conn_check_time_ = millis();
+  entry_time_ = millis();
+  idle_time_ = 0;
+  if (sm().transport_->session_lost()) {
+    sm().info("broker lost the session, sending all states");
+    state_cache::clear();
+  }
   if (sm().on_connect_callback_) {
     sm().on_connect_callback_();
   }
@@ -182,16 +221,35 @@ void NetworkSMStates::FullyConnectedState::entry() {
 }
 
 void NetworkSMStates::FullyConnectedState::loop() {
+  // publishes the broker hasn't acknowledged yet are lost when disconnected
+  bool acked = sm().transport_->in_flight() == 0 ||
+               millis() - sm().cmd_disconnect_time_ > MQTT_ACK_TIMEOUT;
+  bool idle = uxQueueMessagesWaiting(sm().mqtt_publish_queue_) == 0 &&
+              sm().transport_->in_flight() == 0;
+  sm().idle_ = idle;
+  if (!idle) {
+    idle_time_ = 0;
+  } else if (idle_time_ == 0) {
+    idle_time_ = millis();
+  }
   if (sm().command_ == Network::Command::DISCONNECT &&
-      uxQueueMessagesWaiting(sm().mqtt_publish_queue_) == 0) {
+      uxQueueMessagesWaiting(sm().mqtt_publish_queue_) == 0 && acked) {
+    if (idle_time_ != 0) {
+      metrics::observe(metrics::Histogram::PUBLISH_MS,
+                       idle_time_ - entry_time_);
+    } else {
+      sm().undelivered_ = true;  // ack timeout
+    }
     return transition_to<DisconnectState>();
   } else if (millis() - last_conn_check_time_ > NET_CONN_CHECK_INTERVAL) {
     if (WiFi.status() != WL_CONNECTED) {
       sm().warning("Wi-Fi connection interrupted. Reconnecting...");
+      metrics::inc(metrics::Counter::WIFI_RECONNECTS);
       return transition_to<DisconnectState>();
-    } else if (!sm().mqtt_client_.connected()) {
+    } else if (!sm().transport_->connected()) {
       sm().state_ = Network::State::W_CONNECTED;
       sm().warning("MQTT connection interrupted. Reconnecting...");
+      metrics::inc(metrics::Counter::MQTT_RECONNECTS);
       return transition_to<MQTTConnectState>();
     }
     last_conn_check_time_ = millis();
@@ -202,7 +260,7 @@ void NetworkSMStates::FullyConnectedState::loop() {
            xQueueReceive(sm().mqtt_publish_queue_, &element, 0)) {
       sm().debug("received payload (topic: %s)", element.topic.c_str());
       sm()._publish_unsafe(element.topic, element.payload.c_str(),
-                           element.retained);
+                           element.retained, element.state);
       max_element_to_process--;
     }
   }
@@ -211,10 +269,10 @@ void NetworkSMStates::FullyConnectedState::loop() {
 Network::Network(DeviceState &device_state)
     : NetworkStateMachine("NetworkSM", *this),
       Logger("NET"),
-      device_state_(device_state),
-      mqtt_client_(wifi_client_) {
+      device_state_(device_state) {
   mqtt_publish_queue_ =
-      xQueueCreate(MQTT_QUEUE_SIZE, sizeof(PublishQueueElement));
+      xQueueCreateStatic(MQTT_QUEUE_SIZE, sizeof(PublishQueueElement),
+                         mqtt_publish_queue_storage_, &mqtt_publish_queue_buf_);
   if (mqtt_publish_queue_ == nullptr) error("Failed to create publish queue");
 }
 
@@ -225,48 +283,94 @@ Network::~Network() {
 }
 
 void Network::connect() {
+  const char *host;
+  if (parse_server(device_state_.user_preferences().mqtt.server.c_str(),
+                   &host) == TransportType::MQTT_SN) {
+    transport_ = &mqttsn_transport_;
+    mqttsn_ = true;
+  } else {
+    transport_ = &mqtt_transport_;
+    mqttsn_ = false;
+  }
   command_ = Command::CONNECT;
   cmd_connect_time_ = millis();
+  idle_ = false;
+  undelivered_ = false;
+  early_published_ = 0;
   this->erase_ = false;
   debug("cmd connect");
+  post(NetworkEvent::COMMAND);
 }
 
 void Network::disconnect(bool erase) {
   command_ = Command::DISCONNECT;
+  cmd_disconnect_time_ = millis();
   this->erase_ = erase;
   debug("cmd disconnect");
+  post(NetworkEvent::COMMAND);
 }
 
 void Network::update() {
-  mqtt_client_.loop();
-  loop();
+  transport_->loop();
+  run(poll_interval_);
+}
+
+void Network::set_light_sleep(bool enable) {
+  poll_interval_ =
+      enable ? NET_POLL_INTERVAL_LIGHT_SLEEP : NET_POLL_INTERVAL;
+  if (enable) {
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+  }
 }
 
 void Network::setup() { network_task_handle_ = xTaskGetCurrentTaskHandle(); }
 
 Network::State Network::get_state() { return state_; }
 
-void Network::publish(const TopicType &topic, const PayloadType &payload,
+bool Network::publish(const TopicType &topic, const PayloadType &payload,
                       bool retained) {
+  return _publish(topic, payload, retained, false);
+}
+
+void Network::publish_state(const TopicType &topic,
+                            const PayloadType &payload) {
+  if (state_cache::unchanged(topic.c_str(), payload.c_str())) {
+    debug("state unchanged (topic: %s)", topic.c_str());
+    return;
+  }
+  _publish(topic, payload, true, true);
+}
+
+void Network::publish_state(const TopicType &topic, const char *payload) {
+  publish_state(topic, PayloadType{payload});
+}
+
+bool Network::_publish(const TopicType &topic, const PayloadType &payload,
+                       bool retained, bool state) {
   auto current_task = xTaskGetCurrentTaskHandle();
 
   if (current_task == network_task_handle_) {
     debug("publish from same task, no need to queue");
-    _publish_unsafe(topic, payload.c_str(), retained);
+    return _publish_unsafe(topic, payload.c_str(), retained, state);
   } else {
-    PublishQueueElement element{topic, payload, retained};
+    PublishQueueElement element{topic, payload, retained, state};
     if (mqtt_publish_queue_ != nullptr &&
         xQueueSend(mqtt_publish_queue_, (void *)&element, (TickType_t)100)) {
       debug("queue send successful (topic: %s)", topic.c_str());
+      post(NetworkEvent::PUBLISH);
+      return true;
     } else {
       error("queue send failed (topic: %s)", topic.c_str());
+      metrics::inc(metrics::Counter::QUEUE_FULL);
+      undelivered_ = true;
+      return false;
     }
   }
 }
 
-void Network::publish(const TopicType &topic, const char *payload,
+bool Network::publish(const TopicType &topic, const char *payload,
                       bool retained) {
-  publish(topic, PayloadType{payload}, retained);
+  return publish(topic, PayloadType{payload}, retained);
 }
 
 bool Network::subscribe(const TopicType &topic) {
@@ -279,7 +383,7 @@ bool Network::subscribe(const TopicType &topic) {
     return false;
   }
   bool ret;
-  ret = mqtt_client_.subscribe(topic.c_str());
+  ret = transport_->subscribe(topic.c_str());
   if (ret) {
     debug("sub to: %s SUCCESS.", topic.c_str());
   } else {
@@ -288,11 +392,28 @@ bool Network::subscribe(const TopicType &topic) {
   return ret;
 }
 
+// Same answer as MQTTSNTransport::publishes_early(), but from the caller's
+// task: the transport belongs to the network task.
+bool Network::publishes_early(const TopicType &topic) const {
+  return mqttsn_ && topic_id_lookup_ && topic_id_lookup_(topic.c_str()) != 0;
+}
+
+void Network::set_topic_id_lookup(Transport::TopicIdLookup lookup) {
+  topic_id_lookup_ = lookup;
+  mqttsn_transport_.set_topic_id_lookup(lookup);
+}
+
 void Network::set_mqtt_callback(
     std::function<void(const char *, const char *)> callback) {
   usr_callback_ = callback;
 }
 
+void Network::set_mqtt_raw_callback(
+    std::function<bool(const char *, const uint8_t *, uint32_t, uint32_t)>
+        callback) {
+  usr_raw_callback_ = callback;
+}
+
 void Network::set_on_connect(std::function<void()> on_connect) {
   this->on_connect_callback_ = on_connect;
 }
@@ -319,19 +440,45 @@ void Network::_pre_wifi_connect() {
 }
 
 bool Network::_connect_mqtt() {
-  if (device_state_.user_preferences().mqtt.user.length() > 0 &&
-      device_state_.user_preferences().mqtt.password.length() > 0) {
-    return mqtt_client_.connect(
-        device_state_.factory().unique_id.c_str(),
-        device_state_.user_preferences().mqtt.user.c_str(),
-        device_state_.user_preferences().mqtt.password.c_str());
-  } else {
-    return mqtt_client_.connect(device_state_.factory().unique_id.c_str());
+  return transport_->connect(
+      device_state_.factory().unique_id.c_str(),
+      device_state_.user_preferences().mqtt.user.c_str(),
+      device_state_.user_preferences().mqtt.password.c_str(), false);
+}
+
+// Sends the queued messages that don't need a session, up to the first one
+// that does, so the order is kept.
+void Network::_publish_early() {
+  PublishQueueElement element;
+  while (xQueuePeek(mqtt_publish_queue_, &element, 0) == pdTRUE &&
+         transport_->publishes_early(element.topic.c_str())) {
+    xQueueReceive(mqtt_publish_queue_, &element, 0);
+    if (transport_->publish_early(element.topic.c_str(),
+                                  element.payload.c_str())) {
+      debug("early pub to: %s SUCCESS.", element.topic.c_str());
+      early_published_++;
+    } else {
+      error("early pub to: %s FAIL.", element.topic.c_str());
+      metrics::inc(metrics::Counter::PUBLISH_FAILURES);
+    }
+  }
+}
+
+void Network::_mqtt_stream_callback(const char *topic, const uint8_t *data,
+                                    uint32_t length, uint32_t offset) {
+  if (usr_raw_callback_ == NULL ||
+      !usr_raw_callback_(topic, data, length, offset)) {
+    if (offset == 0) warning("msg on topic: %s too large, skipped", topic);
   }
 }
 
 void Network::_mqtt_callback(const char *topic, uint8_t *payload,
                              uint32_t length) {
+  if (usr_raw_callback_ != NULL &&
+      usr_raw_callback_(topic, payload, length, 0)) {
+    debug("msg on topic: %s, len: %d (raw)", topic, length);
+    return;
+  }
   char buff[length + 1];
   memcpy(buff, payload, (size_t)length);
   buff[length] = '\0';  // required so it can be converted to String
@@ -344,20 +491,24 @@ void Network::_mqtt_callback(const char *topic, uint8_t *payload,
   }
 }
 
-void Network::_publish_unsafe(const TopicType &topic, const char *payload,
-                              bool retained) {
-  bool ret;
-  if (retained) {
-    ret = mqtt_client_.publish(topic.c_str(), payload, true);
-  } else {
-    ret = mqtt_client_.publish(topic.c_str(), payload);
-  }
+bool Network::_publish_unsafe(const TopicType &topic, const char *payload,
+                              bool retained, bool state) {
+  bool ret = transport_->publish(topic.c_str(), payload, retained);
   if (ret) {
     debug("pub to: %s SUCCESS.", topic.c_str());
     debug("content: %s", payload);
   } else {
     error("pub to: %s FAIL.", topic.c_str());
+    metrics::inc(metrics::Counter::PUBLISH_FAILURES);
+    undelivered_ = true;
   }
+  // any other retained message replaces the state the cache knows about
+  if (ret && state) {
+    state_cache::store(topic.c_str(), payload);
+  } else if (retained) {
+    state_cache::forget(topic.c_str());
+  }
+  return ret;
 }
 
 StaticIPConfig validate_static_ip_config(StaticIPConfig config) {
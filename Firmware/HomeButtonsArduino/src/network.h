@@ -2,18 +2,35 @@
 #define HOMEBUTTONS_NETWORK_H
 
 #include <Arduino.h>
-#include <PubSubClient.h>
 #include <WiFi.h>
 
+#include <atomic>
+
 #include "state_machine.h"
 #include "mqtt_helper.h"  // For TopicType
 #include "freertos/queue.h"
 #include "logger.h"
+#include "mqtt_transport.h"
+#include "mqttsn.h"
 #include "state.h"
+#include "transport.h"
 
 class DeviceState;
 class Network;
 
+// The network states are polled, events only wake the network task early.
+enum class NetworkEvent : uint8_t {
+  COMMAND,  // connect() or disconnect()
+  PUBLISH,  // a message was queued
+};
+
+template <>
+struct StateMachineTraits<Network> {
+  using Event = NetworkEvent;
+  static constexpr UBaseType_t EVENT_QUEUE_SIZE = 4;
+  static constexpr uint8_t MAX_TIMERS = 1;
+};
+
 namespace NetworkSMStates {
 class IdleState : public State<Network> {
  public:
@@ -94,6 +111,8 @@ class FullyConnectedState : public State<Network> {
 
  private:
   uint32_t last_conn_check_time_ = 0;
+  uint32_t entry_time_ = 0;
+  uint32_t idle_time_ = 0;  // nothing queued or in flight since, 0 = busy
 };
 }  // namespace NetworkSMStates
 
@@ -121,46 +140,96 @@ class Network : public NetworkStateMachine, public Logger {
 
   void connect();
   void disconnect(bool erase = false);
-  void update();
+  void update();  // waits for up to the poll interval
+  // Polls MQTT less often and keeps Wi-Fi in modem sleep (the radio wakes
+  // for every DTIM beacon), so the CPU can light sleep.
+  void set_light_sleep(bool enable);
   void setup();  // Warning: must be called from same task (thread) as update()
 
   State get_state();
+  // True once everything published since connect() was sent and
+  // acknowledged by the broker.
+  bool delivered() const { return idle_ && !undelivered_; }
 
-  void publish(const TopicType &topic, const PayloadType &payload,
+  // False if the message could neither be sent nor queued.
+  bool publish(const TopicType &topic, const PayloadType &payload,
                bool retained = false);
-  void publish(const TopicType &topic, const char *payload,
+  bool publish(const TopicType &topic, const char *payload,
                bool retained = false);
+  // Retained, skipped if the broker already has this payload (state_cache).
+  void publish_state(const TopicType &topic, const PayloadType &payload);
+  void publish_state(const TopicType &topic, const char *payload);
   bool subscribe(const TopicType &topic);
+  // True if a message on topic is sent as soon as Wi-Fi is up, before the
+  // MQTT session (MQTT-SN with a predefined topic id). For the task that
+  // calls connect(), it doesn't touch the transport.
+  bool publishes_early(const TopicType &topic) const;
+  // Messages publish_early() sent since connect().
+  uint8_t early_published() const { return early_published_; }
+  // Predefined MQTT-SN topic ids, must match the gateway's configuration.
+  // Set before the network task starts, the lookup is called from both tasks.
+  void set_topic_id_lookup(Transport::TopicIdLookup lookup);
   void set_mqtt_callback(
       std::function<void(const char *, const char *)> callback);
+  // Receives the payload in place, without copying. Return true if the
+  // message was consumed, otherwise it's passed on to the mqtt callback.
+  // Messages too large for the receive buffer arrive in pieces, with the
+  // offset of each piece in the payload, and only here.
+  void set_mqtt_raw_callback(
+      std::function<bool(const char *, const uint8_t *, uint32_t, uint32_t)>
+          callback);
   void set_on_connect(std::function<void()> on_connect);
 
  private:
   State state_ = State::DISCONNECTED;
   Command command_ = Command::NONE;
+  // publish queue empty and nothing in flight
+  std::atomic<bool> idle_{false};
+  // a publish since connect() failed or was never acknowledged
+  std::atomic<bool> undelivered_{false};
+  std::atomic<uint8_t> early_published_{0};
   uint32_t cmd_connect_time_ = 0;
+  uint32_t cmd_disconnect_time_ = 0;
   bool erase_ = false;
+  uint32_t poll_interval_ = NET_POLL_INTERVAL;
 
   DeviceState &device_state_;
-  WiFiClient wifi_client_;
-  PubSubClient mqtt_client_;
-  QueueHandle_t mqtt_publish_queue_ = nullptr;
+  MQTTTransport mqtt_transport_;
+  MQTTSNTransport mqttsn_transport_;
+  Transport *transport_ = &mqtt_transport_;
+  // set by connect(), for publishes_early()
+  bool mqttsn_ = false;
+  Transport::TopicIdLookup topic_id_lookup_;
   TaskHandle_t network_task_handle_ = nullptr;
 
   struct PublishQueueElement {
     TopicType topic;
     PayloadType payload;
     bool retained;
+    bool state;
   };
 
+  static constexpr uint8_t MQTT_QUEUE_SIZE = 4;
+  QueueHandle_t mqtt_publish_queue_ = nullptr;
+  StaticQueue_t mqtt_publish_queue_buf_;
+  uint8_t mqtt_publish_queue_storage_[MQTT_QUEUE_SIZE *
+                                      sizeof(PublishQueueElement)];
+
   std::function<void(const char *, const char *)> usr_callback_;
+  std::function<bool(const char *, const uint8_t *, uint32_t, uint32_t)>
+      usr_raw_callback_;
   std::function<void()> on_connect_callback_;
 
   void _pre_wifi_connect();
   bool _connect_mqtt();
+  void _publish_early();
   void _mqtt_callback(const char *topic, uint8_t *payload, uint32_t length);
-  void _publish_unsafe(const TopicType &topic, const char *payload,
-                       bool retained = false);
+  void _mqtt_stream_callback(const char *topic, const uint8_t *data,
+                             uint32_t length, uint32_t offset);
+  bool _publish(const TopicType &topic, const PayloadType &payload,
+                bool retained, bool state);
+  bool _publish_unsafe(const TopicType &topic, const char *payload,
+                       bool retained = false, bool state = false);
 
   friend class NetworkSMStates::IdleState;
   friend class NetworkSMStates::QuickConnectState;
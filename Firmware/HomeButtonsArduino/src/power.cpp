@@ -0,0 +1,209 @@
+#include "power.h"
+
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "metrics.h"
+
+namespace power {
+
+static constexpr size_t NUM_LOCKS = static_cast<size_t>(Lock::NUM);
+static constexpr size_t NUM_PROFILES = static_cast<size_t>(CpuProfile::NUM);
+// esp_pm only scales between min and max
+static_assert(NUM_PROFILES == 2, "a profile has no frequency");
+
+#if CONFIG_PM_ENABLE
+struct LockInfo {
+  esp_pm_lock_type_t type;
+  const char* name;
+};
+
+static constexpr LockInfo LOCKS[] = {
+    {ESP_PM_NO_LIGHT_SLEEP, "display"},
+    {ESP_PM_NO_LIGHT_SLEEP, "leds"},
+    {ESP_PM_NO_LIGHT_SLEEP, "buttons"},
+};
+static_assert(sizeof(LOCKS) / sizeof(LOCKS[0]) == NUM_LOCKS,
+              "a lock has no type");
+
+static esp_pm_lock_handle_t locks[NUM_LOCKS] = {};
+static esp_pm_lock_handle_t compute_lock = nullptr;
+#endif
+static bool begun = false;
+static bool light_sleep = false;
+
+// profile arbitration and statistics
+static portMUX_TYPE cpu_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t requests[NUM_PROFILES] = {};
+static CpuProfile current = CpuProfile::WAIT;
+static int64_t current_since = 0;  // us
+static int64_t time_at[NUM_PROFILES] = {};  // us, since record_cpu_stats()
+static uint32_t max_switch_us = 0;
+
+#if CONFIG_PM_ENABLE
+static bool _configure(bool light_sleep_enable) {
+  esp_pm_config_esp32s2_t config = {.max_freq_mhz = CPU_FREQ_MAX,
+                                    .min_freq_mhz = CPU_FREQ_MIN,
+                                    .light_sleep_enable = light_sleep_enable};
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE("power", "esp_pm_configure failed: %d", err);
+    return false;
+  }
+  return true;
+}
+#endif
+
+bool begin() {
+#if CONFIG_PM_ENABLE
+  if (begun) return true;
+  // locks first, so nothing runs unlocked once scaling is on
+  for (size_t i = 0; i < NUM_LOCKS; i++) {
+    if (esp_pm_lock_create(LOCKS[i].type, 0, LOCKS[i].name, &locks[i]) !=
+        ESP_OK) {
+      ESP_LOGE("power", "failed to create lock %s", LOCKS[i].name);
+      return false;
+    }
+  }
+  if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "compute", &compute_lock) !=
+      ESP_OK) {
+    ESP_LOGE("power", "failed to create lock compute");
+    return false;
+  }
+  if (!_configure(false)) return false;
+  begun = true;
+  ESP_LOGI("power", "frequency scaling %d-%d MHz", CPU_FREQ_MIN,
+           CPU_FREQ_MAX);
+  return true;
+#else
+  ESP_LOGW("power", "frequency scaling not supported by this build");
+  return false;
+#endif
+}
+
+bool enable_light_sleep(uint64_t wake_pins) {
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  if (light_sleep) return true;
+  if (!begun) return false;
+  // RTC IO wakeup, it leaves the pins' edge interrupts alone
+  esp_sleep_enable_ext1_wakeup(wake_pins, ESP_EXT1_WAKEUP_ANY_HIGH);
+  if (!_configure(true)) return false;
+  light_sleep = true;
+  ESP_LOGI("power", "light sleep enabled");
+  return true;
+#else
+  ESP_LOGW("power", "light sleep not supported by this build");
+  return false;
+#endif
+}
+
+bool light_sleep_enabled() { return light_sleep; }
+
+bool acquire(Lock lock) {
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_handle_t handle = locks[static_cast<size_t>(lock)];
+  return handle != nullptr && esp_pm_lock_acquire(handle) == ESP_OK;
+#else
+  return false;
+#endif
+}
+
+void release(Lock lock) {
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_handle_t handle = locks[static_cast<size_t>(lock)];
+  if (handle != nullptr) esp_pm_lock_release(handle);
+#endif
+}
+
+// call with cpu_mux held, returns true if the profile changed
+static bool _arbitrate() {
+  CpuProfile next = CpuProfile::WAIT;
+  for (size_t i = NUM_PROFILES - 1; i > 0; i--) {
+    if (requests[i] > 0) {
+      next = static_cast<CpuProfile>(i);
+      break;
+    }
+  }
+  if (next == current) return false;
+  int64_t now = esp_timer_get_time();
+  time_at[static_cast<size_t>(current)] += now - current_since;
+  current_since = now;
+  current = next;
+  return true;
+}
+
+void request_cpu(CpuProfile profile) {
+  taskENTER_CRITICAL(&cpu_mux);
+  requests[static_cast<size_t>(profile)]++;
+  bool switched = _arbitrate();
+  taskEXIT_CRITICAL(&cpu_mux);
+#if CONFIG_PM_ENABLE
+  if (profile == CpuProfile::COMPUTE && compute_lock != nullptr) {
+    // switches synchronously on the first request
+    int64_t start = esp_timer_get_time();
+    esp_pm_lock_acquire(compute_lock);
+    uint32_t latency = esp_timer_get_time() - start;
+    if (switched && latency > max_switch_us) max_switch_us = latency;
+  }
+#endif
+}
+
+void release_cpu(CpuProfile profile) {
+#if CONFIG_PM_ENABLE
+  if (profile == CpuProfile::COMPUTE && compute_lock != nullptr) {
+    esp_pm_lock_release(compute_lock);
+  }
+#endif
+  taskENTER_CRITICAL(&cpu_mux);
+  requests[static_cast<size_t>(profile)]--;
+  _arbitrate();
+  taskEXIT_CRITICAL(&cpu_mux);
+}
+
+void record_cpu_stats() {
+  int64_t at[NUM_PROFILES];
+  taskENTER_CRITICAL(&cpu_mux);
+  int64_t now = esp_timer_get_time();
+  time_at[static_cast<size_t>(current)] += now - current_since;
+  current_since = now;
+  for (size_t i = 0; i < NUM_PROFILES; i++) {
+    at[i] = time_at[i];
+    time_at[i] = 0;
+  }
+  uint32_t switch_us = max_switch_us;
+  max_switch_us = 0;
+  taskEXIT_CRITICAL(&cpu_mux);
+
+  int64_t total = at[0] + at[1];
+  int32_t max_pct = total > 0 ? at[1] * 100 / total : 0;
+  ESP_LOGI("power", "cpu: %lld ms at %d MHz, %lld ms at %d MHz, switch %u us",
+           at[0] / 1000, CPU_FREQ_MIN, at[1] / 1000, CPU_FREQ_MAX, switch_us);
+  metrics::set(metrics::Gauge::CPU_MAX_PCT, max_pct);
+  metrics::set(metrics::Gauge::CPU_SWITCH_US, switch_us);
+}
+
+int32_t idle_pct() {
+#if configGENERATE_RUN_TIME_STATS && INCLUDE_xTaskGetIdleTaskHandle
+  static uint32_t last_idle = 0;
+  static uint32_t last_total = 0;
+  uint32_t idle = ulTaskGetIdleRunTimeCounter();
+  uint32_t total = portGET_RUN_TIME_COUNTER_VALUE();
+  // the counters wrap, differences don't as long as this is called often
+  // enough
+  uint32_t total_delta = total - last_total;
+  uint32_t idle_delta = idle - last_idle;
+  last_idle = idle;
+  last_total = total;
+  if (total_delta == 0) return -1;
+  return static_cast<uint64_t>(idle_delta) * 100 / total_delta;
+#else
+  return -1;
+#endif
+}
+
+}  // namespace power
@@ -0,0 +1,91 @@
+#ifndef HOMEBUTTONS_POWER_H
+#define HOMEBUTTONS_POWER_H
+
+#include <cstdint>
+
+// CPU frequency profiles, and automatic light sleep for awake mode. The CPU
+// sleeps whenever all tasks are blocked, code that can't tolerate that holds
+// a lock.
+namespace power {
+
+enum class Lock : uint8_t {
+  DISPLAY,  // rendering, keeps SPI clocked
+  LEDS,     // LEDC PWM stops in light sleep
+  BUTTONS,  // button interrupts miss edges in light sleep
+  NUM
+};
+
+// The highest requested profile wins, WAIT if there are no requests.
+enum class CpuProfile : uint8_t {
+  WAIT,     // radio, panel, buttons: CPU_FREQ_MIN
+  COMPUTE,  // decoding, TLS, rendering: CPU_FREQ_MAX
+  NUM
+};
+
+// Turns on frequency scaling, call once at boot. Needs CONFIG_PM_ENABLE,
+// without it the CPU stays at the default frequency.
+bool begin();
+
+// Needs begin() and CONFIG_FREERTOS_USE_TICKLESS_IDLE. Any of the pins in
+// wake_pins going high wakes the CPU. Stays enabled until reset.
+bool enable_light_sleep(uint64_t wake_pins);
+bool light_sleep_enabled();
+
+// Locks are counted. Returns false (and release() must not be called) if
+// the lock isn't available, i.e. light sleep was never enabled.
+bool acquire(Lock lock);
+void release(Lock lock);
+
+class Hold {
+ public:
+  explicit Hold(Lock lock) : lock_(lock), acquired_(acquire(lock)) {}
+  ~Hold() {
+    if (acquired_) release(lock_);
+  }
+  Hold(const Hold&) = delete;
+  Hold& operator=(const Hold&) = delete;
+
+ private:
+  Lock lock_;
+  bool acquired_;
+};
+
+void request_cpu(CpuProfile profile);
+void release_cpu(CpuProfile profile);
+
+// Scoped request, can also be started and ended explicitly.
+class CpuRequest {
+ public:
+  CpuRequest() = default;
+  explicit CpuRequest(CpuProfile profile) { start(profile); }
+  ~CpuRequest() { end(); }
+  CpuRequest(const CpuRequest&) = delete;
+  CpuRequest& operator=(const CpuRequest&) = delete;
+
+  void start(CpuProfile profile) {
+    end();
+    request_cpu(profile);
+    profile_ = profile;
+    active_ = true;
+  }
+  void end() {
+    if (active_) release_cpu(profile_);
+    active_ = false;
+  }
+
+ private:
+  CpuProfile profile_ = CpuProfile::WAIT;
+  bool active_ = false;
+};
+
+// Sets the CPU_MAX_PCT and CPU_SWITCH_US gauges for the time since the
+// previous call (or boot).
+void record_cpu_stats();
+
+// Percentage of time the CPU spent idle (light sleep included) since the
+// previous call, -1 without CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+int32_t idle_pct();
+
+}  // namespace power
+
+#endif  // HOMEBUTTONS_POWER_H
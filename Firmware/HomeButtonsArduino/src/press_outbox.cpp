@@ -0,0 +1,137 @@
+#include "press_outbox.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "metrics.h"
+
+namespace press_outbox {
+
+static constexpr uint32_t MAGIC = 0x48504F31;  // "HPO1"
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+// clock is considered set after 2023-01-01
+static constexpr time_t MIN_VALID_TIME = 1672531200;
+
+struct Ring {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint8_t head;  // index of the oldest press
+  uint8_t count;
+  Press presses[PRESS_OUTBOX_ENTRIES];
+};
+
+RTC_NOINIT_ATTR static Ring ring;
+static bool initialized = false;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// call with lock held
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  if (ring.magic != MAGIC ||
+      memcmp(ring.firmware_id, id, FIRMWARE_ID_LEN) != 0 ||
+      ring.head >= PRESS_OUTBOX_ENTRIES || ring.count > PRESS_OUTBOX_ENTRIES) {
+    memset(&ring, 0, sizeof(ring));
+    ring.magic = MAGIC;
+    memcpy(ring.firmware_id, id, FIRMWARE_ID_LEN);
+  }
+  initialized = true;
+}
+
+static Press& _at(uint8_t i) {
+  return ring.presses[(ring.head + i) % PRESS_OUTBOX_ENTRIES];
+}
+
+void add(uint8_t button, uint8_t action, time_t time) {
+  Press press{
+      .time = static_cast<uint32_t>(time),
+      .button = button,
+      .action = action,
+      .time_valid = time >= MIN_VALID_TIME,
+  };
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  bool full = ring.count == PRESS_OUTBOX_ENTRIES;
+  if (full) {
+    ring.head = (ring.head + 1) % PRESS_OUTBOX_ENTRIES;
+    ring.count--;
+  }
+  _at(ring.count) = press;
+  ring.count++;
+  taskEXIT_CRITICAL(&lock);
+  metrics::inc(metrics::Counter::PRESSES_QUEUED);
+  if (full) {
+    ESP_LOGW("press_outbox", "full, dropped the oldest press");
+    metrics::inc(metrics::Counter::PRESSES_DROPPED);
+  }
+}
+
+// a press from the future means the clock went back, it's kept
+static bool _fresh(const Press& press, uint32_t now) {
+  return now < press.time || now - press.time <= PRESS_OUTBOX_MAX_AGE;
+}
+
+bool pending() {
+  uint32_t now = static_cast<uint32_t>(time(nullptr));
+  bool fresh = false;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (uint8_t i = 0; i < ring.count && !fresh; i++) {
+    fresh = _fresh(_at(i), now);
+  }
+  taskEXIT_CRITICAL(&lock);
+  return fresh;
+}
+
+uint8_t peek(Press* out) {
+  // same clock as add(), set or not, clock_set() keeps them in step
+  uint32_t now = static_cast<uint32_t>(time(nullptr));
+  uint8_t n = 0;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  uint8_t total = ring.count;
+  for (uint8_t i = 0; i < total; i++) {
+    if (_fresh(_at(i), now)) out[n++] = _at(i);
+  }
+  // keep the fresh ones, in order, from the head on
+  ring.head = 0;
+  ring.count = n;
+  std::copy(out, out + n, ring.presses);
+  taskEXIT_CRITICAL(&lock);
+  if (n < total) {
+    ESP_LOGI("press_outbox", "dropped %u presses older than %lu s", total - n,
+             PRESS_OUTBOX_MAX_AGE);
+    metrics::inc(metrics::Counter::PRESSES_DROPPED, total - n);
+  }
+  return n;
+}
+
+void remove(uint8_t n) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  n = std::min(n, ring.count);
+  ring.head = (ring.head + n) % PRESS_OUTBOX_ENTRIES;
+  ring.count -= n;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void clock_set(int64_t offset_s) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (uint8_t i = 0; i < ring.count; i++) {
+    Press& press = _at(i);
+    if (!press.time_valid) {
+      press.time += offset_s;
+      press.time_valid = press.time >= MIN_VALID_TIME;
+    }
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+}  // namespace press_outbox
@@ -0,0 +1,39 @@
+#ifndef HOMEBUTTONS_PRESS_OUTBOX_H
+#define HOMEBUTTONS_PRESS_OUTBOX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// Button presses that couldn't be delivered, kept in RTC memory and
+// published on the next connection with the time they happened. Presses
+// older than PRESS_OUTBOX_MAX_AGE are dropped instead, a late press is
+// worse than none. Reset on power loss and when the firmware changes.
+namespace press_outbox {
+
+struct Press {
+  uint32_t time;  // unix time, s
+  uint8_t button;
+  uint8_t action;   // Button::ButtonAction
+  bool time_valid;  // false if taken before the clock was ever set
+};
+
+// The oldest press is dropped if full.
+void add(uint8_t button, uint8_t action, time_t time);
+// True if a press isn't too old yet.
+bool pending();
+
+// Drops the presses that are too old and copies the others to out (room for
+// PRESS_OUTBOX_ENTRIES), oldest first. They stay in the outbox until
+// remove(). Returns how many.
+uint8_t peek(Press* out);
+// Removes the n oldest presses, once they are delivered.
+void remove(uint8_t n);
+
+// Shifts the presses made before the clock was set, offset is the
+// correction applied to the clock.
+void clock_set(int64_t offset_s);
+
+}  // namespace press_outbox
+
+#endif  // HOMEBUTTONS_PRESS_OUTBOX_H
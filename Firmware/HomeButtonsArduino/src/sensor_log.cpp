@@ -0,0 +1,225 @@
+#include "sensor_log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "esp_attr.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+namespace sensor_log {
+
+static constexpr uint32_t MAGIC = 0x48534C31;  // "HSL1"
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+// clock is considered set after 2023-01-01
+static constexpr time_t MIN_VALID_TIME = 1672531200;
+
+struct Ring {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint8_t head;   // index of the oldest sample
+  uint8_t count;
+  bool force_upload;
+  bool has_reference;
+  Sample reference;  // newest sample of the last upload
+  Sample samples[SENSOR_LOG_ENTRIES];
+};
+
+RTC_NOINIT_ATTR static Ring ring;
+static bool initialized = false;
+// not in RTC memory, nothing is in flight after a wake
+static uint8_t sent_samples = 0;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// call with lock held
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  if (ring.magic != MAGIC ||
+      memcmp(ring.firmware_id, id, FIRMWARE_ID_LEN) != 0 ||
+      ring.head >= SENSOR_LOG_ENTRIES || ring.count > SENSOR_LOG_ENTRIES) {
+    memset(&ring, 0, sizeof(ring));
+    ring.magic = MAGIC;
+    memcpy(ring.firmware_id, id, FIRMWARE_ID_LEN);
+  }
+  initialized = true;
+}
+
+static Sample& _at(uint8_t i) {
+  return ring.samples[(ring.head + i) % SENSOR_LOG_ENTRIES];
+}
+
+void add(float temperature, float humidity, uint8_t battery_pct, time_t time) {
+  Sample sample{
+      .time = static_cast<uint32_t>(time),
+      .temperature = static_cast<int16_t>(lroundf(temperature * 100)),
+      .humidity = static_cast<uint16_t>(lroundf(humidity * 100)),
+      .battery_pct = battery_pct,
+      .time_valid = time >= MIN_VALID_TIME,
+  };
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  if (ring.count == SENSOR_LOG_ENTRIES) {
+    ring.head = (ring.head + 1) % SENSOR_LOG_ENTRIES;
+    ring.count--;
+    if (sent_samples > 0) sent_samples--;
+  }
+  _at(ring.count) = sample;
+  ring.count++;
+  taskEXIT_CRITICAL(&lock);
+}
+
+uint8_t count() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  uint8_t n = ring.count;
+  taskEXIT_CRITICAL(&lock);
+  return n;
+}
+
+bool upload_due(uint8_t batch_size) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  bool due = ring.force_upload || ring.count >= batch_size;
+  if (!due && ring.count > 0 && ring.has_reference) {
+    const Sample& newest = _at(ring.count - 1);
+    due = abs(newest.temperature - ring.reference.temperature) >
+              SEN_BATCH_TEMP_DELTA * 100 ||
+          abs(newest.humidity - ring.reference.humidity) >
+              SEN_BATCH_HMD_DELTA * 100;
+  }
+  taskEXIT_CRITICAL(&lock);
+  return due;
+}
+
+void force_upload() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  ring.force_upload = true;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void sent(uint8_t n) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  sent_samples = std::max(sent_samples, std::min(n, ring.count));
+  taskEXIT_CRITICAL(&lock);
+}
+
+uint8_t sent_count() {
+  taskENTER_CRITICAL(&lock);
+  uint8_t n = sent_samples;
+  taskEXIT_CRITICAL(&lock);
+  return n;
+}
+
+void delivered(uint8_t n) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  n = std::min(n, sent_samples);
+  sent_samples -= n;
+  if (n > 0) {
+    ring.reference = _at(n - 1);
+    ring.has_reference = true;
+    ring.head = (ring.head + n) % SENSOR_LOG_ENTRIES;
+    ring.count -= n;
+  }
+  if (ring.count == 0) {
+    ring.force_upload = false;
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+void clock_set(int64_t offset_s) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (uint8_t i = 0; i < ring.count; i++) {
+    Sample& sample = _at(i);
+    if (!sample.time_valid) {
+      sample.time += offset_s;
+      sample.time_valid = sample.time >= MIN_VALID_TIME;
+    }
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+// value in 0.01 units with two decimals, e.g. -1.05
+static int _print_fixed(char* buf, size_t len, int32_t value) {
+  return snprintf(buf, len, "%s%d.%02d", value < 0 ? "-" : "",
+                  static_cast<int>(abs(value) / 100),
+                  static_cast<int>(abs(value) % 100));
+}
+
+size_t to_json(uint8_t first, time_t now, char* buf, size_t len) {
+  Sample samples[JSON_SAMPLES];
+  uint8_t n = 0;
+  bool untimed = false;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (uint8_t i = first; i < ring.count && n < JSON_SAMPLES; i++) {
+    samples[n] = _at(i);
+    untimed |= !samples[n].time_valid;
+    n++;
+  }
+  taskEXIT_CRITICAL(&lock);
+  if (n == 0) {
+    return 0;
+  }
+
+  size_t pos = 0;
+  auto append = [&](int ret) {
+    pos = ret < 0 ? len : std::min(pos + ret, len);
+  };
+  static constexpr const char* KEYS[] = {"t", "age", "temp", "hum", "batt"};
+  append(snprintf(buf, len, "{"));
+  for (uint8_t key = 0; key < 5; key++) {
+    if (key == 1 && !untimed) continue;
+    append(snprintf(buf + pos, len - pos, "%s\"%s\":[", key > 0 ? "," : "",
+                    KEYS[key]));
+    for (uint8_t i = 0; i < n; i++) {
+      if (i > 0) append(snprintf(buf + pos, len - pos, ","));
+      const Sample& sample = samples[i];
+      switch (key) {
+        case 0:
+          if (sample.time_valid) {
+            append(snprintf(buf + pos, len - pos, "%u",
+                            static_cast<unsigned>(sample.time)));
+          } else {
+            append(snprintf(buf + pos, len - pos, "null"));
+          }
+          break;
+        case 1:
+          // until it is set, the clock keeps counting from the same start
+          // as when the sample was taken, unknown once it is
+          if (sample.time_valid || now >= MIN_VALID_TIME) {
+            append(snprintf(buf + pos, len - pos, "null"));
+          } else {
+            uint32_t age = static_cast<uint32_t>(now) - sample.time;
+            append(snprintf(buf + pos, len - pos, "%u",
+                            static_cast<unsigned>(age)));
+          }
+          break;
+        case 2:
+          append(_print_fixed(buf + pos, len - pos, sample.temperature));
+          break;
+        case 3:
+          append(_print_fixed(buf + pos, len - pos, sample.humidity));
+          break;
+        case 4:
+          append(snprintf(buf + pos, len - pos, "%u", sample.battery_pct));
+          break;
+      }
+    }
+    append(snprintf(buf + pos, len - pos, "]"));
+  }
+  append(snprintf(buf + pos, len - pos, "}"));
+  return pos < len ? pos : 0;
+}
+
+}  // namespace sensor_log
@@ -0,0 +1,62 @@
+#ifndef HOMEBUTTONS_SENSOR_LOG_H
+#define HOMEBUTTONS_SENSOR_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// Sensor samples kept in RTC memory between uploads, for batched telemetry:
+// timer wakes only add a sample, the radio is brought up when a batch is
+// full or a value moved by more than the thresholds. Reset on power loss and
+// when the firmware changes.
+namespace sensor_log {
+
+struct Sample {
+  uint32_t time;        // unix time, s
+  int16_t temperature;  // 0.01 deg, unit as configured
+  uint16_t humidity;    // 0.01 %
+  uint8_t battery_pct;
+  bool time_valid;  // false if taken before the clock was ever set
+};
+
+// The oldest sample is dropped if full.
+void add(float temperature, float humidity, uint8_t battery_pct, time_t time);
+uint8_t count();
+
+// True if there are batch_size samples, the newest one moved beyond the
+// thresholds since the last upload, or an upload was forced.
+bool upload_due(uint8_t batch_size);
+// Makes the next upload_due() true, e.g. to connect on the next timer wake.
+void force_upload();
+// Marks the n oldest samples as sent. They stay in the log until
+// delivered(), if that doesn't happen during this wake they are sent again
+// on the next one.
+void sent(uint8_t n);
+// Number of samples sent and not delivered yet, the oldest ones.
+uint8_t sent_count();
+// Removes the n oldest samples once the broker has them, keeps the newest of
+// them as reference for the thresholds. At most sent_count().
+void delivered(uint8_t n);
+
+// Shifts the samples taken before the clock was set, offset is the
+// correction applied to the clock.
+void clock_set(int64_t offset_s);
+
+// Samples per sensor history message.
+static constexpr uint8_t JSON_SAMPLES = 8;
+// {"t":[],"age":[],"temp":[],"hum":[],"batt":[]} plus per sample the longest
+// of "4294967295,", "4294967295,", "-327.68,", "655.35," and "255,"
+static constexpr size_t MAX_JSON_LEN =
+    46 + JSON_SAMPLES * (11 + 11 + 8 + 7 + 4);
+
+// {"t":[unix s],"temp":[..],"hum":[..],"batt":[..]} of the JSON_SAMPLES
+// samples from index first on, oldest first. Temperature and humidity have
+// two decimals. A sample taken before the clock was set has null as its
+// time, and "age":[s] is added with how long before now it was taken, null
+// for the others and if now is a set clock. Returns the length, 0 if there is no sample from first on
+// or it doesn't fit.
+size_t to_json(uint8_t first, time_t now, char* buf, size_t len);
+
+}  // namespace sensor_log
+
+#endif  // HOMEBUTTONS_SENSOR_LOG_H
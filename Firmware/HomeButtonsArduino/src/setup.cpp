@@ -1,7 +1,6 @@
 #include "setup.h"
 
 #include <Arduino.h>
-#include <PubSubClient.h>
 #include <WiFi.h>
 #include <WiFiManager.h>
 
@@ -9,8 +8,12 @@
 #include "display.h"
 #include "hardware.h"
 #include "state.h"
+#include "state_cache.h"
 #include "logger.h"
+#include "mqtt_transport.h"
+#include "mqttsn.h"
 #include "network.h"
+#include "transport.h"
 #include "utils.h"
 
 static WiFiManager wifi_manager;
@@ -18,11 +21,15 @@ static WiFiManager wifi_manager;
 static WiFiManagerParameter device_name_param("device_name", "Device Name", "",
                                               20);
 static WiFiManagerParameter mqtt_server_param("mqtt_server", "MQTT Server", "",
-                                              32);
+                                              48);
 static WiFiManagerParameter mqtt_port_param("mqtt_port", "MQTT Port", "", 6);
 static WiFiManagerParameter mqtt_user_param("mqtt_user", "MQTT User", "", 64);
 static WiFiManagerParameter mqtt_password_param("mqtt_password",
                                                 "MQTT Password", "", 64);
+static WiFiManagerParameter tls_psk_param("tls_psk", "TLS PSK (hex)", "", 64);
+static WiFiManagerParameter tls_pin_param("tls_pin",
+                                          "TLS Certificate SHA-256 (hex)",
+                                          "", 64);
 static WiFiManagerParameter base_topic_param("base_topic", "Base Topic", "",
                                              64);
 static WiFiManagerParameter discovery_prefix_param("disc_prefix",
@@ -48,6 +55,8 @@ static WiFiManagerParameter btn6_label_param("btn6_lbl", "Button 6 Label", "",
 #endif
 static WiFiManagerParameter temp_unit_param("temp_unit", "Temperature Unit", "",
                                             1);
+static WiFiManagerParameter icon_source_param("icon_src", "Icon Source URL", "",
+                                              ICON_SOURCE_MAXLEN);
 
 static bool web_portal_saved = false;
 
@@ -110,6 +119,8 @@ void save_params_callback(DeviceState* device_state) {
       mqtt_server_param.getValue(), String(mqtt_port_param.getValue()).toInt(),
       mqtt_user_param.getValue(), mqtt_password_param.getValue(),
       base_topic_param.getValue(), discovery_prefix_param.getValue());
+  device_state->set_mqtt_tls(tls_psk_param.getValue(),
+                             tls_pin_param.getValue());
   device_state->set_btn_label(0, btn1_label_param.getValue());
   device_state->set_btn_label(1, btn2_label_param.getValue());
   device_state->set_btn_label(2, btn3_label_param.getValue());
@@ -119,6 +130,7 @@ void save_params_callback(DeviceState* device_state) {
   device_state->set_btn_label(5, btn6_label_param.getValue());
 #endif
   device_state->set_temp_unit(StaticString<1>(temp_unit_param.getValue()));
+  device_state->set_icon_source(icon_source_param.getValue());
 
   IPAddress static_ip, gateway, subnet, dns, dns2;
   static_ip.fromString(static_ip_param.getValue());
@@ -146,13 +158,17 @@ void start_setup(DeviceState& device_state, Display& display,
   // parameters
   device_name_param.setValue(device_state.device_name().c_str(), 20);
   mqtt_server_param.setValue(
-      device_state.user_preferences().mqtt.server.c_str(), 32);
+      device_state.user_preferences().mqtt.server.c_str(), 48);
   mqtt_port_param.setValue(
       String(device_state.user_preferences().mqtt.port).c_str(), 6);
   mqtt_user_param.setValue(device_state.user_preferences().mqtt.user.c_str(),
                            64);
   mqtt_password_param.setValue(
       device_state.user_preferences().mqtt.password.c_str(), 64);
+  tls_psk_param.setValue(device_state.user_preferences().mqtt.tls_psk.c_str(),
+                         64);
+  tls_pin_param.setValue(device_state.user_preferences().mqtt.tls_pin.c_str(),
+                         64);
   base_topic_param.setValue(
       device_state.user_preferences().mqtt.base_topic.c_str(), 64);
   discovery_prefix_param.setValue(
@@ -182,11 +198,15 @@ void start_setup(DeviceState& device_state, Display& display,
                             BTN_LABEL_MAXLEN);
 #endif
   temp_unit_param.setValue(device_state.get_temp_unit().c_str(), 1);
+  icon_source_param.setValue(device_state.icon_source().c_str(),
+                             ICON_SOURCE_MAXLEN);
   wifi_manager.addParameter(&device_name_param);
   wifi_manager.addParameter(&mqtt_server_param);
   wifi_manager.addParameter(&mqtt_port_param);
   wifi_manager.addParameter(&mqtt_user_param);
   wifi_manager.addParameter(&mqtt_password_param);
+  wifi_manager.addParameter(&tls_psk_param);
+  wifi_manager.addParameter(&tls_pin_param);
   wifi_manager.addParameter(&base_topic_param);
   wifi_manager.addParameter(&discovery_prefix_param);
   wifi_manager.addParameter(&static_ip_param);
@@ -203,6 +223,7 @@ void start_setup(DeviceState& device_state, Display& display,
   wifi_manager.addParameter(&btn6_label_param);
 #endif
   wifi_manager.addParameter(&temp_unit_param);
+  wifi_manager.addParameter(&icon_source_param);
 
   display.disp_message("Entering\nSETUP...");
   display.update();
@@ -282,26 +303,32 @@ void start_setup(DeviceState& device_state, Display& display,
 
   // test MQTT connection
   uint32_t mqtt_start_time = millis();
-  WiFiClient wifi_client;
-  PubSubClient mqtt_client(wifi_client);
-  setupLogger.debug("Trying to connect to mqtt://%s:%d",
-                    device_state.user_preferences().mqtt.server.c_str(),
-                    device_state.user_preferences().mqtt.port);
-  mqtt_client.setServer(device_state.user_preferences().mqtt.server.c_str(),
-                        device_state.user_preferences().mqtt.port);
-  if (device_state.user_preferences().mqtt.user.length() > 0 &&
-      device_state.user_preferences().mqtt.password.length() > 0) {
-    mqtt_client.connect(device_state.factory().unique_id.c_str(),
-                        device_state.user_preferences().mqtt.user.c_str(),
-                        device_state.user_preferences().mqtt.password.c_str());
-  } else {
-    mqtt_client.connect(device_state.factory().unique_id.c_str());
+  static MQTTTransport mqtt_transport;
+  static MQTTSNTransport mqttsn_transport;
+  const char* host;
+  Transport* transport = &mqtt_transport;
+  TransportType type =
+      parse_server(device_state.user_preferences().mqtt.server.c_str(), &host);
+  if (type == TransportType::MQTT_SN) {
+    transport = &mqttsn_transport;
   }
+  mqtt_transport.set_tls(type == TransportType::MQTT_TLS,
+                         device_state.user_preferences().mqtt.tls_psk.c_str(),
+                         device_state.user_preferences().mqtt.tls_pin.c_str());
+  setupLogger.debug("Trying to connect to %s %s:%d", transport->name(), host,
+                    device_state.user_preferences().mqtt.port);
+  transport->set_server(host, device_state.user_preferences().mqtt.port);
+  transport->connect(device_state.factory().unique_id.c_str(),
+                     device_state.user_preferences().mqtt.user.c_str(),
+                     device_state.user_preferences().mqtt.password.c_str(),
+                     true);
+  state_cache::clear();
 
   display.disp_message("Confirming\nsetup...");
   display.update();
 
-  while (!mqtt_client.connected()) {
+  while (!transport->connected()) {
+    transport->loop();
     delay(10);
     if (millis() - mqtt_start_time >= MQTT_TIMEOUT) {
       device_state.persisted().setup_done = false;
@@ -315,7 +342,7 @@ void start_setup(DeviceState& device_state, Display& display,
     }
   }
 
-  mqtt_client.disconnect();
+  transport->disconnect();
   WiFi.disconnect(true);
   device_state.persisted().setup_done = true;
   device_state.persisted().silent_restart = true;
@@ -0,0 +1,59 @@
+#include "shutdown.h"
+
+#include <Arduino.h>
+
+#include <cstring>
+
+#include "metrics.h"
+
+void ShutdownSequencer::begin() {
+  for (auto& entry : steps_) entry = {};
+  count_ = 0;
+  start_time_ = millis();
+  reported_ = false;
+}
+
+void ShutdownSequencer::add(const char* name, Step step) {
+  if (count_ >= MAX_STEPS) {
+    error("too many steps, %s skipped", name);
+    return;
+  }
+  steps_[count_].name = name;
+  steps_[count_].step = step;
+  count_++;
+}
+
+bool ShutdownSequencer::done() {
+  bool all_done = true;
+  for (uint8_t i = 0; i < count_; i++) {
+    Entry& entry = steps_[i];
+    if (entry.done) continue;
+    if (entry.step()) {
+      entry.done = true;
+      entry.time = millis() - start_time_;
+      debug("%s done in %lu ms", entry.name, entry.time);
+    } else {
+      all_done = false;
+    }
+  }
+  if (all_done && !reported_) _report();
+  return all_done;
+}
+
+bool ShutdownSequencer::finished(const char* name) const {
+  for (uint8_t i = 0; i < count_; i++) {
+    if (strcmp(steps_[i].name, name) == 0) return steps_[i].done;
+  }
+  return false;
+}
+
+void ShutdownSequencer::_report() {
+  reported_ = true;
+  uint32_t total = millis() - start_time_;
+  StaticString<Logger::MAX_LOG_LINE_SIZE> line("ready in %lu ms:", total);
+  for (uint8_t i = 0; i < count_; i++) {
+    line += StaticString<32>(" %s %lu", steps_[i].name, steps_[i].time);
+  }
+  info("%s", line.c_str());
+  metrics::observe(metrics::Histogram::SHUTDOWN_MS, total);
+}
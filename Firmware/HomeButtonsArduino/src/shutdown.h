@@ -0,0 +1,45 @@
+#ifndef HOMEBUTTONS_SHUTDOWN_H
+#define HOMEBUTTONS_SHUTDOWN_H
+
+#include <functional>
+
+#include "logger.h"
+
+// Waits for the subsystems before deep sleep. Each one adds a step that is
+// polled until it returns true; a step may start work on its first poll and
+// wait for other steps. All steps run in parallel, so done() turns true as
+// soon as the slowest one finished. When it does, the time each step took is
+// logged.
+class ShutdownSequencer : public Logger {
+ public:
+  using Step = std::function<bool()>;
+
+  static constexpr uint8_t MAX_STEPS = 6;
+
+  ShutdownSequencer() : Logger("SHDN") {}
+
+  // Clears the steps and starts the clock.
+  void begin();
+  void add(const char* name, Step step);
+  // Polls the steps that aren't done yet.
+  bool done();
+  // True once the step has finished, false for an unknown name.
+  bool finished(const char* name) const;
+
+ private:
+  struct Entry {
+    const char* name = nullptr;
+    Step step;
+    uint32_t time = 0;  // ms after begin()
+    bool done = false;
+  };
+
+  Entry steps_[MAX_STEPS];
+  uint8_t count_ = 0;
+  uint32_t start_time_ = 0;
+  bool reported_ = false;
+
+  void _report();
+};
+
+#endif  // HOMEBUTTONS_SHUTDOWN_H
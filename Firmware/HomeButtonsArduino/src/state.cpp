@@ -1,24 +1,32 @@
 #include "state.h"
 #include "utils.h"
 #include "config.h"
+#include "trace.h"
 
 void DeviceState::save_user() {
+  TRACE_SCOPE("DeviceState::save_user");
   preferences_.begin("user", false);
   preferences_.putString("device_name", user_preferences_.device_name.c_str());
-  preferences_.putString("mqtt_srv", user_preferences_.mqtt.server);
+  preferences_.putString("mqtt_srv", user_preferences_.mqtt.server.c_str());
   preferences_.putUInt("mqtt_port", user_preferences_.mqtt.port);
-  preferences_.putString("mqtt_user", user_preferences_.mqtt.user);
-  preferences_.putString("mqtt_pass", user_preferences_.mqtt.password);
-  preferences_.putString("base_topic", user_preferences_.mqtt.base_topic);
+  preferences_.putString("mqtt_user", user_preferences_.mqtt.user.c_str());
+  preferences_.putString("mqtt_pass", user_preferences_.mqtt.password.c_str());
+  preferences_.putString("base_topic",
+                         user_preferences_.mqtt.base_topic.c_str());
   preferences_.putString("disc_prefix",
-                         user_preferences_.mqtt.discovery_prefix);
+                         user_preferences_.mqtt.discovery_prefix.c_str());
+  preferences_.putString("mqtt_psk", user_preferences_.mqtt.tls_psk.c_str());
+  preferences_.putString("mqtt_pin", user_preferences_.mqtt.tls_pin.c_str());
   for (int i = 0; i < NUM_BUTTONS; i++) {
     preferences_.putString(StaticString<8>("btn%d_txt", i + 1).c_str(),
                            user_preferences_.btn_labels[i].c_str());
   }
   preferences_.putUInt("sen_itv", user_preferences_.sensor_interval);
+  preferences_.putUInt("sen_batch", user_preferences_.sensor_batch);
+  preferences_.putBool("sen_comb", user_preferences_.combined_sensors);
   preferences_.putUInt("rotation", user_preferences_.rotation);
   preferences_.putBool("use_f", user_preferences_.use_fahrenheit);
+  preferences_.putString("icon_src", user_preferences_.icon_source.c_str());
   preferences_.putString(
       "sta_ip",
       ip_address_to_static_string(user_preferences_.network.static_ip).c_str());
@@ -38,31 +46,39 @@ void DeviceState::save_user() {
 }
 
 void DeviceState::load_user() {
+  TRACE_SCOPE("DeviceState::load_user");
   preferences_.begin("user", true);
   _load_to_static_string(
       user_preferences_.device_name, "device_name",
       (DeviceName{DEVICE_NAME_DFLT} + " " + factory_.random_id).c_str());
-  user_preferences_.mqtt.server = preferences_.getString("mqtt_srv", "");
+  _load_to_static_string(user_preferences_.mqtt.server, "mqtt_srv", "");
   user_preferences_.mqtt.port =
       preferences_.getUInt("mqtt_port", MQTT_PORT_DFLT);
-  user_preferences_.mqtt.user = preferences_.getString("mqtt_user", "");
-  user_preferences_.mqtt.password = preferences_.getString("mqtt_pass", "");
-  user_preferences_.mqtt.base_topic =
-      preferences_.getString("base_topic", BASE_TOPIC_DFLT);
-  user_preferences_.mqtt.discovery_prefix =
-      preferences_.getString("disc_prefix", DISCOVERY_PREFIX_DFLT);
+  _load_to_static_string(user_preferences_.mqtt.user, "mqtt_user", "");
+  _load_to_static_string(user_preferences_.mqtt.password, "mqtt_pass", "");
+  _load_to_static_string(user_preferences_.mqtt.base_topic, "base_topic",
+                         BASE_TOPIC_DFLT);
+  _load_to_static_string(user_preferences_.mqtt.discovery_prefix,
+                         "disc_prefix", DISCOVERY_PREFIX_DFLT);
+  _load_to_static_string(user_preferences_.mqtt.tls_psk, "mqtt_psk", "");
+  _load_to_static_string(user_preferences_.mqtt.tls_pin, "mqtt_pin", "");
 
   for (int i = 0; i < NUM_BUTTONS; i++) {
     _load_to_static_string(user_preferences_.btn_labels[i],
                            StaticString<8>("btn%d_txt", i + 1).c_str(),
                            StaticString<16>("mdi:numeric-%d", i + 1).c_str());
   }
+  _parse_btn_labels();
 
   user_preferences_.sensor_interval =
       preferences_.getUInt("sen_itv", SEN_INTERVAL_DFLT);
+  user_preferences_.sensor_batch =
+      preferences_.getUInt("sen_batch", SEN_BATCH_DFLT);
+  user_preferences_.combined_sensors = preferences_.getBool("sen_comb", false);
   user_preferences_.rotation =
       preferences_.getUInt("rotation", 0);
   user_preferences_.use_fahrenheit = preferences_.getBool("use_f", false);
+  _load_to_static_string(user_preferences_.icon_source, "icon_src", "");
 
   _load_to_ip_address(user_preferences_.network.static_ip, "sta_ip", "0.0.0.0");
   _load_to_ip_address(user_preferences_.network.gateway, "g_way", "0.0.0.0");
@@ -80,6 +96,7 @@ void DeviceState::clear_user() {
 }
 
 void DeviceState::save_persisted() {
+  TRACE_SCOPE("DeviceState::save_persisted");
   preferences_.begin("persisted", false);
   preferences_.putBool("lb_mode", persisted_.low_batt_mode);
   preferences_.putBool("wifi_done", persisted_.wifi_done);
@@ -102,6 +119,7 @@ void DeviceState::save_persisted() {
 }
 
 void DeviceState::load_persisted() {
+  TRACE_SCOPE("DeviceState::load_persisted");
   preferences_.begin("persisted", false);
   persisted_.low_batt_mode = preferences_.getBool("lb_mode", false);
   persisted_.wifi_done = preferences_.getBool("wifi_done", false);
@@ -186,10 +204,28 @@ const ButtonLabel& DeviceState::get_btn_label(uint8_t i) const {
   }
 }
 
+const LabelDescriptor& DeviceState::get_btn_label_desc(uint8_t i) const {
+  static LabelDescriptor noLabel;
+  if (i < NUM_BUTTONS) {
+    return btn_label_descs_[i];
+  } else {
+    return noLabel;
+  }
+}
+
 void DeviceState::set_btn_label(uint8_t i, const char* label) {
   if (i < NUM_BUTTONS) {
     user_preferences_.btn_labels[i].set(label);
+    btn_label_descs_[i] = parse_label(user_preferences_.btn_labels[i].c_str());
+    update_label_layout(btn_label_descs_);
+  }
+}
+
+void DeviceState::_parse_btn_labels() {
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    btn_label_descs_[i] = parse_label(user_preferences_.btn_labels[i].c_str());
   }
+  update_label_layout(btn_label_descs_);
 }
 
 void DeviceState::_load_to_ip_address(IPAddress& destination, const char* key,
@@ -8,6 +8,7 @@
 #include "types.h"
 #include "logger.h"
 #include "hardware.h"
+#include "label.h"
 #include <IPAddress.h>
 
 struct StaticIPConfig {
@@ -34,19 +35,24 @@ class DeviceState : public Logger {
     DeviceName device_name;
     ButtonLabel btn_labels[NUM_BUTTONS];
     uint16_t sensor_interval = 0;  // minutes
+    uint8_t sensor_batch = SEN_BATCH_DFLT;  // samples per upload
+    bool combined_sensors = false;  // one JSON state topic for all sensors
 
     uint16_t rotation = 0;
     bool use_fahrenheit = false;
+    IconSource icon_source;  // empty = default (GitHub)
 
     StaticIPConfig network;
 
     struct {
-      String server = "";
+      MQTTServer server;
       int32_t port = 0;
-      String user = "";
-      String password = "";
-      String base_topic = "";
-      String discovery_prefix = "";
+      MQTTUser user;
+      MQTTPassword password;
+      MQTTTopicPrefix base_topic;
+      MQTTTopicPrefix discovery_prefix;
+      TLSKey tls_psk;  // used with mqtts://
+      TLSKey tls_pin;  // without a PSK
     } mqtt;
   } user_preferences_;
 
@@ -76,7 +82,6 @@ class DeviceState : public Logger {
   struct Flags {
     bool display_redraw = false;
     bool awake_mode = false;
-    uint32_t schedule_wakeup_time = 0;
   } flags_;
 
   struct Sensors {
@@ -99,12 +104,19 @@ class DeviceState : public Logger {
 
   // User preferences
   const UserPreferences& user_preferences() const { return user_preferences_; }
-  void set_mqtt_parameters(const String& server, int32_t port,
-                           const String& user, const String& password,
-                           const String& base_topic,
-                           const String& discovery_prefix) {
-    user_preferences_.mqtt = {server,   port,       user,
-                              password, base_topic, discovery_prefix};
+  void set_mqtt_parameters(const char* server, int32_t port, const char* user,
+                           const char* password, const char* base_topic,
+                           const char* discovery_prefix) {
+    user_preferences_.mqtt.server = server;
+    user_preferences_.mqtt.port = port;
+    user_preferences_.mqtt.user = user;
+    user_preferences_.mqtt.password = password;
+    user_preferences_.mqtt.base_topic = base_topic;
+    user_preferences_.mqtt.discovery_prefix = discovery_prefix;
+  }
+  void set_mqtt_tls(const char* psk, const char* pin) {
+    user_preferences_.mqtt.tls_psk = psk;
+    user_preferences_.mqtt.tls_pin = pin;
   }
   void set_static_ip_config(const IPAddress& static_ip,
                             const IPAddress& gateway, const IPAddress& subnet,
@@ -132,13 +144,29 @@ class DeviceState : public Logger {
   void set_sensor_interval(uint16_t interval_min) {
     user_preferences_.sensor_interval = interval_min;
   }
+  uint8_t sensor_batch() const { return user_preferences_.sensor_batch; }
+  void set_sensor_batch(uint8_t batch) {
+    user_preferences_.sensor_batch = batch;
+  }
+  bool combined_sensors() const { return user_preferences_.combined_sensors; }
+  void set_combined_sensors(bool combined) {
+    user_preferences_.combined_sensors = combined;
+  }
   uint16_t global_rotation() const { return user_preferences_.rotation; }
   void set_global_rotation(uint16_t rotation) {
     user_preferences_.rotation = rotation;
   }
   const ButtonLabel& get_btn_label(uint8_t i) const;
+  const LabelDescriptor& get_btn_label_desc(uint8_t i) const;
   void set_btn_label(uint8_t i, const char* label);
 
+  const IconSource& icon_source() const {
+    return user_preferences_.icon_source;
+  }
+  void set_icon_source(const char* url) {
+    user_preferences_.icon_source.set(url);
+  }
+
   bool get_use_fahrenheit() const { return user_preferences_.use_fahrenheit; }
   StaticString<1> get_temp_unit() const {
     return StaticString<1>(user_preferences_.use_fahrenheit ? "F" : "C");
@@ -201,8 +229,11 @@ class DeviceState : public Logger {
   void _load_to_ip_address(IPAddress& destination, const char* key,
                            const char* defaultValue);
 
+  void _parse_btn_labels();
+
   Preferences preferences_;
   StaticString<15> ip_address_;
+  LabelDescriptor btn_label_descs_[NUM_BUTTONS];
 };
 
 #endif  // HOMEBUTTONS_STATE_H
@@ -0,0 +1,119 @@
+#include "state_cache.h"
+
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+namespace state_cache {
+
+static constexpr uint32_t MAGIC = 0x48534331;  // "HSC1"
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+
+struct Entry {
+  uint32_t topic;  // hash, 0 = free
+  uint32_t payload;
+};
+
+struct Cache {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint16_t wakes;
+  uint8_t next;  // replaced if full
+  Entry entries[STATE_CACHE_ENTRIES];
+};
+
+RTC_NOINIT_ATTR static Cache cache;
+static bool initialized = false;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void _reset() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  memset(&cache, 0, sizeof(cache));
+  cache.magic = MAGIC;
+  memcpy(cache.firmware_id, id, FIRMWARE_ID_LEN);
+}
+
+// call with lock held
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  if (cache.magic != MAGIC ||
+      memcmp(cache.firmware_id, id, FIRMWARE_ID_LEN) != 0 ||
+      cache.next >= STATE_CACHE_ENTRIES) {
+    _reset();
+  }
+  initialized = true;
+}
+
+// FNV-1a, never 0
+static uint32_t _hash(const char* str) {
+  uint32_t hash = 2166136261u;
+  for (; *str != '\0'; str++) {
+    hash = (hash ^ static_cast<uint8_t>(*str)) * 16777619u;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+// call with lock held
+static Entry* _find(uint32_t topic) {
+  for (auto& entry : cache.entries) {
+    if (entry.topic == topic) return &entry;
+  }
+  return nullptr;
+}
+
+void wakeup() {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  if (++cache.wakes >= STATE_REFRESH_WAKES) {
+    _reset();
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+void clear() {
+  taskENTER_CRITICAL(&lock);
+  _reset();
+  initialized = true;
+  taskEXIT_CRITICAL(&lock);
+}
+
+bool unchanged(const char* topic, const char* payload) {
+  uint32_t topic_hash = _hash(topic);
+  uint32_t payload_hash = _hash(payload);
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  Entry* entry = _find(topic_hash);
+  bool same = entry != nullptr && entry->payload == payload_hash;
+  taskEXIT_CRITICAL(&lock);
+  return same;
+}
+
+void store(const char* topic, const char* payload) {
+  uint32_t topic_hash = _hash(topic);
+  uint32_t payload_hash = _hash(payload);
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  Entry* entry = _find(topic_hash);
+  if (entry == nullptr) {
+    entry = &cache.entries[cache.next];
+    cache.next = (cache.next + 1) % STATE_CACHE_ENTRIES;
+  }
+  *entry = {topic_hash, payload_hash};
+  taskEXIT_CRITICAL(&lock);
+}
+
+void forget(const char* topic) {
+  uint32_t topic_hash = _hash(topic);
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  Entry* entry = _find(topic_hash);
+  if (entry != nullptr) entry->topic = 0;
+  taskEXIT_CRITICAL(&lock);
+}
+
+}  // namespace state_cache
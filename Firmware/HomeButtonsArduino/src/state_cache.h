@@ -0,0 +1,19 @@
+#ifndef HOMEBUTTONS_STATE_CACHE_H
+#define HOMEBUTTONS_STATE_CACHE_H
+
+// Hashes of the retained state messages the broker has, kept in RTC memory,
+// so states are only republished when they change. Everything is
+// republished every STATE_REFRESH_WAKES wakes, in case the broker lost it,
+// and after power loss or a firmware change.
+namespace state_cache {
+
+void wakeup();  // once per boot
+void clear();   // the broker or the session changed
+
+bool unchanged(const char* topic, const char* payload);
+void store(const char* topic, const char* payload);
+void forget(const char* topic);
+
+}  // namespace state_cache
+
+#endif  // HOMEBUTTONS_STATE_CACHE_H
@@ -1,11 +1,17 @@
 #ifndef HOMEBUTTONS_STATEMACHINE_H
 #define HOMEBUTTONS_STATEMACHINE_H
 
+#include <algorithm>
 #include <tuple>
-#include <variant>
+#include <type_traits>
 #include <stdio.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
 #include "logger.h"
+#include "trace.h"
 
 template <typename Base>
 class State;
@@ -13,16 +19,55 @@ class State;
 template <typename Base, typename... States>
 class StateMachine;
 
+// Per-machine settings. Specialize for the machine's Base class, before its
+// states are declared, to give the machine its own event type.
+template <typename Base>
+struct StateMachineTraits {
+  enum class Event : uint8_t {};
+  static constexpr UBaseType_t EVENT_QUEUE_SIZE = 4;
+  static constexpr uint8_t MAX_TIMERS = 2;
+};
+
+// States a state may transition to, see State::Transitions.
+template <typename... Targets>
+struct Transitions {
+  template <typename Target>
+  static constexpr bool contains = (std::is_same_v<Target, Targets> || ...);
+};
+
+struct AnyTransition {
+  template <typename Target>
+  static constexpr bool contains = true;
+};
+
 template <typename Base>
 class State {
  public:
   using SM = Base;
+  using Event = typename StateMachineTraits<Base>::Event;
+  // Redeclare in a state to nest it in another state of the same machine.
+  // The parent gets the events the state doesn't handle and is entered
+  // before / exited after it.
+  using Parent = void;
+  // Redeclare as Transitions<...> to check transition_to<Next>(this) calls
+  // at compile time.
+  using Transitions = AnyTransition;
+
   explicit State(Base &base) : base_(base) {}
 
   virtual void entry() {}
   virtual void loop() {}
   virtual void exit() {}
 
+  // Returns true if the event was handled.
+  virtual bool on_event([[maybe_unused]] Event event,
+                        [[maybe_unused]] uint32_t arg) {
+    return false;
+  }
+  // Event driven states return false, the machine then sleeps until an event
+  // or a timer instead of running loop() at the poll interval.
+  virtual bool polled() const { return true; }
+
   virtual const char *get_name() = 0;
 
   template <typename NextState>
@@ -30,68 +75,295 @@ class State {
     base_.template transition_to<NextState>();
   }
 
+  template <typename NextState, typename Self>
+  void transition_to(const Self *) {
+    static_assert(Self::Transitions::template contains<NextState>,
+                  "transition is not declared in Self::Transitions");
+    base_.template transition_to<NextState>();
+  }
+
+  // Dispatches `event` after interval_ms, restarts it if already running.
+  // Timers are stopped when the state exits.
+  bool start_timer(Event event, uint32_t interval_ms, bool periodic = false) {
+    return base_._start_timer(this, event, interval_ms, periodic);
+  }
+  void stop_timer(Event event) { base_._stop_timer(this, event); }
+
  protected:
   Base &base_;
   Base &sm() { return base_; }
+
+ private:
+  State *parent_ = nullptr;
+
+  template <typename, typename...>
+  friend class StateMachine;
 };
 
+// States are driven either by loop() (polled) or by run(), which also
+// dispatches posted events and timers. Everything except post() runs in the
+// machine's task.
 template <typename Base, typename... States>
 class StateMachine {
  public:
+  using Traits = StateMachineTraits<Base>;
+  using Event = typename Traits::Event;
+  using StateBase = State<Base>;
+
   StateMachine(const char *name, Base &base)
-      : current_state_(&std::get<0>(states_)),
-        states_(States(base)...),
-        base_(base) {
+      : states_(States(base)...), base_(base) {
     static_assert(std::is_base_of<Logger, Base>::value);
+    static_assert((_check_state<States>() && ...));
+    (_link_parent<States>(), ...);
+    current_state_ = &std::get<0>(states_);
     snprintf(name_, MAX_NAME_LENGTH, "%s", name);
+    event_queue_ =
+        xQueueCreateStatic(Traits::EVENT_QUEUE_SIZE, sizeof(EventMessage),
+                           event_queue_storage_, &event_queue_buf_);
   }
 
+  // Called from an entry(), the transition is done once all states down to
+  // the current one are entered; the last one requested wins.
   template <typename NextState>
   void transition_to() {
-    _exit_state(current_state_);
+    static_assert(is_state<NextState>, "not a state of this machine");
+    _transition(&std::get<NextState>(states_));
+  }
 
-    current_state_ = &std::get<NextState>(states_);
+  void loop() {
+    _start();
+    current_state_->loop();
+  }
 
-    base_.info("Entering state %s::%s", name_,
-               std::visit([](auto statePtr) { return statePtr->get_name(); },
-                          current_state_));
-    std::visit([](auto statePtr) { statePtr->entry(); }, current_state_);
+  // Waits for an event or a timer, at most poll_ms if the current state is
+  // polled and never longer than max_wait_ms. Then dispatches it and runs
+  // the current state's loop().
+  void run(uint32_t poll_ms, uint32_t max_wait_ms = UINT32_MAX) {
+    _start();
+    uint32_t wait_ms = std::min(
+        max_wait_ms, current_state_->polled() ? poll_ms : UINT32_MAX);
+    TickType_t wait = std::min(wait_ms == UINT32_MAX
+                                   ? static_cast<TickType_t>(portMAX_DELAY)
+                                   : pdMS_TO_TICKS(wait_ms),
+                               _next_timer());
+    EventMessage message;
+    if (xQueueReceive(event_queue_, &message, wait) == pdTRUE) {
+      dispatch(message.event, message.arg);
+    }
+    _fire_timers();
+    current_state_->loop();
   }
 
-  void loop() {
-    if (first_run_) {
-      first_run_ = false;
-      _enter_state(current_state_);
+  // Safe from any task. Returns false if the queue is full.
+  bool post(Event event, uint32_t arg = 0) {
+    EventMessage message{event, arg};
+    return xQueueSend(event_queue_, &message, 0) == pdTRUE;
+  }
+
+  // Goes up the parents until a state handles it, unhandled events are
+  // dropped.
+  void dispatch(Event event, uint32_t arg) {
+    for (StateBase *state = current_state_; state != nullptr;
+         state = state->parent_) {
+      if (state->on_event(event, arg)) return;
     }
-    std::visit([](auto statePtr) { statePtr->loop(); }, current_state_);
   }
 
   template <typename State>
   bool is_current_state() const {
-    return std::holds_alternative<State *>(current_state_);
+    return current_state_ == &std::get<State>(states_);
   }
 
-  void _enter_state(std::variant<States *...> state) {
-    base_.info(
-        "Entering state %s::%s", name_,
-        std::visit([](auto statePtr) { return statePtr->get_name(); }, state));
-    std::visit([](auto statePtr) { statePtr->entry(); }, state);
+  // true also if State is a parent of the current state
+  template <typename State>
+  bool is_in_state() const {
+    for (const StateBase *state = current_state_; state != nullptr;
+         state = state->parent_) {
+      if (state == &std::get<State>(states_)) return true;
+    }
+    return false;
   }
 
-  void _exit_state(std::variant<States *...> state) {
-    base_.info(
-        "Leaving state %s::%s", name_,
-        std::visit([](auto statePtr) { return statePtr->get_name(); }, state));
-    std::visit([](auto statePtr) { statePtr->exit(); }, state);
+  // the time spent in a state is traced as one span
+  void _enter_state(StateBase *state) {
+    const char *state_name = state->get_name();
+    base_.info("Entering state %s::%s", name_, state_name);
+    TRACE_BEGIN(state_name);
+    state->entry();
+  }
+
+  void _exit_state(StateBase *state) {
+    const char *state_name = state->get_name();
+    base_.info("Leaving state %s::%s", name_, state_name);
+    state->exit();
+    for (auto &timer : timers_) {
+      if (timer.owner == state) timer.owner = nullptr;
+    }
+    TRACE_END(state_name);
+  }
+
+  bool _start_timer(StateBase *owner, Event event, uint32_t interval_ms,
+                    bool periodic) {
+    Timer *slot = nullptr;
+    for (auto &timer : timers_) {
+      if (timer.owner == owner && timer.event == event) {
+        slot = &timer;
+        break;
+      } else if (timer.owner == nullptr && slot == nullptr) {
+        slot = &timer;
+      }
+    }
+    if (slot == nullptr) {
+      base_.error("%s: no free timer", name_);
+      return false;
+    }
+    *slot = Timer{owner, event, pdMS_TO_TICKS(interval_ms), xTaskGetTickCount(),
+                  periodic};
+    return true;
+  }
+
+  void _stop_timer(StateBase *owner, Event event) {
+    for (auto &timer : timers_) {
+      if (timer.owner == owner && timer.event == event) timer.owner = nullptr;
+    }
   }
 
  protected:
-  std::variant<States *...> current_state_;
+  template <typename State>
+  static constexpr bool is_state = (std::is_same_v<State, States> || ...);
+
+  StateBase *current_state_;
   std::tuple<States...> states_;
   static constexpr size_t MAX_NAME_LENGTH = 32;
   char name_[MAX_NAME_LENGTH];
   Base &base_;
   bool first_run_ = true;
+
+ private:
+  struct EventMessage {
+    Event event;
+    uint32_t arg;
+  };
+
+  struct Timer {
+    StateBase *owner;  // nullptr if not running
+    Event event;
+    TickType_t interval;
+    TickType_t start;
+    bool periodic;
+  };
+
+  template <typename State>
+  static constexpr bool _check_state() {
+    static_assert(std::is_base_of_v<StateBase, State>,
+                  "states must derive from State<Base>");
+    static_assert(std::is_void_v<typename State::Parent> ||
+                      is_state<typename State::Parent>,
+                  "parent is not a state of this machine");
+    static_assert(_check_transitions(typename State::Transitions{}),
+                  "transition target is not a state of this machine");
+    return true;
+  }
+
+  template <typename... Targets>
+  static constexpr bool _check_transitions(Transitions<Targets...>) {
+    return (is_state<Targets> && ...);
+  }
+  static constexpr bool _check_transitions(AnyTransition) { return true; }
+
+  template <typename State>
+  void _link_parent() {
+    if constexpr (!std::is_void_v<typename State::Parent>) {
+      std::get<State>(states_).parent_ =
+          &std::get<typename State::Parent>(states_);
+    }
+  }
+
+  static bool _is_parent_of(const StateBase *parent, const StateBase *state) {
+    for (state = state->parent_; state != nullptr; state = state->parent_) {
+      if (state == parent) return true;
+    }
+    return false;
+  }
+
+  void _transition(StateBase *next) {
+    if (entering_) {
+      pending_ = next;
+      return;
+    }
+    // leave up to the closest common parent, a self transition exits and
+    // enters the state again
+    StateBase *state = current_state_;
+    while (state != nullptr && !_is_parent_of(state, next)) {
+      _exit_state(state);
+      state = state->parent_;
+    }
+    current_state_ = next;
+    _enter_from(state);
+  }
+
+  // enters the states below `from` down to the current one, then does the
+  // transition an entry() asked for, so exit() only runs on entered states
+  void _enter_from(StateBase *from) {
+    entering_ = true;
+    _enter_path(from, current_state_);
+    entering_ = false;
+    if (pending_ != nullptr) {
+      StateBase *next = pending_;
+      pending_ = nullptr;
+      _transition(next);
+    }
+  }
+
+  // enters the states below `from` down to `to`, outermost first
+  void _enter_path(StateBase *from, StateBase *to) {
+    if (to->parent_ != from) _enter_path(from, to->parent_);
+    _enter_state(to);
+  }
+
+  void _start() {
+    if (first_run_) {
+      first_run_ = false;
+      _enter_from(nullptr);
+    }
+  }
+
+  TickType_t _next_timer() const {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t next = portMAX_DELAY;
+    for (const auto &timer : timers_) {
+      if (timer.owner == nullptr) continue;
+      TickType_t elapsed = now - timer.start;
+      next = std::min(next, elapsed >= timer.interval
+                                ? static_cast<TickType_t>(0)
+                                : timer.interval - elapsed);
+    }
+    return next;
+  }
+
+  void _fire_timers() {
+    for (auto &timer : timers_) {
+      if (timer.owner == nullptr) continue;
+      TickType_t now = xTaskGetTickCount();
+      if (now - timer.start < timer.interval) continue;
+      if (timer.periodic) {
+        // skip missed periods instead of firing them back to back
+        timer.start = now - (now - timer.start) % std::max<TickType_t>(
+                                                      timer.interval, 1);
+      } else {
+        timer.owner = nullptr;
+      }
+      dispatch(timer.event, 0);
+    }
+  }
+
+  bool entering_ = false;
+  StateBase *pending_ = nullptr;  // transition requested while entering
+  Timer timers_[Traits::MAX_TIMERS] = {};
+  StaticQueue_t event_queue_buf_;
+  uint8_t event_queue_storage_[Traits::EVENT_QUEUE_SIZE *
+                               sizeof(EventMessage)];
+  QueueHandle_t event_queue_ = nullptr;
 };
 
 #endif  // HOMEBUTTONS_STATEMACHINE_H
@@ -6,34 +6,100 @@
 #include <algorithm>
 #include "Arduino.h"
 
+// Non-owning view of a part of a string. Not necessarily '\0' terminated,
+// only valid as long as the string it points to.
+class StaticStringView {
+ public:
+  constexpr StaticStringView() {}
+  StaticStringView(const char* str)
+      : data_(str ? str : ""), length_(str ? strlen(str) : 0) {}
+  constexpr StaticStringView(const char* str, size_t length)
+      : data_(str), length_(length) {}
+
+  const char* data() const { return data_; }
+  size_t length() const { return length_; }
+  bool empty() const { return length_ == 0; }
+  char operator[](size_t i) const { return data_[i]; }
+
+  StaticStringView substring(size_t i) const { return substring(i, length_); }
+  StaticStringView substring(size_t i, size_t j) const {
+    if (i > j || i >= length_) {
+      return StaticStringView();
+    }
+    return StaticStringView(data_ + i, std::min(j, length_) - i);
+  }
+
+  // removes any leading or trailing spaces
+  StaticStringView trim() const {
+    size_t start = 0;
+    size_t end = length_;
+    while (start < end && isspace(data_[start])) {
+      start++;
+    }
+    while (end > start && isspace(data_[end - 1])) {
+      end--;
+    }
+    return StaticStringView(data_ + start, end - start);
+  }
+
+  // returns index of first occurrence of c, or -1 if not found
+  int index_of(char c, unsigned int start = 0) const {
+    if (start >= length_) {
+      return -1;
+    }
+    auto found =
+        static_cast<const char*>(memchr(data_ + start, c, length_ - start));
+    return found ? found - data_ : -1;
+  }
+
+  bool starts_with(const char* prefix) const {
+    size_t n = strlen(prefix);
+    return n <= length_ && std::memcmp(data_, prefix, n) == 0;
+  }
+
+  bool operator==(const char* other) const {
+    return std::strncmp(data_, other, length_) == 0 && other[length_] == '\0';
+  }
+
+ private:
+  const char* data_ = "";
+  size_t length_ = 0;
+};
+
 // A class to hold a string up to MAX_SIZE characters (or MAX_SIZE+1 characters
-// including \0)
+// including \0). The length is kept up to date, appending does not format.
 template <size_t _MAX_SIZE>
 class StaticString {
   static constexpr size_t MAX_SIZE = _MAX_SIZE + 1;  // to include trailing '\0'
 
+  template <size_t>
+  friend class StaticString;
+
  public:
   StaticString() {}
-  explicit StaticString(const char* str) {
-    auto n = std::snprintf(data_, MAX_SIZE, "%s", str);
-    _check_snprintf_return_value(n);
-  }
+  explicit StaticString(const char* str) { _assign(str, strlen(str)); }
 
   explicit StaticString(const String& str) {
-    auto n = std::snprintf(data_, MAX_SIZE, "%s", str.c_str());
-    _check_snprintf_return_value(n);
+    _assign(str.c_str(), str.length());
   }
 
+  explicit StaticString(StaticStringView str) {
+    _assign(str.data(), str.length());
+  }
+
+  StaticString(const StaticString& other) { _assign(other.data_, other.len_); }
+
   template <size_t _OTHER_MAX_SIZE>
   StaticString(const StaticString<_OTHER_MAX_SIZE>& other) {
-    auto n = std::snprintf(data_, MAX_SIZE, "%s", other.c_str());
-    _check_snprintf_return_value(n);
+    _assign(other.data_, other.len_);
   }
 
   template <typename... Args>
   explicit StaticString(const char* format, Args... args) {
     auto n = std::snprintf(data_, MAX_SIZE, format, args...);
     _check_snprintf_return_value(n);
+    len_ = n < 0 ? 0 : std::min(static_cast<size_t>(n), MAX_SIZE - 1);
+    data_[len_] = '\0';
   }
 
   template <typename... Args>
@@ -43,51 +109,20 @@ class StaticString {
 
   const char* c_str() const { return data_; }
 
-  size_t length() const { return strlen(data_); }
-  bool empty() const { return strlen(data_) == 0; }
-  StaticString substring(size_t i) const { return substring(i, length()); }
+  size_t length() const { return len_; }
+  bool empty() const { return len_ == 0; }
+  StaticStringView view() const { return StaticStringView(data_, len_); }
+  StaticString substring(size_t i) const { return substring(i, len_); }
   StaticString substring(size_t i, size_t j) const {
-    StaticString output;
-    if (i > j || i >= length()) {
-      return output;
-    }
-    auto n = std::snprintf(output.data_, std::min(MAX_SIZE, j - i + 1), "%s",
-                           data_ + i);
-    _check_snprintf_return_value(n);
-    return output;
+    return StaticString(view().substring(i, j));
   }
 
   // removes any leading or trailing spaces
-  StaticString trim(void) {
-    StaticString output;
-    if (empty()) {
-      return output;
-    }
-    auto start = data_;
-    while (isspace(*start)) {
-      start++;
-    }
-    auto end = data_ + length() - 1;
-    while (end > start && isspace(*end)) {
-      end--;
-    }
-    auto n = std::snprintf(output.data_, static_cast<size_t>(end - start + 2),
-                           "%s", start);
-    _check_snprintf_return_value(n);
-    return output;
-  }
+  StaticString trim(void) const { return StaticString(view().trim()); }
 
   // returns index of first occurrence of c, or -1 if not found
   int index_of(char c, unsigned int start = 0) const {
-    if (start >= length()) {
-      return -1;
-    }
-    for (unsigned int i = start; i < length(); i++) {
-      if (data_[i] == c) {
-        return i;
-      }
-    }
-    return -1;
+    return view().index_of(c, start);
   }
 
   template <typename T>
@@ -99,73 +134,122 @@ class StaticString {
 
   template <size_t _OTHER_MAX_SIZE>
   StaticString& operator+=(const StaticString<_OTHER_MAX_SIZE>& other) {
-    *this += other.c_str();
-    return *this;
+    return _append(other.data_, other.len_);
   }
 
   StaticString& operator+=(const String& other) {
-    *this += other.c_str();
-    return *this;
+    return _append(other.c_str(), other.length());
+  }
+
+  StaticString& operator+=(StaticStringView other) {
+    return _append(other.data(), other.length());
   }
 
   StaticString& operator+=(unsigned long i) {
-    auto offset = length();
-    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%lu", i);
-    _check_snprintf_return_value(n);
-    return *this;
+    char buffer[24];
+    return _append(buffer, _format_uint(buffer, i));
   }
 
   StaticString& operator+=(int i) {
-    auto offset = length();
-    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%d", i);
-    _check_snprintf_return_value(n);
-    return *this;
+    char buffer[24];
+    size_t n = 0;
+    if (i < 0) {
+      buffer[n++] = '-';
+    }
+    // negate as unsigned, works for INT_MIN too
+    unsigned long u = i < 0 ? 0UL - static_cast<unsigned long>(i) : i;
+    n += _format_uint(buffer + n, u);
+    return _append(buffer, n);
   }
 
   StaticString& operator+=(const char* other) {
-    auto offset = length();
-    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%s", other);
-    _check_snprintf_return_value(n);
-    return *this;
+    return _append(other, strlen(other));
   }
 
-  StaticString& operator+=(char other) {
-    auto offset = length();
-    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%c", other);
-    _check_snprintf_return_value(n);
+  StaticString& operator+=(char other) { return _append(&other, 1); }
+
+  StaticString& operator=(const StaticString& other) {
+    if (this != &other) {
+      _assign(other.data_, other.len_);
+    }
     return *this;
   }
 
   StaticString& operator=(const char* other) {
     if (!other) {
+      len_ = 0;
       data_[0] = '\0';
       return *this;
     }
-    auto n = std::snprintf(data_, MAX_SIZE, "%s", other);
-    _check_snprintf_return_value(n);
+    _assign(other, strlen(other));
+    return *this;
+  }
+
+  StaticString& operator=(StaticStringView other) {
+    _assign(other.data(), other.length());
     return *this;
   }
 
   bool operator==(const char* other) const {
-    return std::strncmp(data_, other, MAX_SIZE) == 0;
+    return std::strncmp(data_, other, len_ + 1) == 0;
   }
 
   template <size_t _OTHER_MAX_SIZE>
-  bool operator==(const StaticString<_OTHER_MAX_SIZE> other) const {
-    return std::strncmp(data_, other.data_,
-                        std::min(MAX_SIZE,
-                                 StaticString<_OTHER_MAX_SIZE>::MAX_SIZE)) == 0;
+  bool operator==(const StaticString<_OTHER_MAX_SIZE>& other) const {
+    return len_ == other.len_ && std::memcmp(data_, other.data_, len_) == 0;
   }
 
  private:
   char data_[MAX_SIZE] = {'\0'};
-  void _check_snprintf_return_value(int value) const {
-    if (value >= MAX_SIZE)
+  size_t len_ = 0;
+
+  // src may overlap with data_ (e.g. s = s.c_str() + 1)
+  void _assign(const char* src, size_t n) {
+    len_ = _clamp(n, 0);
+    std::memmove(data_, src, len_);
+    data_[len_] = '\0';
+  }
+
+  StaticString& _append(const char* src, size_t n) {
+    size_t count = _clamp(n, len_);
+    std::memmove(data_ + len_, src, count);
+    len_ += count;
+    data_[len_] = '\0';
+    return *this;
+  }
+
+  // number of characters that fit after offset, logs if truncated
+  size_t _clamp(size_t n, size_t offset) const {
+    if (offset + n >= MAX_SIZE) {
       ESP_LOGE("static_string",
-               "buffer too small (size: %d, wanted: %d, content: %s)", MAX_SIZE,
-               value, data_);
-    else if (value < 0)
+               "buffer too small (size: %u, wanted: %u, content: %s)",
+               static_cast<unsigned>(MAX_SIZE),
+               static_cast<unsigned>(offset + n), data_);
+      return MAX_SIZE - 1 - offset;
+    }
+    return n;
+  }
+
+  static size_t _format_uint(char* buffer, unsigned long value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+      digits[n++] = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+    for (size_t i = 0; i < n; i++) {
+      buffer[i] = digits[n - 1 - i];
+    }
+    return n;
+  }
+
+  void _check_snprintf_return_value(int value) const {
+    if (value < 0)
       ESP_LOGE("static_string", "format failed");
+    else if (static_cast<size_t>(value) >= MAX_SIZE)
+      ESP_LOGE("static_string",
+               "buffer too small (size: %u, wanted: %d, content: %s)",
+               static_cast<unsigned>(MAX_SIZE), value, data_);
   }
 };
 
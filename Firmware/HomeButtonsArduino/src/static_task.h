@@ -0,0 +1,43 @@
+#ifndef HOMEBUTTONS_STATIC_TASK_H
+#define HOMEBUTTONS_STATIC_TASK_H
+
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// FreeRTOS task with its stack and control block allocated statically, as a
+// member of the owning object. STACK_SIZE is in bytes (ESP-IDF StackType_t).
+template <uint32_t STACK_SIZE>
+class StaticTask {
+ public:
+  StaticTask() = default;
+  StaticTask(const StaticTask&) = delete;
+  StaticTask& operator=(const StaticTask&) = delete;
+
+  // Does nothing if already started.
+  bool start(TaskFunction_t function, const char* name, void* param,
+             UBaseType_t priority) {
+    if (handle_ != nullptr) {
+      return false;
+    }
+    handle_ = xTaskCreateStatic(function, name, STACK_SIZE, param, priority,
+                                stack_, &tcb_);
+    return handle_ != nullptr;
+  }
+
+  bool started() const { return handle_ != nullptr; }
+  TaskHandle_t handle() const { return handle_; }
+  static constexpr uint32_t stack_size() { return STACK_SIZE; }
+  // minimum free stack so far (high-water mark) in bytes
+  uint32_t stack_free() const {
+    return handle_ != nullptr ? uxTaskGetStackHighWaterMark(handle_) : 0;
+  }
+
+ private:
+  StackType_t stack_[STACK_SIZE];
+  StaticTask_t tcb_;
+  TaskHandle_t handle_ = nullptr;
+};
+
+#endif  // HOMEBUTTONS_STATIC_TASK_H
@@ -0,0 +1,57 @@
+#include "timesync.h"
+
+#include <Arduino.h>
+#include <sys/time.h>
+
+#include <ctime>
+
+#include "esp_log.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+#include "config.h"
+#include "press_outbox.h"
+#include "sensor_log.h"
+#include "wake_schedule.h"
+
+namespace timesync {
+
+// 2023-01-01, anything earlier means the clock was never set
+static constexpr time_t MIN_VALID_TIME = 1672531200;
+
+static bool started = false;
+static uint32_t start_ms = 0;
+// clock before the last sync, to correct the samples taken with it
+static time_t unsynced_time = 0;
+static int64_t unsynced_timer_us = 0;
+
+static void _on_sync(struct timeval *tv) {
+  int64_t now_us = esp_timer_get_time();
+  time_t was = unsynced_time + (now_us - unsynced_timer_us) / 1000000;
+  int64_t offset = tv->tv_sec - was;
+  // periodic resyncs only correct the drift since this one
+  unsynced_time = tv->tv_sec;
+  unsynced_timer_us = now_us;
+  ESP_LOGI("timesync", "clock set, offset %lld s", offset);
+  sensor_log::clock_set(offset);
+  press_outbox::clock_set(offset);
+  wake_schedule::clock_set(offset);
+}
+
+void start() {
+  if (started || valid()) return;
+  started = true;
+  start_ms = millis();
+  unsynced_time = time(nullptr);
+  unsynced_timer_us = esp_timer_get_time();
+  sntp_set_time_sync_notification_cb(_on_sync);
+  configTime(0, 0, NTP_SERVER);
+}
+
+bool valid() { return time(nullptr) >= MIN_VALID_TIME; }
+
+bool settled() {
+  return valid() || (started && millis() - start_ms >= SNTP_TIMEOUT);
+}
+
+}  // namespace timesync
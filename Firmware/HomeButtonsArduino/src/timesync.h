@@ -0,0 +1,17 @@
+#ifndef HOMEBUTTONS_TIMESYNC_H
+#define HOMEBUTTONS_TIMESYNC_H
+
+// SNTP, for timestamping the batched sensor samples. The system time is kept
+// in deep sleep, so a sync is only needed once after boot.
+namespace timesync {
+
+// Starts SNTP if the clock was never set, call once connected.
+void start();
+// True if the clock has been set.
+bool valid();
+// True if the clock is set or start() was called more than SNTP_TIMEOUT ago.
+bool settled();
+
+}  // namespace timesync
+
+#endif  // HOMEBUTTONS_TIMESYNC_H
@@ -0,0 +1,273 @@
+#include "tls.h"
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/sha256.h>
+
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+
+#include "metrics.h"
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x48544C31;  // "HTL1"
+constexpr size_t FIRMWARE_ID_LEN = 8;
+
+// Without a pin only PSK suites, so the server can't fall back to an
+// unverified certificate.
+constexpr int PSK_SUITES[] = {MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+                              MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA256, 0};
+
+// Last session, only used by the network task.
+struct SessionCache {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  uint32_t server;
+  uint16_t length;  // 0 = none
+  uint8_t data[TLS_SESSION_SIZE];
+};
+
+RTC_NOINIT_ATTR SessionCache cache;
+bool initialized = false;
+
+void init_cache() {
+  if (initialized) return;
+  const uint8_t *id = esp_ota_get_app_description()->app_elf_sha256;
+  if (cache.magic != MAGIC ||
+      memcmp(cache.firmware_id, id, FIRMWARE_ID_LEN) != 0 ||
+      cache.length > TLS_SESSION_SIZE) {
+    cache.magic = MAGIC;
+    memcpy(cache.firmware_id, id, FIRMWARE_ID_LEN);
+    cache.length = 0;
+  }
+  initialized = true;
+}
+
+// FNV-1a, chained over several strings
+uint32_t hash(const char *str, uint32_t seed = 2166136261u) {
+  for (; *str != '\0'; str++) {
+    seed = (seed ^ static_cast<uint8_t>(*str)) * 16777619u;
+  }
+  return (seed ^ 0xFF) * 16777619u;  // separator
+}
+
+// Returns the number of bytes, 0 if empty or not valid hex.
+size_t from_hex(const char *hex, uint8_t *out, size_t max) {
+  size_t length = strlen(hex);
+  if (length % 2 != 0 || length / 2 > max) return 0;
+  for (size_t i = 0; i < length / 2; i++) {
+    char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+    char *end;
+    out[i] = strtoul(byte, &end, 16);
+    if (*end != '\0') return 0;
+  }
+  return length / 2;
+}
+
+int fill_random(void *, unsigned char *buf, size_t len) {
+  esp_fill_random(buf, len);
+  return 0;
+}
+
+}  // namespace
+
+bool TLSChannel::begin(int socket, const char *host, uint16_t port,
+                       const char *psk_identity, const char *psk,
+                       const char *pin) {
+  end();
+  compute_.start(power::CpuProfile::COMPUTE);
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  active_ = true;
+  socket_ = socket;
+  staged_ = 0;
+  resuming_ = false;
+  pin_ok_ = false;
+
+  size_t psk_length = from_hex(psk, psk_, sizeof(psk_));
+  has_pin_ = psk_length == 0 && from_hex(pin, pin_, sizeof(pin_)) == 32;
+  if (psk_length == 0 && !has_pin_) {
+    error("needs a PSK or a certificate pin");
+    end();
+    return false;
+  }
+
+  int ret = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT,
+                                        MBEDTLS_SSL_TRANSPORT_STREAM,
+                                        MBEDTLS_SSL_PRESET_DEFAULT);
+  mbedtls_ssl_conf_rng(&conf_, fill_random, nullptr);
+  if (ret == 0 && psk_length > 0) {
+    mbedtls_ssl_conf_ciphersuites(&conf_, PSK_SUITES);
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+    ret = mbedtls_ssl_conf_psk(
+        &conf_, psk_, psk_length,
+        reinterpret_cast<const unsigned char *>(psk_identity),
+        strlen(psk_identity));
+  } else if (ret == 0) {
+    // no CA, _verify() checks the pin
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_OPTIONAL);
+    mbedtls_ssl_conf_verify(&conf_, _verify, this);
+  }
+  if (ret == 0) ret = mbedtls_ssl_setup(&ssl_, &conf_);
+  if (ret == 0) ret = mbedtls_ssl_set_hostname(&ssl_, host);
+  if (ret != 0) {
+    error("setup failed: -0x%04x", -ret);
+    end();
+    return false;
+  }
+  mbedtls_ssl_set_bio(&ssl_, &socket_, _bio_send, _bio_recv, nullptr);
+
+  server_ = hash(pin, hash(psk, hash(psk_identity, hash(host) + port)));
+  _resume();
+  start_time_ = millis();
+  return true;
+}
+
+int TLSChannel::handshake() {
+  int ret = mbedtls_ssl_handshake(&ssl_);
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+  compute_.end();
+  if (ret != 0) {
+    warning("handshake failed: -0x%04x", -ret);
+    cache.length = 0;
+    return -1;
+  }
+  // a resumed session keeps the master secret
+  bool resumed = resuming_ && memcmp(ssl_.session->master, resume_master_,
+                                     sizeof(resume_master_)) == 0;
+  if (has_pin_ && !resumed && !pin_ok_) {
+    error("certificate doesn't match the pin");
+    cache.length = 0;
+    return -1;
+  }
+  uint32_t duration = millis() - start_time_;
+  info("handshake (%s) in %lu ms", resumed ? "resumed" : "full", duration);
+  metrics::observe(metrics::Histogram::TLS_HANDSHAKE_MS, duration);
+  metrics::inc(resumed ? metrics::Counter::TLS_RESUMED
+                       : metrics::Counter::TLS_FULL);
+  _save_session();  // the server may have sent a new ticket
+  return 1;
+}
+
+int TLSChannel::send(const uint8_t *data, size_t length, bool more) {
+  if (staged_ + length <= sizeof(stage_)) {
+    memcpy(&stage_[staged_], data, length);
+    staged_ += length;
+    if (more) return length;
+    int ret = _flush();
+    if (ret <= 0) {
+      // called again with the same data
+      staged_ -= length;
+      return ret;
+    }
+    return length;
+  }
+  int ret = _flush();
+  if (ret <= 0) return ret;
+  ret = mbedtls_ssl_write(&ssl_, data, length);
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  } else if (ret < 0) {
+    warning("write failed: -0x%04x", -ret);
+    return -1;
+  }
+  return ret;
+}
+
+int TLSChannel::receive(uint8_t *buf, size_t length) {
+  int ret = mbedtls_ssl_read(&ssl_, buf, length);
+  if (ret > 0) {
+    return ret;
+  } else if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+             ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  } else if (ret != 0 && ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+    warning("read failed: -0x%04x", -ret);
+  }
+  return -1;
+}
+
+void TLSChannel::end() {
+  compute_.end();
+  if (!active_) return;
+  mbedtls_ssl_close_notify(&ssl_);  // best effort, doesn't wait
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  active_ = false;
+}
+
+void TLSChannel::_resume() {
+  init_cache();
+  if (cache.length == 0 || cache.server != server_) return;
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  if (mbedtls_ssl_session_load(&session, cache.data, cache.length) == 0 &&
+      mbedtls_ssl_set_session(&ssl_, &session) == 0) {
+    memcpy(resume_master_, session.master, sizeof(resume_master_));
+    resuming_ = true;
+  }
+  mbedtls_ssl_session_free(&session);
+}
+
+void TLSChannel::_save_session() {
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  size_t length = 0;
+  cache.length = 0;
+  if (mbedtls_ssl_get_session(&ssl_, &session) == 0) {
+    if (mbedtls_ssl_session_save(&session, cache.data, sizeof(cache.data),
+                                 &length) == 0) {
+      cache.server = server_;
+      cache.length = length;
+    } else {
+      warning("session too large to keep (%u bytes)", length);
+    }
+  }
+  mbedtls_ssl_session_free(&session);
+}
+
+int TLSChannel::_flush() {
+  if (staged_ == 0) return 1;
+  int ret = mbedtls_ssl_write(&ssl_, stage_, staged_);
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  } else if (ret < 0) {
+    warning("write failed: -0x%04x", -ret);
+    return -1;
+  }
+  staged_ = 0;  // a record this small is written whole
+  return 1;
+}
+
+int TLSChannel::_verify(void *ctx, mbedtls_x509_crt *crt, int depth,
+                        uint32_t *flags) {
+  auto *self = static_cast<TLSChannel *>(ctx);
+  if (depth == 0) {
+    uint8_t digest[32];
+    mbedtls_sha256_ret(crt->raw.p, crt->raw.len, digest, 0);
+    self->pin_ok_ = memcmp(digest, self->pin_, sizeof(digest)) == 0;
+  }
+  *flags = 0;  // trust comes from the pin alone
+  return 0;
+}
+
+int TLSChannel::_bio_send(void *ctx, const unsigned char *buf, size_t len) {
+  int ret = lwip_send(*static_cast<int *>(ctx), buf, len, 0);
+  if (ret >= 0) return ret;
+  return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE
+                                                 : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int TLSChannel::_bio_recv(void *ctx, unsigned char *buf, size_t len) {
+  int ret = lwip_recv(*static_cast<int *>(ctx), buf, len, 0);
+  if (ret >= 0) return ret;  // 0 = closed
+  return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ
+                                                 : MBEDTLS_ERR_NET_RECV_FAILED;
+}
@@ -0,0 +1,61 @@
+#ifndef HOMEBUTTONS_TLS_H
+#define HOMEBUTTONS_TLS_H
+
+#include <mbedtls/ssl.h>
+
+#include "config.h"
+#include "logger.h"
+#include "power.h"
+
+// mbedTLS client on a connected non-blocking socket. The peer is trusted by
+// a pre-shared key or by the SHA-256 of its certificate (pinned, no CA). The
+// session is kept in RTC memory and resumed on the next wake, which skips the
+// key exchange and the certificate. The CPU runs at full speed from begin()
+// until the handshake is over.
+class TLSChannel : public Logger {
+ public:
+  TLSChannel() : Logger("TLS") {}
+  ~TLSChannel() { end(); }
+
+  // psk and pin are hex, either may be empty. The PSK identity is sent in
+  // the clear.
+  bool begin(int socket, const char *host, uint16_t port,
+             const char *psk_identity, const char *psk, const char *pin);
+  // 1 when done, 0 while in progress, -1 if it failed.
+  int handshake();
+  // Bytes sent or read, 0 if the socket isn't ready, -1 on error or close.
+  // more holds small writes back, so a packet goes out in one record.
+  int send(const uint8_t *data, size_t length, bool more);
+  int receive(uint8_t *buf, size_t length);
+  void end();
+
+ private:
+  static constexpr size_t STAGE_SIZE = 128;
+
+  bool active_ = false;
+  power::CpuRequest compute_;
+  int socket_ = -1;
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  uint32_t server_ = 0;  // hash of what the cached session is valid for
+  uint32_t start_time_ = 0;
+  bool resuming_ = false;
+  uint8_t resume_master_[48];
+  bool has_pin_ = false;
+  bool pin_ok_ = false;
+  uint8_t pin_[32];
+  uint8_t psk_[32];
+  uint8_t stage_[STAGE_SIZE];
+  size_t staged_ = 0;
+
+  void _resume();
+  void _save_session();
+  int _flush();
+
+  static int _verify(void *ctx, mbedtls_x509_crt *crt, int depth,
+                     uint32_t *flags);
+  static int _bio_send(void *ctx, const unsigned char *buf, size_t len);
+  static int _bio_recv(void *ctx, unsigned char *buf, size_t len);
+};
+
+#endif  // HOMEBUTTONS_TLS_H
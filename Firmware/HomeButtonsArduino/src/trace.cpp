@@ -0,0 +1,126 @@
+#include "trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include <atomic>
+#include <cstdio>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+namespace trace {
+
+struct Event {
+  uint32_t timestamp;  // us
+  const char* name;
+  EventType type;
+};
+
+struct TaskBuffer {
+  std::atomic<TaskHandle_t> task{nullptr};
+  char task_name[configMAX_TASK_NAME_LEN];
+  // written only by the owning task, the dump reads up to count
+  std::atomic<uint16_t> count{0};
+  Event events[TRACE_TASK_EVENTS];
+};
+
+static TaskBuffer buffers[TRACE_MAX_TASKS];
+static std::atomic<uint32_t> dropped{0};
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskBuffer* _get_buffer() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  for (auto& buffer : buffers) {
+    TaskHandle_t owner = buffer.task.load(std::memory_order_acquire);
+    if (owner == task) {
+      return &buffer;
+    }
+    if (owner == nullptr) {
+      break;
+    }
+  }
+  // first event of this task
+  TaskBuffer* claimed = nullptr;
+  taskENTER_CRITICAL(&lock);
+  for (auto& buffer : buffers) {
+    if (buffer.task.load(std::memory_order_relaxed) == nullptr) {
+      snprintf(buffer.task_name, sizeof(buffer.task_name), "%s",
+               pcTaskGetName(task));
+      buffer.task.store(task, std::memory_order_release);
+      claimed = &buffer;
+      break;
+    }
+  }
+  taskEXIT_CRITICAL(&lock);
+  return claimed;
+}
+
+void record(EventType type, const char* name) {
+  uint32_t timestamp = static_cast<uint32_t>(esp_timer_get_time());
+  TaskBuffer* buffer = _get_buffer();
+  if (buffer == nullptr) {
+    dropped++;
+    return;
+  }
+  uint16_t i = buffer->count.load(std::memory_order_relaxed);
+  if (i >= TRACE_TASK_EVENTS) {
+    dropped++;
+    return;
+  }
+  buffer->events[i] = {timestamp, name, type};
+  buffer->count.store(i + 1, std::memory_order_release);
+}
+
+static char _type_to_char(EventType type) {
+  switch (type) {
+    case EventType::BEGIN:
+      return 'B';
+    case EventType::END:
+      return 'E';
+    default:
+      return 'I';
+  }
+}
+
+size_t for_each_line(std::function<void(const char*)> fn) {
+  char line[64];
+  snprintf(line, sizeof(line), "HBT1 %u", dropped.load());
+  fn(line);
+  size_t total = 0;
+  for (uint8_t id = 0; id < TRACE_MAX_TASKS; id++) {
+    TaskBuffer& buffer = buffers[id];
+    if (buffer.task.load(std::memory_order_acquire) == nullptr) {
+      break;
+    }
+    snprintf(line, sizeof(line), "T %u %s", id, buffer.task_name);
+    fn(line);
+    uint16_t count = buffer.count.load(std::memory_order_acquire);
+    for (uint16_t i = 0; i < count; i++) {
+      const Event& event = buffer.events[i];
+      snprintf(line, sizeof(line), "%c %u %u %s", _type_to_char(event.type),
+               id, event.timestamp, event.name);
+      fn(line);
+    }
+    total += count;
+  }
+  return total;
+}
+
+void dump() {
+  for_each_line([](const char* line) { printf("TRACE %s\n", line); });
+}
+
+void clear() {
+  // tasks keep their buffers, only the events are dropped
+  for (auto& buffer : buffers) {
+    buffer.count.store(0, std::memory_order_release);
+  }
+  dropped = 0;
+}
+
+}  // namespace trace
+
+#endif  // TRACE_ENABLED
@@ -0,0 +1,75 @@
+#ifndef HOMEBUTTONS_TRACE_H
+#define HOMEBUTTONS_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Lightweight tracing of where the wake time goes. Build with -DTRACE_ENABLED,
+// otherwise all TRACE_* macros expand to nothing and the functions below are
+// empty.
+//
+// Events are timestamped with esp_timer (us since boot, wraps after ~71 min)
+// and stored in a fixed size buffer per task, so recording needs no lock.
+// Names must be string literals, only the pointer is stored. When a buffer is
+// full further events of that task are dropped.
+//
+// The dump is a list of lines, converted to Chrome trace JSON (chrome://tracing
+// or ui.perfetto.dev) by tools/trace_to_chrome.py:
+//   HBT1 <dropped events>
+//   T <task id> <task name>
+//   B|E|I <task id> <timestamp> <name>
+namespace trace {
+
+enum class EventType : uint8_t { BEGIN, END, INSTANT };
+
+#ifdef TRACE_ENABLED
+
+void record(EventType type, const char* name);
+
+// Calls fn for every line of the dump. Returns number of events.
+size_t for_each_line(std::function<void(const char*)> fn);
+// Prints the dump to the UART, lines prefixed with "TRACE ".
+void dump();
+// Drops all recorded events.
+void clear();
+
+class Scope {
+ public:
+  explicit Scope(const char* name) : name_(name) {
+    record(EventType::BEGIN, name);
+  }
+  ~Scope() { record(EventType::END, name_); }
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  const char* name_;
+};
+
+#else
+
+inline size_t for_each_line(std::function<void(const char*)>) { return 0; }
+inline void dump() {}
+inline void clear() {}
+
+#endif  // TRACE_ENABLED
+
+}  // namespace trace
+
+#ifdef TRACE_ENABLED
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+  trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_BEGIN(name) trace::record(trace::EventType::BEGIN, name)
+#define TRACE_END(name) trace::record(trace::EventType::END, name)
+#define TRACE_INSTANT(name) trace::record(trace::EventType::INSTANT, name)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#endif  // TRACE_ENABLED
+
+#endif  // HOMEBUTTONS_TRACE_H
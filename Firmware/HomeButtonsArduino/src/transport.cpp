@@ -0,0 +1,20 @@
+#include "transport.h"
+
+#include <cstring>
+
+#include "config.h"
+
+TransportType parse_server(const char *server, const char **host) {
+  size_t scheme_len = strlen(MQTTSN_SCHEME);
+  if (strncmp(server, MQTTSN_SCHEME, scheme_len) == 0) {
+    *host = server + scheme_len;
+    return TransportType::MQTT_SN;
+  }
+  scheme_len = strlen(MQTTS_SCHEME);
+  if (strncmp(server, MQTTS_SCHEME, scheme_len) == 0) {
+    *host = server + scheme_len;
+    return TransportType::MQTT_TLS;
+  }
+  *host = server;
+  return TransportType::MQTT;
+}
@@ -0,0 +1,66 @@
+#ifndef HOMEBUTTONS_TRANSPORT_H
+#define HOMEBUTTONS_TRANSPORT_H
+
+#include <Arduino.h>
+
+#include <functional>
+
+// Message transport below Network. The server setting selects it: a plain
+// host is MQTT over TCP, "mqtts://host" MQTT over TLS, "mqttsn://host" MQTT-SN
+// over UDP. All calls must come from the network task, Network answers
+// publishes_early() for the other tasks itself.
+class Transport {
+ public:
+  using Callback = std::function<void(const char *, uint8_t *, uint32_t)>;
+  // A message too large for the receive buffer, in pieces: topic, data,
+  // length and offset within the payload.
+  using StreamCallback =
+      std::function<void(const char *, const uint8_t *, uint32_t, uint32_t)>;
+  // Returns the topic's predefined MQTT-SN topic id, 0 if it has none.
+  using TopicIdLookup = std::function<uint16_t(const char *)>;
+
+  virtual ~Transport() = default;
+
+  virtual void set_server(const char *host, uint16_t port) = 0;
+  virtual void set_callback(Callback callback) = 0;
+  // Only MQTT over TCP streams, the others skip large messages.
+  virtual void set_stream_callback(StreamCallback callback) {}
+  // Starts connecting, connected() turns true once loop() got the broker's
+  // reply (MQTT) or blocks until connected or failed (MQTT-SN). user and
+  // password may be empty. Without a clean session the broker keeps the
+  // subscriptions and queues QoS 1 messages for the client while it's
+  // offline.
+  virtual bool connect(const char *client_id, const char *user,
+                       const char *password, bool clean_session) = 0;
+  virtual bool connected() = 0;
+  virtual void disconnect() = 0;
+  virtual void loop() = 0;
+  virtual bool publish(const char *topic, const char *payload,
+                       bool retained) = 0;
+  virtual bool subscribe(const char *topic) = 0;
+
+  // Sends without a session, before connect(). Returns false if the
+  // transport or the topic doesn't allow it.
+  virtual bool publish_early(const char *topic, const char *payload) {
+    return false;
+  }
+  virtual bool publishes_early(const char *topic) const { return false; }
+
+  // True if a connect without a clean session found no session on the
+  // broker, the subscriptions are gone. Only known for MQTT.
+  virtual bool session_lost() const { return false; }
+  // Publishes sent but not acknowledged yet.
+  virtual uint8_t in_flight() const { return 0; }
+  // MQTT bytes sent since the last call, without the IP, TCP/UDP and TLS
+  // overhead.
+  virtual uint32_t take_bytes_sent() { return 0; }
+
+  virtual const char *name() const = 0;
+};
+
+enum class TransportType { MQTT, MQTT_TLS, MQTT_SN };
+
+// Splits the server setting into transport and host.
+TransportType parse_server(const char *server, const char **host);
+
+#endif  // HOMEBUTTONS_TRANSPORT_H
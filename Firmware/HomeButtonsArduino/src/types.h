@@ -15,5 +15,12 @@ using DeviceName = StaticString<20>;
 using ButtonLabel = StaticString<BTN_LABEL_MAXLEN>;
 using MDIName = StaticString<48>;
 using UserMessage = StaticString<USER_MSG_MAXLEN>;
+using IconSource = StaticString<ICON_SOURCE_MAXLEN>;
+
+using MQTTServer = StaticString<48>;
+using MQTTUser = StaticString<64>;
+using MQTTPassword = StaticString<64>;
+using MQTTTopicPrefix = StaticString<64>;  // base topic, discovery prefix
+using TLSKey = StaticString<64>;  // hex, PSK or certificate SHA-256
 
 #endif  // HOMEBUTTONS_TYPES_H;
\ No newline at end of file
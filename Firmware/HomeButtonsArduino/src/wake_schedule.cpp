@@ -0,0 +1,137 @@
+#include "wake_schedule.h"
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+namespace wake_schedule {
+
+static constexpr uint32_t MAGIC = 0x48575331;  // "HWS1"
+static constexpr size_t FIRMWARE_ID_LEN = 8;
+static constexpr size_t NUM_SOURCES = static_cast<size_t>(Source::NUM);
+static constexpr int64_t US_PER_S = 1000000;
+
+static constexpr const char* SOURCE_NAMES[] = {"sensor", "scheduled",
+                                               "info_screen", "retry"};
+static_assert(sizeof(SOURCE_NAMES) / sizeof(SOURCE_NAMES[0]) == NUM_SOURCES,
+              "a source has no name");
+
+struct Schedule {
+  uint32_t magic;
+  uint8_t firmware_id[FIRMWARE_ID_LEN];
+  int64_t deadlines[NUM_SOURCES];  // system time in us, 0 = none
+};
+
+RTC_NOINIT_ATTR static Schedule schedule;
+static bool initialized = false;
+static bool due_[NUM_SOURCES] = {};
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// call with lock held
+static void _init() {
+  const uint8_t* id = esp_ota_get_app_description()->app_elf_sha256;
+  if (schedule.magic != MAGIC ||
+      memcmp(schedule.firmware_id, id, FIRMWARE_ID_LEN) != 0) {
+    memset(&schedule, 0, sizeof(schedule));
+    schedule.magic = MAGIC;
+    memcpy(schedule.firmware_id, id, FIRMWARE_ID_LEN);
+  }
+  initialized = true;
+}
+
+// keeps running in deep sleep
+static int64_t _now_us() {
+  timeval tv;
+  gettimeofday(&tv, nullptr);
+  return static_cast<int64_t>(tv.tv_sec) * US_PER_S + tv.tv_usec;
+}
+
+static int64_t& _deadline(Source source) {
+  return schedule.deadlines[static_cast<size_t>(source)];
+}
+
+void wakeup() {
+  int64_t now = _now_us();
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  int64_t horizon = now + WAKE_COALESCE_WINDOW * US_PER_S;
+  for (size_t i = 0; i < NUM_SOURCES; i++) {
+    int64_t& deadline = schedule.deadlines[i];
+    due_[i] = deadline != 0 && deadline <= horizon;
+    if (due_[i] && static_cast<Source>(i) != Source::SENSOR) deadline = 0;
+  }
+  taskEXIT_CRITICAL(&lock);
+  for (size_t i = 0; i < NUM_SOURCES; i++) {
+    if (due_[i]) ESP_LOGI("wake_schedule", "%s due", SOURCE_NAMES[i]);
+  }
+}
+
+bool due(Source source) { return due_[static_cast<size_t>(source)]; }
+
+void set(Source source, uint32_t delay_s) {
+  int64_t now = _now_us();
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  _deadline(source) = now + delay_s * US_PER_S;
+  due_[static_cast<size_t>(source)] = false;  // already handled
+  taskEXIT_CRITICAL(&lock);
+}
+
+void clear(Source source) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  _deadline(source) = 0;
+  taskEXIT_CRITICAL(&lock);
+}
+
+void every(Source source, uint32_t interval_s) {
+  int64_t now = _now_us();
+  int64_t interval = interval_s * US_PER_S;
+  int64_t window = WAKE_COALESCE_WINDOW * US_PER_S;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  int64_t& deadline = _deadline(source);
+  if (deadline != 0 && due(source)) deadline += interval;
+  // not set, behind by a whole interval, or too far ahead (interval changed)
+  if (deadline <= now || deadline > now + interval + window) {
+    deadline = now + interval;
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+uint64_t sleep_time_us() {
+  int64_t now = _now_us();
+  int64_t earliest = 0;
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (int64_t deadline : schedule.deadlines) {
+    if (deadline != 0 && (earliest == 0 || deadline < earliest)) {
+      earliest = deadline;
+    }
+  }
+  taskEXIT_CRITICAL(&lock);
+  if (earliest == 0) return 0;
+  // never longer than any source asks for, in case the clock jumped
+  int64_t sleep = std::min<int64_t>(earliest - now, WAKE_MAX_SLEEP * US_PER_S);
+  return std::max<int64_t>(sleep, US_PER_S);
+}
+
+void clock_set(int64_t offset_s) {
+  taskENTER_CRITICAL(&lock);
+  if (!initialized) _init();
+  for (int64_t& deadline : schedule.deadlines) {
+    if (deadline != 0) deadline += offset_s * US_PER_S;
+  }
+  taskEXIT_CRITICAL(&lock);
+}
+
+}  // namespace wake_schedule
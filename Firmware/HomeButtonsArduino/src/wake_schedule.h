@@ -0,0 +1,42 @@
+#ifndef HOMEBUTTONS_WAKE_SCHEDULE_H
+#define HOMEBUTTONS_WAKE_SCHEDULE_H
+
+#include <cstdint>
+
+// Deadlines of everything that wakes the device by timer, kept in RTC memory
+// as absolute system time. The timer is set to the earliest one, and on
+// every wake all deadlines within WAKE_COALESCE_WINDOW are handled together
+// in the same boot. Reset on power loss and when the firmware changes.
+namespace wake_schedule {
+
+enum class Source : uint8_t {
+  SENSOR,       // periodic, see every()
+  SCHEDULED,    // cmd/schedule_wakeup
+  INFO_SCREEN,  // back to the main screen
+  RETRY,        // connecting failed on a timer wake
+  NUM
+};
+
+// Finds the due deadlines, call once per boot. One-shot deadlines are
+// consumed, periodic ones only move on with every().
+void wakeup();
+// True if the deadline had passed (or was about to) at wakeup().
+bool due(Source source);
+
+// Replaces an earlier deadline of the source, also restarts a periodic one.
+void set(Source source, uint32_t delay_s);
+void clear(Source source);
+// Periodic: moves the deadline on by interval_s if it was due, keeping the
+// phase so errors don't add up over the wakes, or starts it over if it
+// fell behind or isn't set.
+void every(Source source, uint32_t interval_s);
+
+// Time to the earliest deadline, at least 1 s, 0 if there is none.
+uint64_t sleep_time_us();
+// Shifts the deadlines when the system clock is set, offset is the
+// correction applied to the clock.
+void clock_set(int64_t offset_s);
+
+}  // namespace wake_schedule
+
+#endif  // HOMEBUTTONS_WAKE_SCHEDULE_H
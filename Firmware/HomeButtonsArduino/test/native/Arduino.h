@@ -0,0 +1,41 @@
+#ifndef HOMEBUTTONS_NATIVE_ARDUINO_H
+#define HOMEBUTTONS_NATIVE_ARDUINO_H
+
+// The parts of the Arduino core used by the modules under test, for the
+// native environment. millis() is the host's monotonic clock, tests can move
+// it on with native_time::advance() instead of waiting.
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include "WString.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#define PROGMEM
+
+typedef bool boolean;
+
+namespace native_time {
+
+inline uint32_t offset_ms = 0;
+
+inline void advance(uint32_t ms) { offset_ms += ms; }
+
+}  // namespace native_time
+
+inline uint32_t millis() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+             .count() +
+         native_time::offset_ms;
+}
+
+inline void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#endif  // HOMEBUTTONS_NATIVE_ARDUINO_H
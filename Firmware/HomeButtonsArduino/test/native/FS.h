@@ -0,0 +1,71 @@
+#ifndef HOMEBUTTONS_NATIVE_FS_H
+#define HOMEBUTTONS_NATIVE_FS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Arduino-ESP32's file system API on files kept in memory, native_fs::files
+// by path. Writes only, what the modules under test need.
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+
+namespace native_fs {
+inline std::map<std::string, std::vector<uint8_t>> files;
+}  // namespace native_fs
+
+namespace fs {
+
+class File {
+ public:
+  File() = default;
+  explicit File(const std::string& path) : path_(path), open_(true) {}
+
+  explicit operator bool() const { return open_; }
+  size_t write(const uint8_t* data, size_t length) {
+    if (!open_) return 0;
+    auto& file = native_fs::files[path_];
+    file.insert(file.end(), data, data + length);
+    return length;
+  }
+  void close() { open_ = false; }
+  const char* path() const { return path_.c_str(); }
+
+ private:
+  std::string path_;
+  bool open_ = false;
+};
+
+class FS {
+ public:
+  bool begin(bool format_on_fail = false) { return true; }
+  void end() {}
+  bool exists(const char* path) { return native_fs::files.count(path) > 0; }
+  File open(const char* path, const char* mode = FILE_READ,
+            bool create = false) {
+    if (std::string(mode) == FILE_WRITE) {
+      native_fs::files[path].clear();
+    } else if (!exists(path)) {
+      return File();
+    }
+    return File(path);
+  }
+  bool remove(const char* path) { return native_fs::files.erase(path) > 0; }
+  bool rename(const char* from, const char* to) {
+    auto file = native_fs::files.find(from);
+    if (file == native_fs::files.end()) return false;
+    native_fs::files[to] = file->second;
+    native_fs::files.erase(from);
+    return true;
+  }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif  // HOMEBUTTONS_NATIVE_FS_H
@@ -0,0 +1,46 @@
+#ifndef HOMEBUTTONS_NATIVE_IPADDRESS_H
+#define HOMEBUTTONS_NATIVE_IPADDRESS_H
+
+#include <arpa/inet.h>
+
+#include <cstdint>
+
+// IPv4 address, stored in network byte order as on the ESP32.
+class IPAddress {
+ public:
+  IPAddress() = default;
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    bytes_[0] = a;
+    bytes_[1] = b;
+    bytes_[2] = c;
+    bytes_[3] = d;
+  }
+  explicit IPAddress(uint32_t address) { _set(address); }
+
+  bool fromString(const char* str) {
+    in_addr addr;
+    if (inet_pton(AF_INET, str, &addr) != 1) return false;
+    _set(addr.s_addr);
+    return true;
+  }
+
+  operator uint32_t() const {
+    uint32_t address;
+    __builtin_memcpy(&address, bytes_, sizeof(address));
+    return address;
+  }
+  bool operator==(const IPAddress& other) const {
+    return static_cast<uint32_t>(*this) == static_cast<uint32_t>(other);
+  }
+  bool operator!=(const IPAddress& other) const { return !(*this == other); }
+  uint8_t operator[](int index) const { return bytes_[index]; }
+
+ private:
+  uint8_t bytes_[4] = {};
+
+  void _set(uint32_t address) {
+    __builtin_memcpy(bytes_, &address, sizeof(address));
+  }
+};
+
+#endif  // HOMEBUTTONS_NATIVE_IPADDRESS_H
@@ -0,0 +1,8 @@
+#ifndef HOMEBUTTONS_NATIVE_SPIFFS_H
+#define HOMEBUTTONS_NATIVE_SPIFFS_H
+
+#include "FS.h"
+
+inline fs::FS SPIFFS;
+
+#endif  // HOMEBUTTONS_NATIVE_SPIFFS_H
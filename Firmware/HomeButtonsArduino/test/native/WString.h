@@ -0,0 +1,14 @@
+#ifndef HOMEBUTTONS_NATIVE_WSTRING_H
+#define HOMEBUTTONS_NATIVE_WSTRING_H
+
+#include <string>
+
+// Arduino String, as far as StaticString needs it.
+class String : public std::string {
+ public:
+  using std::string::string;
+  String() = default;
+  String(const std::string& str) : std::string(str) {}
+};
+
+#endif  // HOMEBUTTONS_NATIVE_WSTRING_H
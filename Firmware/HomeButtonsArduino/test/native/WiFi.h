@@ -0,0 +1,26 @@
+#ifndef HOMEBUTTONS_NATIVE_WIFI_H
+#define HOMEBUTTONS_NATIVE_WIFI_H
+
+#include <netdb.h>
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+// Name resolution only, the host is always online.
+class WiFiClass {
+ public:
+  bool hostByName(const char* host, IPAddress& ip) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0) return false;
+    ip = IPAddress(
+        reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(result);
+    return true;
+  }
+};
+
+inline WiFiClass WiFi;
+
+#endif  // HOMEBUTTONS_NATIVE_WIFI_H
@@ -0,0 +1,93 @@
+#ifndef HOMEBUTTONS_NATIVE_WIFIUDP_H
+#define HOMEBUTTONS_NATIVE_WIFIUDP_H
+
+#include <lwip/sockets.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "WiFi.h"
+
+// Arduino-ESP32's WiFiUDP on a host socket: one datagram is buffered for
+// sending and one for reading.
+class WiFiUDP {
+ public:
+  ~WiFiUDP() { stop(); }
+
+  uint8_t begin(uint16_t port) {
+    stop();
+    socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_ < 0) return 0;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (bind(socket_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+      stop();
+      return 0;
+    }
+    fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL, 0) | O_NONBLOCK);
+    return 1;
+  }
+
+  void stop() {
+    if (socket_ >= 0) close(socket_);
+    socket_ = -1;
+  }
+
+  int beginPacket(IPAddress ip, uint16_t port) {
+    if (socket_ < 0) return 0;
+    remote_ = {};
+    remote_.sin_family = AF_INET;
+    remote_.sin_port = htons(port);
+    remote_.sin_addr.s_addr = static_cast<uint32_t>(ip);
+    tx_length_ = 0;
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t length) {
+    length = std::min(length, sizeof(tx_) - tx_length_);
+    memcpy(tx_ + tx_length_, data, length);
+    tx_length_ += length;
+    return length;
+  }
+
+  int endPacket() {
+    return sendto(socket_, tx_, tx_length_, 0,
+                  reinterpret_cast<sockaddr*>(&remote_),
+                  sizeof(remote_)) == static_cast<ssize_t>(tx_length_);
+  }
+
+  int parsePacket() {
+    if (socket_ < 0) return 0;
+    sockaddr_in from = {};
+    socklen_t from_length = sizeof(from);
+    ssize_t n = recvfrom(socket_, rx_, sizeof(rx_), 0,
+                         reinterpret_cast<sockaddr*>(&from), &from_length);
+    if (n <= 0) return 0;
+    rx_length_ = n;
+    rx_pos_ = 0;
+    remote_ip_ = IPAddress(from.sin_addr.s_addr);
+    return n;
+  }
+
+  int read(uint8_t* buf, size_t length) {
+    length = std::min(length, rx_length_ - rx_pos_);
+    memcpy(buf, rx_ + rx_pos_, length);
+    rx_pos_ += length;
+    return length;
+  }
+
+  IPAddress remoteIP() const { return remote_ip_; }
+
+ private:
+  int socket_ = -1;
+  sockaddr_in remote_ = {};
+  uint8_t tx_[1460];
+  size_t tx_length_ = 0;
+  uint8_t rx_[1460];
+  size_t rx_length_ = 0;
+  size_t rx_pos_ = 0;
+  IPAddress remote_ip_;
+};
+
+#endif  // HOMEBUTTONS_NATIVE_WIFIUDP_H
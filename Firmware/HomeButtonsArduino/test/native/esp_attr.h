@@ -0,0 +1,10 @@
+#ifndef HOMEBUTTONS_NATIVE_ESP_ATTR_H
+#define HOMEBUTTONS_NATIVE_ESP_ATTR_H
+
+// RTC memory is ordinary memory on the host, zeroed at start like after a
+// power loss.
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+
+#endif  // HOMEBUTTONS_NATIVE_ESP_ATTR_H
@@ -0,0 +1,49 @@
+#ifndef HOMEBUTTONS_NATIVE_ESP_LOG_H
+#define HOMEBUTTONS_NATIVE_ESP_LOG_H
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+inline void esp_log_level_set(const char* tag, esp_log_level_t level) {}
+inline uint32_t esp_log_timestamp() { return 0; }
+
+// to stderr, Unity reports on stdout
+inline void esp_log_write(esp_log_level_t level, const char* tag,
+                          const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)                  \
+  do {                                                                \
+    if (level <= LOGGER_DEFAULT_LOG_LEVEL)                            \
+      esp_log_write(level, tag, "[%s] " format "\n", tag, ##__VA_ARGS__); \
+  } while (0)
+#define ESP_LOGE(tag, format, ...) \
+  ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) \
+  ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) \
+  ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) \
+  ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#define LOG_COLOR_E ""
+#define LOG_COLOR_W ""
+#define LOG_COLOR_I ""
+#define LOG_COLOR_D ""
+#define LOG_RESET_COLOR ""
+
+#endif  // HOMEBUTTONS_NATIVE_ESP_LOG_H
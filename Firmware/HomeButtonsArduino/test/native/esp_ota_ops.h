@@ -0,0 +1,16 @@
+#ifndef HOMEBUTTONS_NATIVE_ESP_OTA_OPS_H
+#define HOMEBUTTONS_NATIVE_ESP_OTA_OPS_H
+
+#include <cstdint>
+
+typedef struct {
+  char version[32];
+  uint8_t app_elf_sha256[32];
+} esp_app_desc_t;
+
+inline const esp_app_desc_t* esp_ota_get_app_description() {
+  static const esp_app_desc_t desc = {"native", {0x4e, 0x41, 0x54, 0x49}};
+  return &desc;
+}
+
+#endif  // HOMEBUTTONS_NATIVE_ESP_OTA_OPS_H
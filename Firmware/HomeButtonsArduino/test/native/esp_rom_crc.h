@@ -0,0 +1,19 @@
+#ifndef HOMEBUTTONS_NATIVE_ESP_ROM_CRC_H
+#define HOMEBUTTONS_NATIVE_ESP_ROM_CRC_H
+
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3) as the ROM computes it, chained over calls
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf,
+                                 uint32_t len) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+#endif  // HOMEBUTTONS_NATIVE_ESP_ROM_CRC_H
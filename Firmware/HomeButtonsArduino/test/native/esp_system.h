@@ -0,0 +1,14 @@
+#ifndef HOMEBUTTONS_NATIVE_ESP_SYSTEM_H
+#define HOMEBUTTONS_NATIVE_ESP_SYSTEM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+inline void esp_fill_random(void* buf, size_t len) {
+  static std::random_device random;
+  auto* bytes = static_cast<uint8_t*>(buf);
+  for (size_t i = 0; i < len; i++) bytes[i] = static_cast<uint8_t>(random());
+}
+
+#endif  // HOMEBUTTONS_NATIVE_ESP_SYSTEM_H
@@ -0,0 +1,18 @@
+#ifndef HOMEBUTTONS_NATIVE_MBEDTLS_SSL_H
+#define HOMEBUTTONS_NATIVE_MBEDTLS_SSL_H
+
+// Only the types TLSChannel's members need, the native environment builds
+// the fake channel in test/native/fakes.cpp instead of tls.cpp. native_tls
+// leaves this directory out and uses the host's mbedTLS.
+
+typedef struct mbedtls_ssl_context {
+  int unused;
+} mbedtls_ssl_context;
+
+typedef struct mbedtls_ssl_config {
+  int unused;
+} mbedtls_ssl_config;
+
+typedef struct mbedtls_x509_crt mbedtls_x509_crt;
+
+#endif  // HOMEBUTTONS_NATIVE_MBEDTLS_SSL_H
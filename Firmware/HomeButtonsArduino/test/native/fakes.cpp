@@ -0,0 +1,136 @@
+#include "fakes.h"
+
+#include <lwip/sockets.h>
+
+#include "log_ring.h"
+#include "mdi_helper.h"
+#include "tls.h"
+
+namespace fakes {
+
+static uint32_t counters[static_cast<size_t>(metrics::Counter::NUM)];
+static int32_t cpu[static_cast<size_t>(power::CpuProfile::NUM)];
+TLSScript tls;
+
+uint32_t counter(metrics::Counter counter) {
+  return counters[static_cast<size_t>(counter)];
+}
+
+int32_t cpu_requests(power::CpuProfile profile) {
+  return cpu[static_cast<size_t>(profile)];
+}
+
+void reset() {
+  for (auto& value : counters) value = 0;
+  for (auto& value : cpu) value = 0;
+  tls = TLSScript();
+  native_fs::files.clear();
+}
+
+std::string icon_path(const char* name, uint16_t size) {
+  return "/mdi/" + std::to_string(size) + "/" + name + ".bmp";
+}
+
+}  // namespace fakes
+
+namespace log_ring {
+
+uint8_t register_tag(const char* tag) { return NO_TAG; }
+void record(esp_log_level_t level, uint8_t tag, const char* fmt,
+            va_list args) {}
+
+}  // namespace log_ring
+
+namespace metrics {
+
+void inc(Counter counter, uint32_t n) {
+  fakes::counters[static_cast<size_t>(counter)] += n;
+}
+void set(Gauge gauge, int32_t value) {}
+void observe(Histogram histogram, uint32_t value) {}
+
+}  // namespace metrics
+
+namespace power {
+
+void request_cpu(CpuProfile profile) {
+  fakes::cpu[static_cast<size_t>(profile)]++;
+}
+void release_cpu(CpuProfile profile) {
+  fakes::cpu[static_cast<size_t>(profile)]--;
+}
+
+}  // namespace power
+
+static constexpr char UPLOAD_PATH[] = "/mdi/upload.tmp";
+
+MDIHelper::MDIHelper() : Logger("MDI") {}
+
+void MDIHelper::add_size(uint16_t size) {
+  if (num_sizes_ < MAX_NUM_SIZES) sizes_[num_sizes_++] = size;
+}
+
+bool MDIHelper::has_size(uint16_t size) const {
+  for (uint8_t i = 0; i < num_sizes_; ++i) {
+    if (sizes_[i] == size) return true;
+  }
+  return false;
+}
+
+const BuiltinIcon* MDIHelper::get_builtin(const char* name, uint16_t size) {
+  return nullptr;
+}
+
+File MDIHelper::begin_upload(size_t size) {
+  upload_active_ = true;
+  return SPIFFS.open(UPLOAD_PATH, FILE_WRITE, true);
+}
+
+bool MDIHelper::finish_upload(const char* name, uint16_t size) {
+  upload_active_ = false;
+  return SPIFFS.rename(UPLOAD_PATH, fakes::icon_path(name, size).c_str());
+}
+
+void MDIHelper::abort_upload() {
+  upload_active_ = false;
+  SPIFFS.remove(UPLOAD_PATH);
+}
+
+#ifndef NATIVE_MBEDTLS
+bool TLSChannel::begin(int socket, const char *host, uint16_t port,
+                       const char *psk_identity, const char *psk,
+                       const char *pin) {
+  fakes::tls.begins++;
+  socket_ = socket;
+  active_ = true;
+  compute_.start(power::CpuProfile::COMPUTE);
+  return true;
+}
+
+int TLSChannel::handshake() {
+  if (fakes::tls.handshake_steps > 0) {
+    fakes::tls.handshake_steps--;
+    return 0;
+  }
+  compute_.end();
+  return fakes::tls.handshake_ok ? 1 : -1;
+}
+
+int TLSChannel::send(const uint8_t *data, size_t length, bool more) {
+  int sent = lwip_send(socket_, data, length, 0);
+  if (sent >= 0) return sent;
+  return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+}
+
+int TLSChannel::receive(uint8_t *buf, size_t length) {
+  int n = lwip_recv(socket_, buf, length, MSG_DONTWAIT);
+  if (n > 0) return n;
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+}
+
+void TLSChannel::end() {
+  compute_.end();
+  active_ = false;
+  socket_ = -1;
+}
+#endif  // NATIVE_MBEDTLS
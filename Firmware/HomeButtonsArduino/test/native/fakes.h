@@ -0,0 +1,35 @@
+#ifndef HOMEBUTTONS_NATIVE_FAKES_H
+#define HOMEBUTTONS_NATIVE_FAKES_H
+
+#include <cstdint>
+#include <string>
+
+#include "metrics.h"
+#include "power.h"
+
+// Modules the native environment doesn't build, replaced by fakes that tests
+// can inspect: metrics and power record what they're given, TLSChannel
+// passes the bytes through unencrypted after a scripted handshake (the real
+// one with NATIVE_MBEDTLS, see env:native_tls), MDIHelper stores uploads in
+// native_fs::files.
+namespace fakes {
+
+uint32_t counter(metrics::Counter counter);
+// CPU profiles requested and not released yet
+int32_t cpu_requests(power::CpuProfile profile);
+
+struct TLSScript {
+  uint8_t handshake_steps = 0;  // handshake() calls returning 0 first
+  bool handshake_ok = true;
+  uint8_t begins = 0;  // counted by the fake
+};
+extern TLSScript tls;
+
+// where MDIHelper keeps a finished upload
+std::string icon_path(const char* name, uint16_t size);
+
+void reset();
+
+}  // namespace fakes
+
+#endif  // HOMEBUTTONS_NATIVE_FAKES_H
@@ -0,0 +1,28 @@
+#ifndef HOMEBUTTONS_NATIVE_FREERTOS_H
+#define HOMEBUTTONS_NATIVE_FREERTOS_H
+
+#include <cstdint>
+
+// Single task FreeRTOS for the native environment. Critical sections are
+// no-ops, queues and the tick count are simulated, see queue.h.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef void* TaskHandle_t;
+
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define taskENTER_CRITICAL(mux) (void)(mux)
+#define taskEXIT_CRITICAL(mux) (void)(mux)
+
+#endif  // HOMEBUTTONS_NATIVE_FREERTOS_H
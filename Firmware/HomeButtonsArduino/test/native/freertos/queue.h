@@ -0,0 +1,92 @@
+#ifndef HOMEBUTTONS_NATIVE_FREERTOS_QUEUE_H
+#define HOMEBUTTONS_NATIVE_FREERTOS_QUEUE_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+
+#include "FreeRTOS.h"
+
+// Queues on a simulated tick count: a task blocking on an empty queue moves
+// the time on to the end of its wait, or to the next interrupt scheduled
+// with native_rtos::at() if that comes first.
+namespace native_rtos {
+
+inline TickType_t tick = 0;
+inline std::multimap<TickType_t, std::function<void()>> interrupts;
+// times a blocked task was woken up
+inline uint32_t wakeups = 0;
+
+inline void at(TickType_t when, std::function<void()> fn) {
+  interrupts.emplace(when, fn);
+}
+
+inline void reset() {
+  tick = 0;
+  interrupts.clear();
+  wakeups = 0;
+}
+
+}  // namespace native_rtos
+
+typedef struct {
+  uint8_t* storage;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+} StaticQueue_t;
+
+inline TickType_t xTaskGetTickCount() { return native_rtos::tick; }
+
+inline QueueHandle_t xQueueCreateStatic(UBaseType_t length,
+                                        UBaseType_t item_size,
+                                        uint8_t* storage,
+                                        StaticQueue_t* queue) {
+  *queue = {storage, length, item_size, 0, 0};
+  return queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t handle, const void* item,
+                             TickType_t) {
+  auto* queue = static_cast<StaticQueue_t*>(handle);
+  if (queue->count == queue->length) return pdFALSE;
+  UBaseType_t tail = (queue->head + queue->count) % queue->length;
+  memcpy(queue->storage + tail * queue->item_size, item, queue->item_size);
+  queue->count++;
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t handle, void* item,
+                                TickType_t wait) {
+  auto* queue = static_cast<StaticQueue_t*>(handle);
+  TickType_t end = wait == portMAX_DELAY ? portMAX_DELAY
+                                         : native_rtos::tick + wait;
+  while (queue->count == 0) {
+    auto next = native_rtos::interrupts.begin();
+    if (next == native_rtos::interrupts.end() || next->first > end) {
+      // nothing would ever wake the task
+      if (end == portMAX_DELAY) return pdFALSE;
+      native_rtos::tick = end;
+      break;
+    }
+    native_rtos::tick = std::max(native_rtos::tick, next->first);
+    auto fn = next->second;
+    native_rtos::interrupts.erase(next);
+    fn();
+  }
+  if (wait > 0) native_rtos::wakeups++;
+  if (queue->count == 0) return pdFALSE;
+  memcpy(item, queue->storage + queue->head * queue->item_size,
+         queue->item_size);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+  return static_cast<StaticQueue_t*>(handle)->count;
+}
+
+#endif  // HOMEBUTTONS_NATIVE_FREERTOS_QUEUE_H
@@ -0,0 +1,15 @@
+#ifndef HOMEBUTTONS_NATIVE_FREERTOS_SEMPHR_H
+#define HOMEBUTTONS_NATIVE_FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  static int mutex;
+  return &mutex;
+}
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) {
+  return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+
+#endif  // HOMEBUTTONS_NATIVE_FREERTOS_SEMPHR_H
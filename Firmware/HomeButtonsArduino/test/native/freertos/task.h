@@ -0,0 +1,7 @@
+#ifndef HOMEBUTTONS_NATIVE_FREERTOS_TASK_H
+#define HOMEBUTTONS_NATIVE_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#endif  // HOMEBUTTONS_NATIVE_FREERTOS_TASK_H
@@ -0,0 +1,46 @@
+#ifndef HOMEBUTTONS_NATIVE_LWIP_SOCKETS_H
+#define HOMEBUTTONS_NATIVE_LWIP_SOCKETS_H
+
+// lwIP's BSD socket API is the host's.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+inline int lwip_socket(int domain, int type, int protocol) {
+  return socket(domain, type, protocol);
+}
+inline int lwip_connect(int s, const sockaddr* addr, socklen_t len) {
+  return connect(s, addr, len);
+}
+inline int lwip_close(int s) { return close(s); }
+inline ssize_t lwip_send(int s, const void* data, size_t size, int flags) {
+  return send(s, data, size, flags | MSG_NOSIGNAL);
+}
+inline ssize_t lwip_recv(int s, void* mem, size_t len, int flags) {
+  return recv(s, mem, len, flags);
+}
+inline int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset,
+                       fd_set* exceptset, timeval* timeout) {
+  return select(maxfdp1, readset, writeset, exceptset, timeout);
+}
+inline int lwip_fcntl(int s, int cmd, int val) { return fcntl(s, cmd, val); }
+inline int lwip_setsockopt(int s, int level, int optname, const void* optval,
+                           socklen_t optlen) {
+  return setsockopt(s, level, optname, optval, optlen);
+}
+inline int lwip_getsockopt(int s, int level, int optname, void* optval,
+                           socklen_t* optlen) {
+  return getsockopt(s, level, optname, optval, optlen);
+}
+
+#endif  // HOMEBUTTONS_NATIVE_LWIP_SOCKETS_H
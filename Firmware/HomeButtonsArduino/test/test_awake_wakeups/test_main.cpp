@@ -0,0 +1,181 @@
+#include <unity.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "config.h"
+#include "logger.h"
+#include "state_machine.h"
+
+// Benchmark of awake mode: how often the main task wakes up while idle, with
+// the idle state polled every 10 ms as it used to be and event driven as it
+// is now. Time is simulated, run() blocks on the queue of the native
+// FreeRTOS and the button presses are interrupts scheduled on its ticks.
+//
+// Only the main task is measured. The display and LED tasks, polled every
+// 50 and 100 ms before, now block until a command and add no idle wakeups.
+// The button task still polls every 20 ms (50 wakeups/s in both cases): the
+// edge interrupt misses presses in light sleep, so the pin level is sampled.
+
+class Bench;
+
+enum class BenchEvent : uint8_t { BUTTON_PRESS, IDLE_TICK };
+
+template <>
+struct StateMachineTraits<Bench> {
+  using Event = BenchEvent;
+  static constexpr UBaseType_t EVENT_QUEUE_SIZE = 4;
+  static constexpr uint8_t MAX_TIMERS = 2;
+};
+
+static constexpr TickType_t DURATION = pdMS_TO_TICKS(3600 * 1000);
+static constexpr TickType_t PRESS_INTERVAL = pdMS_TO_TICKS(45 * 1000 + 3);
+
+class InitState : public State<Bench> {
+ public:
+  using State<Bench>::State;
+  void entry() override;
+  const char* get_name() override { return "InitState"; }
+};
+
+// buttons and the redraw interval checked on every poll
+class PolledIdleState : public State<Bench> {
+ public:
+  using State<Bench>::State;
+  void entry() override;
+  void loop() override;
+  const char* get_name() override { return "PolledIdleState"; }
+
+ private:
+  TickType_t last_tick_ = 0;
+};
+
+// as AwakeModeIdleState: woken by the press event or the redraw timer
+class EventIdleState : public State<Bench> {
+ public:
+  using State<Bench>::State;
+  void entry() override;
+  bool on_event(BenchEvent event, uint32_t arg) override;
+  bool polled() const override { return false; }
+  const char* get_name() override { return "EventIdleState"; }
+};
+
+class Bench : public StateMachine<Bench, InitState, PolledIdleState,
+                                  EventIdleState>,
+              public Logger {
+ public:
+  explicit Bench(bool polled)
+      : StateMachine("Bench", *this), Logger("BENCH"), polled_(polled) {}
+
+  // from the button task, before the events there was only the flag
+  void press() {
+    press_pending_ = true;
+    press_time_ = xTaskGetTickCount();
+    if (!polled_) post(BenchEvent::BUTTON_PRESS);
+  }
+
+  void handle_press() {
+    if (!press_pending_) return;
+    press_pending_ = false;
+    presses_++;
+    max_latency_ = std::max(max_latency_, xTaskGetTickCount() - press_time_);
+  }
+
+  bool polled_;
+  bool press_pending_ = false;
+  TickType_t press_time_ = 0;
+  uint32_t presses_ = 0;
+  uint32_t ticks_ = 0;
+  TickType_t max_latency_ = 0;
+};
+
+void InitState::entry() {
+  if (sm().polled_) {
+    transition_to<PolledIdleState>();
+  } else {
+    transition_to<EventIdleState>();
+  }
+}
+
+void PolledIdleState::entry() { last_tick_ = xTaskGetTickCount(); }
+
+void PolledIdleState::loop() {
+  sm().handle_press();
+  if (xTaskGetTickCount() - last_tick_ >= AWAKE_REDRAW_INTERVAL) {
+    last_tick_ += AWAKE_REDRAW_INTERVAL;
+    sm().ticks_++;
+  }
+}
+
+void EventIdleState::entry() {
+  start_timer(BenchEvent::IDLE_TICK, AWAKE_REDRAW_INTERVAL, true);
+}
+
+bool EventIdleState::on_event(BenchEvent event, uint32_t arg) {
+  switch (event) {
+    case BenchEvent::BUTTON_PRESS:
+      sm().handle_press();
+      return true;
+    case BenchEvent::IDLE_TICK:
+      sm().ticks_++;
+      return true;
+  }
+  return false;
+}
+
+struct Result {
+  float wakeups_per_s;
+  uint32_t presses;
+  uint32_t ticks;
+  TickType_t max_latency;
+};
+
+static Result run_awake(bool polled) {
+  native_rtos::reset();
+  Bench bench(polled);
+  for (TickType_t t = PRESS_INTERVAL; t < DURATION; t += PRESS_INTERVAL) {
+    native_rtos::at(t, [&bench] { bench.press(); });
+  }
+  // as App::setup()
+  while (xTaskGetTickCount() < DURATION) {
+    bench.run(10, WDT_TIMEOUT_AWAKE * 1000 / 2);
+  }
+  Result result = {native_rtos::wakeups * 1000.0f / DURATION, bench.presses_,
+                   bench.ticks_, bench.max_latency_};
+  char line[96];
+  snprintf(line, sizeof(line),
+           "main task %s: %.2f wakeups/s, %u presses, up to %u ms until "
+           "handled",
+           polled ? "polled" : "event driven", result.wakeups_per_s,
+           result.presses, result.max_latency);
+  TEST_MESSAGE(line);
+  return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// same work done, at a fraction of the wakeups and without the poll delay
+void test_wakeups_per_second() {
+  Result polled = run_awake(true);
+  Result event_driven = run_awake(false);
+
+  const uint32_t expected_presses = (DURATION - 1) / PRESS_INTERVAL;
+  TEST_ASSERT_EQUAL(expected_presses, polled.presses);
+  TEST_ASSERT_EQUAL(expected_presses, event_driven.presses);
+  TEST_ASSERT_EQUAL(DURATION / AWAKE_REDRAW_INTERVAL, polled.ticks);
+  TEST_ASSERT_EQUAL(polled.ticks, event_driven.ticks);
+
+  TEST_ASSERT_TRUE(polled.wakeups_per_s >= 90);
+  // the redraw timer and the presses
+  TEST_ASSERT_TRUE(event_driven.wakeups_per_s <= 1.1f);
+  TEST_ASSERT_EQUAL(0, event_driven.max_latency);
+  TEST_ASSERT_GREATER_THAN(0, polled.max_latency);
+  TEST_ASSERT_LESS_OR_EQUAL(10, polled.max_latency);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_wakeups_per_second);
+  return UNITY_END();
+}
@@ -0,0 +1,193 @@
+#include <unity.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "icon_bundle.h"
+
+struct Icon {
+  std::string name;
+  uint16_t size;
+  std::string data;
+};
+
+static std::vector<uint8_t> make_bundle(const std::vector<Icon>& icons) {
+  std::vector<uint8_t> bundle;
+  auto append = [&bundle](const void* data, size_t length) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    bundle.insert(bundle.end(), bytes, bytes + length);
+  };
+  IconBundleHeader header = {};
+  memcpy(header.magic, IconBundleHeader::MAGIC, sizeof(header.magic));
+  header.count = icons.size();
+  append(&header, sizeof(header));
+  for (const auto& icon : icons) {
+    IconBundleEntry entry = {};
+    strncpy(entry.name, icon.name.c_str(), sizeof(entry.name));
+    entry.size = icon.size;
+    entry.length = icon.data.size();
+    append(&entry, sizeof(entry));
+  }
+  for (const auto& icon : icons) append(icon.data.data(), icon.data.size());
+  return bundle;
+}
+
+// what the callbacks saw
+struct Result {
+  std::vector<Icon> icons;
+  std::vector<std::string> ended;
+};
+
+static IconBundleParser make_parser(Result& result) {
+  return IconBundleParser(
+      [&result](const IconBundleEntry& entry) {
+        result.icons.push_back({entry.name, entry.size, ""});
+        return true;
+      },
+      [&result](const uint8_t* data, size_t len) {
+        result.icons.back().data.append(reinterpret_cast<const char*>(data),
+                                        len);
+        return true;
+      },
+      [&result](const IconBundleEntry& entry) {
+        result.ended.push_back(entry.name);
+        return true;
+      });
+}
+
+static const std::vector<Icon> ICONS = {
+    {"lightbulb", 64, std::string(300, 'a')},
+    {"fan", 48, std::string(10, 'b')},
+    {"empty", 64, ""},
+    {"garage-open", 96, std::string(1000, 'c')},
+};
+
+static void check_icons(const Result& result) {
+  TEST_ASSERT_EQUAL(ICONS.size(), result.icons.size());
+  TEST_ASSERT_EQUAL(ICONS.size(), result.ended.size());
+  for (size_t i = 0; i < ICONS.size(); i++) {
+    TEST_ASSERT_EQUAL_STRING(ICONS[i].name.c_str(),
+                             result.icons[i].name.c_str());
+    TEST_ASSERT_EQUAL_STRING(ICONS[i].name.c_str(), result.ended[i].c_str());
+    TEST_ASSERT_EQUAL(ICONS[i].size, result.icons[i].size);
+    TEST_ASSERT_TRUE(ICONS[i].data == result.icons[i].data);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_whole_bundle() {
+  std::vector<uint8_t> bundle = make_bundle(ICONS);
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_TRUE(parser.feed(bundle.data(), bundle.size()));
+  TEST_ASSERT_TRUE(parser.done());
+  TEST_ASSERT_EQUAL(ICONS.size(), parser.count());
+  check_icons(result);
+}
+
+// chunk boundaries anywhere in the header, the table and the icons
+void test_any_chunk_size() {
+  std::vector<uint8_t> bundle = make_bundle(ICONS);
+  for (size_t chunk : {1, 2, 3, 7, 8, 59, 60, 61, 256, 1024}) {
+    Result result;
+    IconBundleParser parser = make_parser(result);
+    for (size_t pos = 0; pos < bundle.size(); pos += chunk) {
+      size_t n = std::min(chunk, bundle.size() - pos);
+      TEST_ASSERT_TRUE(parser.feed(&bundle[pos], n));
+      TEST_ASSERT_TRUE(pos + n == bundle.size() || !parser.done());
+    }
+    TEST_ASSERT_TRUE(parser.done());
+    check_icons(result);
+  }
+}
+
+void test_empty_bundle() {
+  std::vector<uint8_t> bundle = make_bundle({});
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_TRUE(parser.feed(bundle.data(), bundle.size()));
+  TEST_ASSERT_TRUE(parser.done());
+  TEST_ASSERT_EQUAL(0, result.icons.size());
+}
+
+void test_truncated_bundle() {
+  std::vector<uint8_t> bundle = make_bundle(ICONS);
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_TRUE(parser.feed(bundle.data(), bundle.size() - 1));
+  TEST_ASSERT_FALSE(parser.done());
+  TEST_ASSERT_EQUAL(ICONS.size() - 1, result.ended.size());
+}
+
+void test_bad_magic() {
+  std::vector<uint8_t> bundle = make_bundle(ICONS);
+  bundle[3] = '2';
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_FALSE(parser.feed(bundle.data(), bundle.size()));
+  TEST_ASSERT_FALSE(parser.done());
+  TEST_ASSERT_EQUAL(0, result.icons.size());
+}
+
+void test_too_many_entries() {
+  std::vector<Icon> icons(IconBundleParser::MAX_ENTRIES + 1,
+                          {"icon", 64, "x"});
+  std::vector<uint8_t> bundle = make_bundle(icons);
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_FALSE(parser.feed(bundle.data(), bundle.size()));
+  TEST_ASSERT_EQUAL(0, result.icons.size());
+}
+
+void test_trailing_data() {
+  std::vector<uint8_t> bundle = make_bundle(ICONS);
+  bundle.push_back(0);
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_FALSE(parser.feed(bundle.data(), bundle.size()));
+}
+
+// a name without a terminator is cut at the end of the field
+void test_unterminated_name() {
+  std::vector<uint8_t> bundle = make_bundle({{"x", 64, "data"}});
+  IconBundleEntry* entry = reinterpret_cast<IconBundleEntry*>(
+      &bundle[sizeof(IconBundleHeader)]);
+  memset(entry->name, 'n', sizeof(entry->name));
+  Result result;
+  IconBundleParser parser = make_parser(result);
+  TEST_ASSERT_TRUE(parser.feed(bundle.data(), bundle.size()));
+  TEST_ASSERT_EQUAL(sizeof(entry->name) - 1, result.icons[0].name.size());
+}
+
+// a callback returning false stops the parser for good
+void test_callback_abort() {
+  std::vector<uint8_t> bundle = make_bundle(ICONS);
+  size_t begun = 0;
+  IconBundleParser parser(
+      [&begun](const IconBundleEntry& entry) {
+        return ++begun < 2;
+      },
+      [](const uint8_t* data, size_t len) { return true; },
+      [](const IconBundleEntry& entry) { return true; });
+  TEST_ASSERT_FALSE(parser.feed(bundle.data(), bundle.size()));
+  TEST_ASSERT_EQUAL(2, begun);
+  TEST_ASSERT_FALSE(parser.feed(bundle.data(), 1));
+  TEST_ASSERT_FALSE(parser.done());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_whole_bundle);
+  RUN_TEST(test_any_chunk_size);
+  RUN_TEST(test_empty_bundle);
+  RUN_TEST(test_truncated_bundle);
+  RUN_TEST(test_bad_magic);
+  RUN_TEST(test_too_many_entries);
+  RUN_TEST(test_trailing_data);
+  RUN_TEST(test_unterminated_name);
+  RUN_TEST(test_callback_abort);
+  return UNITY_END();
+}
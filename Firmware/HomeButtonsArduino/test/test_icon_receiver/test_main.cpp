@@ -0,0 +1,283 @@
+#include <unity.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <esp_rom_crc.h>
+
+#include "config.h"
+#include "fakes.h"
+#include "icon_receiver.h"
+#include "mqtt_helper.h"  // MQTT_BUFFER_SIZE
+
+// Pushed icons through a stand-in for the broker and the MQTT client, into
+// the fake MDIHelper's in-memory file system.
+
+using Bytes = std::vector<uint8_t>;
+using Result = IconReceiver::Result;
+
+static constexpr uint32_t BMP_HEADER_SIZE = 62;
+
+// Delivers each published chunk the way MQTTTransport hands it on: whole,
+// or if larger than its buffer to the stream callback in pieces, each with
+// its offset within the message.
+class Broker {
+ public:
+  explicit Broker(IconReceiver& receiver) : receiver_(receiver) {}
+
+  // the first error, or the result of the last piece
+  Result publish(const Bytes& message, uint32_t piece = MQTT_BUFFER_SIZE) {
+    Result result = Result::IN_PROGRESS;
+    for (uint32_t offset = 0; offset < message.size(); offset += piece) {
+      uint32_t length = std::min<uint32_t>(piece, message.size() - offset);
+      Result ret = receiver_.handle_chunk(&message[offset], length, offset);
+      if (result != Result::ERROR) result = ret;
+    }
+    return result;
+  }
+
+ private:
+  IconReceiver& receiver_;
+};
+
+struct Icon {
+  std::string name;
+  uint16_t size;
+  uint16_t width;
+  uint16_t height;
+  Bytes bitmap;
+};
+
+static Icon make_icon(const char* name, uint16_t size, uint16_t width,
+                      uint16_t height) {
+  Icon icon = {name, size, width, height, {}};
+  icon.bitmap.resize((width + 7) / 8 * height);
+  for (size_t i = 0; i < icon.bitmap.size(); i++) {
+    icon.bitmap[i] = static_cast<uint8_t>(i * 7 + i / 13);
+  }
+  return icon;
+}
+
+static Bytes chunk(const Icon& icon, uint32_t offset, uint32_t length) {
+  IconChunkHeader header = {};
+  memcpy(header.magic, IconChunkHeader::MAGIC, sizeof(header.magic));
+  strncpy(header.name, icon.name.c_str(), sizeof(header.name) - 1);
+  header.size = icon.size;
+  header.width = icon.width;
+  header.height = icon.height;
+  header.total_len = icon.bitmap.size();
+  header.offset = offset;
+  header.crc32 =
+      esp_rom_crc32_le(0, icon.bitmap.data(), icon.bitmap.size());
+  Bytes message(reinterpret_cast<uint8_t*>(&header),
+                reinterpret_cast<uint8_t*>(&header) + sizeof(header));
+  message.insert(message.end(), icon.bitmap.begin() + offset,
+                 icon.bitmap.begin() + offset + length);
+  return message;
+}
+
+static std::vector<Bytes> chunks(const Icon& icon, uint32_t length) {
+  std::vector<Bytes> messages;
+  for (uint32_t offset = 0; offset < icon.bitmap.size(); offset += length) {
+    messages.push_back(chunk(
+        icon, offset,
+        std::min<uint32_t>(length, icon.bitmap.size() - offset)));
+  }
+  return messages;
+}
+
+static bool stored(const Icon& icon) {
+  return native_fs::files.count(fakes::icon_path(icon.name.c_str(),
+                                                 icon.size)) > 0;
+}
+
+static bool upload_left() { return native_fs::files.size() > 0; }
+
+// BMP rows are padded to 4 bytes
+static void assert_stored(const Icon& icon) {
+  TEST_ASSERT_TRUE(stored(icon));
+  TEST_ASSERT_EQUAL(1, native_fs::files.size());
+  const Bytes& file =
+      native_fs::files[fakes::icon_path(icon.name.c_str(), icon.size)];
+  uint32_t stride = (icon.width + 7) / 8;
+  uint32_t row_size = (stride + 3) & ~3;
+  TEST_ASSERT_EQUAL(BMP_HEADER_SIZE + row_size * icon.height, file.size());
+  TEST_ASSERT_EQUAL('B', file[0]);
+  TEST_ASSERT_EQUAL('M', file[1]);
+  TEST_ASSERT_EQUAL(icon.width, file[18] | file[19] << 8);
+  for (uint32_t row = 0; row < icon.height; row++) {
+    const uint8_t* stored_row = &file[BMP_HEADER_SIZE + row * row_size];
+    TEST_ASSERT_EQUAL_MEMORY(&icon.bitmap[row * stride], stored_row, stride);
+    for (uint32_t pad = stride; pad < row_size; pad++) {
+      TEST_ASSERT_EQUAL(0, stored_row[pad]);
+    }
+  }
+}
+
+static MDIHelper* mdi;
+static IconReceiver* receiver;
+static Broker* broker;
+
+void setUp() {
+  fakes::reset();
+  mdi = new MDIHelper();
+  mdi->add_size(48);
+  mdi->add_size(100);
+  receiver = new IconReceiver(*mdi);
+  broker = new Broker(*receiver);
+}
+
+void tearDown() {
+  delete broker;
+  delete receiver;
+  delete mdi;
+}
+
+void test_single_chunk() {
+  Icon icon = make_icon("lightbulb", 48, 48, 48);
+  TEST_ASSERT_TRUE(broker->publish(chunk(icon, 0, icon.bitmap.size())) ==
+                   Result::DONE);
+  TEST_ASSERT_FALSE(receiver->busy());
+  TEST_ASSERT_EQUAL_STRING("lightbulb", receiver->name().c_str());
+  TEST_ASSERT_EQUAL(48, receiver->size());
+  assert_stored(icon);
+}
+
+// chunks end anywhere within a row, the padding goes in after each row
+void test_chunks_reassembled() {
+  Icon icon = make_icon("fan", 48, 45, 40);
+  std::vector<Bytes> messages = chunks(icon, 37);
+  for (size_t i = 0; i + 1 < messages.size(); i++) {
+    TEST_ASSERT_TRUE(broker->publish(messages[i]) == Result::IN_PROGRESS);
+    TEST_ASSERT_TRUE(receiver->busy());
+    TEST_ASSERT_FALSE(stored(icon));
+  }
+  TEST_ASSERT_TRUE(broker->publish(messages.back()) == Result::DONE);
+  assert_stored(icon);
+}
+
+// one chunk larger than the MQTT buffer, streamed in pieces
+void test_streamed_chunk() {
+  Icon icon = make_icon("garage", 100, 100, 100);
+  Bytes message = chunk(icon, 0, icon.bitmap.size());
+  TEST_ASSERT_TRUE(message.size() > MQTT_BUFFER_SIZE);
+  TEST_ASSERT_TRUE(broker->publish(message) == Result::DONE);
+  assert_stored(icon);
+
+  // pieces of any size, as long as the first holds the chunk header
+  fakes::reset();
+  TEST_ASSERT_TRUE(broker->publish(message, 301) == Result::DONE);
+  assert_stored(icon);
+  fakes::reset();
+  TEST_ASSERT_TRUE(broker->publish(message, sizeof(IconChunkHeader) - 1) ==
+                   Result::ERROR);
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+void test_chunk_out_of_order() {
+  Icon icon = make_icon("fan", 48, 48, 48);
+  std::vector<Bytes> messages = chunks(icon, 64);
+  TEST_ASSERT_TRUE(broker->publish(messages[0]) == Result::IN_PROGRESS);
+  TEST_ASSERT_TRUE(broker->publish(messages[2]) == Result::ERROR);
+  TEST_ASSERT_FALSE(receiver->busy());
+  TEST_ASSERT_FALSE(upload_left());
+  // the rest doesn't start a new upload
+  TEST_ASSERT_TRUE(broker->publish(messages[1]) == Result::ERROR);
+  TEST_ASSERT_TRUE(broker->publish(messages[3]) == Result::ERROR);
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+// a first chunk again restarts the upload
+void test_restarted() {
+  Icon icon = make_icon("fan", 48, 48, 48);
+  std::vector<Bytes> messages = chunks(icon, 64);
+  TEST_ASSERT_TRUE(broker->publish(messages[0]) == Result::IN_PROGRESS);
+  TEST_ASSERT_TRUE(broker->publish(messages[1]) == Result::IN_PROGRESS);
+  for (const Bytes& message : messages) {
+    broker->publish(message);
+  }
+  assert_stored(icon);
+}
+
+// the last chunk never comes, the upload times out
+void test_chunk_missing() {
+  Icon icon = make_icon("fan", 48, 48, 48);
+  std::vector<Bytes> messages = chunks(icon, 64);
+  for (size_t i = 0; i + 1 < messages.size(); i++) {
+    broker->publish(messages[i]);
+  }
+  TEST_ASSERT_TRUE(receiver->busy());
+  native_time::advance(ICON_UPLOAD_TIMEOUT + 1);
+  TEST_ASSERT_FALSE(receiver->busy());
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+// a piece of a streamed chunk that doesn't follow the last one
+void test_piece_out_of_order() {
+  Icon icon = make_icon("garage", 100, 100, 100);
+  Bytes message = chunk(icon, 0, icon.bitmap.size());
+  TEST_ASSERT_TRUE(receiver->handle_chunk(message.data(), 500) ==
+                   Result::IN_PROGRESS);
+  TEST_ASSERT_TRUE(receiver->handle_chunk(&message[600], 100, 600) ==
+                   Result::ERROR);
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+void test_oversize() {
+  // larger than its size
+  Icon wide = make_icon("wide", 48, 49, 48);
+  TEST_ASSERT_TRUE(broker->publish(chunk(wide, 0, wide.bitmap.size())) ==
+                   Result::ERROR);
+  // a size the device doesn't use
+  Icon large = make_icon("large", 64, 64, 64);
+  TEST_ASSERT_TRUE(broker->publish(chunk(large, 0, large.bitmap.size())) ==
+                   Result::ERROR);
+  // more data than the header's length
+  Icon icon = make_icon("fan", 48, 48, 48);
+  Bytes message = chunk(icon, 0, icon.bitmap.size());
+  message.push_back(0);
+  TEST_ASSERT_TRUE(broker->publish(message) == Result::ERROR);
+  // length not matching the dimensions
+  message = chunk(icon, 0, icon.bitmap.size());
+  reinterpret_cast<IconChunkHeader*>(message.data())->total_len += 1;
+  TEST_ASSERT_TRUE(broker->publish(message) == Result::ERROR);
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+void test_crc_mismatch() {
+  Icon icon = make_icon("fan", 48, 48, 48);
+  std::vector<Bytes> messages = chunks(icon, 100);
+  messages[1].back() ^= 0x01;
+  for (size_t i = 0; i + 1 < messages.size(); i++) {
+    TEST_ASSERT_TRUE(broker->publish(messages[i]) == Result::IN_PROGRESS);
+  }
+  TEST_ASSERT_TRUE(broker->publish(messages.back()) == Result::ERROR);
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+void test_not_a_chunk() {
+  Bytes message = {'H', 'B', 'I', '1'};
+  TEST_ASSERT_TRUE(broker->publish(message) == Result::ERROR);
+  Icon icon = make_icon("fan", 48, 48, 48);
+  message = chunk(icon, 0, icon.bitmap.size());
+  message[3] = '2';
+  TEST_ASSERT_TRUE(broker->publish(message) == Result::ERROR);
+  TEST_ASSERT_FALSE(upload_left());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_chunk);
+  RUN_TEST(test_chunks_reassembled);
+  RUN_TEST(test_streamed_chunk);
+  RUN_TEST(test_chunk_out_of_order);
+  RUN_TEST(test_restarted);
+  RUN_TEST(test_chunk_missing);
+  RUN_TEST(test_piece_out_of_order);
+  RUN_TEST(test_oversize);
+  RUN_TEST(test_crc_mismatch);
+  RUN_TEST(test_not_a_chunk);
+  return UNITY_END();
+}
@@ -0,0 +1,117 @@
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "builtin_icons.h"
+#include "config.h"
+#include "types.h"
+
+// Benchmark of an awake mode redraw of all buttons: the icons decoded again
+// on every redraw as before the cache, against the cache lookup that replaces
+// it (MDIHelper::_cache_slot(), one name compare per entry). Host timings,
+// only the ratio carries over to the ESP32-S2. Reading a stored BMP from
+// SPIFFS, also skipped on a hit, is far slower and not included.
+
+static constexpr uint16_t ICON_SIZE = 64;
+static constexpr size_t DECODED_SIZE = (ICON_SIZE + 7) / 8 * ICON_SIZE;
+static constexpr int REDRAWS = 20000;
+
+// ring, roughly what a line icon compresses to
+static std::vector<uint8_t> packbits_icon() {
+  std::vector<uint8_t> raw;
+  for (int y = 0; y < ICON_SIZE; y++) {
+    for (int x = 0; x < ICON_SIZE; x += 8) {
+      uint8_t byte = 0;
+      for (int bit = 0; bit < 8; bit++) {
+        int dx = x + bit - ICON_SIZE / 2;
+        int dy = y - ICON_SIZE / 2;
+        int r2 = dx * dx + dy * dy;
+        if (r2 < 28 * 28 && r2 > 22 * 22) byte |= 1 << bit;
+      }
+      raw.push_back(byte);
+    }
+  }
+  std::vector<uint8_t> packed;
+  size_t i = 0;
+  while (i < raw.size()) {
+    size_t run = 1;
+    while (i + run < raw.size() && run < 128 && raw[i + run] == raw[i]) run++;
+    if (run > 1) {
+      packed.push_back(static_cast<uint8_t>(1 - static_cast<int>(run)));
+      packed.push_back(raw[i]);
+    } else {
+      size_t start = i;
+      while (i + run < raw.size() && run < 128 &&
+             raw[i + run] != raw[i + run - 1]) {
+        run++;
+      }
+      packed.push_back(static_cast<uint8_t>(run - 1));
+      packed.insert(packed.end(), raw.begin() + start,
+                    raw.begin() + start + run);
+    }
+    i += run;
+  }
+  return packed;
+}
+
+static double ns_per_redraw(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double, std::nano>(d).count() / REDRAWS;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_redraw_decode_vs_cache() {
+  std::vector<uint8_t> data = packbits_icon();
+  BuiltinIcon icon = {"ring", ICON_SIZE, ICON_SIZE, ICON_SIZE,
+                      data.data(), data.size()};
+  uint8_t bitmaps[NUM_BUTTONS][DECODED_SIZE];
+  MDIName names[NUM_BUTTONS];
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    names[i] = "ring";
+    names[i] += static_cast<char>('a' + i);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int redraw = 0; redraw < REDRAWS; redraw++) {
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      TEST_ASSERT_TRUE(
+          builtin_icons::decode(icon, bitmaps[i], sizeof(bitmaps[i])));
+    }
+  }
+  double decode_ns = ns_per_redraw(std::chrono::steady_clock::now() - start);
+
+  uint32_t hits = 0;
+  start = std::chrono::steady_clock::now();
+  for (int redraw = 0; redraw < REDRAWS; redraw++) {
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      MDIName name = names[i];
+      for (const MDIName& entry : names) {
+        if (entry == name.c_str()) {
+          hits++;
+          break;
+        }
+      }
+    }
+  }
+  double cached_ns = ns_per_redraw(std::chrono::steady_clock::now() - start);
+
+  char line[128];
+  snprintf(line, sizeof(line),
+           "%u icons of %ux%u, %u bytes packed: decoded %.0f ns, cached %.0f "
+           "ns per redraw (%.0fx)",
+           NUM_BUTTONS, ICON_SIZE, ICON_SIZE, static_cast<unsigned>(data.size()),
+           decode_ns, cached_ns, decode_ns / cached_ns);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_EQUAL(REDRAWS * NUM_BUTTONS, hits);
+  TEST_ASSERT_TRUE(cached_ns < decode_ns);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_redraw_decode_vs_cache);
+  return UNITY_END();
+}
@@ -0,0 +1,83 @@
+#include <unity.h>
+
+#include "icon_source.h"
+
+struct Rewrite {
+  bool https;
+  IconSource host;
+  IconSource http_url;
+};
+
+static Rewrite rewrite(const char* source) {
+  Rewrite result;
+  result.https =
+      icon_source::to_plain_http(IconSource(source), result.host,
+                                 result.http_url);
+  return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_host_only() {
+  Rewrite r = rewrite("https://192.168.1.10/");
+  TEST_ASSERT_TRUE(r.https);
+  TEST_ASSERT_EQUAL_STRING("192.168.1.10", r.host.c_str());
+  TEST_ASSERT_EQUAL_STRING("http://192.168.1.10/", r.http_url.c_str());
+}
+
+void test_no_path() {
+  Rewrite r = rewrite("https://icons.lan");
+  TEST_ASSERT_TRUE(r.https);
+  TEST_ASSERT_EQUAL_STRING("icons.lan", r.host.c_str());
+  TEST_ASSERT_EQUAL_STRING("http://icons.lan", r.http_url.c_str());
+}
+
+// an explicit port is kept, the mirror may only listen there
+void test_port_kept() {
+  Rewrite r = rewrite("https://192.168.1.10:8443/mdi/");
+  TEST_ASSERT_TRUE(r.https);
+  TEST_ASSERT_EQUAL_STRING("192.168.1.10", r.host.c_str());
+  TEST_ASSERT_EQUAL_STRING("http://192.168.1.10:8443/mdi/",
+                           r.http_url.c_str());
+}
+
+void test_port_no_path() {
+  Rewrite r = rewrite("https://icons.lan:8080");
+  TEST_ASSERT_TRUE(r.https);
+  TEST_ASSERT_EQUAL_STRING("icons.lan", r.host.c_str());
+  TEST_ASSERT_EQUAL_STRING("http://icons.lan:8080", r.http_url.c_str());
+}
+
+// a colon after the host is part of the path
+void test_colon_in_path() {
+  Rewrite r = rewrite("https://icons.lan/a:b/");
+  TEST_ASSERT_TRUE(r.https);
+  TEST_ASSERT_EQUAL_STRING("icons.lan", r.host.c_str());
+  TEST_ASSERT_EQUAL_STRING("http://icons.lan/a:b/", r.http_url.c_str());
+}
+
+void test_not_https() {
+  IconSource host("unchanged");
+  IconSource http_url("unchanged");
+  TEST_ASSERT_FALSE(icon_source::to_plain_http(
+      IconSource("http://192.168.1.10:8080/"), host, http_url));
+  TEST_ASSERT_FALSE(
+      icon_source::to_plain_http(IconSource("ftp://icons.lan/"), host,
+                                 http_url));
+  TEST_ASSERT_FALSE(
+      icon_source::to_plain_http(IconSource("https:/"), host, http_url));
+  TEST_ASSERT_EQUAL_STRING("unchanged", host.c_str());
+  TEST_ASSERT_EQUAL_STRING("unchanged", http_url.c_str());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_host_only);
+  RUN_TEST(test_no_path);
+  RUN_TEST(test_port_kept);
+  RUN_TEST(test_port_no_path);
+  RUN_TEST(test_colon_in_path);
+  RUN_TEST(test_not_https);
+  return UNITY_END();
+}
@@ -0,0 +1,100 @@
+#include <ArduinoJson.h>
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "discovery_templates.h"
+#include "json_template.h"
+
+// Benchmark of a discovery config, the temperature sensor with the history
+// attributes: rendered from the templates straight into the payload, against
+// the StaticJsonDocument it was built in before, serialized into a buffer and
+// copied into the payload. Host timings, only the ratio carries over.
+
+// as PayloadType and MQTT_PYLD_SIZE in mqtt_helper.h
+static constexpr size_t PYLD_SIZE = 512;
+using Payload = StaticString<PYLD_SIZE>;
+using Device = StaticString<256>;
+
+static constexpr int RUNS = 20000;
+static constexpr char UNIQUE_ID[] = "hbtn-a1b2c3";
+
+static void render_template(Payload& conf) {
+  Device device;
+  json_template::render(device, DEVICE_SHORT, {UNIQUE_ID});
+  json_template::render(conf, SENSOR_CONF,
+                        {"Temperature", UNIQUE_ID, "temperature",
+                         "homebuttons/a1b2c3/temperature", "temperature",
+                         "\xC2\xB0" "C", 3660});
+  json_template::render(conf, HISTORY_ATTRIBUTES,
+                        {"homebuttons/a1b2c3/sensor_history", "temperature",
+                         "temp"});
+  json_template::render(conf, DEVICE_END, {device});
+}
+
+static void render_document(Payload& conf) {
+  StaticJsonDocument<128> device;
+  device["ids"][0] = UNIQUE_ID;
+  StaticJsonDocument<PYLD_SIZE> doc;
+  doc["name"] = "Temperature";
+  doc["uniq_id"] = std::string(UNIQUE_ID) + "_temperature";
+  doc["stat_t"] = "homebuttons/a1b2c3/temperature";
+  doc["dev_cla"] = "temperature";
+  doc["unit_of_meas"] = "\xC2\xB0" "C";
+  doc["exp_aft"] = 3660;
+  doc["json_attr_t"] = "homebuttons/a1b2c3/sensor_history";
+  doc["json_attr_tpl"] =
+      "{{ {'time': value_json.t, 'temperature': value_json.temp} | tojson }}";
+  doc["dev"] = device;
+  char buffer[PYLD_SIZE];
+  serializeJson(doc, buffer, sizeof(buffer));
+  conf = buffer;
+}
+
+template <typename Render>
+static double ns_per_config(Render render, Payload& out) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < RUNS; i++) {
+    Payload conf;
+    render(conf);
+    if (i == 0) out = conf;
+  }
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         RUNS;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_template_vs_document() {
+  Payload from_template;
+  Payload from_document;
+  double template_ns = ns_per_config(render_template, from_template);
+  double document_ns = ns_per_config(render_document, from_document);
+  TEST_ASSERT_EQUAL_STRING(from_document.c_str(), from_template.c_str());
+
+  char line[160];
+  snprintf(line, sizeof(line),
+           "%u bytes: template %.0f ns, ArduinoJson %d.%d.%d %.0f ns (%.1fx), "
+           "stack %u vs %u bytes",
+           static_cast<unsigned>(from_template.length()), template_ns,
+           ARDUINOJSON_VERSION_MAJOR, ARDUINOJSON_VERSION_MINOR,
+           ARDUINOJSON_VERSION_REVISION, document_ns,
+           document_ns / template_ns,
+           static_cast<unsigned>(sizeof(Device)),
+           static_cast<unsigned>(sizeof(StaticJsonDocument<128>) +
+                                 sizeof(StaticJsonDocument<PYLD_SIZE>) +
+                                 PYLD_SIZE));
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(template_ns < document_ns);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_template_vs_document);
+  return UNITY_END();
+}
@@ -0,0 +1,276 @@
+#include <ArduinoJson.h>
+#include <unity.h>
+
+#include <string>
+
+#include "discovery_templates.h"
+#include "json_template.h"
+
+// The discovery payloads as they were built with ArduinoJson, before the
+// templates, must come out the same byte for byte.
+
+// the version the firmware is built with (platformio.ini), a different one
+// may escape differently
+static_assert(ARDUINOJSON_VERSION_MAJOR == 6 && ARDUINOJSON_VERSION_MINOR == 20,
+              "compare with ArduinoJson 6.20");
+
+using Payload = StaticString<512>;
+using Device = StaticString<256>;
+using Doc = StaticJsonDocument<1024>;
+
+static constexpr char UNIQUE_ID[] = "hbtn-a1b2c3";
+// everything ArduinoJson escapes, and some it doesn't
+static constexpr char NAME[] = "Living \"room\" \\ 1\n\t\b\f\r / \xC2\xB0 '";
+static constexpr char TOPIC[] = "homebuttons/Living \"room\"/button_1";
+
+static std::string serialized(const JsonDocument& doc) {
+  std::string out;
+  serializeJson(doc, out);
+  return out;
+}
+
+template <size_t SIZE>
+static void assert_same(const JsonDocument& expected,
+                        const StaticString<SIZE>& actual) {
+  std::string json = serialized(expected);
+  TEST_ASSERT_EQUAL_STRING(json.c_str(), actual.c_str());
+}
+
+static Device device_full() {
+  Device device;
+  json_template::render(device, DEVICE_FULL,
+                        {UNIQUE_ID, "Home Buttons", NAME, "v2.3.0", "2.2",
+                         "Planinsek Industries"});
+  return device;
+}
+
+static void device_full_doc(JsonDocument& doc) {
+  doc["ids"][0] = UNIQUE_ID;
+  doc["mdl"] = "Home Buttons";
+  doc["name"] = NAME;
+  doc["sw"] = "v2.3.0";
+  doc["hw"] = "2.2";
+  doc["mf"] = "Planinsek Industries";
+}
+
+static Device device_short() {
+  Device device;
+  json_template::render(device, DEVICE_SHORT, {UNIQUE_ID});
+  return device;
+}
+
+static void device_short_doc(JsonDocument& doc) { doc["ids"][0] = UNIQUE_ID; }
+
+void setUp() {}
+void tearDown() {}
+
+void test_device() {
+  Doc full;
+  device_full_doc(full);
+  assert_same(full, device_full());
+  Doc short_;
+  device_short_doc(short_);
+  assert_same(short_, device_short());
+}
+
+void test_trigger() {
+  for (bool full : {true, false}) {
+    Payload conf;
+    json_template::render(conf, TRIGGER_CONF,
+                          {TOPIC, "_double", "PRESS", "button_double_press", 1});
+    json_template::render(conf, DEVICE_END,
+                          {full ? device_full() : device_short()});
+
+    Doc expected;
+    expected["atype"] = "trigger";
+    expected["t"] = std::string(TOPIC) + "_double";
+    expected["pl"] = "PRESS";
+    expected["type"] = "button_double_press";
+    expected["stype"] = "button_1";
+    StaticJsonDocument<256> device;
+    full ? device_full_doc(device) : device_short_doc(device);
+    expected["dev"] = device;
+    assert_same(expected, conf);
+  }
+}
+
+void test_sensor() {
+  for (bool combined : {false, true}) {
+    Payload conf;
+    json_template::render(conf, SENSOR_CONF,
+                          {"Temperature", UNIQUE_ID, "temperature",
+                           combined ? "hb/sensors" : "hb/temperature",
+                           "temperature", "\xC2\xB0" "C", 3660});
+    if (combined) json_template::render(conf, VALUE_TEMPLATE, {"temp"});
+    json_template::render(conf, HISTORY_ATTRIBUTES,
+                          {"hb/sensor_history", "temperature", "temp"});
+    json_template::render(conf, DEVICE_END, {device_short()});
+
+    Doc expected;
+    expected["name"] = "Temperature";
+    expected["uniq_id"] = std::string(UNIQUE_ID) + "_temperature";
+    expected["stat_t"] = combined ? "hb/sensors" : "hb/temperature";
+    expected["dev_cla"] = "temperature";
+    expected["unit_of_meas"] = "\xC2\xB0" "C";
+    expected["exp_aft"] = 3660;
+    if (combined) expected["val_tpl"] = "{{ value_json.temp }}";
+    expected["json_attr_t"] = "hb/sensor_history";
+    expected["json_attr_tpl"] =
+        "{{ {'time': value_json.t, 'temperature': value_json.temp} | tojson "
+        "}}";
+    StaticJsonDocument<256> device;
+    device_short_doc(device);
+    expected["dev"] = device;
+    assert_same(expected, conf);
+  }
+}
+
+void test_number() {
+  for (bool unit : {true, false}) {
+    Payload conf;
+    json_template::render(conf, NUMBER_CONF,
+                          {"Sensor interval", UNIQUE_ID, "sensor_interval",
+                           "hb/cmd/sensor_interval", "hb/sensor_interval"});
+    if (unit) json_template::render(conf, UNIT, {"min"});
+    json_template::render(conf, NUMBER_RANGE,
+                          {1, 30, "slider", "mdi:timer-sand"});
+    json_template::render(conf, DEVICE_END, {device_short()});
+
+    Doc expected;
+    expected["name"] = "Sensor interval";
+    expected["uniq_id"] = std::string(UNIQUE_ID) + "_sensor_interval";
+    expected["cmd_t"] = "hb/cmd/sensor_interval";
+    expected["stat_t"] = "hb/sensor_interval";
+    if (unit) expected["unit_of_meas"] = "min";
+    expected["min"] = 1;
+    expected["max"] = 30;
+    expected["mode"] = "slider";
+    expected["ic"] = "mdi:timer-sand";
+    expected["ret"] = "true";
+    StaticJsonDocument<256> device;
+    device_short_doc(device);
+    expected["dev"] = device;
+    assert_same(expected, conf);
+  }
+}
+
+void test_text() {
+  Payload conf;
+  json_template::render(conf, TEXT_CONF,
+                        {"Button 1 label", UNIQUE_ID, "button_1_label",
+                         "hb/cmd/btn_1_label", "hb/btn_1_label", 56,
+                         "mdi:numeric-1-box"});
+  json_template::render(conf, DEVICE_END, {device_short()});
+
+  Doc expected;
+  expected["name"] = "Button 1 label";
+  expected["uniq_id"] = std::string(UNIQUE_ID) + "_button_1_label";
+  expected["cmd_t"] = "hb/cmd/btn_1_label";
+  expected["stat_t"] = "hb/btn_1_label";
+  expected["max"] = 56;
+  expected["ic"] = "mdi:numeric-1-box";
+  expected["ret"] = "true";
+  StaticJsonDocument<256> device;
+  device_short_doc(device);
+  expected["dev"] = device;
+  assert_same(expected, conf);
+}
+
+void test_diagnostic() {
+  static constexpr char VALUE[] =
+      "{{ (value_json.wake_ms[1] / [value_json.wake_ms[0], 1] | max) | "
+      "round(0) }}";
+  for (const char* unit : {"ms", static_cast<const char*>(nullptr)}) {
+    Payload conf;
+    json_template::render(conf, DIAGNOSTIC_CONF,
+                          {"Average wake time", UNIQUE_ID, "avg_wake_time",
+                           "hb/diagnostics/h0", VALUE});
+    if (unit != nullptr) json_template::render(conf, UNIT, {unit});
+    json_template::render(conf, DIAGNOSTIC_CLASS, {"measurement"});
+    json_template::render(conf, DEVICE_END, {device_short()});
+
+    Doc expected;
+    expected["name"] = "Average wake time";
+    expected["uniq_id"] = std::string(UNIQUE_ID) + "_avg_wake_time";
+    expected["stat_t"] = "hb/diagnostics/h0";
+    expected["val_tpl"] = VALUE;
+    if (unit != nullptr) expected["unit_of_meas"] = unit;
+    expected["stat_cla"] = "measurement";
+    expected["ent_cat"] = "diagnostic";
+    StaticJsonDocument<256> device;
+    device_short_doc(device);
+    expected["dev"] = device;
+    assert_same(expected, conf);
+  }
+}
+
+void test_switch() {
+  for (bool config : {true, false}) {
+    Payload conf;
+    json_template::render(conf, SWITCH_CONF,
+                          {"Awake mode", UNIQUE_ID, "awake_mode",
+                           "hb/cmd/awake_mode", "hb/awake_mode",
+                           "mdi:coffee"});
+    if (config) {
+      json_template::render(conf, CONFIG_CATEGORY);
+    } else {
+      json_template::render(conf, AVAILABILITY, {"hb/awake_mode_avlb"});
+    }
+    json_template::render(conf, DEVICE_END, {device_short()});
+
+    Doc expected;
+    expected["name"] = "Awake mode";
+    expected["uniq_id"] = std::string(UNIQUE_ID) + "_awake_mode";
+    expected["cmd_t"] = "hb/cmd/awake_mode";
+    expected["stat_t"] = "hb/awake_mode";
+    expected["ic"] = "mdi:coffee";
+    expected["ret"] = "true";
+    if (config) {
+      expected["ent_cat"] = "config";
+    } else {
+      expected["avty_t"] = "hb/awake_mode_avlb";
+    }
+    StaticJsonDocument<256> device;
+    device_short_doc(device);
+    expected["dev"] = device;
+    assert_same(expected, conf);
+  }
+}
+
+// every printable character and the named escapes, one at a time
+void test_escaping() {
+  std::string chars = "\b\f\n\r\t";
+  for (char c = 0x20; c < 0x7F; c++) chars += c;
+  for (char c : chars) {
+    char str[] = {'a', c, 'b', '\0'};
+    Payload conf;
+    json_template::render(conf, R"({"v":"$"})", {str});
+    Doc expected;
+    expected["v"] = str;
+    assert_same(expected, conf);
+  }
+}
+
+void test_numbers() {
+  for (int number : {0, 1, -1, 59, 65535, -32768, 2147483647}) {
+    Payload conf;
+    json_template::render(conf, R"({"v":#})", {number});
+    Doc expected;
+    expected["v"] = number;
+    assert_same(expected, conf);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_device);
+  RUN_TEST(test_trigger);
+  RUN_TEST(test_sensor);
+  RUN_TEST(test_number);
+  RUN_TEST(test_text);
+  RUN_TEST(test_diagnostic);
+  RUN_TEST(test_switch);
+  RUN_TEST(test_escaping);
+  RUN_TEST(test_numbers);
+  return UNITY_END();
+}
@@ -0,0 +1,152 @@
+#include <unity.h>
+
+#include "label.h"
+
+using Type = LabelDescriptor::Type;
+
+static const char* text_of(const char* label, const LabelDescriptor& desc) {
+  return label + desc.text_start;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty() {
+  LabelDescriptor desc = parse_label("");
+  TEST_ASSERT_TRUE(desc.type == Type::Empty);
+  TEST_ASSERT_FALSE(desc.has_icon());
+  TEST_ASSERT_FALSE(desc.has_text());
+}
+
+void test_text() {
+  const char* label = "Kitchen";
+  LabelDescriptor desc = parse_label(label);
+  TEST_ASSERT_TRUE(desc.type == Type::Text);
+  TEST_ASSERT_EQUAL(0, desc.rotation);
+  TEST_ASSERT_EQUAL(0, desc.font_level);
+  TEST_ASSERT_EQUAL_STRING("Kitchen", text_of(label, desc));
+}
+
+void test_rotated_text() {
+  const char* label = "90;Kitchen";
+  LabelDescriptor desc = parse_label(label);
+  TEST_ASSERT_TRUE(desc.type == Type::Text);
+  TEST_ASSERT_EQUAL(90, desc.rotation);
+  TEST_ASSERT_EQUAL_STRING("Kitchen", text_of(label, desc));
+}
+
+// only up to three digits and a semicolon make a rotation
+void test_not_a_rotation() {
+  const char* labels[] = {"1800;text", "9x;text", ";text", "90 text"};
+  for (const char* label : labels) {
+    LabelDescriptor desc = parse_label(label);
+    TEST_ASSERT_TRUE(desc.type == Type::Text);
+    TEST_ASSERT_EQUAL(0, desc.rotation);
+    TEST_ASSERT_EQUAL_STRING(label, text_of(label, desc));
+  }
+}
+
+void test_icon() {
+  LabelDescriptor desc = parse_label("mdi:lightbulb");
+  TEST_ASSERT_TRUE(desc.type == Type::Icon);
+  TEST_ASSERT_TRUE(desc.has_icon());
+  TEST_ASSERT_FALSE(desc.has_text());
+  TEST_ASSERT_EQUAL_STRING("lightbulb", desc.icon.c_str());
+  TEST_ASSERT_EQUAL(0, desc.rotation);
+}
+
+void test_rotated_icon() {
+  LabelDescriptor desc = parse_label("mdi:270;fan");
+  TEST_ASSERT_TRUE(desc.type == Type::Icon);
+  TEST_ASSERT_EQUAL_STRING("fan", desc.icon.c_str());
+  TEST_ASSERT_EQUAL(270, desc.rotation);
+}
+
+void test_mixed() {
+  const char* label = "mdi:garage-open Garage door";
+  LabelDescriptor desc = parse_label(label);
+  TEST_ASSERT_TRUE(desc.type == Type::Mixed);
+  TEST_ASSERT_TRUE(desc.has_icon());
+  TEST_ASSERT_TRUE(desc.has_text());
+  TEST_ASSERT_EQUAL_STRING("garage-open", desc.icon.c_str());
+  TEST_ASSERT_EQUAL_STRING("Garage door", text_of(label, desc));
+}
+
+void test_rotated_mixed() {
+  const char* label = "mdi:180;fan Fan";
+  LabelDescriptor desc = parse_label(label);
+  TEST_ASSERT_TRUE(desc.type == Type::Mixed);
+  TEST_ASSERT_EQUAL(180, desc.rotation);
+  TEST_ASSERT_EQUAL_STRING("fan", desc.icon.c_str());
+  TEST_ASSERT_EQUAL_STRING("Fan", text_of(label, desc));
+}
+
+void test_font_level() {
+  const char* label = "__Small";
+  LabelDescriptor desc = parse_label(label);
+  TEST_ASSERT_EQUAL(2, desc.font_level);
+  TEST_ASSERT_EQUAL_STRING("Small", text_of(label, desc));
+
+  label = "mdi:fan ___Fan";
+  desc = parse_label(label);
+  TEST_ASSERT_EQUAL(3, desc.font_level);
+  TEST_ASSERT_EQUAL_STRING("Fan", text_of(label, desc));
+
+  label = "90;_Rotated";
+  desc = parse_label(label);
+  TEST_ASSERT_EQUAL(1, desc.font_level);
+  TEST_ASSERT_EQUAL_STRING("Rotated", text_of(label, desc));
+}
+
+// underscores beyond the smallest font are text
+void test_font_level_limit() {
+  const char* label = "______x";
+  LabelDescriptor desc = parse_label(label);
+  TEST_ASSERT_EQUAL(LabelDescriptor::MAX_FONT_LEVEL, desc.font_level);
+  TEST_ASSERT_EQUAL_STRING("__x", text_of(label, desc));
+}
+
+void test_text_accessor() {
+  ButtonLabel label("mdi:fan __Fan");
+  LabelDescriptor desc = parse_label(label.c_str());
+  TEST_ASSERT_EQUAL_STRING("Fan", desc.text(label));
+}
+
+void test_layout() {
+  LabelDescriptor labels[NUM_BUTTONS];
+  const char* texts[] = {"mdi:fan",    "Fan",          "mdi:fan",
+                         "mdi:90;fan", "mdi:fan Fan", "mdi:fan"};
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) labels[i] = parse_label(texts[i]);
+  update_label_layout(labels);
+#ifndef HOME_BUTTONS_MINI
+  // icon opposite text
+  TEST_ASSERT_EQUAL(48, labels[0].icon_size);
+  TEST_ASSERT_EQUAL(0, labels[1].icon_size);
+  // icon opposite a rotated icon
+  TEST_ASSERT_EQUAL(64, labels[2].icon_size);
+  // rotated icon, always large
+  TEST_ASSERT_EQUAL(64, labels[3].icon_size);
+  // mixed, and an icon opposite it
+  TEST_ASSERT_EQUAL(48, labels[4].icon_size);
+  TEST_ASSERT_EQUAL(48, labels[5].icon_size);
+#else
+  for (const auto& label : labels) TEST_ASSERT_EQUAL(100, label.icon_size);
+#endif
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_text);
+  RUN_TEST(test_rotated_text);
+  RUN_TEST(test_not_a_rotation);
+  RUN_TEST(test_icon);
+  RUN_TEST(test_rotated_icon);
+  RUN_TEST(test_mixed);
+  RUN_TEST(test_rotated_mixed);
+  RUN_TEST(test_font_level);
+  RUN_TEST(test_font_level_limit);
+  RUN_TEST(test_text_accessor);
+  RUN_TEST(test_layout);
+  return UNITY_END();
+}
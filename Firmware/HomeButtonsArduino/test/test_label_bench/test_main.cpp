@@ -0,0 +1,180 @@
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+#include "label.h"
+
+// Benchmark of the label handling in a redraw of all buttons: every label
+// parsed again with substring()/index_of() on each draw as
+// Display::draw_main() used to, against the LabelDescriptor parsed once by
+// DeviceState when the label changes and only read on a redraw. Host timings,
+// only the ratio carries over to the ESP32-S2.
+
+static constexpr int REDRAWS = 20000;
+
+static const char* LABELS[] = {
+    "Kitchen", "90;Kitchen", "mdi:lightbulb", "mdi:90;fan", "mdi:fan __Fan",
+    "___Living room"};
+
+struct Parsed {
+  MDIName icon;
+  uint16_t rotation = 0;
+  StaticString<56> text;
+  uint8_t font_level = 0;
+};
+
+static uint8_t strip_underscores(StaticString<56>& text) {
+  uint8_t level = 0;
+  while (level < LabelDescriptor::MAX_FONT_LEVEL && text.index_of('_') == 0) {
+    text = text.substring(1);
+    level++;
+  }
+  return level;
+}
+
+// draw_main() before the descriptors, without the drawing
+static void parse_per_draw(const ButtonLabel (&labels)[NUM_BUTTONS],
+                           Parsed (&out)[NUM_BUTTONS]) {
+  using Type = LabelDescriptor::Type;
+  Type label_type[NUM_BUTTONS] = {};
+  for (uint16_t i = 0; i < NUM_BUTTONS; i++) {
+    ButtonLabel label = labels[i];
+    if (label.substring(0, 4) == "mdi:") {
+      label_type[i] = label.index_of(' ') > 0 ? Type::Mixed : Type::Icon;
+    } else {
+      label_type[i] = label == "" ? Type::Icon : Type::Text;
+    }
+  }
+
+  for (uint16_t i = 0; i < NUM_BUTTONS; i++) {
+    ButtonLabel label = labels[i];
+    Parsed& p = out[i];
+    p = Parsed();
+    if (label_type[i] == Type::Icon && label.substring(0, 4) == "mdi:") {
+      if (label.index_of(';') > 0) {
+        p.icon = label.substring(
+            label.index_of(';') + 1,
+            label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
+        p.rotation = atoi(label.substring(4, label.index_of(';')).c_str());
+      } else {
+        p.icon = label.substring(
+            4, label.index_of(' ') > 0 ? label.index_of(' ') : label.length());
+      }
+    } else if (label_type[i] == Type::Mixed) {
+      if (label.index_of(';') > 0) {
+        p.icon = label.substring(label.index_of(';') + 1, label.index_of(' '));
+        p.rotation = atoi(label.substring(4, label.index_of(';')).c_str());
+      } else {
+        p.icon = label.substring(4, label.index_of(' '));
+      }
+      p.text = label.substring(label.index_of(' ') + 1);
+      p.font_level = strip_underscores(p.text);
+    } else if (label_type[i] == Type::Text) {
+      if (label.index_of(';') > 0) {
+        p.rotation = atoi(label.substring(0, label.index_of(';')).c_str());
+        label = label.substring(label.index_of(';') + 1).c_str();
+      }
+      p.text = label.c_str();
+      p.font_level = strip_underscores(p.text);
+    }
+  }
+}
+
+// draw_main() now
+static void read_descriptors(const ButtonLabel (&labels)[NUM_BUTTONS],
+                             const LabelDescriptor (&descs)[NUM_BUTTONS],
+                             Parsed (&out)[NUM_BUTTONS]) {
+  for (uint16_t i = 0; i < NUM_BUTTONS; i++) {
+    const LabelDescriptor& desc = descs[i];
+    Parsed& p = out[i];
+    p = Parsed();
+    p.rotation = desc.rotation;
+    if (desc.has_icon()) p.icon = desc.icon.c_str();
+    if (desc.has_text()) {
+      p.text = desc.text(labels[i]);
+      p.font_level = desc.font_level;
+    }
+  }
+}
+
+static double ns_per_redraw(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double, std::nano>(d).count() / REDRAWS;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// both give the draw code the same icon, rotation, text and font
+void test_same_result() {
+  ButtonLabel labels[NUM_BUTTONS];
+  LabelDescriptor descs[NUM_BUTTONS];
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    labels[i] = LABELS[i % std::size(LABELS)];
+    descs[i] = parse_label(labels[i].c_str());
+  }
+  Parsed before[NUM_BUTTONS];
+  Parsed after[NUM_BUTTONS];
+  parse_per_draw(labels, before);
+  read_descriptors(labels, descs, after);
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(before[i].icon.c_str(),
+                                     after[i].icon.c_str(), labels[i].c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(before[i].rotation, after[i].rotation,
+                              labels[i].c_str());
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(before[i].text.c_str(),
+                                     after[i].text.c_str(), labels[i].c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(before[i].font_level, after[i].font_level,
+                              labels[i].c_str());
+  }
+}
+
+void test_redraw_per_draw_vs_descriptor() {
+  ButtonLabel labels[NUM_BUTTONS];
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    labels[i] = LABELS[i % std::size(LABELS)];
+  }
+  Parsed out[NUM_BUTTONS];
+  uint32_t sum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int redraw = 0; redraw < REDRAWS; redraw++) {
+    parse_per_draw(labels, out);
+    sum += out[redraw % NUM_BUTTONS].rotation;
+  }
+  double per_draw_ns = ns_per_redraw(std::chrono::steady_clock::now() - start);
+  uint32_t per_draw_sum = sum;
+
+  // parsed once, as DeviceState does on a label change
+  sum = 0;
+  start = std::chrono::steady_clock::now();
+  LabelDescriptor descs[NUM_BUTTONS];
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    descs[i] = parse_label(labels[i].c_str());
+  }
+  update_label_layout(descs);
+  for (int redraw = 0; redraw < REDRAWS; redraw++) {
+    read_descriptors(labels, descs, out);
+    sum += out[redraw % NUM_BUTTONS].rotation;
+  }
+  double desc_ns = ns_per_redraw(std::chrono::steady_clock::now() - start);
+
+  char line[128];
+  snprintf(line, sizeof(line),
+           "%u labels: parsed per draw %.0f ns, descriptor %.0f ns per redraw "
+           "(%.1fx)",
+           NUM_BUTTONS, per_draw_ns, desc_ns, per_draw_ns / desc_ns);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_EQUAL(per_draw_sum, sum);
+  TEST_ASSERT_TRUE(desc_ns < per_draw_ns);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_result);
+  RUN_TEST(test_redraw_per_draw_vs_descriptor);
+  return UNITY_END();
+}
@@ -0,0 +1,560 @@
+#include <lwip/sockets.h>
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "fakes.h"
+#include "mqtt_transport.h"
+
+// The client against a scripted broker on a localhost socket. Both run in
+// the test's thread: the broker writes what it's told, byte by byte if need
+// be, and loop() picks it up.
+
+using Bytes = std::vector<uint8_t>;
+
+static constexpr uint32_t TIMEOUT = 1000;  // ms
+
+class Broker {
+ public:
+  Broker() {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    listen(listener_, 1);
+    socklen_t len = sizeof(addr);
+    getsockname(listener_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+  }
+  ~Broker() {
+    drop();
+    close(listener_);
+  }
+
+  uint16_t port() const { return port_; }
+
+  void accept() {
+    drop();
+    client_ = ::accept(listener_, nullptr, nullptr);
+    timeval timeout = {TIMEOUT / 1000, 0};
+    setsockopt(client_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+
+  void drop() {
+    if (client_ >= 0) close(client_);
+    client_ = -1;
+  }
+
+  void send(const Bytes& bytes) {
+    ::send(client_, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+  }
+
+  // One whole packet from the client, empty if none came.
+  Bytes packet() {
+    Bytes packet;
+    uint8_t byte;
+    if (recv(client_, &byte, 1, MSG_WAITALL) != 1) return packet;
+    packet.push_back(byte);
+    uint32_t length = 0;
+    uint8_t shift = 0;
+    do {
+      if (recv(client_, &byte, 1, MSG_WAITALL) != 1) return Bytes();
+      packet.push_back(byte);
+      length |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    size_t header = packet.size();
+    packet.resize(header + length);
+    if (length > 0 &&
+        recv(client_, &packet[header], length, MSG_WAITALL) != length) {
+      return Bytes();
+    }
+    return packet;
+  }
+
+  // nothing sent by the client, without reading it
+  bool idle() {
+    uint8_t byte;
+    return recv(client_, &byte, 1, MSG_DONTWAIT | MSG_PEEK) < 0 &&
+           errno == EAGAIN;
+  }
+
+  bool closed() {
+    uint8_t byte;
+    return recv(client_, &byte, 1, 0) == 0;
+  }
+
+ private:
+  int listener_ = -1;
+  int client_ = -1;
+  uint16_t port_ = 0;
+};
+
+// remaining length, packet and body
+static Bytes packet(uint8_t type, const Bytes& body) {
+  Bytes packet = {type};
+  uint32_t length = body.size();
+  do {
+    uint8_t byte = length & 0x7F;
+    length >>= 7;
+    packet.push_back(length > 0 ? byte | 0x80 : byte);
+  } while (length > 0);
+  packet.insert(packet.end(), body.begin(), body.end());
+  return packet;
+}
+
+static Bytes publish(const std::string& topic, const std::string& payload,
+                     uint16_t id = 0) {
+  Bytes body = {static_cast<uint8_t>(topic.size() >> 8),
+                static_cast<uint8_t>(topic.size())};
+  body.insert(body.end(), topic.begin(), topic.end());
+  if (id != 0) {
+    body.push_back(id >> 8);
+    body.push_back(id & 0xFF);
+  }
+  body.insert(body.end(), payload.begin(), payload.end());
+  return packet(id != 0 ? 0x32 : 0x30, body);
+}
+
+static Bytes puback(uint16_t id) {
+  return packet(0x40, {static_cast<uint8_t>(id >> 8),
+                       static_cast<uint8_t>(id & 0xFF)});
+}
+
+static Bytes connack(bool session_present, uint8_t code = 0) {
+  return packet(0x20, {session_present, code});
+}
+
+// of a short publish, with a one byte length
+static uint16_t id_of(const Bytes& publish) {
+  size_t pos = 4 + ((publish[2] << 8) | publish[3]);
+  return (publish[pos] << 8) | publish[pos + 1];
+}
+
+template <typename Pred>
+static bool loop_until(MQTTTransport& mqtt, Pred pred) {
+  uint32_t start = millis();
+  while (!pred()) {
+    if (millis() - start > TIMEOUT) return false;
+    mqtt.loop();
+  }
+  return true;
+}
+
+struct Received {
+  std::string topic;
+  std::string payload;
+};
+
+static Broker* broker;
+static MQTTTransport* mqtt;
+static std::vector<Received> received;
+
+// the client sends CONNECT from loop(), once the TCP connection is up
+static void accept() {
+  broker->accept();
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !broker->idle(); }));
+}
+
+static void start(bool clean_session = true) {
+  TEST_ASSERT_TRUE(mqtt->connect("hbtn-test", "", "", clean_session));
+  accept();
+  Bytes connect = broker->packet();
+  TEST_ASSERT_FALSE(connect.empty());
+  TEST_ASSERT_EQUAL_HEX8(0x10, connect[0]);
+}
+
+// connected, with the session on the broker if session_present
+static void start_session(bool session_present = false,
+                          bool clean_session = true) {
+  start(clean_session);
+  broker->send(connack(session_present));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->connected(); }));
+}
+
+void setUp() {
+  fakes::reset();
+  received.clear();
+  broker = new Broker();
+  mqtt = new MQTTTransport();
+  mqtt->set_server("127.0.0.1", broker->port());
+  mqtt->set_callback([](const char* topic, uint8_t* payload, uint32_t length) {
+    received.push_back(
+        {topic, std::string(reinterpret_cast<char*>(payload), length)});
+  });
+}
+
+void tearDown() {
+  delete mqtt;
+  delete broker;
+}
+
+void test_connect_packet() {
+  TEST_ASSERT_TRUE(mqtt->connect("hbtn-test", "user", "secret", false));
+  accept();
+  const Bytes expected = packet(
+      0x10, {0, 4, 'M', 'Q', 'T', 'T', 4, 0xC0, 0, MQTT_KEEPALIVE,
+             0, 9, 'h', 'b', 't', 'n', '-', 't', 'e', 's', 't',
+             0, 4, 'u', 's', 'e', 'r',
+             0, 6, 's', 'e', 'c', 'r', 'e', 't'});
+  TEST_ASSERT_TRUE(expected == broker->packet());
+  TEST_ASSERT_EQUAL(expected.size(), mqtt->take_bytes_sent());
+}
+
+// the CONNACK in single bytes, connected once it's whole
+void test_connack_split() {
+  start();
+  Bytes reply = connack(false);
+  for (uint8_t byte : reply) {
+    TEST_ASSERT_FALSE(mqtt->connected());
+    broker->send({byte});
+    mqtt->loop();
+  }
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->connected(); }));
+}
+
+void test_connect_rejected() {
+  start();
+  broker->send(connack(false, 5));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !broker->idle(); }));
+  TEST_ASSERT_TRUE(broker->closed());
+  TEST_ASSERT_FALSE(mqtt->connected());
+}
+
+void test_session_lost() {
+  start_session(false, false);
+  TEST_ASSERT_TRUE(mqtt->session_lost());
+  start_session(true, false);
+  TEST_ASSERT_FALSE(mqtt->session_lost());
+  // nothing to lose with a clean session
+  start_session(false, true);
+  TEST_ASSERT_FALSE(mqtt->session_lost());
+}
+
+// an incoming publish in single bytes, passed on once it's whole
+void test_publish_received_split() {
+  start_session();
+  Bytes message = publish("hb/cmd/awake_mode", "ON");
+  for (uint8_t byte : message) {
+    TEST_ASSERT_EQUAL(0, received.size());
+    broker->send({byte});
+    mqtt->loop();
+  }
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return received.size() == 1; }));
+  TEST_ASSERT_EQUAL_STRING("hb/cmd/awake_mode", received[0].topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("ON", received[0].payload.c_str());
+}
+
+// several packets in one read, and one cut at the end of it
+void test_publishes_received_together() {
+  start_session();
+  Bytes bytes = publish("a", "1");
+  Bytes second = publish("b", "2");
+  Bytes third = publish("c", "3");
+  bytes.insert(bytes.end(), second.begin(), second.end());
+  bytes.insert(bytes.end(), third.begin(), third.end() - 1);
+  broker->send(bytes);
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return received.size() == 2; }));
+  broker->send({third.back()});
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return received.size() == 3; }));
+  TEST_ASSERT_EQUAL_STRING("c", received[2].topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("3", received[2].payload.c_str());
+}
+
+void test_qos1_received_acknowledged() {
+  start_session();
+  broker->send(publish("hb/cmd/btn_1_label", "Fan", 0x1234));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return received.size() == 1; }));
+  TEST_ASSERT_TRUE(puback(0x1234) == broker->packet());
+}
+
+void test_publish() {
+  start_session();
+  mqtt->take_bytes_sent();
+  TEST_ASSERT_TRUE(mqtt->publish("hb/button_1", "single", true));
+  Bytes sent = broker->packet();
+  // QoS 1, retained
+  Bytes expected = publish("hb/button_1", "single", id_of(sent));
+  expected[0] = 0x33;
+  TEST_ASSERT_TRUE(expected == sent);
+  TEST_ASSERT_EQUAL(sent.size(), mqtt->take_bytes_sent());
+
+  TEST_ASSERT_EQUAL(1, mqtt->in_flight());
+  broker->send(puback(id_of(sent)));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->in_flight() == 0; }));
+}
+
+// up to MQTT_INFLIGHT unacknowledged, each with its own id
+void test_in_flight_limit() {
+  start_session();
+  std::vector<uint16_t> ids;
+  for (uint8_t i = 0; i < MQTT_INFLIGHT; i++) {
+    TEST_ASSERT_TRUE(mqtt->publish("hb/t", "x", false));
+    ids.push_back(id_of(broker->packet()));
+  }
+  for (uint8_t i = 1; i < ids.size(); i++) {
+    TEST_ASSERT_NOT_EQUAL(ids[i - 1], ids[i]);
+  }
+  TEST_ASSERT_FALSE(mqtt->publish("hb/t", "x", false));
+  TEST_ASSERT_TRUE(broker->idle());
+  // an ack that arrived meanwhile is read by publish() itself
+  broker->send(puback(ids[1]));
+  TEST_ASSERT_TRUE(mqtt->publish("hb/t", "x", false));
+  TEST_ASSERT_EQUAL(MQTT_INFLIGHT, mqtt->in_flight());
+}
+
+void test_subscribe() {
+  start_session();
+  TEST_ASSERT_TRUE(mqtt->subscribe("hb/cmd/#"));
+  Bytes sent = broker->packet();
+  TEST_ASSERT_EQUAL_HEX8(0x82, sent[0]);
+  Bytes body(sent.begin() + 4, sent.end());
+  TEST_ASSERT_TRUE((Bytes{0, 8, 'h', 'b', '/', 'c', 'm', 'd', '/', '#', 1}) ==
+                   body);
+}
+
+void test_broker_closes() {
+  start_session();
+  broker->drop();
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !mqtt->connected(); }));
+  TEST_ASSERT_FALSE(mqtt->publish("hb/t", "x", false));
+}
+
+// unacknowledged publishes go out again after a reconnect, as duplicates if
+// the broker kept the session
+void test_reconnect_resends() {
+  for (bool session_present : {true, false}) {
+    start_session(false, false);
+    TEST_ASSERT_TRUE(mqtt->publish("hb/a", "1", false));
+    TEST_ASSERT_TRUE(mqtt->publish("hb/b", "2", true));
+    uint16_t first = id_of(broker->packet());
+    uint16_t second = id_of(broker->packet());
+    broker->send(puback(first));
+    TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->in_flight() == 1; }));
+    broker->drop();
+    TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !mqtt->connected(); }));
+    TEST_ASSERT_EQUAL(1, mqtt->in_flight());
+
+    start(false);
+    broker->send(connack(session_present));
+    TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->connected(); }));
+    Bytes resent = broker->packet();
+    Bytes expected = publish("hb/b", "2", second);
+    expected[0] |= 0x01 | (session_present ? 0x08 : 0);
+    TEST_ASSERT_TRUE(expected == resent);
+    TEST_ASSERT_TRUE(broker->idle());
+    broker->send(puback(second));
+    TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->in_flight() == 0; }));
+  }
+}
+
+// a publish the connection breaks under is kept and sent after the reconnect
+void test_publish_send_fails() {
+  start_session(false, false);
+  broker->drop();
+  // into the closed connection, the broker resets it
+  TEST_ASSERT_TRUE(mqtt->publish("hb/a", "1", false));
+  delay(10);
+  TEST_ASSERT_TRUE(mqtt->publish("hb/b", "2", false));
+  TEST_ASSERT_FALSE(mqtt->connected());
+  TEST_ASSERT_EQUAL(2, mqtt->in_flight());
+
+  start(false);
+  broker->send(connack(true));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->connected(); }));
+  Bytes a = broker->packet();
+  Bytes b = broker->packet();
+  Bytes expected_a = publish("hb/a", "1", id_of(a));
+  Bytes expected_b = publish("hb/b", "2", id_of(b));
+  expected_a[0] |= 0x08;
+  expected_b[0] |= 0x08;
+  TEST_ASSERT_TRUE(expected_a == a);
+  TEST_ASSERT_TRUE(expected_b == b);
+  broker->send(puback(id_of(a)));
+  broker->send(puback(id_of(b)));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->in_flight() == 0; }));
+}
+
+// a message larger than the buffer goes to the stream callback in pieces,
+// wherever the reads split it, and is acknowledged
+void test_large_streamed() {
+  std::string payload;
+  for (size_t i = 0; i < 3 * MQTT_BUFFER_SIZE; i++) payload += 'a' + i % 26;
+  std::string streamed;
+  uint32_t calls = 0;
+  mqtt->set_stream_callback([&](const char* topic, const uint8_t* data,
+                                uint32_t length, uint32_t offset) {
+    TEST_ASSERT_EQUAL_STRING("hb/cmd/icon", topic);
+    TEST_ASSERT_EQUAL(streamed.size(), offset);
+    streamed.append(reinterpret_cast<const char*>(data), length);
+    calls++;
+  });
+  start_session();
+  Bytes message = publish("hb/cmd/icon", payload, 77);
+  for (size_t chunk : {message.size(), size_t(1), size_t(100), size_t(777)}) {
+    streamed.clear();
+    calls = 0;
+    for (size_t pos = 0; pos < message.size(); pos += chunk) {
+      size_t end = std::min(message.size(), pos + chunk);
+      broker->send(Bytes(message.begin() + pos, message.begin() + end));
+      mqtt->loop();
+    }
+    TEST_ASSERT_TRUE(
+        loop_until(*mqtt, [&] { return streamed.size() == payload.size(); }));
+    TEST_ASSERT_TRUE(payload == streamed);
+    TEST_ASSERT_TRUE(calls >= 4);
+    TEST_ASSERT_TRUE(puback(77) == broker->packet());
+  }
+  TEST_ASSERT_EQUAL(0, received.size());
+}
+
+// without a stream callback it's skipped, still acknowledged, and the
+// connection stays
+void test_large_skipped() {
+  start_session();
+  broker->send(publish("hb/cmd/icon", std::string(2000, 'x'), 78));
+  broker->send(publish("hb/cmd/awake_mode", "OFF"));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return received.size() == 1; }));
+  TEST_ASSERT_EQUAL_STRING("hb/cmd/awake_mode", received[0].topic.c_str());
+  TEST_ASSERT_TRUE(puback(78) == broker->packet());
+  TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+void test_disconnect() {
+  start_session();
+  mqtt->disconnect();
+  TEST_ASSERT_TRUE(packet(0xE0, {}) == broker->packet());
+  TEST_ASSERT_TRUE(broker->closed());
+  TEST_ASSERT_FALSE(mqtt->connected());
+}
+
+// idle for the keepalive: PINGREQ, and the connection stays while the
+// PINGRESP is on its way
+void test_keepalive() {
+  start_session();
+  for (uint8_t i = 0; i < 2; i++) {
+    native_time::advance(MQTT_KEEPALIVE * 1000 + 1);
+    mqtt->loop();
+    TEST_ASSERT_TRUE(packet(0xC0, {}) == broker->packet());
+    for (uint8_t j = 0; j < 10; j++) mqtt->loop();
+    TEST_ASSERT_TRUE(mqtt->connected());
+    native_time::advance(MQTT_ACK_TIMEOUT / 2);
+    broker->send(packet(0xD0, {}));
+    // answered, past the ack timeout it's still up, and the next round
+    // only pings again
+    native_time::advance(MQTT_ACK_TIMEOUT);
+    for (uint8_t j = 0; j < 10; j++) mqtt->loop();
+    TEST_ASSERT_TRUE(mqtt->connected());
+    TEST_ASSERT_TRUE(broker->idle());
+  }
+}
+
+void test_keepalive_no_response() {
+  start_session();
+  native_time::advance(MQTT_KEEPALIVE * 1000 + 1);
+  mqtt->loop();
+  TEST_ASSERT_TRUE(packet(0xC0, {}) == broker->packet());
+  native_time::advance(MQTT_ACK_TIMEOUT + 1);
+  mqtt->loop();
+  TEST_ASSERT_FALSE(mqtt->connected());
+  TEST_ASSERT_TRUE(broker->closed());
+}
+
+// Over TLS the fake channel passes the bytes through after a scripted
+// handshake, CONNECT waits for the handshake. The CPU runs at full speed
+// only while it lasts.
+void test_tls_handshake() {
+  mqtt->set_tls(true, "0123456789abcdef");
+  TEST_ASSERT_EQUAL_STRING("MQTTS", mqtt->name());
+  fakes::tls.handshake_steps = 3;
+  TEST_ASSERT_TRUE(mqtt->connect("hbtn-test", "", "", true));
+  broker->accept();
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return fakes::tls.begins == 1; }));
+  for (uint8_t i = 0; i < 2; i++) {
+    TEST_ASSERT_EQUAL(1, fakes::cpu_requests(power::CpuProfile::COMPUTE));
+    TEST_ASSERT_TRUE(broker->idle());
+    mqtt->loop();
+  }
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !broker->idle(); }));
+  TEST_ASSERT_EQUAL(0, fakes::cpu_requests(power::CpuProfile::COMPUTE));
+  TEST_ASSERT_EQUAL_HEX8(0x10, broker->packet()[0]);
+  broker->send(connack(false));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return mqtt->connected(); }));
+
+  broker->send(publish("hb/cmd/awake_mode", "ON", 5));
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return received.size() == 1; }));
+  TEST_ASSERT_TRUE(puback(5) == broker->packet());
+}
+
+void test_tls_handshake_fails() {
+  mqtt->set_tls(true, "0123456789abcdef");
+  fakes::tls.handshake_steps = 1;
+  fakes::tls.handshake_ok = false;
+  TEST_ASSERT_TRUE(mqtt->connect("hbtn-test", "", "", true));
+  broker->accept();
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !broker->idle(); }));
+  TEST_ASSERT_TRUE(broker->closed());
+  TEST_ASSERT_FALSE(mqtt->connected());
+  TEST_ASSERT_EQUAL(0, fakes::cpu_requests(power::CpuProfile::COMPUTE));
+}
+
+// closed during the handshake, the CPU request ends with it
+void test_tls_closed_during_handshake() {
+  mqtt->set_tls(true, "0123456789abcdef");
+  fakes::tls.handshake_steps = 100;
+  TEST_ASSERT_TRUE(mqtt->connect("hbtn-test", "", "", true));
+  broker->accept();
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return fakes::tls.begins == 1; }));
+  TEST_ASSERT_EQUAL(1, fakes::cpu_requests(power::CpuProfile::COMPUTE));
+  mqtt->disconnect();
+  TEST_ASSERT_TRUE(broker->closed());
+  TEST_ASSERT_EQUAL(0, fakes::cpu_requests(power::CpuProfile::COMPUTE));
+}
+
+// unacknowledged publishes are resent over the new TLS connection
+void test_tls_reconnect_resends() {
+  mqtt->set_tls(true, "0123456789abcdef");
+  start_session(true, false);
+  TEST_ASSERT_TRUE(mqtt->publish("hb/a", "1", false));
+  uint16_t id = id_of(broker->packet());
+  broker->drop();
+  TEST_ASSERT_TRUE(loop_until(*mqtt, [] { return !mqtt->connected(); }));
+
+  fakes::tls.handshake_steps = 2;
+  start_session(true, false);
+  TEST_ASSERT_EQUAL(2, fakes::tls.begins);
+  Bytes expected = publish("hb/a", "1", id);
+  expected[0] |= 0x08;
+  TEST_ASSERT_TRUE(expected == broker->packet());
+  TEST_ASSERT_EQUAL(0, fakes::cpu_requests(power::CpuProfile::COMPUTE));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_packet);
+  RUN_TEST(test_connack_split);
+  RUN_TEST(test_connect_rejected);
+  RUN_TEST(test_session_lost);
+  RUN_TEST(test_publish_received_split);
+  RUN_TEST(test_publishes_received_together);
+  RUN_TEST(test_qos1_received_acknowledged);
+  RUN_TEST(test_publish);
+  RUN_TEST(test_in_flight_limit);
+  RUN_TEST(test_subscribe);
+  RUN_TEST(test_broker_closes);
+  RUN_TEST(test_reconnect_resends);
+  RUN_TEST(test_publish_send_fails);
+  RUN_TEST(test_large_streamed);
+  RUN_TEST(test_large_skipped);
+  RUN_TEST(test_disconnect);
+  RUN_TEST(test_keepalive);
+  RUN_TEST(test_keepalive_no_response);
+  RUN_TEST(test_tls_handshake);
+  RUN_TEST(test_tls_handshake_fails);
+  RUN_TEST(test_tls_closed_during_handshake);
+  RUN_TEST(test_tls_reconnect_resends);
+  return UNITY_END();
+}
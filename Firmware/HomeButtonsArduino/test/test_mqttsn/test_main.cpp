@@ -0,0 +1,415 @@
+#include <lwip/sockets.h>
+#include <unity.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "fakes.h"
+#include "mqttsn.h"
+
+// The client against a scripted gateway on a localhost UDP socket. The
+// client's requests wait for the reply, so the gateway answers from its own
+// thread, as the test's script says.
+
+using Bytes = std::vector<uint8_t>;
+// the replies to a message from the client
+using Script = std::function<std::vector<Bytes>(const Bytes&)>;
+
+static constexpr uint32_t TIMEOUT = 1000;  // ms
+
+// message types and flags
+static constexpr uint8_t CONNECT = 0x04;
+static constexpr uint8_t CONNACK = 0x05;
+static constexpr uint8_t REGISTER = 0x0A;
+static constexpr uint8_t REGACK = 0x0B;
+static constexpr uint8_t PUBLISH = 0x0C;
+static constexpr uint8_t PUBACK = 0x0D;
+static constexpr uint8_t SUBSCRIBE = 0x12;
+static constexpr uint8_t SUBACK = 0x13;
+static constexpr uint8_t DISCONNECT = 0x18;
+static constexpr uint8_t FLAG_DUP = 0x80;
+static constexpr uint8_t FLAG_RETAIN = 0x10;
+static constexpr uint8_t QOS_1 = 0x20;
+static constexpr uint8_t QOS_MINUS_1 = 0x60;
+static constexpr uint8_t TOPIC_PREDEFINED = 0x01;
+static constexpr uint8_t INVALID_TOPIC_ID = 0x02;
+
+class Gateway {
+ public:
+  Gateway() {
+    socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(socket_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(socket_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    timeval timeout = {0, 10000};
+    setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    thread_ = std::thread([this] { _run(); });
+  }
+  ~Gateway() {
+    stop_ = true;
+    thread_.join();
+    close(socket_);
+  }
+
+  uint16_t port() const { return port_; }
+
+  void script(Script script) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    script_ = script;
+  }
+
+  // what the client sent, in order
+  std::vector<Bytes> received() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return received_;
+  }
+
+  // to the client, unasked
+  void send(const Bytes& message) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sendto(socket_, message.data(), message.size(), 0,
+           reinterpret_cast<sockaddr*>(&client_), sizeof(client_));
+  }
+
+ private:
+  int socket_ = -1;
+  uint16_t port_ = 0;
+  sockaddr_in client_ = {};
+  std::mutex mutex_;
+  Script script_;
+  std::vector<Bytes> received_;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+
+  void _run() {
+    uint8_t buf[1500];
+    while (!stop_) {
+      sockaddr_in from = {};
+      socklen_t from_length = sizeof(from);
+      ssize_t n = recvfrom(socket_, buf, sizeof(buf), 0,
+                           reinterpret_cast<sockaddr*>(&from), &from_length);
+      if (n <= 0) continue;
+      std::lock_guard<std::mutex> lock(mutex_);
+      client_ = from;
+      Bytes message(buf, buf + n);
+      received_.push_back(message);
+      if (!script_) continue;
+      for (const Bytes& reply : script_(message)) {
+        sendto(socket_, reply.data(), reply.size(), 0,
+               reinterpret_cast<sockaddr*>(&from), sizeof(from));
+      }
+    }
+  }
+};
+
+static Bytes message(uint8_t type, const Bytes& body) {
+  Bytes message = {static_cast<uint8_t>(2 + body.size()), type};
+  message.insert(message.end(), body.begin(), body.end());
+  return message;
+}
+
+static Bytes bytes(uint16_t value) {
+  return {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+}
+
+static Bytes operator+(Bytes a, const Bytes& b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+static Bytes text(const std::string& str) {
+  return Bytes(str.begin(), str.end());
+}
+
+static uint16_t get16(const Bytes& message, size_t at) {
+  return (message[at] << 8) | message[at + 1];
+}
+
+// offsets in a message from the client, all are short
+static uint16_t publish_topic_id(const Bytes& publish) {
+  return get16(publish, 3);
+}
+static uint16_t publish_msg_id(const Bytes& publish) {
+  return get16(publish, 5);
+}
+static uint16_t register_msg_id(const Bytes& reg) { return get16(reg, 4); }
+static std::string register_topic(const Bytes& reg) {
+  return std::string(reg.begin() + 6, reg.end());
+}
+
+static Bytes regack(uint16_t topic_id, uint16_t msg_id, uint8_t code = 0) {
+  return message(REGACK, bytes(topic_id) + bytes(msg_id) + Bytes{code});
+}
+
+static Bytes puback(const Bytes& publish, uint8_t code = 0) {
+  return message(PUBACK, bytes(publish_topic_id(publish)) +
+                             bytes(publish_msg_id(publish)) + Bytes{code});
+}
+
+// a gateway that accepts everything, topics are registered as 1, 2, ...
+static std::vector<Bytes> accept_all(const Bytes& message) {
+  static uint16_t next_id = 0;
+  switch (message[1]) {
+    case CONNECT:
+      next_id = 0;
+      return {::message(CONNACK, {0})};
+    case REGISTER:
+      return {regack(++next_id, register_msg_id(message))};
+    case PUBLISH:
+      if ((message[2] & 0x60) == QOS_1) return {puback(message)};
+      return {};
+    default:
+      return {};
+  }
+}
+
+template <typename Pred>
+static bool loop_until(MQTTSNTransport& mqttsn, Pred pred) {
+  uint32_t start = millis();
+  while (!pred()) {
+    if (millis() - start > TIMEOUT) return false;
+    mqttsn.loop();
+    delay(1);
+  }
+  return true;
+}
+
+struct Received {
+  std::string topic;
+  std::string payload;
+};
+
+static Gateway* gateway;
+static MQTTSNTransport* mqttsn;
+static std::vector<Received> received;
+
+// the type of each message the client sent
+static Bytes types() {
+  Bytes types;
+  for (const Bytes& message : gateway->received()) types.push_back(message[1]);
+  return types;
+}
+
+void setUp() {
+  fakes::reset();
+  received.clear();
+  gateway = new Gateway();
+  gateway->script(accept_all);
+  mqttsn = new MQTTSNTransport();
+  mqttsn->set_server("127.0.0.1", gateway->port());
+  mqttsn->set_callback([](const char* topic, uint8_t* payload,
+                          uint32_t length) {
+    received.push_back(
+        {topic, std::string(reinterpret_cast<char*>(payload), length)});
+  });
+  mqttsn->set_topic_id_lookup([](const char* topic) -> uint16_t {
+    return std::string(topic) == "hb/button" ? MQTTSN_BTN_TOPIC_ID : 0;
+  });
+}
+
+void tearDown() {
+  delete mqttsn;
+  delete gateway;
+}
+
+void test_connect() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_TRUE(mqttsn->connected());
+  std::vector<Bytes> sent = gateway->received();
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_TRUE(message(CONNECT, Bytes{0x04, 0x01} +
+                                        bytes(MQTTSN_KEEPALIVE) +
+                                        text("hbtn-test")) == sent[0]);
+  TEST_ASSERT_EQUAL(sent[0].size(), mqttsn->take_bytes_sent());
+}
+
+void test_connect_rejected() {
+  gateway->script([](const Bytes& message) -> std::vector<Bytes> {
+    return {::message(CONNACK, {0x03})};
+  });
+  TEST_ASSERT_FALSE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_FALSE(mqttsn->connected());
+}
+
+// sent again after MQTTSN_RETRY_TIMEOUT, given up after MQTTSN_RETRIES
+void test_no_reply() {
+  gateway->script(nullptr);
+  uint32_t start = millis();
+  TEST_ASSERT_FALSE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_UINT32_WITHIN(100, MQTTSN_RETRY_TIMEOUT * MQTTSN_RETRIES,
+                            millis() - start);
+  TEST_ASSERT_TRUE(Bytes(MQTTSN_RETRIES, CONNECT) == types());
+}
+
+// registered once, then published with the id the gateway gave it
+void test_register_and_publish() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/temperature", "21.5", true));
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/temperature", "21.6", false));
+  std::vector<Bytes> sent = gateway->received();
+  TEST_ASSERT_TRUE((Bytes{CONNECT, REGISTER, PUBLISH, PUBLISH}) == types());
+  TEST_ASSERT_EQUAL_STRING("hb/temperature", register_topic(sent[1]).c_str());
+  TEST_ASSERT_EQUAL_HEX8(QOS_1 | FLAG_RETAIN, sent[2][2]);
+  TEST_ASSERT_EQUAL_HEX8(QOS_1, sent[3][2]);
+  for (size_t i : {2, 3}) TEST_ASSERT_EQUAL(1, publish_topic_id(sent[i]));
+  TEST_ASSERT_NOT_EQUAL(publish_msg_id(sent[2]), publish_msg_id(sent[3]));
+  TEST_ASSERT_EQUAL_STRING(
+      "21.5", std::string(sent[2].begin() + 7, sent[2].end()).c_str());
+}
+
+// a publish without an answer is sent again as a duplicate, same message id
+void test_publish_retried() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  gateway->script([](const Bytes& message) -> std::vector<Bytes> {
+    if (message[1] != PUBLISH) return accept_all(message);
+    if ((message[2] & FLAG_DUP) == 0) return {};
+    return {puback(message)};
+  });
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/button", "single", false));
+  std::vector<Bytes> sent = gateway->received();
+  TEST_ASSERT_TRUE((Bytes{CONNECT, PUBLISH, PUBLISH}) == types());
+  TEST_ASSERT_EQUAL_HEX8(0, sent[1][2] & FLAG_DUP);
+  TEST_ASSERT_EQUAL_HEX8(FLAG_DUP, sent[2][2] & FLAG_DUP);
+  TEST_ASSERT_EQUAL(publish_msg_id(sent[1]), publish_msg_id(sent[2]));
+}
+
+// a predefined topic id needs no REGISTER
+void test_predefined_topic() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/button", "single", false));
+  std::vector<Bytes> sent = gateway->received();
+  TEST_ASSERT_TRUE((Bytes{CONNECT, PUBLISH}) == types());
+  TEST_ASSERT_EQUAL_HEX8(QOS_1 | TOPIC_PREDEFINED, sent[1][2]);
+  TEST_ASSERT_EQUAL(MQTTSN_BTN_TOPIC_ID, publish_topic_id(sent[1]));
+}
+
+// the gateway forgot the registration, it's registered once more
+void test_invalid_topic_id() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/battery", "80", false));
+  gateway->script([](const Bytes& message) -> std::vector<Bytes> {
+    if (message[1] == PUBLISH && publish_topic_id(message) == 1) {
+      return {puback(message, INVALID_TOPIC_ID)};
+    }
+    return accept_all(message);
+  });
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/battery", "79", false));
+  std::vector<Bytes> sent = gateway->received();
+  TEST_ASSERT_TRUE(
+      (Bytes{CONNECT, REGISTER, PUBLISH, PUBLISH, REGISTER, PUBLISH}) ==
+      types());
+  TEST_ASSERT_EQUAL(2, publish_topic_id(sent[5]));
+}
+
+void test_publish_early() {
+  TEST_ASSERT_TRUE(mqttsn->publishes_early("hb/button"));
+  TEST_ASSERT_FALSE(mqttsn->publishes_early("hb/temperature"));
+  TEST_ASSERT_FALSE(mqttsn->publish_early("hb/temperature", "21.5"));
+  // QoS -1, without a session or a reply
+  TEST_ASSERT_TRUE(mqttsn->publish_early("hb/button", "double"));
+  TEST_ASSERT_FALSE(mqttsn->connected());
+  uint32_t start = millis();
+  while (gateway->received().empty() && millis() - start < TIMEOUT) delay(1);
+  std::vector<Bytes> sent = gateway->received();
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_TRUE(message(PUBLISH, Bytes{QOS_MINUS_1 | TOPIC_PREDEFINED} +
+                                        bytes(MQTTSN_BTN_TOPIC_ID) +
+                                        bytes(0) + text("double")) ==
+                   sent[0]);
+}
+
+void test_subscribe_and_receive() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  gateway->script([](const Bytes& message) -> std::vector<Bytes> {
+    if (message[1] != SUBSCRIBE) return accept_all(message);
+    uint16_t msg_id = get16(message, 3);
+    return {::message(SUBACK, Bytes{QOS_1} + bytes(9) + bytes(msg_id) +
+                                  Bytes{0})};
+  });
+  TEST_ASSERT_TRUE(mqttsn->subscribe("hb/cmd/awake_mode"));
+  TEST_ASSERT_EQUAL_STRING(
+      "hb/cmd/awake_mode",
+      std::string(gateway->received()[1].begin() + 5,
+                  gateway->received()[1].end())
+          .c_str());
+
+  gateway->send(message(PUBLISH, Bytes{QOS_1} + bytes(9) + bytes(300) +
+                                     text("ON")));
+  TEST_ASSERT_TRUE(
+      loop_until(*mqttsn, [] { return received.size() == 1; }));
+  TEST_ASSERT_EQUAL_STRING("hb/cmd/awake_mode", received[0].topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("ON", received[0].payload.c_str());
+  TEST_ASSERT_TRUE(loop_until(*mqttsn, [] { return types().size() == 3; }));
+  TEST_ASSERT_TRUE(message(PUBACK, bytes(9) + bytes(300) + Bytes{0}) ==
+                   gateway->received()[2]);
+}
+
+// a topic of a wildcard subscription, registered by the gateway
+void test_registered_by_gateway() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  gateway->send(message(REGISTER, bytes(12) + bytes(400) + text("hb/cmd/x")));
+  TEST_ASSERT_TRUE(loop_until(*mqttsn, [] { return types().size() == 2; }));
+  TEST_ASSERT_TRUE(regack(12, 400) == gateway->received()[1]);
+
+  gateway->send(message(PUBLISH, Bytes{0} + bytes(12) + bytes(0) + text("1")));
+  TEST_ASSERT_TRUE(
+      loop_until(*mqttsn, [] { return received.size() == 1; }));
+  TEST_ASSERT_EQUAL_STRING("hb/cmd/x", received[0].topic.c_str());
+}
+
+// unknown topic id: rejected, not passed on
+void test_receive_unknown_topic() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  gateway->send(message(PUBLISH, Bytes{QOS_1} + bytes(42) + bytes(301) +
+                                     text("x")));
+  TEST_ASSERT_TRUE(loop_until(*mqttsn, [] { return types().size() == 2; }));
+  TEST_ASSERT_TRUE(message(PUBACK, bytes(42) + bytes(301) +
+                                       Bytes{INVALID_TOPIC_ID}) ==
+                   gateway->received()[1]);
+  TEST_ASSERT_EQUAL(0, received.size());
+}
+
+// a new session starts without the registrations of the old one
+void test_reconnect_registers_again() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/battery", "80", false));
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  TEST_ASSERT_TRUE(mqttsn->publish("hb/battery", "79", false));
+  TEST_ASSERT_TRUE(
+      (Bytes{CONNECT, REGISTER, PUBLISH, CONNECT, REGISTER, PUBLISH}) ==
+      types());
+}
+
+void test_disconnected_by_gateway() {
+  TEST_ASSERT_TRUE(mqttsn->connect("hbtn-test", "", "", true));
+  gateway->send(message(DISCONNECT, {}));
+  TEST_ASSERT_TRUE(loop_until(*mqttsn, [] { return !mqttsn->connected(); }));
+  TEST_ASSERT_FALSE(mqttsn->publish("hb/button", "single", false));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect);
+  RUN_TEST(test_connect_rejected);
+  RUN_TEST(test_no_reply);
+  RUN_TEST(test_register_and_publish);
+  RUN_TEST(test_publish_retried);
+  RUN_TEST(test_predefined_topic);
+  RUN_TEST(test_invalid_topic_id);
+  RUN_TEST(test_publish_early);
+  RUN_TEST(test_subscribe_and_receive);
+  RUN_TEST(test_registered_by_gateway);
+  RUN_TEST(test_receive_unknown_topic);
+  RUN_TEST(test_reconnect_registers_again);
+  RUN_TEST(test_disconnected_by_gateway);
+  return UNITY_END();
+}
@@ -0,0 +1,169 @@
+#include <unity.h>
+
+#include <ctime>
+
+#include "config.h"
+#include "fakes.h"
+#include "press_outbox.h"
+
+using press_outbox::Press;
+
+static Press presses[PRESS_OUTBOX_ENTRIES];
+
+void setUp() {
+  press_outbox::remove(PRESS_OUTBOX_ENTRIES);
+  fakes::reset();
+}
+
+void tearDown() {}
+
+void test_empty() {
+  TEST_ASSERT_FALSE(press_outbox::pending());
+  TEST_ASSERT_EQUAL(0, press_outbox::peek(presses));
+}
+
+void test_oldest_first() {
+  time_t now = time(nullptr);
+  for (uint8_t i = 0; i < 3; i++) press_outbox::add(i, 1, now - 10 + i);
+  TEST_ASSERT_TRUE(press_outbox::pending());
+  TEST_ASSERT_EQUAL(3, press_outbox::peek(presses));
+  for (uint8_t i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(i, presses[i].button);
+    TEST_ASSERT_EQUAL(1, presses[i].action);
+    TEST_ASSERT_EQUAL(now - 10 + i, presses[i].time);
+    TEST_ASSERT_TRUE(presses[i].time_valid);
+  }
+  TEST_ASSERT_EQUAL(3, fakes::counter(metrics::Counter::PRESSES_QUEUED));
+}
+
+// peek() leaves them in, until they're delivered
+void test_peek_keeps() {
+  time_t now = time(nullptr);
+  press_outbox::add(0, 1, now);
+  press_outbox::add(1, 2, now);
+  TEST_ASSERT_EQUAL(2, press_outbox::peek(presses));
+  TEST_ASSERT_EQUAL(2, press_outbox::peek(presses));
+  press_outbox::remove(1);
+  TEST_ASSERT_EQUAL(1, press_outbox::peek(presses));
+  TEST_ASSERT_EQUAL(1, presses[0].button);
+  press_outbox::remove(1);
+  TEST_ASSERT_FALSE(press_outbox::pending());
+}
+
+// presses added while the peeked ones were being published stay behind them
+void test_add_while_delivering() {
+  time_t now = time(nullptr);
+  press_outbox::add(0, 1, now);
+  press_outbox::add(1, 1, now);
+  uint8_t n = press_outbox::peek(presses);
+  press_outbox::add(2, 1, now);
+  press_outbox::remove(n);
+  TEST_ASSERT_EQUAL(1, press_outbox::peek(presses));
+  TEST_ASSERT_EQUAL(2, presses[0].button);
+}
+
+void test_remove_more_than_queued() {
+  press_outbox::add(0, 1, time(nullptr));
+  press_outbox::remove(PRESS_OUTBOX_ENTRIES + 3);
+  TEST_ASSERT_EQUAL(0, press_outbox::peek(presses));
+  press_outbox::add(1, 1, time(nullptr));
+  TEST_ASSERT_EQUAL(1, press_outbox::peek(presses));
+}
+
+// the oldest press is dropped, the order is kept across the wrap
+void test_overflow() {
+  time_t now = time(nullptr);
+  for (uint8_t i = 0; i < PRESS_OUTBOX_ENTRIES + 3; i++) {
+    press_outbox::add(i, 1, now);
+  }
+  TEST_ASSERT_EQUAL(PRESS_OUTBOX_ENTRIES, press_outbox::peek(presses));
+  for (uint8_t i = 0; i < PRESS_OUTBOX_ENTRIES; i++) {
+    TEST_ASSERT_EQUAL(i + 3, presses[i].button);
+  }
+  TEST_ASSERT_EQUAL(3, fakes::counter(metrics::Counter::PRESSES_DROPPED));
+  TEST_ASSERT_EQUAL(PRESS_OUTBOX_ENTRIES + 3,
+                    fakes::counter(metrics::Counter::PRESSES_QUEUED));
+}
+
+// wrapped around the end of the ring, then removed in part
+void test_overflow_then_remove() {
+  time_t now = time(nullptr);
+  for (uint8_t i = 0; i < PRESS_OUTBOX_ENTRIES + 2; i++) {
+    press_outbox::add(i, 1, now);
+  }
+  press_outbox::remove(3);
+  press_outbox::add(100, 1, now);
+  uint8_t n = press_outbox::peek(presses);
+  TEST_ASSERT_EQUAL(PRESS_OUTBOX_ENTRIES - 2, n);
+  TEST_ASSERT_EQUAL(5, presses[0].button);
+  TEST_ASSERT_EQUAL(100, presses[n - 1].button);
+}
+
+void test_age_expiry() {
+  time_t now = time(nullptr);
+  press_outbox::add(0, 1, now - PRESS_OUTBOX_MAX_AGE - 60);
+  press_outbox::add(1, 1, now - PRESS_OUTBOX_MAX_AGE + 60);
+  press_outbox::add(2, 1, now);
+  TEST_ASSERT_EQUAL(2, press_outbox::peek(presses));
+  TEST_ASSERT_EQUAL(1, presses[0].button);
+  TEST_ASSERT_EQUAL(2, presses[1].button);
+  TEST_ASSERT_EQUAL(1, fakes::counter(metrics::Counter::PRESSES_DROPPED));
+  // dropped for good
+  TEST_ASSERT_EQUAL(2, press_outbox::peek(presses));
+  TEST_ASSERT_EQUAL(1, fakes::counter(metrics::Counter::PRESSES_DROPPED));
+}
+
+void test_only_stale() {
+  press_outbox::add(0, 1, time(nullptr) - PRESS_OUTBOX_MAX_AGE - 1);
+  TEST_ASSERT_FALSE(press_outbox::pending());
+  TEST_ASSERT_EQUAL(0, press_outbox::peek(presses));
+}
+
+// a press from the future means the clock went back, it's kept
+void test_future_press() {
+  press_outbox::add(0, 1, time(nullptr) + 3600);
+  TEST_ASSERT_TRUE(press_outbox::pending());
+  TEST_ASSERT_EQUAL(1, press_outbox::peek(presses));
+}
+
+// taken before the clock was set, moved along when it is. The host clock
+// is always set, the press is from the clock reading 1000 s after boot.
+void test_clock_set() {
+  time_t now = time(nullptr);
+  press_outbox::add(0, 1, 990);
+  press_outbox::add(1, 1, now);
+  press_outbox::clock_set(now - 1000);
+  TEST_ASSERT_EQUAL(2, press_outbox::peek(presses));
+  TEST_ASSERT_EQUAL(now - 10, presses[0].time);
+  TEST_ASSERT_TRUE(presses[0].time_valid);
+  // already valid, not moved
+  TEST_ASSERT_EQUAL(now, presses[1].time);
+}
+
+// a correction that leaves it before 2023 keeps it invalid, the next one
+// still moves it
+void test_clock_set_twice() {
+  press_outbox::add(0, 1, 990);
+  press_outbox::clock_set(3600);
+  press_outbox::clock_set(time(nullptr) - 990 - 3600);
+  TEST_ASSERT_EQUAL(1, press_outbox::peek(presses));
+  TEST_ASSERT_TRUE(presses[0].time_valid);
+  TEST_ASSERT_UINT32_WITHIN(2, time(nullptr), presses[0].time);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_oldest_first);
+  RUN_TEST(test_peek_keeps);
+  RUN_TEST(test_add_while_delivering);
+  RUN_TEST(test_remove_more_than_queued);
+  RUN_TEST(test_overflow);
+  RUN_TEST(test_overflow_then_remove);
+  RUN_TEST(test_age_expiry);
+  RUN_TEST(test_only_stale);
+  RUN_TEST(test_future_press);
+  RUN_TEST(test_clock_set);
+  RUN_TEST(test_clock_set_twice);
+  return UNITY_END();
+}
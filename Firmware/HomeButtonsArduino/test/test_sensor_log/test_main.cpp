@@ -0,0 +1,180 @@
+#include <unity.h>
+
+#include <ctime>
+#include <string>
+
+#include "config.h"
+#include "fakes.h"
+#include "sensor_log.h"
+
+// 2024-01-01, any time after the clock was set
+static constexpr time_t NOW = 1704067200;
+
+static void assert_json(const char* expected, uint8_t first, time_t now) {
+  char buf[sensor_log::MAX_JSON_LEN + 1];
+  size_t len = sensor_log::to_json(first, now, buf, sizeof(buf));
+  std::string json(buf, len);
+  TEST_ASSERT_EQUAL_STRING(expected, json.c_str());
+}
+
+void setUp() {
+  sensor_log::sent(SENSOR_LOG_ENTRIES);
+  sensor_log::delivered(SENSOR_LOG_ENTRIES);
+  fakes::reset();
+}
+
+void tearDown() {}
+
+void test_empty() {
+  TEST_ASSERT_EQUAL(0, sensor_log::count());
+  assert_json("", 0, NOW);
+}
+
+void test_timed() {
+  sensor_log::add(21.5f, 45.0f, 90, NOW - 600);
+  sensor_log::add(-1.05f, 50.25f, 89, NOW - 300);
+  assert_json(
+      R"({"t":[1704066600,1704066900],"temp":[21.50,-1.05],)"
+      R"("hum":[45.00,50.25],"batt":[90,89]})",
+      0, NOW);
+}
+
+// taken before the clock was ever set, e.g. without a connection since the
+// battery was put in: sent with their age instead of being left out
+void test_untimed_have_age() {
+  sensor_log::add(21.5f, 45.0f, 90, 100);
+  sensor_log::add(21.0f, 46.0f, 90, 160);
+  assert_json(
+      R"({"t":[null,null],"age":[300,240],"temp":[21.50,21.00],)"
+      R"("hum":[45.00,46.00],"batt":[90,90]})",
+      0, 400);
+}
+
+void test_mixed() {
+  sensor_log::add(21.5f, 45.0f, 90, 100);
+  sensor_log::add(21.0f, 46.0f, 90, NOW - 60);
+  assert_json(
+      R"({"t":[null,1704067140],"age":[300,null],"temp":[21.50,21.00],)"
+      R"("hum":[45.00,46.00],"batt":[90,90]})",
+      0, 400);
+  // the age is unknown once the clock is set
+  assert_json(
+      R"({"t":[null,1704067140],"age":[null,null],"temp":[21.50,21.00],)"
+      R"("hum":[45.00,46.00],"batt":[90,90]})",
+      0, NOW);
+}
+
+void test_clock_set() {
+  sensor_log::add(21.5f, 45.0f, 90, 100);
+  sensor_log::clock_set(NOW - 400);
+  assert_json(
+      R"({"t":[1704066900],"temp":[21.50],"hum":[45.00],"batt":[90]})",
+      0, NOW);
+}
+
+void test_split() {
+  for (uint8_t i = 0; i < 10; i++) sensor_log::add(20.0f, 40.0f, 80, NOW + i);
+  assert_json(
+      R"({"t":[1704067200,1704067201,1704067202,1704067203,1704067204,)"
+      R"(1704067205,1704067206,1704067207],)"
+      R"("temp":[20.00,20.00,20.00,20.00,20.00,20.00,20.00,20.00],)"
+      R"("hum":[40.00,40.00,40.00,40.00,40.00,40.00,40.00,40.00],)"
+      R"("batt":[80,80,80,80,80,80,80,80]})",
+      0, NOW);
+  assert_json(
+      R"({"t":[1704067208,1704067209],"temp":[20.00,20.00],)"
+      R"("hum":[40.00,40.00],"batt":[80,80]})",
+      8, NOW);
+  assert_json("", 10, NOW);
+}
+
+void test_longest_fits() {
+  for (uint8_t i = 0; i < sensor_log::JSON_SAMPLES; i++) {
+    sensor_log::add(-327.68f, 655.35f, 255, i % 2 ? 0 : 0xFFFFFFFF);
+  }
+  char buf[sensor_log::MAX_JSON_LEN + 1];
+  TEST_ASSERT_GREATER_THAN(0, sensor_log::to_json(0, 0xFFFFFFFF, buf,
+                                                  sizeof(buf)));
+}
+
+// sent samples stay until the broker has them
+void test_kept_until_delivered() {
+  for (uint8_t i = 0; i < 3; i++) sensor_log::add(20.0f, 40.0f, 80, NOW + i);
+  sensor_log::sent(3);
+  TEST_ASSERT_EQUAL(3, sensor_log::count());
+  TEST_ASSERT_EQUAL(3, sensor_log::sent_count());
+
+  // one more taken meanwhile isn't removed with them
+  sensor_log::add(20.0f, 40.0f, 80, NOW + 3);
+  sensor_log::delivered(sensor_log::count());
+  TEST_ASSERT_EQUAL(1, sensor_log::count());
+  TEST_ASSERT_EQUAL(0, sensor_log::sent_count());
+  assert_json(
+      R"({"t":[1704067203],"temp":[20.00],"hum":[40.00],"batt":[80]})",
+      0, NOW);
+}
+
+void test_sent_is_capped() {
+  sensor_log::add(20.0f, 40.0f, 80, NOW);
+  sensor_log::sent(5);
+  TEST_ASSERT_EQUAL(1, sensor_log::sent_count());
+  // never goes back
+  sensor_log::add(20.0f, 40.0f, 80, NOW + 1);
+  sensor_log::sent(2);
+  sensor_log::sent(1);
+  TEST_ASSERT_EQUAL(2, sensor_log::sent_count());
+}
+
+// the oldest one dropped when full was one of the sent ones
+void test_full_while_sent() {
+  for (uint8_t i = 0; i < SENSOR_LOG_ENTRIES; i++) {
+    sensor_log::add(20.0f, 40.0f, 80, NOW + i);
+  }
+  sensor_log::sent(SENSOR_LOG_ENTRIES);
+  sensor_log::add(20.0f, 40.0f, 80, NOW + SENSOR_LOG_ENTRIES);
+  TEST_ASSERT_EQUAL(SENSOR_LOG_ENTRIES, sensor_log::count());
+  TEST_ASSERT_EQUAL(SENSOR_LOG_ENTRIES - 1, sensor_log::sent_count());
+
+  sensor_log::delivered(sensor_log::sent_count());
+  TEST_ASSERT_EQUAL(1, sensor_log::count());
+  assert_json(
+      R"({"t":[1704067216],"temp":[20.00],"hum":[40.00],"batt":[80]})",
+      0, NOW);
+}
+
+// the newest delivered sample is the reference for the thresholds
+void test_threshold_after_delivery() {
+  sensor_log::add(20.0f, 40.0f, 80, NOW);
+  sensor_log::sent(1);
+  sensor_log::delivered(1);
+  sensor_log::add(20.5f, 41.0f, 80, NOW + 1);
+  TEST_ASSERT_FALSE(sensor_log::upload_due(SENSOR_LOG_ENTRIES));
+  sensor_log::add(21.5f, 41.0f, 80, NOW + 2);
+  TEST_ASSERT_TRUE(sensor_log::upload_due(SENSOR_LOG_ENTRIES));
+}
+
+void test_force_upload_until_delivered() {
+  sensor_log::add(20.0f, 40.0f, 80, NOW);
+  sensor_log::force_upload();
+  sensor_log::sent(1);
+  TEST_ASSERT_TRUE(sensor_log::upload_due(SENSOR_LOG_ENTRIES));
+  sensor_log::delivered(1);
+  TEST_ASSERT_FALSE(sensor_log::upload_due(SENSOR_LOG_ENTRIES));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_timed);
+  RUN_TEST(test_untimed_have_age);
+  RUN_TEST(test_mixed);
+  RUN_TEST(test_clock_set);
+  RUN_TEST(test_split);
+  RUN_TEST(test_longest_fits);
+  RUN_TEST(test_kept_until_delivered);
+  RUN_TEST(test_sent_is_capped);
+  RUN_TEST(test_full_while_sent);
+  RUN_TEST(test_threshold_after_delivery);
+  RUN_TEST(test_force_upload_until_delivered);
+  return UNITY_END();
+}
@@ -0,0 +1,204 @@
+#include <unity.h>
+
+#include <string>
+
+#include "logger.h"
+#include "state_machine.h"
+
+// Entry and exit order of nested states, and transitions asked for while the
+// states are being entered.
+
+class Machine;
+
+enum class MachineEvent : uint8_t { GO, PARENT_ONLY };
+
+template <>
+struct StateMachineTraits<Machine> {
+  using Event = MachineEvent;
+  static constexpr UBaseType_t EVENT_QUEUE_SIZE = 4;
+  static constexpr uint8_t MAX_TIMERS = 2;
+};
+
+// entry/exit calls, "+Name" and "-Name"
+static std::string calls;
+
+class Traced : public State<Machine> {
+ public:
+  using State<Machine>::State;
+  void entry() override { calls += std::string("+") + get_name() + " "; }
+  void exit() override { calls += std::string("-") + get_name() + " "; }
+};
+
+class IdleState : public Traced {
+ public:
+  using Traced::Traced;
+  bool on_event(MachineEvent event, uint32_t arg) override;
+  const char* get_name() override { return "Idle"; }
+};
+
+// transitions to Other from its entry() if the machine says so
+class ParentState : public Traced {
+ public:
+  using Traced::Traced;
+  void entry() override;
+  bool on_event(MachineEvent event, uint32_t arg) override;
+  const char* get_name() override { return "Parent"; }
+};
+
+class ChildState : public Traced {
+ public:
+  using Traced::Traced;
+  using Parent = ParentState;
+  const char* get_name() override { return "Child"; }
+};
+
+// transitions to Idle from its entry() if the machine says so
+class GrandchildState : public Traced {
+ public:
+  using Traced::Traced;
+  using Parent = ChildState;
+  void entry() override;
+  const char* get_name() override { return "Grandchild"; }
+};
+
+class OtherState : public Traced {
+ public:
+  using Traced::Traced;
+  const char* get_name() override { return "Other"; }
+};
+
+class Machine : public StateMachine<Machine, IdleState, ParentState,
+                                    ChildState, GrandchildState, OtherState>,
+                public Logger {
+ public:
+  Machine() : StateMachine("Machine", *this), Logger("MACHINE") {}
+
+  template <typename Target>
+  void go() {
+    go_ = [](Machine& m) { m.transition_to<Target>(); };
+    post(MachineEvent::GO);
+    run(10, 0);
+  }
+
+  void (*go_)(Machine&) = nullptr;
+  bool parent_leaves_ = false;
+  bool grandchild_leaves_ = false;
+  int parent_events_ = 0;
+};
+
+bool IdleState::on_event(MachineEvent event, uint32_t arg) {
+  if (event != MachineEvent::GO) return false;
+  sm().go_(sm());
+  return true;
+}
+
+void ParentState::entry() {
+  Traced::entry();
+  if (sm().parent_leaves_) transition_to<OtherState>();
+}
+
+bool ParentState::on_event(MachineEvent event, uint32_t arg) {
+  if (event == MachineEvent::PARENT_ONLY) {
+    sm().parent_events_++;
+    return true;
+  }
+  if (event != MachineEvent::GO) return false;
+  sm().go_(sm());
+  return true;
+}
+
+void GrandchildState::entry() {
+  Traced::entry();
+  if (sm().grandchild_leaves_) transition_to<IdleState>();
+}
+
+void setUp() {
+  native_rtos::reset();
+  calls.clear();
+}
+void tearDown() {}
+
+void test_enters_outermost_first() {
+  Machine m;
+  m.run(10, 0);
+  TEST_ASSERT_EQUAL_STRING("+Idle ", calls.c_str());
+  calls.clear();
+
+  m.go<GrandchildState>();
+  TEST_ASSERT_EQUAL_STRING("-Idle +Parent +Child +Grandchild ", calls.c_str());
+  TEST_ASSERT_TRUE(m.is_current_state<GrandchildState>());
+  TEST_ASSERT_TRUE(m.is_in_state<ParentState>());
+}
+
+void test_leaves_up_to_common_parent() {
+  Machine m;
+  m.run(10, 0);
+  m.go<GrandchildState>();
+  calls.clear();
+
+  // the target is left and entered again as well
+  m.go<ChildState>();
+  TEST_ASSERT_EQUAL_STRING("-Grandchild -Child +Child ", calls.c_str());
+  calls.clear();
+
+  // a self transition exits and enters again
+  m.go<ChildState>();
+  TEST_ASSERT_EQUAL_STRING("-Child +Child ", calls.c_str());
+  calls.clear();
+
+  m.go<IdleState>();
+  TEST_ASSERT_EQUAL_STRING("-Child -Parent +Idle ", calls.c_str());
+}
+
+// the child was never left because it was never entered
+void test_parent_entry_transition_is_deferred() {
+  Machine m;
+  m.run(10, 0);
+  calls.clear();
+  m.parent_leaves_ = true;
+
+  m.go<GrandchildState>();
+  TEST_ASSERT_EQUAL_STRING(
+      "-Idle +Parent +Child +Grandchild -Grandchild -Child -Parent +Other ",
+      calls.c_str());
+  TEST_ASSERT_TRUE(m.is_current_state<OtherState>());
+}
+
+void test_innermost_entry_transition() {
+  Machine m;
+  m.run(10, 0);
+  calls.clear();
+  m.grandchild_leaves_ = true;
+
+  m.go<GrandchildState>();
+  TEST_ASSERT_EQUAL_STRING(
+      "-Idle +Parent +Child +Grandchild -Grandchild -Child -Parent +Idle ",
+      calls.c_str());
+  TEST_ASSERT_TRUE(m.is_current_state<IdleState>());
+}
+
+void test_unhandled_events_go_to_parent() {
+  Machine m;
+  m.run(10, 0);
+  m.go<GrandchildState>();
+
+  TEST_ASSERT_TRUE(m.post(MachineEvent::PARENT_ONLY));
+  m.run(10, 0);
+  TEST_ASSERT_EQUAL(1, m.parent_events_);
+
+  // dropped outside the parent
+  m.go<IdleState>();
+  TEST_ASSERT_TRUE(m.post(MachineEvent::PARENT_ONLY));
+  m.run(10, 0);
+  TEST_ASSERT_EQUAL(1, m.parent_events_);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_enters_outermost_first);
+  RUN_TEST(test_leaves_up_to_common_parent);
+  RUN_TEST(test_parent_entry_transition_is_deferred);
+  RUN_TEST(test_innermost_entry_transition);
+  RUN_TEST(test_unhandled_events_go_to_parent);
+  return UNITY_END();
+}
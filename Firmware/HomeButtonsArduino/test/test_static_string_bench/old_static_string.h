@@ -0,0 +1,174 @@
+#ifndef HOMEBUTTONS_TEST_OLD_STATIC_STRING_H
+#define HOMEBUTTONS_TEST_OLD_STATIC_STRING_H
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "Arduino.h"
+
+// StaticString before the cached length and the views, kept as the baseline
+// of the benchmark: strlen() in length() and index_of(), snprintf() for every
+// copy and append. Only the format check changed, to build without warnings.
+template <size_t _MAX_SIZE>
+class OldStaticString {
+  static constexpr size_t MAX_SIZE = _MAX_SIZE + 1;  // to include trailing '\0'
+
+ public:
+  OldStaticString() {}
+  explicit OldStaticString(const char* str) {
+    auto n = std::snprintf(data_, MAX_SIZE, "%s", str);
+    _check_snprintf_return_value(n);
+  }
+
+  explicit OldStaticString(const String& str) {
+    auto n = std::snprintf(data_, MAX_SIZE, "%s", str.c_str());
+    _check_snprintf_return_value(n);
+  }
+
+  template <size_t _OTHER_MAX_SIZE>
+  OldStaticString(const OldStaticString<_OTHER_MAX_SIZE>& other) {
+    auto n = std::snprintf(data_, MAX_SIZE, "%s", other.c_str());
+    _check_snprintf_return_value(n);
+  }
+
+  template <typename... Args>
+  explicit OldStaticString(const char* format, Args... args) {
+    auto n = std::snprintf(data_, MAX_SIZE, format, args...);
+    _check_snprintf_return_value(n);
+  }
+
+  template <typename... Args>
+  void set(Args... args) {
+    *this = OldStaticString(args...);
+  }
+
+  const char* c_str() const { return data_; }
+
+  size_t length() const { return strlen(data_); }
+  bool empty() const { return strlen(data_) == 0; }
+  OldStaticString substring(size_t i) const { return substring(i, length()); }
+  OldStaticString substring(size_t i, size_t j) const {
+    OldStaticString output;
+    if (i > j || i >= length()) {
+      return output;
+    }
+    auto n = std::snprintf(output.data_, std::min(MAX_SIZE, j - i + 1), "%s",
+                           data_ + i);
+    _check_snprintf_return_value(n);
+    return output;
+  }
+
+  // removes any leading or trailing spaces
+  OldStaticString trim(void) {
+    OldStaticString output;
+    if (empty()) {
+      return output;
+    }
+    auto start = data_;
+    while (isspace(*start)) {
+      start++;
+    }
+    auto end = data_ + length() - 1;
+    while (end > start && isspace(*end)) {
+      end--;
+    }
+    auto n = std::snprintf(output.data_, static_cast<size_t>(end - start + 2),
+                           "%s", start);
+    _check_snprintf_return_value(n);
+    return output;
+  }
+
+  // returns index of first occurrence of c, or -1 if not found
+  int index_of(char c, unsigned int start = 0) const {
+    if (start >= length()) {
+      return -1;
+    }
+    for (unsigned int i = start; i < length(); i++) {
+      if (data_[i] == c) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  template <typename T>
+  OldStaticString operator+(T other) const {
+    OldStaticString output = *this;
+    output += other;
+    return output;
+  }
+
+  template <size_t _OTHER_MAX_SIZE>
+  OldStaticString& operator+=(const OldStaticString<_OTHER_MAX_SIZE>& other) {
+    *this += other.c_str();
+    return *this;
+  }
+
+  OldStaticString& operator+=(const String& other) {
+    *this += other.c_str();
+    return *this;
+  }
+
+  OldStaticString& operator+=(unsigned long i) {
+    auto offset = length();
+    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%lu", i);
+    _check_snprintf_return_value(n);
+    return *this;
+  }
+
+  OldStaticString& operator+=(int i) {
+    auto offset = length();
+    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%d", i);
+    _check_snprintf_return_value(n);
+    return *this;
+  }
+
+  OldStaticString& operator+=(const char* other) {
+    auto offset = length();
+    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%s", other);
+    _check_snprintf_return_value(n);
+    return *this;
+  }
+
+  OldStaticString& operator+=(char other) {
+    auto offset = length();
+    auto n = std::snprintf(&data_[offset], MAX_SIZE - offset, "%c", other);
+    _check_snprintf_return_value(n);
+    return *this;
+  }
+
+  OldStaticString& operator=(const char* other) {
+    if (!other) {
+      data_[0] = '\0';
+      return *this;
+    }
+    auto n = std::snprintf(data_, MAX_SIZE, "%s", other);
+    _check_snprintf_return_value(n);
+    return *this;
+  }
+
+  bool operator==(const char* other) const {
+    return std::strncmp(data_, other, MAX_SIZE) == 0;
+  }
+
+  template <size_t _OTHER_MAX_SIZE>
+  bool operator==(const OldStaticString<_OTHER_MAX_SIZE> other) const {
+    constexpr size_t OTHER_MAX_SIZE =
+        OldStaticString<_OTHER_MAX_SIZE>::MAX_SIZE;
+    return std::strncmp(data_, other.data_,
+                        std::min(MAX_SIZE, OTHER_MAX_SIZE)) == 0;
+  }
+
+ private:
+  char data_[MAX_SIZE] = {'\0'};
+  void _check_snprintf_return_value(int value) const {
+    if (value < 0)
+      ESP_LOGE("static_string", "format failed");
+    else if (static_cast<size_t>(value) >= MAX_SIZE)
+      ESP_LOGE("static_string",
+               "buffer too small (size: %u, wanted: %d, content: %s)",
+               static_cast<unsigned>(MAX_SIZE), value, data_);
+  }
+};
+
+#endif  // HOMEBUTTONS_TEST_OLD_STATIC_STRING_H
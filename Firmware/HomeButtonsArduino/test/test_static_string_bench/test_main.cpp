@@ -0,0 +1,213 @@
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+#include "config.h"
+#include "mqtt_helper.h"
+#include "old_static_string.h"
+#include "static_string.h"
+
+// Benchmark of StaticString before and after the cached length, memcpy based
+// appends and views, on the three uses it was reworked for: building the
+// discovery topics, parsing the button labels and splitting a UI message into
+// lines. The before code runs on OldStaticString as it was written then, the
+// after code on StaticString as it is written now. Host timings, only the
+// ratio carries over to the ESP32-S2.
+
+static constexpr int ROUNDS = 20000;
+
+// UIState::MessageType
+static constexpr size_t MESSAGE_SIZE = 64;
+
+static const char* LABELS[] = {
+    "Kitchen", "90;Kitchen", "mdi:lightbulb", "mdi:90;fan", "mdi:fan __Fan",
+    "___Living room"};
+static constexpr size_t NUM_LABELS = std::size(LABELS);
+// volatile, or the optimizer builds the topics at compile time
+static const char* volatile PREFIX = "homeassistant";
+static const char* volatile UNIQUE_ID = "hbtn-a1b2c3";
+static const char* MESSAGE = "Wi-Fi\nconnection\nfailed.\nRetrying in\n60 s";
+static constexpr uint16_t MESSAGE_LINES = 5;
+
+// as in MQTTHelper::send_discovery_config(), once per button
+template <template <size_t> class String>
+static uint32_t build_topics(const char* prefix, const char* unique_id) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    String<MAX_TOPIC_LENGTH> topic = String<MAX_TOPIC_LENGTH>{} + prefix +
+                                     "/text/" + unique_id + "/button_" +
+                                     (i + 1) + "_label/config";
+    total += topic.length();
+  }
+  return total;
+}
+
+// label handling of Display::draw_main() before the descriptors, without the
+// drawing; it stayed the same code, only the string underneath changes
+template <template <size_t> class String>
+static uint32_t parse_labels(
+    const String<BTN_LABEL_MAXLEN> (&labels)[NUM_LABELS]) {
+  uint32_t total = 0;
+  for (const auto& stored : labels) {
+    String<BTN_LABEL_MAXLEN> label = stored;
+    String<48> icon;
+    String<56> text;
+    uint16_t rotation = 0;
+    if (label.substring(0, 4) == "mdi:") {
+      int space = label.index_of(' ');
+      if (label.index_of(';') > 0) {
+        icon = label.substring(label.index_of(';') + 1,
+                               space > 0 ? space : label.length());
+        rotation = atoi(label.substring(4, label.index_of(';')).c_str());
+      } else {
+        icon = label.substring(4, space > 0 ? space : label.length());
+      }
+      if (space > 0) text = label.substring(space + 1);
+    } else {
+      if (label.index_of(';') > 0) {
+        rotation = atoi(label.substring(0, label.index_of(';')).c_str());
+        label = label.substring(label.index_of(';') + 1).c_str();
+      }
+      text = label.c_str();
+    }
+    while (text.index_of('_') == 0) text = text.substring(1);
+    total += rotation + icon.length() + text.length();
+  }
+  return total;
+}
+
+// Display::draw_message() before: the rest of the message copied per line
+static uint32_t split_lines_copy(
+    const OldStaticString<MESSAGE_SIZE>& message) {
+  uint32_t total = 0;
+  OldStaticString<MESSAGE_SIZE> part;
+  OldStaticString<MESSAGE_SIZE> remain = message;
+  uint16_t lines = 0;
+  do {
+    if (remain.index_of('\n') < 0) {
+      part = remain;
+      remain = "";
+    } else {
+      part = remain.substring(0, remain.index_of('\n'));
+      remain = remain.substring(remain.index_of('\n') + 1);
+    }
+    lines += 1;
+  } while (strcmp(remain.c_str(), "") != 0);
+
+  remain = message;
+  do {
+    if (remain.index_of('\n') < 0) {
+      part = remain;
+      remain = "";
+    } else {
+      part = remain.substring(0, remain.index_of('\n'));
+      remain = remain.substring(remain.index_of('\n') + 1);
+    }
+    total += part.length();
+  } while (strcmp(remain.c_str(), "") != 0);
+  return total * lines;
+}
+
+// Display::draw_message() now: views into the message
+static uint32_t split_lines_view(const StaticString<MESSAGE_SIZE>& message) {
+  uint32_t total = 0;
+  StaticString<MESSAGE_SIZE> part;
+  StaticStringView remain = message.view();
+  uint16_t lines = 0;
+  do {
+    int end = remain.index_of('\n');
+    remain = end < 0 ? StaticStringView() : remain.substring(end + 1);
+    lines += 1;
+  } while (!remain.empty());
+
+  remain = message.view();
+  do {
+    int end = remain.index_of('\n');
+    if (end < 0) {
+      part = remain;
+      remain = StaticStringView();
+    } else {
+      part = remain.substring(0, end);
+      remain = remain.substring(end + 1);
+    }
+    total += part.length();
+  } while (!remain.empty());
+  return total * lines;
+}
+
+struct Timing {
+  double before_ns;
+  double after_ns;
+};
+
+template <typename Before, typename After>
+static Timing measure(const char* name, Before before, After after) {
+  uint32_t before_sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < ROUNDS; round++) before_sum += before();
+  auto before_time = std::chrono::steady_clock::now() - start;
+
+  uint32_t after_sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (int round = 0; round < ROUNDS; round++) after_sum += after();
+  auto after_time = std::chrono::steady_clock::now() - start;
+
+  Timing timing = {
+      std::chrono::duration<double, std::nano>(before_time).count() / ROUNDS,
+      std::chrono::duration<double, std::nano>(after_time).count() / ROUNDS};
+  char line[128];
+  snprintf(line, sizeof(line), "%s: before %.0f ns, after %.0f ns (%.1fx)",
+           name, timing.before_ns, timing.after_ns,
+           timing.before_ns / timing.after_ns);
+  TEST_MESSAGE(line);
+
+  // same work done on both sides
+  TEST_ASSERT_EQUAL(before_sum, after_sum);
+  return timing;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_topic_building() {
+  Timing timing = measure(
+      "topics",
+      [] { return build_topics<OldStaticString>(PREFIX, UNIQUE_ID); },
+      [] { return build_topics<StaticString>(PREFIX, UNIQUE_ID); });
+  TEST_ASSERT_TRUE(timing.after_ns < timing.before_ns);
+}
+
+void test_label_parsing() {
+  OldStaticString<BTN_LABEL_MAXLEN> old_labels[NUM_LABELS];
+  StaticString<BTN_LABEL_MAXLEN> labels[NUM_LABELS];
+  for (uint8_t i = 0; i < NUM_LABELS; i++) {
+    old_labels[i] = LABELS[i];
+    labels[i] = LABELS[i];
+  }
+  Timing timing = measure(
+      "labels", [&] { return parse_labels<OldStaticString>(old_labels); },
+      [&] { return parse_labels<StaticString>(labels); });
+  TEST_ASSERT_TRUE(timing.after_ns < timing.before_ns);
+}
+
+void test_message_lines() {
+  OldStaticString<MESSAGE_SIZE> old_message(MESSAGE);
+  StaticString<MESSAGE_SIZE> message(MESSAGE);
+  TEST_ASSERT_EQUAL((strlen(MESSAGE) - MESSAGE_LINES + 1) * MESSAGE_LINES,
+                    split_lines_view(message));
+  Timing timing = measure(
+      "message lines", [&] { return split_lines_copy(old_message); },
+      [&] { return split_lines_view(message); });
+  TEST_ASSERT_TRUE(timing.after_ns < timing.before_ns);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_topic_building);
+  RUN_TEST(test_label_parsing);
+  RUN_TEST(test_message_lines);
+  return UNITY_END();
+}
@@ -0,0 +1,188 @@
+#include <unity.h>
+
+#include "config.h"
+#include "wake_schedule.h"
+
+using wake_schedule::Source;
+
+// The schedule runs on the host's clock. Deadlines are set relative to now
+// and moved with clock_set() to make time pass, so the tests don't wait.
+
+static constexpr uint64_t US_PER_S = 1000000;
+// now moves on while a test runs
+static constexpr uint64_t TOLERANCE_US = 500000;
+
+static constexpr Source SOURCES[] = {Source::SENSOR, Source::SCHEDULED,
+                                     Source::INFO_SCREEN, Source::RETRY};
+
+// as after a wake with nothing due
+void setUp() {
+  for (Source source : SOURCES) wake_schedule::clear(source);
+  wake_schedule::wakeup();
+}
+
+void tearDown() {}
+
+static void assert_sleep_s(uint64_t expected_s) {
+  TEST_ASSERT_UINT64_WITHIN(TOLERANCE_US, expected_s * US_PER_S,
+                            wake_schedule::sleep_time_us());
+}
+
+void test_empty() {
+  TEST_ASSERT_EQUAL_UINT64(0, wake_schedule::sleep_time_us());
+  for (Source source : SOURCES) TEST_ASSERT_FALSE(wake_schedule::due(source));
+}
+
+// the earliest deadline sets the timer, whatever order they were set in
+void test_earliest_first() {
+  wake_schedule::set(Source::SCHEDULED, 900);
+  wake_schedule::set(Source::INFO_SCREEN, 300);
+  wake_schedule::set(Source::RETRY, 600);
+  assert_sleep_s(300);
+
+  wake_schedule::clear(Source::INFO_SCREEN);
+  assert_sleep_s(600);
+  // replaces the earlier deadline of the source
+  wake_schedule::set(Source::RETRY, 1200);
+  assert_sleep_s(900);
+}
+
+void test_at_least_one_second() {
+  wake_schedule::set(Source::SCHEDULED, 0);
+  TEST_ASSERT_EQUAL_UINT64(US_PER_S, wake_schedule::sleep_time_us());
+}
+
+void test_never_longer_than_max() {
+  wake_schedule::set(Source::SCHEDULED, WAKE_MAX_SLEEP + 3600);
+  assert_sleep_s(WAKE_MAX_SLEEP);
+}
+
+// deadlines within the window are handled in the same wake
+void test_merged_within_window() {
+  wake_schedule::set(Source::SCHEDULED, 100);
+  wake_schedule::set(Source::INFO_SCREEN, 100 + WAKE_COALESCE_WINDOW - 5);
+  wake_schedule::set(Source::RETRY, 100 + WAKE_COALESCE_WINDOW + 60);
+  wake_schedule::clock_set(-100);  // 100 s later
+  wake_schedule::wakeup();
+
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::SCHEDULED));
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::INFO_SCREEN));
+  TEST_ASSERT_FALSE(wake_schedule::due(Source::RETRY));
+  TEST_ASSERT_FALSE(wake_schedule::due(Source::SENSOR));
+  // one-shot deadlines are consumed, the next wake is for the other one
+  assert_sleep_s(WAKE_COALESCE_WINDOW + 60);
+}
+
+void test_not_due_twice() {
+  wake_schedule::set(Source::SCHEDULED, 0);
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::SCHEDULED));
+  wake_schedule::wakeup();
+  TEST_ASSERT_FALSE(wake_schedule::due(Source::SCHEDULED));
+}
+
+// set() during the wake means it's handled and rescheduled
+void test_set_clears_due() {
+  wake_schedule::set(Source::RETRY, 0);
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::RETRY));
+  wake_schedule::set(Source::RETRY, 300);
+  TEST_ASSERT_FALSE(wake_schedule::due(Source::RETRY));
+  assert_sleep_s(300);
+}
+
+void test_periodic_starts() {
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600);
+  // not due, a repeated call doesn't move it
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600);
+}
+
+// the deadline moves on by the interval, not from the time of the wake, so
+// waking early or late doesn't add up
+void test_periodic_keeps_phase() {
+  wake_schedule::every(Source::SENSOR, 600);
+  // woke up 20 s early, within the window
+  wake_schedule::clock_set(-(600 - 20));
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::SENSOR));
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600 + 20);
+
+  // woke up 10 s late
+  wake_schedule::clock_set(-(620 + 10));
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::SENSOR));
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600 - 10);
+}
+
+// periodic deadlines aren't consumed by the wake
+void test_periodic_stays() {
+  wake_schedule::every(Source::SENSOR, 600);
+  wake_schedule::clock_set(-600);
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::SENSOR));
+  TEST_ASSERT_EQUAL_UINT64(US_PER_S, wake_schedule::sleep_time_us());
+}
+
+// more than a whole interval behind starts over instead of catching up
+void test_periodic_fell_behind() {
+  wake_schedule::every(Source::SENSOR, 600);
+  wake_schedule::clock_set(-(3 * 600 + 100));
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::SENSOR));
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600);
+}
+
+void test_periodic_interval_shortened() {
+  wake_schedule::every(Source::SENSOR, 3600);
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600);
+}
+
+// the clock went back without clock_set(), shifting the deadlines is the
+// same: they seem far away, but the device still wakes at WAKE_MAX_SLEEP
+void test_clock_jumped_back() {
+  wake_schedule::set(Source::SCHEDULED, 900);
+  wake_schedule::every(Source::SENSOR, 600);
+  wake_schedule::clock_set(1000000);
+  assert_sleep_s(WAKE_MAX_SLEEP);
+  wake_schedule::wakeup();
+  TEST_ASSERT_FALSE(wake_schedule::due(Source::SENSOR));
+  TEST_ASSERT_FALSE(wake_schedule::due(Source::SCHEDULED));
+  // and the periodic deadline starts over once it's noticed
+  wake_schedule::every(Source::SENSOR, 600);
+  assert_sleep_s(600);
+}
+
+// drift of the sleep timer: wakes a little before the deadline, which is
+// still handled in that wake instead of another one seconds later
+void test_early_wake() {
+  wake_schedule::set(Source::INFO_SCREEN, 300);
+  wake_schedule::clock_set(-(300 - 3));
+  wake_schedule::wakeup();
+  TEST_ASSERT_TRUE(wake_schedule::due(Source::INFO_SCREEN));
+  TEST_ASSERT_EQUAL_UINT64(0, wake_schedule::sleep_time_us());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_earliest_first);
+  RUN_TEST(test_at_least_one_second);
+  RUN_TEST(test_never_longer_than_max);
+  RUN_TEST(test_merged_within_window);
+  RUN_TEST(test_not_due_twice);
+  RUN_TEST(test_set_clears_due);
+  RUN_TEST(test_periodic_starts);
+  RUN_TEST(test_periodic_keeps_phase);
+  RUN_TEST(test_periodic_stays);
+  RUN_TEST(test_periodic_fell_behind);
+  RUN_TEST(test_periodic_interval_shortened);
+  RUN_TEST(test_clock_jumped_back);
+  RUN_TEST(test_early_wake);
+  return UNITY_END();
+}
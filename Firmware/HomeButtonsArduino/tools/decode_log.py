@@ -0,0 +1,206 @@
+#!/usr/bin/env python
+"""Decodes the binary log history of a Home Buttons device.
+
+The device keeps its last log entries in RTC memory as (timestamp, tag,
+format string address, raw arguments), see src/log_ring.h. Publishing "raw"
+to {BASE_TOPIC}/{DEVICE_NAME}/cmd/log makes it dump them as hex lines on
+{BASE_TOPIC}/{DEVICE_NAME}/log. This script formats them using the format
+strings from the ELF file of the firmware that wrote them.
+
+Usage:
+    decode_log.py firmware.elf --host 192.168.0.10 --device "Home Buttons"
+    decode_log.py firmware.elf --input dump.txt
+
+The ELF is .pio/build/<env>/firmware.elf. --input reads lines saved with
+e.g. mosquitto_sub -t "homebuttons/Home Buttons/log".
+
+Requires pyelftools, and paho-mqtt for --host.
+"""
+
+import argparse
+import hashlib
+import re
+import struct
+import sys
+import time
+
+from elftools.elf.constants import SH_FLAGS
+from elftools.elf.elffile import ELFFile
+
+ENTRY_HEADER = "<IIHBBBB2x"  # src/log_ring.h Entry
+ENTRY_HEADER_SIZE = struct.calcsize(ENTRY_HEADER)
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D", 5: "V"}
+SPEC = re.compile(
+    r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?([hlLqjzt]*)([diouxXcpfFeEgGaAs%])")
+IDLE_TIMEOUT = 3  # s
+
+
+class Firmware:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.id = hashlib.sha256(f.read()).digest()[:8]
+        self._file = open(path, "rb")
+        self._sections = [
+            s for s in ELFFile(self._file).iter_sections()
+            if s["sh_flags"] & SH_FLAGS.SHF_ALLOC and s["sh_type"] == "SHT_PROGBITS"
+        ]
+
+    def string(self, address):
+        for section in self._sections:
+            start = section["sh_addr"]
+            if start <= address < start + section["sh_size"]:
+                data = section.data()[address - start:]
+                return data[:data.index(b"\0")].decode(errors="replace")
+        return None
+
+
+def format_entry(fmt, args):
+    pos = 0
+    missing = False
+
+    def take(size, signed=False):
+        nonlocal pos, missing
+        if missing or pos + size > len(args):
+            missing = True
+            return None
+        kind = {4: "i", 8: "q"}[size]
+        value = struct.unpack_from("<" + (kind if signed else kind.upper()),
+                                   args, pos)[0]
+        pos += size
+        return value
+
+    def convert(match):
+        nonlocal pos, missing
+        flags, width, precision, length, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if width == "*":
+            width = take(4, True)
+        if precision == "*":
+            precision = take(4, True)
+        if conv == "s":
+            end = args.find(b"\0", pos)
+            if missing or end < 0:
+                missing = True
+                return "?"
+            value = args[pos:end].decode(errors="replace")
+            pos = end + 1
+        elif conv in "fFeEgGaA":
+            if missing or pos + 8 > len(args):
+                missing = True
+                return "?"
+            value = struct.unpack_from("<d", args, pos)[0]
+            pos += 8
+            conv = {"a": "e", "A": "E"}.get(conv, conv)
+        else:
+            size = 8 if length.count("l") >= 2 or set(length) & set("qjL") else 4
+            value = take(size, conv in "di")
+            if value is None:
+                return "?"
+            if conv == "c":
+                value = chr(value & 0xFF)
+            elif conv == "p":
+                return f"0x{value:08x}"
+            conv = {"i": "d", "u": "d"}.get(conv, conv)
+        if missing:
+            return "?"
+        spec = "%" + flags + (str(width) if width is not None else "")
+        if precision is not None:
+            spec += "." + str(precision)
+        return (spec + ("s" if conv == "c" else conv)) % value
+
+    def safe_convert(match):
+        try:
+            return convert(match)
+        except (TypeError, ValueError):
+            return match.group(0)
+
+    return SPEC.sub(safe_convert, fmt)
+
+
+def decode(lines, firmware):
+    tags = {}
+    boot = None
+    out = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith("HBL1 "):
+            _, fw_id, boot = line.split()
+            if bytes.fromhex(fw_id) != firmware.id:
+                print("warning: log was written by a different firmware, "
+                      "format strings will be wrong", file=sys.stderr)
+        elif line.startswith("T "):
+            _, tag_id, name = line.split(maxsplit=2)
+            tags[int(tag_id)] = name
+        elif line.startswith("E "):
+            data = bytes.fromhex(line[2:])
+            timestamp, fmt_addr, entry_boot, level, tag, args_len, flags = \
+                struct.unpack_from(ENTRY_HEADER, data)
+            args = data[ENTRY_HEADER_SIZE:ENTRY_HEADER_SIZE + args_len]
+            fmt = firmware.string(fmt_addr)
+            if fmt is None:
+                text = f"<unknown format 0x{fmt_addr:08x}>"
+            else:
+                text = format_entry(fmt, args)
+            marker = "" if str(entry_boot) == boot else f"#{entry_boot} "
+            out.append(f"[{marker}{timestamp:6d}][{LEVELS.get(level, '?')}]"
+                       f"[{tags.get(tag, '?'):<8}] {text}")
+    return out
+
+
+def read_mqtt(args):
+    import paho.mqtt.client as mqtt
+
+    common = f"{args.base_topic}/{args.device}/"
+    lines = []
+    last = [time.time()]
+
+    def on_message(client, userdata, msg):
+        lines.extend(msg.payload.decode().splitlines())
+        last[0] = time.time()
+
+    client = mqtt.Client()
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.subscribe(common + "log")
+    client.loop_start()
+    # retained, so a sleeping device dumps the log on its next wakeup
+    client.publish(common + "cmd/log", "raw", qos=1, retain=True)
+    print("waiting for the device...", file=sys.stderr)
+    while not lines or time.time() - last[0] < IDLE_TIMEOUT:
+        time.sleep(0.1)
+    client.loop_stop()
+    client.disconnect()
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware.elf of the running firmware")
+    parser.add_argument("--input", help="file with dumped lines")
+    parser.add_argument("--host")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--base-topic", default="homebuttons")
+    parser.add_argument("--device", help="device name")
+    args = parser.parse_args()
+
+    if args.input:
+        with open(args.input) as f:
+            lines = f.read().splitlines()
+    elif args.host and args.device:
+        lines = read_mqtt(args)
+    else:
+        parser.error("either --input or --host and --device are required")
+
+    for line in decode(lines, Firmware(args.elf)):
+        print(line)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
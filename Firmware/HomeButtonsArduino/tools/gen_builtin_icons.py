@@ -0,0 +1,257 @@
+#!/usr/bin/env python
+"""Generates src/builtin_icons_data.h from builtin_icons.ini.
+
+Every configured MDI icon is fetched (BMP, same source the firmware downloads
+from), converted to a 1-bpp XBM bitmap (LSB first, rows padded to full bytes)
+and compressed with PackBits. The result is a sorted table of constexpr arrays
+that MDIHelper looks up before touching SPIFFS or the network.
+
+Usage:
+    gen_builtin_icons.py [--config builtin_icons.ini] [--output FILE]
+                         [--source DIR] [--cache DIR] [--force]
+
+--source points to a local checkout of the MDI-BMP repository and skips the
+network entirely. Downloaded files are cached in --cache.
+"""
+
+import argparse
+import configparser
+import hashlib
+import os
+import struct
+import sys
+import urllib.request
+
+PROJECT_DIR = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+DEFAULT_CONFIG = os.path.join(PROJECT_DIR, "builtin_icons.ini")
+DEFAULT_OUTPUT = os.path.join(PROJECT_DIR, "src", "builtin_icons_data.h")
+DEFAULT_CACHE = os.path.join(PROJECT_DIR, ".pio", "icon_cache")
+
+HASH_PREFIX = "// config-hash: "
+DOWNLOAD_TIMEOUT = 10  # s
+
+
+def read_config(path):
+    parser = configparser.ConfigParser()
+    parser.read(path)
+    url = parser.get("source", "url")
+    sizes = {
+        model: [int(s) for s in value.replace(",", " ").split()]
+        for model, value in parser.items("sizes")
+    }
+    names = [n.strip() for n in parser.get("icons", "names").split() if n.strip()]
+    return url, sizes, sorted(set(names))
+
+
+def config_hash(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    with open(__file__, "rb") as f:
+        data += f.read()
+    return hashlib.sha1(data).hexdigest()
+
+
+def is_up_to_date(config_path, output_path):
+    if not os.path.isfile(output_path):
+        return False
+    with open(output_path) as f:
+        for line in f:
+            if line.startswith(HASH_PREFIX):
+                return line[len(HASH_PREFIX):].strip() == config_hash(config_path)
+    return False
+
+
+def fetch_bmp(name, size, url, source_dir, cache_dir):
+    rel_path = f"{size}x{size}/{name}.bmp"
+    if source_dir:
+        path = os.path.join(source_dir, rel_path)
+        with open(path, "rb") as f:
+            return f.read()
+
+    cache_path = os.path.join(cache_dir, rel_path)
+    if os.path.isfile(cache_path):
+        with open(cache_path, "rb") as f:
+            return f.read()
+
+    with urllib.request.urlopen(url + rel_path, timeout=DOWNLOAD_TIMEOUT) as r:
+        data = r.read()
+    os.makedirs(os.path.dirname(cache_path), exist_ok=True)
+    with open(cache_path, "wb") as f:
+        f.write(data)
+    return data
+
+
+def bmp_to_xbm(data):
+    """Converts an uncompressed BMP to XBM bits using the same black/white
+    threshold as MDIHelper::_decode_bmp()."""
+    if data[0:2] != b"BM":
+        raise ValueError("not a BMP file")
+    image_offset = struct.unpack_from("<I", data, 10)[0]
+    header_size = struct.unpack_from("<I", data, 14)[0]
+    width, height = struct.unpack_from("<ii", data, 18)
+    planes, depth = struct.unpack_from("<HH", data, 26)
+    compression = struct.unpack_from("<I", data, 30)[0]
+    if planes != 1 or compression not in (0, 3):
+        raise ValueError("unsupported BMP format")
+
+    flip = height > 0
+    height = abs(height)
+    row_size = ((width * depth + 31) // 32) * 4
+
+    palette = []
+    if depth <= 8:
+        palette_offset = 14 + header_size
+        for i in range(1 << depth):
+            b, g, r = data[palette_offset + 4 * i:palette_offset + 4 * i + 3]
+            palette.append(r + g + b > 3 * 0x80)
+
+    def is_white(row, col):
+        offset = image_offset + row * row_size
+        if depth == 24 or depth == 32:
+            px = offset + col * (depth // 8)
+            b, g, r = data[px:px + 3]
+            return r + g + b > 3 * 0x80
+        if depth == 16:
+            lsb, msb = data[offset + 2 * col:offset + 2 * col + 2]
+            b = (lsb & 0x1F) << 3
+            if compression == 0:
+                g = ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2)
+                r = (msb & 0x7C) << 1
+            else:
+                g = ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3)
+                r = msb & 0xF8
+            return r + g + b > 3 * 0x80
+        bit = col * depth
+        byte = data[offset + bit // 8]
+        index = (byte >> (8 - depth - bit % 8)) & ((1 << depth) - 1)
+        return palette[index]
+
+    stride = (width + 7) // 8
+    bits = bytearray(stride * height)
+    for y in range(height):
+        src_row = height - 1 - y if flip else y
+        for x in range(width):
+            if not is_white(src_row, x):
+                bits[y * stride + x // 8] |= 1 << (x % 8)
+    return width, height, bytes(bits)
+
+
+def packbits(data):
+    out = bytearray()
+    i = 0
+    n = len(data)
+    while i < n:
+        run = 1
+        while i + run < n and run < 128 and data[i + run] == data[i]:
+            run += 1
+        if run >= 3:
+            out.append(257 - run)
+            out.append(data[i])
+            i += run
+            continue
+        start = i
+        i += run
+        while i < n and i - start < 128:
+            if i + 2 < n and data[i] == data[i + 1] == data[i + 2]:
+                break
+            i += 1
+        out.append(i - start - 1)
+        out += data[start:i]
+    return bytes(out)
+
+
+def c_identifier(name, size):
+    return "icon_" + name.replace("-", "_") + f"_{size}"
+
+
+def format_array(identifier, data):
+    lines = [f"static constexpr uint8_t {identifier}[] = {{"]
+    for i in range(0, len(data), 12):
+        chunk = ", ".join(f"0x{b:02x}" for b in data[i:i + 12])
+        lines.append(f"    {chunk},")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def generate(config_path, output_path, source_dir, cache_dir):
+    url, sizes, names = read_config(config_path)
+    guards = {"original": "#ifndef HOME_BUTTONS_MINI", "mini": "#ifdef HOME_BUTTONS_MINI"}
+
+    out = [
+        "// Generated by tools/gen_builtin_icons.py from builtin_icons.ini.",
+        "// Do not edit.",
+        None,  # config hash, see below
+        "#ifndef HOMEBUTTONS_BUILTIN_ICONS_DATA_H",
+        "#define HOMEBUTTONS_BUILTIN_ICONS_DATA_H",
+        "",
+    ]
+    num_icons = 0
+    num_failed = 0
+    total_raw = 0
+    total_packed = 0
+    for model, model_sizes in sizes.items():
+        if model not in guards:
+            raise ValueError(f"unknown model '{model}' in [sizes]")
+        arrays = []
+        table = []
+        for name in names:
+            for size in sorted(model_sizes):
+                try:
+                    bmp = fetch_bmp(name, size, url, source_dir, cache_dir)
+                    width, height, bits = bmp_to_xbm(bmp)
+                except Exception as e:  # keep going, icon will be downloaded
+                    print(f"gen_builtin_icons: skipping {name} ({size}): {e}")
+                    num_failed += 1
+                    continue
+                packed = packbits(bits)
+                total_raw += len(bits)
+                total_packed += len(packed)
+                identifier = c_identifier(name, size)
+                arrays.append(format_array(identifier, packed))
+                table.append(
+                    f'    {{"{name}", {size}, {width}, {height}, {identifier}, '
+                    f"sizeof({identifier})}},")
+        num_icons += len(table)
+        out.append(guards[model])
+        if table:
+            out += arrays
+            out.append("")
+            out.append("#define HAS_BUILTIN_ICONS")
+            out.append("static constexpr BuiltinIcon BUILTIN_ICONS[] = {")
+            out += table
+            out.append("};")
+        out.append(f"#endif  // {model}")
+        out.append("")
+    out.append("#endif  // HOMEBUTTONS_BUILTIN_ICONS_DATA_H")
+    # without the hash an incomplete set is generated again on the next build
+    out[2] = (HASH_PREFIX + config_hash(config_path) if num_failed == 0 else
+              f"// incomplete: {num_failed} icons missing")
+
+    with open(output_path, "w") as f:
+        f.write("\n".join(out) + "\n")
+    print(f"gen_builtin_icons: {num_icons} icons, {total_raw} B raw, "
+          f"{total_packed} B compressed -> {os.path.relpath(output_path)}")
+    if num_failed > 0:
+        print(f"gen_builtin_icons: {num_failed} icons missing, "
+              "retrying on the next build")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--config", default=DEFAULT_CONFIG)
+    parser.add_argument("--output", default=DEFAULT_OUTPUT)
+    parser.add_argument("--source", help="local MDI-BMP checkout")
+    parser.add_argument("--cache", default=DEFAULT_CACHE)
+    parser.add_argument("--force", action="store_true")
+    args = parser.parse_args()
+
+    if not args.force and is_up_to_date(args.config, args.output):
+        print("gen_builtin_icons: up to date")
+        return 0
+    generate(args.config, args.output, args.source, args.cache)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,114 @@
+#!/usr/bin/env python
+"""Minimal LAN icon mirror for Home Buttons.
+
+Serves MDI icons with the same layout as the MDI-BMP repository
+(/<size>x<size>/<name>.bmp) plus a /bundle endpoint that returns several
+icons in one response:
+
+    GET /bundle?sizes=64,48&icons=lightbulb,fan
+
+Bundle format (little endian), see src/icon_bundle.h:
+
+    "HBB1", uint16 count, uint16 reserved
+    count x {char name[48], uint16 size, uint16 reserved, uint32 length}
+    BMP files concatenated in table order
+
+Icons are read from --root. Missing icons are fetched from the upstream
+source once and stored in --root, unless --offline is given.
+
+Set the icon source of the device to http://<mirror-ip>:<port>/ in the setup
+portal or via the cmd/icon_source topic.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+from gen_builtin_icons import DEFAULT_CONFIG, read_config, fetch_bmp
+
+NAME_RE = re.compile(r"^[a-z0-9-]{1,47}$")
+MAX_ENTRIES = 24  # IconBundleParser::MAX_ENTRIES
+PATH_RE = re.compile(r"^/(\d+)x\1/([a-z0-9-]+)\.bmp$")
+
+
+def load_icon(root, upstream, name, size):
+    if not NAME_RE.match(name) or not 0 < size <= 1024:
+        return None
+    try:
+        return fetch_bmp(name, size, upstream, None, root) if upstream else \
+            fetch_bmp(name, size, None, root, None)
+    except Exception as e:
+        print(f"icon_mirror: {name} ({size}) not available: {e}")
+        return None
+
+
+def build_bundle(entries):
+    table = b""
+    data = b""
+    for name, size, bmp in entries:
+        table += struct.pack("<48sHHI", name.encode(), size, 0, len(bmp))
+        data += bmp
+    return struct.pack("<4sHH", b"HBB1", len(entries), 0) + table + data
+
+
+def make_handler(root, upstream):
+    class Handler(BaseHTTPRequestHandler):
+        def _send(self, code, body=b"", content_type="application/octet-stream"):
+            self.send_response(code)
+            self.send_header("Content-Type", content_type)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_GET(self):
+            url = urlparse(self.path)
+            if url.path == "/bundle":
+                query = parse_qs(url.query)
+                sizes = [int(s) for s in ",".join(query.get("sizes", [])).split(",") if s]
+                names = [n for n in ",".join(query.get("icons", [])).split(",") if n]
+                entries = []
+                for name in names:
+                    for size in sizes:
+                        bmp = load_icon(root, upstream, name, size)
+                        if bmp is not None:
+                            entries.append((name, size, bmp))
+                if len(entries) > MAX_ENTRIES:
+                    return self._send(413)
+                return self._send(200, build_bundle(entries))
+
+            match = PATH_RE.match(url.path)
+            if match:
+                bmp = load_icon(root, upstream, match.group(2), int(match.group(1)))
+                if bmp is not None:
+                    return self._send(200, bmp, "image/bmp")
+            self._send(404)
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--root", default="icons", help="icon directory")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--offline", action="store_true",
+                        help="serve only icons already in --root")
+    args = parser.parse_args()
+
+    upstream = None if args.offline else read_config(DEFAULT_CONFIG)[0]
+    os.makedirs(args.root, exist_ok=True)
+    server = ThreadingHTTPServer(("", args.port), make_handler(args.root, upstream))
+    print(f"icon_mirror: serving '{args.root}' on port {args.port}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
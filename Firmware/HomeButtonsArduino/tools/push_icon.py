@@ -0,0 +1,123 @@
+#!/usr/bin/env python
+"""Pushes MDI icons to a Home Buttons device over MQTT (cmd/icon topic).
+
+Icons are sent as 1-bpp bitmaps split into chunks that fit into the device's
+MQTT buffer, or with --single as one message which the device receives in
+pieces (MQTT over TCP only, not MQTT-SN). The device must be awake (Awake mode or right after a button
+press) and answers on the {BASE_TOPIC}/{DEVICE_NAME}/icon topic.
+
+Usage:
+    push_icon.py --host 192.168.0.10 --device "Home Buttons Kitchen"
+                 --size 64 --size 48 lightbulb fan
+    push_icon.py ... --file my_icon.bmp --name my-icon --size 64
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import struct
+import sys
+import threading
+import zlib
+
+import paho.mqtt.client as mqtt
+
+from gen_builtin_icons import DEFAULT_CACHE, DEFAULT_CONFIG, bmp_to_xbm, \
+    fetch_bmp, read_config
+
+MAGIC = b"HBI1"
+NAME_LEN = 48
+HEADER_FORMAT = "<4s48sHHHIII"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+MQTT_BUFFER_SIZE = 777  # mqtt_helper.h
+MAX_CHUNK_SIZE = 512
+ACK_TIMEOUT = 10  # s
+
+
+def xbm_to_msb(bits):
+    return bytes(int(f"{b:08b}"[::-1], 2) for b in bits)
+
+
+def build_chunks(name, size, width, height, bitmap, topic, single=False):
+    overhead = 5 + 2 + len(topic.encode()) + HEADER_SIZE
+    chunk_size = min(MAX_CHUNK_SIZE, MQTT_BUFFER_SIZE - overhead)
+    if chunk_size <= 0:
+        raise ValueError("topic too long")
+    if single:
+        chunk_size = max(len(bitmap), 1)
+    crc = zlib.crc32(bitmap) & 0xFFFFFFFF
+    for offset in range(0, len(bitmap), chunk_size):
+        header = struct.pack(HEADER_FORMAT, MAGIC, name.encode(), size, width,
+                             height, len(bitmap), offset, crc)
+        yield header + bitmap[offset:offset + chunk_size]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("names", nargs="+", help="MDI icon names")
+    parser.add_argument("--host", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--base-topic", default="homebuttons")
+    parser.add_argument("--device", required=True, help="device name")
+    parser.add_argument("--size", type=int, action="append", required=True)
+    parser.add_argument("--file", help="local BMP instead of MDI source")
+    parser.add_argument("--source", help="local MDI-BMP checkout")
+    parser.add_argument("--single", action="store_true",
+                        help="send each icon as one message")
+    args = parser.parse_args()
+
+    if any(len(name) >= NAME_LEN for name in args.names):
+        parser.error("icon name too long")
+
+    url, _, _ = read_config(DEFAULT_CONFIG)
+    common = f"{args.base_topic}/{args.device}/"
+    cmd_topic = common + "cmd/icon"
+    state_topic = common + "icon"
+
+    ack = threading.Event()
+    result = {}
+
+    def on_message(client, userdata, msg):
+        result["status"] = msg.payload.decode()
+        ack.set()
+
+    client = mqtt.Client()
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.subscribe(state_topic)
+    client.loop_start()
+
+    failed = False
+    for name in args.names:
+        for size in args.size:
+            if args.file:
+                with open(args.file, "rb") as f:
+                    data = f.read()
+            else:
+                data = fetch_bmp(name, size, url, args.source, DEFAULT_CACHE)
+            width, height, bits = bmp_to_xbm(data)
+            bitmap = xbm_to_msb(bits)
+
+            ack.clear()
+            for chunk in build_chunks(name, size, width, height, bitmap,
+                                      cmd_topic, args.single):
+                client.publish(cmd_topic, chunk, qos=1).wait_for_publish()
+            if not ack.wait(ACK_TIMEOUT):
+                print(f"{name} {size}: no response, is the device awake?")
+                failed = True
+            else:
+                print(result["status"])
+                failed |= not result["status"].endswith("OK")
+
+    client.loop_stop()
+    client.disconnect()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
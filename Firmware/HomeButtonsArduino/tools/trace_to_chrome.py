@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+"""Converts a trace dump of a Home Buttons device to Chrome trace JSON.
+
+Tracing must be enabled in the firmware with -DTRACE_ENABLED (see
+src/trace.h). The dump is printed to the serial port before deep sleep, lines
+prefixed with "TRACE ", and published on {BASE_TOPIC}/{DEVICE_NAME}/trace
+when "1" is published to {BASE_TOPIC}/{DEVICE_NAME}/cmd/trace.
+
+Usage:
+    trace_to_chrome.py monitor.log -o trace.json
+    mosquitto_sub -t "homebuttons/Home Buttons/trace" | trace_to_chrome.py -
+
+Open the output in chrome://tracing or https://ui.perfetto.dev.
+"""
+
+import argparse
+import json
+import sys
+
+PHASES = {"B": "B", "E": "E", "I": "i"}
+
+
+def convert(lines):
+    events = []
+    dropped = 0
+    for line in lines:
+        # serial monitor lines may have a prefix, e.g. a timestamp
+        if "TRACE " in line:
+            line = line[line.index("TRACE ") + len("TRACE "):]
+        fields = line.strip().split(maxsplit=3)
+        if not fields:
+            continue
+        if fields[0] == "HBT1" and len(fields) == 2:
+            dropped += int(fields[1])
+        elif fields[0] == "T" and len(fields) == 3:
+            events.append({"name": "thread_name", "ph": "M", "pid": 1,
+                           "tid": int(fields[1]),
+                           "args": {"name": fields[2]}})
+        elif fields[0] in PHASES and len(fields) == 4:
+            event = {"name": fields[3], "ph": PHASES[fields[0]], "pid": 1,
+                     "tid": int(fields[1]), "ts": int(fields[2])}
+            if event["ph"] == "i":
+                event["s"] = "t"
+            events.append(event)
+    return events, dropped
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="dump file, - for stdin")
+    parser.add_argument("-o", "--output", help="JSON file, default stdout")
+    args = parser.parse_args()
+
+    if args.input == "-":
+        lines = sys.stdin.read().splitlines()
+    else:
+        with open(args.input, errors="replace") as f:
+            lines = f.read().splitlines()
+
+    events, dropped = convert(lines)
+    if dropped:
+        print(f"warning: {dropped} events were dropped on the device, "
+              "increase TRACE_TASK_EVENTS", file=sys.stderr)
+    trace = {"traceEvents": events, "displayTimeUnit": "ms"}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())